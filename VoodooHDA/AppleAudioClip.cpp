@@ -36,6 +36,8 @@ class IOMemoryDescriptor;
 #include "VoodooHDADevice.h"
 #include "VoodooHDAEngine.h"
 #include "PCMBlitterLibDispatch.h"
+#include "iSubCrossover.h"
+#include "PCMResampler.h"
 
 extern "C" {
 //	floating point types
@@ -119,436 +121,133 @@ static inline SInt32	SInt32NativeToLittleEndian(SInt32 inValue) { return inValue
 
 #endif
 
-#define	kMaxClipSInt8		0.9921875
-#define kFloat32ToSInt8		((Float32)0x80)
-#define	kMaxClipSInt16		0.9999694824219
-#define kFloat32ToSInt16	((Float32)0x8000)
-#define	kMaxClipSInt24		0.9999998807907
-#define	kMaxClipSInt32		0.9999999995343
-#define kFloat32ToSInt32	((Float64)0x80000000)
+#define kiSubSRCFrames			64		// input frames per pass through the resampler
+#define kiSubSRCBufferSamples	256
 
-inline static Float32 ClipFloat32ForSInt8(Float32 inSample)
+// the low band mixed down in place to the iSub's channels: all of the stream's to a mono iSub, the even and
+// odd ones to the left and right of a stereo one; output sample i is written after the inputs it comes from
+// are read, which are at i or after. For a stereo stream to a mono iSub that's 0.5 * (left + right), as ever
+static bool mixDownToiSub (Float32 *low, UInt32 numSampleFrames, UInt32 numChannels, UInt32 iSubChannels)
 {
-	// Float32 maxClip = kMaxSampleSInt8 / (kMaxSampleSInt8 + 1.0);
-	if(inSample > kMaxClipSInt8) return kMaxClipSInt8;
-	if(inSample < -1.0) return -1.0;
-	return inSample;
-}
-
-inline static Float32 ClipFloat32ForSInt16(Float32 inSample)
-{
-	// Float32 maxClip = kMaxSampleSInt16 / (kMaxSampleSInt16 + 1.0);
-	if(inSample > kMaxClipSInt16) return kMaxClipSInt16;
-	if(inSample < -1.0) return -1.0;
-	return inSample;
-}
-
-inline static Float32 ClipFloat32ForSInt24(Float32 inSample)
-{
-	// Float32 maxClip = kMaxSampleSInt24 / (kMaxSampleSInt24 + 1.0);
-	if(inSample > kMaxClipSInt24) return kMaxClipSInt24;
-	if(inSample < -1.0) return -1.0;
-	return inSample;
-}
-
-inline static Float32 ClipFloat32ForSInt32(Float32 inSample)
-{
-	// Float64 maxClip64 = kMaxSampleSInt32 / (kMaxSampleSInt32 + 1.0);
-	// Float32 maxClip = maxClip64;
-	if(inSample > kMaxClipSInt32) return kMaxClipSInt32;
-	if(inSample < -1.0) return -1.0;
-	return inSample;
-}
-
-//	Float32 -> SInt8
-#if defined(__i386__) || defined(__x86_64__)
-static void	ClipFloat32ToSInt8_4(const Float32* inInputBuffer, SInt8* outOutputBuffer, UInt32 inNumberSamples)
-{
-	register UInt32 theLeftOvers = inNumberSamples % 4;
-	
-	while(inNumberSamples > theLeftOvers)
-	{
-		register Float32 theFloat32Value1 = *(inInputBuffer + 0);
-		register Float32 theFloat32Value2 = *(inInputBuffer + 1);
-		register Float32 theFloat32Value3 = *(inInputBuffer + 2);
-		register Float32 theFloat32Value4 = *(inInputBuffer + 3);
-		
-		inInputBuffer += 4;
-		
-		theFloat32Value1 = ClipFloat32ForSInt8(theFloat32Value1);
-		theFloat32Value2 = ClipFloat32ForSInt8(theFloat32Value2);
-		theFloat32Value3 = ClipFloat32ForSInt8(theFloat32Value3);
-		theFloat32Value4 = ClipFloat32ForSInt8(theFloat32Value4);
-		
-		*(outOutputBuffer + 0) = (SInt8)(theFloat32Value1 * kFloat32ToSInt8);
-		*(outOutputBuffer + 1) = (SInt8)(theFloat32Value2 * kFloat32ToSInt8);
-		*(outOutputBuffer + 2) = (SInt8)(theFloat32Value3 * kFloat32ToSInt8);
-		*(outOutputBuffer + 3) = (SInt8)(theFloat32Value4 * kFloat32ToSInt8);
-		
-		outOutputBuffer += 4;
-		inNumberSamples -= 4;
-	}
-	
-	while(inNumberSamples > 0)
-	{
-		register Float32	theFloat32Value = *inInputBuffer;
-		
-		++inInputBuffer;
-		
-		theFloat32Value = ClipFloat32ForSInt8(theFloat32Value);
-		
-		*outOutputBuffer = (SInt8)(theFloat32Value * kFloat32ToSInt8);
-		
-		++outOutputBuffer;
-		
-		--inNumberSamples;
-	}
+    UInt32	i, c;
+    Float32	sum, scale;
+
+    if ((iSubChannels < 1) || (iSubChannels > 2) || (numChannels < iSubChannels) || (numChannels % iSubChannels))
+        return false;
+    if (numChannels == iSubChannels)
+        return true;
+
+    scale = (Float32) iSubChannels / (Float32) numChannels;
+    for (i = 0; i < numSampleFrames * iSubChannels; i++) {
+        const Float32 *frame = &low[(i / iSubChannels) * numChannels];
+        sum = 0.0f;
+        for (c = i % iSubChannels; c < numChannels; c += iSubChannels)
+            sum += frame[c];
+        low[i] = scale * sum;
+    }
+    return true;
 }
 
-//	Float32 -> SInt16
-static void	ClipFloat32ToSInt16LE_4(const Float32* inInputBuffer, SInt16* outOutputBuffer, UInt32 inNumberSamples)
+// the low band, in the iSub's channels, to the iSub through the polyphase resampler; clipped and converted like
+// the interpolator in clipAppleAudioToOutputStreamiSub does it
+static IOReturn resampleToiSub (PCMResampler *resampler, const Float32 *low, UInt32 numSampleFrames, SInt16 *iSubBufferMemory, UInt32 *loopCount, SInt32 *iSubBufferOffset, UInt32 iSubBufferLen, const iSubAudioFormatType *iSubFormat)
 {
-	register UInt32 theLeftOvers = inNumberSamples % 4;
-
-	while(inNumberSamples > theLeftOvers)
-	{
-		register Float32 theFloat32Value1 = *(inInputBuffer + 0);
-		register Float32 theFloat32Value2 = *(inInputBuffer + 1);
-		register Float32 theFloat32Value3 = *(inInputBuffer + 2);
-		register Float32 theFloat32Value4 = *(inInputBuffer + 3);
-		
-		inInputBuffer += 4;
-		
-		theFloat32Value1 = ClipFloat32ForSInt16(theFloat32Value1);
-		theFloat32Value2 = ClipFloat32ForSInt16(theFloat32Value2);
-		theFloat32Value3 = ClipFloat32ForSInt16(theFloat32Value3);
-		theFloat32Value4 = ClipFloat32ForSInt16(theFloat32Value4);
-		
-		*(outOutputBuffer + 0) = SInt16NativeToLittleEndian((SInt16)(theFloat32Value1 * kFloat32ToSInt16));
-		*(outOutputBuffer + 1) = SInt16NativeToLittleEndian((SInt16)(theFloat32Value2 * kFloat32ToSInt16));
-		*(outOutputBuffer + 2) = SInt16NativeToLittleEndian((SInt16)(theFloat32Value3 * kFloat32ToSInt16));
-		*(outOutputBuffer + 3) = SInt16NativeToLittleEndian((SInt16)(theFloat32Value4 * kFloat32ToSInt16));
-		
-		outOutputBuffer += 4;
-		inNumberSamples -= 4;
-	}
-	
-	while(inNumberSamples > 0)
-	{
-		register Float32	theFloat32Value = *inInputBuffer;
-		
-		++inInputBuffer;
-		
-		theFloat32Value = ClipFloat32ForSInt16(theFloat32Value);
-		
-		*outOutputBuffer = SInt16NativeToLittleEndian((SInt16)(theFloat32Value * kFloat32ToSInt16));
-		
-		++outOutputBuffer;
-		
-		--inNumberSamples;
-	}
-}
+    Float32	out[kiSubSRCBufferSamples];
+    UInt32	iSubChannels = iSubFormat->numChannels;
+    UInt32	done, frames, outSamples, i;
+    SInt32	offset = *iSubBufferOffset;
+    Float32	iSubSampleFloat;
+    SInt16	iSubSampleInt;
 
-// Stereo
-	static void	ClipFloat32ToSInt24LE_8(const Float32* inInputBuffer, SInt32* outOutputBuffer, UInt32 inNumberSamples)
-	{
-		register UInt32 theLeftOvers = inNumberSamples % 8;
-		
-		while(inNumberSamples > theLeftOvers)
-		{
-			register Float32 theFloat32Value11 = *(inInputBuffer + 0);
-			register Float32 theFloat32Value21 = *(inInputBuffer + 2);
-			register Float32 theFloat32Value31 = *(inInputBuffer + 4);
-			register Float32 theFloat32Value41 = *(inInputBuffer + 6);
-			register Float32 theFloat32Value12 = *(inInputBuffer + 1);
-			register Float32 theFloat32Value22 = *(inInputBuffer + 3);
-			register Float32 theFloat32Value32 = *(inInputBuffer + 5);
-			register Float32 theFloat32Value42 = *(inInputBuffer + 7);
-			
-			inInputBuffer += 8;
-			
-			theFloat32Value11 = ClipFloat32ForSInt24(theFloat32Value11);
-			theFloat32Value21 = ClipFloat32ForSInt24(theFloat32Value21);
-			theFloat32Value31 = ClipFloat32ForSInt24(theFloat32Value31);
-			theFloat32Value41 = ClipFloat32ForSInt24(theFloat32Value41);
-			theFloat32Value12 = ClipFloat32ForSInt24(theFloat32Value12);
-			theFloat32Value22 = ClipFloat32ForSInt24(theFloat32Value22);
-			theFloat32Value32 = ClipFloat32ForSInt24(theFloat32Value32);
-			theFloat32Value42 = ClipFloat32ForSInt24(theFloat32Value42);
-			
-			// Multiply by kFloat32ToSInt32 instead of kFloat32toSInt24 to make the binary operations below work properly.
-			register UInt32 a1 = (UInt32)(SInt32)(theFloat32Value11 * kFloat32ToSInt32);
-			register UInt32 b1 = (UInt32)(SInt32)(theFloat32Value21 * kFloat32ToSInt32);
-			register UInt32 c1 = (UInt32)(SInt32)(theFloat32Value31 * kFloat32ToSInt32);
-			register UInt32 d1 = (UInt32)(SInt32)(theFloat32Value41 * kFloat32ToSInt32);
-			register UInt32 a2 = (UInt32)(SInt32)(theFloat32Value12 * kFloat32ToSInt32);
-			register UInt32 b2 = (UInt32)(SInt32)(theFloat32Value22 * kFloat32ToSInt32);
-			register UInt32 c2 = (UInt32)(SInt32)(theFloat32Value32 * kFloat32ToSInt32);
-			register UInt32 d2 = (UInt32)(SInt32)(theFloat32Value42 * kFloat32ToSInt32);
-			//						a    b    c    d					a    b    c    d
-			//	IN REGISTER:		123X 456X 789X ABCX					abc0 def0 ghi0 jkl0
-			//	OUT REGISTERS:		6123 8945 ABC7						fabc hide jklg
-			//	OUT MEMORY:			3216 5498 7CBA
-			
-			register SInt32 theOutputValue11 = ((b1 << 16) & 0xFF000000) | (a1 >> 8);
-			register SInt32 theOutputValue21 = ((c1 << 8) & 0xFFFF0000) | ((b1 >> 16) & 0x0000FFFF);
-			register SInt32 theOutputValue31 = (d1 & 0xFFFFFF00) | ((c1 >> 24) & 0x000000FF);
-			register SInt32 theOutputValue12 = ((b2 << 16) & 0xFF000000) | (a2 >> 8);
-			register SInt32 theOutputValue22 = ((c2 << 8) & 0xFFFF0000) | ((b2 >> 16) & 0x0000FFFF);
-			register SInt32 theOutputValue32 = (d2 & 0xFFFFFF00) | ((c2 >> 24) & 0x000000FF);
-			//	store everything back to memory
-			*(outOutputBuffer + 0) = theOutputValue11;
-			*(outOutputBuffer + 1) = theOutputValue12;
-			*(outOutputBuffer + 2) = theOutputValue21;
-			*(outOutputBuffer + 3) = theOutputValue22;
-			*(outOutputBuffer + 4) = theOutputValue31;
-			*(outOutputBuffer + 5) = theOutputValue32;
-			
-			outOutputBuffer += 6;
-			
-			inNumberSamples -= 8;
-		}
-		
-		SInt8* theOutputBuffer = (SInt8*)outOutputBuffer;
-		while(inNumberSamples > 0)
-		{
-			register Float32 theFloat32Value = *inInputBuffer;
-			++inInputBuffer;
-			
-			theFloat32Value = ClipFloat32ForSInt24(theFloat32Value);
-			
-			// Multiply by kFloat32ToSInt32 instead of kFloat32toSInt24 to make the binary operations below work properly.
-			register SInt32 theSInt32Value = (SInt32)(theFloat32Value * kFloat32ToSInt32);
-			
-			// Byte swapping will be handled automatically by the CPU if necessary.
-			*(theOutputBuffer + 0) = (SInt8)((((UInt32)theSInt32Value) >> 8) & 0x000000FF);
-			*(theOutputBuffer + 1) = (SInt8)((((UInt32)theSInt32Value) >> 16) & 0x000000FF);
-			*(theOutputBuffer + 2) = (SInt8)((((UInt32)theSInt32Value) >> 24) & 0x000000FF);
-			
-			theOutputBuffer += 3;
-			
-			--inNumberSamples;
-		}
-		
-			
-}
-			
-//	Float32 -> SInt24
-//	we use the MaxSInt32 value because of how we munge the data
-#if 0
-static void	ClipFloat32ToSInt24LE_4(const Float32* inInputBuffer, SInt32* outOutputBuffer, UInt32 inNumberSamples)
-{
-	register UInt32 theLeftOvers = inNumberSamples % 4;
-	
-	while(inNumberSamples > theLeftOvers)
-	{
-		register Float32 theFloat32Value1 = *(inInputBuffer + 0);
-		register Float32 theFloat32Value2 = *(inInputBuffer + 1);
-		register Float32 theFloat32Value3 = *(inInputBuffer + 2);
-		register Float32 theFloat32Value4 = *(inInputBuffer + 3);
-		
-		inInputBuffer += 4;
-		
-		theFloat32Value1 = ClipFloat32ForSInt24(theFloat32Value1);
-		theFloat32Value2 = ClipFloat32ForSInt24(theFloat32Value2);
-		theFloat32Value3 = ClipFloat32ForSInt24(theFloat32Value3);
-		theFloat32Value4 = ClipFloat32ForSInt24(theFloat32Value4);
-
-		// Multiply by kFloat32ToSInt32 instead of kFloat32toSInt24 to make the binary operations below work properly.
-		register UInt32 a = (UInt32)(SInt32)(theFloat32Value1 * kFloat32ToSInt32);
-		register UInt32 b = (UInt32)(SInt32)(theFloat32Value2 * kFloat32ToSInt32);
-		register UInt32 c = (UInt32)(SInt32)(theFloat32Value3 * kFloat32ToSInt32);
-		register UInt32 d = (UInt32)(SInt32)(theFloat32Value4 * kFloat32ToSInt32);
-		
-		#if	defined(__ppc__)
-		
-			//						a    b    c    d
-			//	IN REGISTER:		123X 456X 789X ABCX
-			//	OUT REGISTERS:		3216 5498 7CBA
-			//	OUT MEMORY:			3216 5498 7CBA
-
-			//	each sample in the 4 registers looks like this: 123X, where X
-			//	is the unused byte we need to munge all four so that they look
-			//	like this in three registers: 3216 5498 7CBA. We want to avoid
-			//	any non-aligned memory writes if at all possible.
-			
-			register SInt32	theOutputValue1 = ((a << 16) & 0xFF000000) | (a & 0x00FF0000) | ((a >> 16) & 0x0000FF00) | ((b >> 8) & 0x000000FF);	// 3216
-			register SInt32	theOutputValue2 = ((b << 8) & 0xFF000000) | ((b >> 8) & 0x00FF0000) | (c & 0x0000FF00) | ((c >> 16) & 0x000000FF);
-			register SInt32	theOutputValue3 = (c & 0xFF000000) | ((d << 8) & 0x00FF0000) | ((d >> 8) & 0x0000FF00) | ((d >> 24) & 0x000000FF);
-			
-		#elif defined(__i386__) || defined(__x86_64__)
-			//						a    b    c    d					a    b    c    d
-			//	IN REGISTER:		123X 456X 789X ABCX					abc0 def0 ghi0 jkl0
-			//	OUT REGISTERS:		6123 8945 ABC7						fabc hide jklg
-			//	OUT MEMORY:			3216 5498 7CBA
-		
-			register SInt32 theOutputValue1 = ((b << 16) & 0xFF000000) | (a >> 8);
-			register SInt32 theOutputValue2 = ((c << 8) & 0xFFFF0000) | ((b >> 16) & 0x0000FFFF);
-			register SInt32 theOutputValue3 = (d & 0xFFFFFF00) | ((c >> 24) & 0x000000FF);
-		
-		#endif
-		
-		//	store everything back to memory
-		*(outOutputBuffer + 0) = theOutputValue1;
-		*(outOutputBuffer + 1) = theOutputValue2;
-		*(outOutputBuffer + 2) = theOutputValue3;
-	
-		outOutputBuffer += 3;
-		
-		inNumberSamples -= 4;
-	}
-	
-	SInt8* theOutputBuffer = (SInt8*)outOutputBuffer;
-	while(inNumberSamples > 0)
-	{
-		register Float32 theFloat32Value = *inInputBuffer;
-		++inInputBuffer;
-		
-		theFloat32Value = ClipFloat32ForSInt24(theFloat32Value);
-		
-		// Multiply by kFloat32ToSInt32 instead of kFloat32toSInt24 to make the binary operations below work properly.
-		register SInt32 theSInt32Value = (SInt32)(theFloat32Value * kFloat32ToSInt32);
-		
-		// Byte swapping will be handled automatically by the CPU if necessary.
-		*(theOutputBuffer + 0) = (SInt8)((((UInt32)theSInt32Value) >> 8) & 0x000000FF);
-		*(theOutputBuffer + 1) = (SInt8)((((UInt32)theSInt32Value) >> 16) & 0x000000FF);
-		*(theOutputBuffer + 2) = (SInt8)((((UInt32)theSInt32Value) >> 24) & 0x000000FF);
-		
-		theOutputBuffer += 3;
-		
-		--inNumberSamples;
-	}
+    if ((resampler->numChannels() != iSubChannels) ||
+            (resampler->maxOutputFrames(kiSubSRCFrames) * iSubChannels > kiSubSRCBufferSamples))
+        return kIOReturnUnsupported;
+
+    for (done = 0; done < numSampleFrames; done += frames) {
+        frames = numSampleFrames - done;
+        if (frames > kiSubSRCFrames)
+            frames = kiSubSRCFrames;
+        outSamples = resampler->process(&low[done * iSubChannels], frames, out) * iSubChannels;
+        for (i = 0; i < outSamples; i++) {
+            iSubSampleFloat = out[i];
+            if (iSubSampleFloat > 1.0)
+                iSubSampleFloat = 1.0;
+            else if (iSubSampleFloat < -1.0)
+                iSubSampleFloat = -1.0;
+            if (iSubSampleFloat >= 0)
+                iSubSampleInt = (SInt16) (iSubSampleFloat * 32767.0);
+            else
+                iSubSampleInt = (SInt16) (iSubSampleFloat * 32768.0);
+
+            if (offset >= (SInt32)iSubBufferLen) {
+                offset = 0;
+                (*loopCount)++;
+            }
+            iSubBufferMemory[offset++] = OSSwapLittleToHostInt16(iSubSampleInt);
+        }
+    }
+    *iSubBufferOffset = offset;
+    return kIOReturnSuccess;
 }
-#endif
-//	Float32 -> SInt32
-static void	ClipFloat32ToSInt32LE_4(const Float32* inInputBuffer, SInt32* outOutputBuffer, UInt32 inNumberSamples)
-{
-	register UInt32 theLeftOvers = inNumberSamples % 4;
-	
-	while(inNumberSamples > theLeftOvers)
-	{
-		register Float32 theFloat32Value1 = *(inInputBuffer + 0);
-		register Float32 theFloat32Value2 = *(inInputBuffer + 1);
-		register Float32 theFloat32Value3 = *(inInputBuffer + 2);
-		register Float32 theFloat32Value4 = *(inInputBuffer + 3);
-		
-		inInputBuffer += 4;
-		
-		theFloat32Value1 = ClipFloat32ForSInt32(theFloat32Value1);
-		theFloat32Value2 = ClipFloat32ForSInt32(theFloat32Value2);
-		theFloat32Value3 = ClipFloat32ForSInt32(theFloat32Value3);
-		theFloat32Value4 = ClipFloat32ForSInt32(theFloat32Value4);
-		
-		*(outOutputBuffer + 0) = SInt32NativeToLittleEndian((SInt32)(theFloat32Value1 * kFloat32ToSInt32));
-		*(outOutputBuffer + 1) = SInt32NativeToLittleEndian((SInt32)(theFloat32Value2 * kFloat32ToSInt32));
-		*(outOutputBuffer + 2) = SInt32NativeToLittleEndian((SInt32)(theFloat32Value3 * kFloat32ToSInt32));
-		*(outOutputBuffer + 3) = SInt32NativeToLittleEndian((SInt32)(theFloat32Value4 * kFloat32ToSInt32));
-		
-		outOutputBuffer += 4;
-		inNumberSamples -= 4;
-	}
-	
-	while(inNumberSamples > 0)
-	{
-		register Float32 theFloat32Value = *inInputBuffer;
-		++inInputBuffer;
-		
-		theFloat32Value = ClipFloat32ForSInt32(theFloat32Value);
 
-		*outOutputBuffer = SInt32NativeToLittleEndian((SInt32)(theFloat32Value * kFloat32ToSInt32));
-		
-		++outOutputBuffer;
-		
-		--inNumberSamples;
-	}
-}
-#endif
 // aml 2.21.02 added second filter state for 4th order filter
 // aml 2.21.02 added more filter state for phase compensator
 // aml 3.4.02 added srcPhase
-IOReturn clipAppleAudioToOutputStreamiSub (const void *mixBuf, void *sampleBuf, __unused PreviousValues * filterState, __unused PreviousValues * filterState2, __unused PreviousValues * phaseCompState, Float32 *low, Float32 *high, UInt32 firstSampleFrame, UInt32 numSampleFrames, UInt32 sampleRate, const IOAudioStreamFormat *streamFormat, SInt16 *iSubBufferMemory, UInt32 *loopCount, SInt32 *iSubBufferOffset, UInt32 iSubBufferLen, iSubAudioFormatType* iSubFormat, float* srcPhase, float* srcState)
+// mixBuf: the first frame to clip; low and high: room for numSampleFrames frames, and the high band is left in
+// high for the caller to send on to the codec
+// crossover: set up for sampleRate and the stream's channels, up to kiSubMaxChannels, with the filter state of
+// each channel carried over from the last call
+// resampler: set up for sampleRate -> iSubFormat->outputSampleRate, or NULL or idle for the linear interpolator;
+// at kPCMResamplerQualityLinear it costs no more than the interpolator, the filtered qualities are opt-in
+IOReturn clipAppleAudioToOutputStreamiSub (const Float32 *mixBuf, iSubCrossover *crossover, Float32 *low, Float32 *high, UInt32 numSampleFrames, UInt32 sampleRate, const IOAudioStreamFormat *streamFormat, SInt16 *iSubBufferMemory, UInt32 *loopCount, SInt32 *iSubBufferOffset, UInt32 iSubBufferLen, const iSubAudioFormatType* iSubFormat, float* srcPhase, float* srcState, PCMResampler *resampler)
 {
+    UInt32	numChannels = streamFormat->fNumChannels;
+    UInt32	iSubChannels = iSubFormat->numChannels;
     UInt32	sampleIndex, maxSampleIndex;
-    float 	*floatMixBuf;
-    SInt16 	*outputBuf;
-    float 	highSample;
     Float32	iSubSampleFloat;
     SInt16	iSubSampleInt;
 
     // aml 3.6.02 storage for src
-    float 	x0, x1, temp;
+    float 	x0, x1;
 
     // aml 3.6.02 src variables - should calculate phaseInc somewhere else, change only if the SR changes
     float 	phaseInc = ((float)sampleRate)/((float)(iSubFormat->outputSampleRate));	// phase increment = Fs_in/Fs_out
     float 	phase = *srcPhase;							// current phase location
 
-    floatMixBuf = (float *)mixBuf;
-    outputBuf = (SInt16 *)sampleBuf;
+    if (numSampleFrames == 0)
+        return kIOReturnSuccess;
 
-    maxSampleIndex = (firstSampleFrame + numSampleFrames) * (streamFormat->fNumChannels);
+    // Filter out the highs and lows for use with the iSub: all channels in one pass, with the state carried
+    // over from the last buffer
+    if (crossover->numChannels() != numChannels)
+        return kIOReturnUnsupported;
+    crossover->process(mixBuf, low, high, numSampleFrames);
 
-	// Filter out the highs and lows for use with the iSub
-	if (1 == streamFormat->fNumChannels) 
-	{
-		MonoFilter (&floatMixBuf[firstSampleFrame * streamFormat->fNumChannels], &low[firstSampleFrame * streamFormat->fNumChannels], &high[firstSampleFrame * streamFormat->fNumChannels], numSampleFrames, 960000);
-	} 
-	else if (2 == streamFormat->fNumChannels) 
-	{
-		// aml 2.21.02 changed to 4th order version
-		// aml 2.21.02 changed to 4th order version with phase compensation
-        StereoFilter (&floatMixBuf[firstSampleFrame * streamFormat->fNumChannels], &low[firstSampleFrame * streamFormat->fNumChannels], &high[firstSampleFrame * streamFormat->fNumChannels], numSampleFrames, 960000, NULL);
-    }
+    // aml 3.01.02 adding num channels check. 
+    if (!mixDownToiSub(low, numSampleFrames, numChannels, iSubChannels))
+        return kIOReturnUnsupported;
 
-	// Non iSub Audio
-    for (sampleIndex = (firstSampleFrame * streamFormat->fNumChannels); sampleIndex < maxSampleIndex; sampleIndex++) 
-	{
-            highSample = high[sampleIndex];
-            if (highSample > 1.0) 
-			{
-                    highSample = 1.0;
-            } 
-			else if (highSample < -1.0) 
-			{
-                    highSample = -1.0;
-            }
+    if (resampler && resampler->isActive())
+        return resampleToiSub (resampler, low, numSampleFrames, iSubBufferMemory, loopCount, iSubBufferOffset, iSubBufferLen, iSubFormat);
 
-           outputBuf[sampleIndex] = OSSwapHostToLittleInt16 ((SInt16)(highSample * 32767.0));
-		   // outputBuf[sampleIndex] = OSSwapHostToLittleInt16 ((SInt16)(highSample * 32768.0));
-    }
-    
-    // aml 3.01.02 adding num channels check. 
-    if ((iSubFormat->numChannels == 1) && (streamFormat->fNumChannels == 2)) 
+    if ((iSubChannels == 1) && (numChannels > 1)) 
 	{
         // aml 3.6.02 linear interpolation src (takes the edge off the zoh version, without wasting too many 
         // cycles since we have a 4th order lp in front of us, down -90 dB at Nyquist for 6kHz sample rate)
-        // STEREO->MONO
-        sampleIndex = (firstSampleFrame * streamFormat->fNumChannels);
-        while (sampleIndex < maxSampleIndex) 
+        // the mono mix of all channels
+        sampleIndex = 0;
+        while (sampleIndex < numSampleFrames) 
 		{
             if (phase >= 1.0) 
 			{	
                 phase -= 1.0;
-                sampleIndex+=2;
+                sampleIndex++;
             } 
 			else 
 			{   
                 // check for beginning of frame case, use saved last sample if needed
-                if (sampleIndex == (firstSampleFrame * streamFormat->fNumChannels)) 
-				{ 
-                    x0 = *srcState;
-                } 
-				else 
-				{
-                    // mix x[n-1] to mono
-                    x0 = low[sampleIndex-2];
-                    temp = low[sampleIndex-1];
-                    x0 = 0.5*(x0 + temp);
-                }
-                
-                // mix x[n] to mono
+                x0 = sampleIndex ? low[sampleIndex - 1] : *srcState;
                 x1 = low[sampleIndex];
-                temp = low[sampleIndex+1];
-                x1 = 0.5*(x1 + temp);
                                 
                 // linearly interpolate between x0 and x1
                 iSubSampleFloat = x0 + phase*(x1 - x0);
@@ -587,24 +286,16 @@ IOReturn clipAppleAudioToOutputStreamiSub (const void *mixBuf, void *sampleBuf,
                 phase += phaseInc;		
             }
 	}
-        if (phase < 1) 
-		{
-            // mix and save last sample in buffer to mono if it will be needed for the next loop
-            x1 = low[maxSampleIndex-2];
-            temp = low[maxSampleIndex-1];
-            *srcState = 0.5*(x1 + temp);
-        } 
-		else 
-		{
-            *srcState = 0;
-        }
+        // save the last sample in buffer if it will be needed for the next loop
+        *srcState = (phase < 1) ? low[numSampleFrames - 1] : 0;
         // cache current phase for use next time we enter the clip loop
        *srcPhase = phase;
     } 
 	else 
 	{
         // STEREO->STEREO, MONO->MONO
-	for (sampleIndex = (firstSampleFrame * streamFormat->fNumChannels); sampleIndex < maxSampleIndex; sampleIndex++) 
+	maxSampleIndex = numSampleFrames * iSubChannels;
+	for (sampleIndex = 0; sampleIndex < maxSampleIndex; sampleIndex++)
 	{
             iSubSampleFloat = low[sampleIndex];
             if (iSubSampleFloat > 1.0) 
@@ -964,6 +655,48 @@ End:
 }
 }
 
+// the coefficient tables above, in the form iSubCrossover takes them
+bool iSubCrossoverCoeffsForRate(iSubCrossoverCoeffs *coeffs, UInt32 sampleRate, UInt32 order, bool phaseComp)
+{
+	Float32	c[5];
+	iSubBiquad	*lp = &coeffs->lowpass, *ap = &coeffs->allpass;
+
+	coeffs->sampleRate = sampleRate;
+	coeffs->frequency = (order == 2) ? kiSubCrossoverFrequency2ndOrder : kiSubCrossoverFrequency4thOrder;
+	coeffs->phaseComp = phaseComp;
+	// a1 and a2 stay 0 for the first order allpass of the 2nd order crossover
+	ap->b0 = ap->b1 = ap->b2 = ap->a1 = ap->a2 = 0.0;
+	if (order == 2) {
+		coeffs->numSections = 1;
+#if FLOATLIB
+		CoeffsFilterOrder2 (c, 120, 1/sqrt(2), sampleRate);
+#else
+		if (!CoeffsFilterOrder2Table (c, sampleRate))
+			return false;
+#endif
+		lp->b0 = c[0];
+		lp->b1 = c[1];
+		lp->b2 = c[2];
+		lp->a1 = c[3];
+		lp->a2 = c[4];
+		// y = b0*x + x[n-1] - a1*y[n-1]
+		if (phaseComp && !Set2ndOrderPhaseCompCoefficients (&ap->b0, &ap->a1, sampleRate))
+			return false;
+		ap->b1 = 1.0;
+	} else if (order == 4) {
+		coeffs->numSections = 2;
+		if (!Set4thOrderCoefficients (&lp->b0, &lp->b1, &lp->b2, &lp->a1, &lp->a2, sampleRate))
+			return false;
+		// y = b0*x + b1*x[n-1] + x[n-2] - a1*y[n-1] - a2*y[n-2]
+		if (phaseComp && !Set4thOrderPhaseCompCoefficients (&ap->b0, &ap->b1, &ap->a1, &ap->a2, sampleRate))
+			return false;
+		ap->b2 = 1.0;
+	} else {
+		return false;
+	}
+	return true;
+}
+
 
 // aml 2.15.02, stereo filter that runs twice for double the rolloff
 // tried to make this more efficient and readable that previous filter
@@ -1231,7 +964,7 @@ void StereoFilter4thOrderPhaseComp (Float32 *in, Float32 *low, Float32 *high, UI
 }
 
 // aml new routines [3034710]
-#pragma mark ••• New clipping routines
+#pragma mark --- New clipping routines
 #if	defined(__ppc__)
 
 // this behaves incorrectly in Float32ToSwapInt24 if not declared volatile
@@ -3752,171 +3485,215 @@ IOReturn VoodooHDAEngine::clipOutputSamples(const void *mixBuf, void *sampleBuf,
 	{
         return kIOReturnBadArgument;
     }
+	UInt32 firstSample = firstSampleFrame * streamFormat->fNumChannels;
+	const Float32 *floatMixBuf = ((const Float32*)mixBuf) + firstSample;
+
+	// figure out what sort of blit we need to do
+	if ((streamFormat->fSampleFormat == kIOAudioStreamSampleFormatLinearPCM) && streamFormat->fIsMixable) {
+		// it's mixable linear PCM, which means we will be calling a blitter, which works in samples
+		// not frames; at a rate the codec doesn't have, through the resampler first, and with an iSub
+		// through the crossover before that
+		if (mChannel->isub.buffer && mChannel->isub.sampleRate)
+			return clipiSubOutputSamples(floatMixBuf, sampleBuf, firstSampleFrame, numSampleFrames, streamFormat);
+		if (mChannel->src.engineRate)
+			return resampleOutputSamples(floatMixBuf, sampleBuf, firstSampleFrame, numSampleFrames, streamFormat);
+		return blitOutputSamples(floatMixBuf, sampleBuf, firstSampleFrame, numSampleFrames, streamFormat);
+	} else {
+		// it's not linear PCM or it's not mixable, so just copy the data into the target buffer
+		UInt32 offset = firstSampleFrame * (streamFormat->fBitWidth / 8) * streamFormat->fNumChannels;
+		UInt32 size = numSampleFrames * (streamFormat->fBitWidth / 8) * streamFormat->fNumChannels;
+//        memcpy(&((SInt8 *) sampleBuf)[offset], &((SInt8 *) mixBuf)[offset], size);
+        memcpy((UInt8 *)sampleBuf + offset, (UInt8 *)mixBuf, size);
+	}
+	
+	return kIOReturnSuccess;
+}
+
+// mixable linear PCM from floatMixBuf, which points at the first frame, to numSampleFrames of sampleBuf
+// starting at firstSampleFrame
+IOReturn VoodooHDAEngine::blitOutputSamples(const Float32 *floatMixBuf, void *sampleBuf, UInt32 firstSampleFrame,
+											UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat)
+{
 	UInt32 firstSample = firstSampleFrame * streamFormat->fNumChannels;
 	UInt32 numSamples = numSampleFrames * streamFormat->fNumChannels;
-	int lastSample = firstSample + numSamples;
-	Float32 *floatMixBuf = ((Float32*)mixBuf) + firstSample;
-	Float32 *floatMixBuf2 = ((Float32*)mixBuf); // + firstSample;
-	//Float32 *floatMixBufOld; must be global
 	SInt16 *theOutputBufferSInt16;
 	SInt8  *theOutputBufferSInt8;
 	UInt8* theOutputBufferSInt24;
 	SInt32* theOutputBufferSInt32;
-	long int noiseMask = ~((long int)(1 << mChannel->noiseLevel) - 1);
+	PCMOutputProcessing proc;
+	PCMOutputProcessing procUnmasked;
 #ifndef TIGER	
 	bool SSE2 = mChannel->vectorize;
-	UInt8 *sourceBuf = (UInt8 *) sampleBuf;
+#else
+	bool SSE2 = false;
 #endif	
 	bool Stereo = mChannel->useStereo;
 	int base = mChannel->StereoBase; 
 	if (base) base = mChannel->StereoBase * 2 - 14;
-	if (Stereo && base) {
-		if (base > 0) {
-			//Slice: It is interesting but with artefacts so disabled
-			/*
-			for (int i=firstSample; i<lastSample; i+=2) {
-				int j = i - base*2;
-				if (j < 0) {
-					if (!emptyStream) {
-						floatMixBuf2[i] += floatMixBufOld[i+1]/2.0;
-						floatMixBuf2[i+1] += floatMixBufOld[i]/2.0;
-					} else {
-						floatMixBuf2[i] += floatMixBuf2[i+1]/2.0;
-						floatMixBuf2[i+1] += floatMixBuf2[i]/2.0;						
-					}
-
-				} else {
-					floatMixBuf2[i] += floatMixBuf2[j+1]/2.0;
-					floatMixBuf2[i+1] += floatMixBuf2[j]/2.0;
-				}
-			}
-			 */
-			//Simple mixer
-			for (int i=firstSample; i<lastSample; i+=2) {
-				floatMixBuf2[i] += (floatMixBuf2[i+1]/10.0) * base;
-				floatMixBuf2[i+1] += (floatMixBuf2[i]/10.0) * base;						
-			}			
+
+	/*
+	 * Boost, the stereo crossfeed and the noise mask used to be separate passes, the first two
+	 * writing back into the mix buffer. They are now folded into the blit, which reads the mix once
+	 * and never modifies it. Crossfeed mixes each L/R pair as
+	 *		L += R * |base| / 10;  R += L * |base| / 10;
+	 * which is what both branches of the old loop did, and only makes sense for an even channel count.
+	 * Without Vectorize the same processing runs through the portable kernels. The noise mask is only
+	 * applied where the old pass applied it, to native endian 16 and 32-bit output.
+	 */
+	proc.gain = Boost ? (Float32) Boost : 1.0f;
+	proc.crossfeed = 0.0f;
+	if (Stereo && base && !(streamFormat->fNumChannels & 1))
+		proc.crossfeed = ((base > 0) ? base : -base) / 10.0f;
+	proc.noiseMask = ~((1 << mChannel->noiseLevel) - 1);
+	procUnmasked = proc;
+	procUnmasked.noiseMask = ~0;
+
+	if (streamFormat->fNumericRepresentation == kIOAudioStreamNumericRepresentationSignedInt) {
+		// it's some kind of signed integer, which we handle as some kind of even byte length
+		bool nativeEndianInts;
+		nativeEndianInts = (streamFormat->fByteOrder == kIOAudioStreamByteOrderLittleEndian);
+		
+		switch (streamFormat->fBitWidth) {
+			case 8:
+				theOutputBufferSInt8 = ((SInt8*)sampleBuf) + firstSample;
+				Float32ToInt8Processed(floatMixBuf, theOutputBufferSInt8, numSamples, &procUnmasked);
+				break;
+				
+			case 16:
+				theOutputBufferSInt16 = ((SInt16*)sampleBuf) + firstSample;
+				if (nativeEndianInts)
+					Float32ToNativeInt16Processed(floatMixBuf, theOutputBufferSInt16, numSamples, &proc, SSE2);
+				else
+					Float32ToSwapInt16Processed(floatMixBuf, theOutputBufferSInt16, numSamples, &procUnmasked, SSE2);
+				break;
+				
+			case 20:
+			case 24:
+				theOutputBufferSInt24 = ((UInt8*)sampleBuf) + (firstSample * 3);
+				if (nativeEndianInts)
+					Float32ToNativeInt24Processed(floatMixBuf, theOutputBufferSInt24, numSamples, &procUnmasked, SSE2);
+				else
+					Float32ToSwapInt24Processed(floatMixBuf, theOutputBufferSInt24, numSamples, &procUnmasked, SSE2);
+				break;
+				
+			case 32:
+				theOutputBufferSInt32 = ((SInt32*)sampleBuf) + firstSample;
+				if (nativeEndianInts)
+					Float32ToNativeInt32Processed(floatMixBuf, theOutputBufferSInt32, numSamples, &proc, SSE2);
+				else
+					Float32ToSwapInt32Processed(floatMixBuf, theOutputBufferSInt32, numSamples, &procUnmasked,
+							SSE2);
+				break;
+				
+			default:
+				IOLog("clipOutputSamples: can't handle signed integers with a bit width of %d",
+						 streamFormat->fBitWidth);
+				break;
+				
+		}
+	} else if (streamFormat->fNumericRepresentation == kIOAudioStreamNumericRepresentationIEEE754Float) {
+		// it is some kind of floating point format
+		if ((streamFormat->fBitWidth == 32) && (streamFormat->fBitDepth == 32) &&
+			(streamFormat->fByteOrder == kIOAudioStreamByteOrderLittleEndian)) {
+			// it's Float32, so we only need Boost and crossfeed on the way
+			ProcessFloat32(floatMixBuf, &((Float32 *) sampleBuf)[firstSample], numSamples, &procUnmasked);
 		} else
-			for (int i=0; i<(int)numSamples; i+=2) {
-				floatMixBuf[i] -= (floatMixBuf[i+1]/10.0) * base;
-				floatMixBuf[i+1] -= (floatMixBuf[i]/10.0) * base;
-			}			
+			IOLog("clipOutputSamples: can't handle floats with a bit width of %d, bit depth of %d, "
+					 "and/or the given byte order", streamFormat->fBitWidth, streamFormat->fBitDepth);
 	}
-	if (Boost) {
-		for (int i=firstSample; i<lastSample; i++) {
-			floatMixBuf2[i] *= Boost;
-		}
+	
+	return kIOReturnSuccess;
+}
+
+// With an iSub attached the mix is split by the crossover HDA_ISUB_CHUNK_FRAMES at a time: the low band goes to
+// the iSub, the high band on to the codec the way the mix would have gone
+IOReturn VoodooHDAEngine::clipiSubOutputSamples(const Float32 *floatMixBuf, void *sampleBuf, UInt32 firstSampleFrame,
+												UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat)
+{
+	ChanneliSub *isub = &mChannel->isub;
+	UInt32 numChannels = streamFormat->fNumChannels;
+	UInt32 done, frames;
+	IOReturn result = kIOReturnSuccess;
+
+	for (done = 0; done < numSampleFrames; done += frames) {
+		frames = numSampleFrames - done;
+		if (frames > HDA_ISUB_CHUNK_FRAMES)
+			frames = HDA_ISUB_CHUNK_FRAMES;
+		result = clipAppleAudioToOutputStreamiSub(floatMixBuf + done * numChannels, &isub->crossover, isub->low,
+				isub->high, frames, isub->sampleRate, streamFormat, isub->buffer, &isub->loopCount, &isub->offset,
+				isub->bufferLen, &isub->format, &isub->srcPhase, &isub->srcState, &isub->resampler);
+		if (result != kIOReturnSuccess)
+			break;
+		if (mChannel->src.engineRate)
+			result = resampleOutputSamples(isub->high, sampleBuf, firstSampleFrame + done, frames, streamFormat);
+		else
+			result = blitOutputSamples(isub->high, sampleBuf, firstSampleFrame + done, frames, streamFormat);
+		if (result != kIOReturnSuccess)
+			break;
 	}
-	floatMixBufOld = floatMixBuf2 + numSamples - base * 2;
-	emptyStream = FALSE;
+	return result;
+}
 
-	// figure out what sort of blit we need to do
-	if ((streamFormat->fSampleFormat == kIOAudioStreamSampleFormatLinearPCM) && streamFormat->fIsMixable) {
-		// it's mixable linear PCM, which means we will be calling a blitter, which works in samples
-		// not frames
-		
-		if (streamFormat->fNumericRepresentation == kIOAudioStreamNumericRepresentationSignedInt) {
-			// it's some kind of signed integer, which we handle as some kind of even byte length
-			bool nativeEndianInts;
-			nativeEndianInts = (streamFormat->fByteOrder == kIOAudioStreamByteOrderLittleEndian);
-			
-			switch (streamFormat->fBitWidth) {
-				case 8:
-					theOutputBufferSInt8 = ((SInt8*)sampleBuf) + firstSample;				
-						ClipFloat32ToSInt8_4(floatMixBuf, theOutputBufferSInt8, numSamples);
-					break;
-					
-				case 16:
-					theOutputBufferSInt16 = ((SInt16*)sampleBuf) + firstSample;
-					if (nativeEndianInts) {
-#ifndef TIGER						
-						if (SSE2) {
-							Float32ToNativeInt16(floatMixBuf, theOutputBufferSInt16, numSamples);
-							for (int i=0; i<(int)numSamples; i++) {
-								theOutputBufferSInt16[i] &= noiseMask;
-							}
-							
-						} else
-#endif							
-						{
-							ClipFloat32ToSInt16LE_4(floatMixBuf, theOutputBufferSInt16, numSamples);
-						}
-					}
-#ifndef TIGER						
-					else
-						Float32ToSwapInt16(floatMixBuf, theOutputBufferSInt16, numSamples);
-#endif					
-					break;
-					
-				case 20:
-				case 24:
-					
-					theOutputBufferSInt24 = ((UInt8*)sampleBuf) + (firstSample * 3);
-					if (nativeEndianInts) {
-#ifndef TIGER						
-						if (SSE2) {
-							Float32ToNativeInt24(floatMixBuf, theOutputBufferSInt24, numSamples);
-						} else 
-#endif							
-						{
-							ClipFloat32ToSInt24LE_8(floatMixBuf, (SInt32*)theOutputBufferSInt24, numSamples);		
-						}
-					}
-#ifndef TIGER						
-					else
-						Float32ToSwapInt24(floatMixBuf, theOutputBufferSInt24, numSamples);
-#endif
-					break;
-					
-				case 32:
-					theOutputBufferSInt32 = ((SInt32*)sampleBuf) + firstSample;
-					if (nativeEndianInts) {
-#ifndef TIGER						
-						if (SSE2) {
-							Float32ToNativeInt32(floatMixBuf, theOutputBufferSInt32, numSamples);
-							for (int i=0; i<(int)numSamples; i++) {
-								theOutputBufferSInt32[i] &= noiseMask;
-							}
-							
-						} else
-#endif						
-						{					
-							ClipFloat32ToSInt32LE_4(floatMixBuf, theOutputBufferSInt32, numSamples);
-						}
-						
-					}
-#ifndef TIGER						
-					else
-						Float32ToSwapInt32(floatMixBuf, (SInt32 *) &sourceBuf[4 * firstSample],
-										   numSamples);
-#endif					
-					break;
-					
-				default:
-					IOLog("clipOutputSamples: can't handle signed integers with a bit width of %d",
-							 streamFormat->fBitWidth);
-					break;
-					
-			}
-		} else if (streamFormat->fNumericRepresentation == kIOAudioStreamNumericRepresentationIEEE754Float) {
-			// it is some kind of floating point format
-			if ((streamFormat->fBitWidth == 32) && (streamFormat->fBitDepth == 32) &&
-				(streamFormat->fByteOrder == kIOAudioStreamByteOrderLittleEndian)) {
-				// it's Float32, so we are just going to copy the data
-				memcpy(&((Float32 *) sampleBuf)[firstSample], &floatMixBuf[firstSample],
-					   numSamples * sizeof (Float32));
-			} else
-				IOLog("clipOutputSamples: can't handle floats with a bit width of %d, bit depth of %d, "
-						 "and/or the given byte order", streamFormat->fBitWidth, streamFormat->fBitDepth);
+// At a rate the codec doesn't have, the mix goes through the channel's resampler HDA_SRC_CHUNK_FRAMES at a
+// time, and what comes out is blitted to the DMA buffer at the codec's rate from src.writeFrame on. A clip
+// that doesn't pick up where the last one ended (the engine was restarted, or fell behind) starts the
+// resampler afresh at the codec frame that goes with firstSampleFrame.
+IOReturn VoodooHDAEngine::resampleOutputSamples(const Float32 *floatMixBuf, void *sampleBuf, UInt32 firstSampleFrame,
+												UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat)
+{
+	ChannelSRC *src = &mChannel->src;
+	UInt32 numChannels = streamFormat->fNumChannels;
+	Float32 *out = src->out;
+	UInt32 done, frames, outFrames, pos, count;
+
+	if (numChannels != src->resampler.numChannels())
+		return kIOReturnBadArgument;
+	if (firstSampleFrame != src->nextFrame) {
+		src->resampler.reset();
+		src->writeFrame = (UInt32) (((UInt64) firstSampleFrame * src->hwFrames) / src->engineFrames);
+	}
+
+	for (done = 0; done < numSampleFrames; done += frames) {
+		frames = numSampleFrames - done;
+		if (frames > HDA_SRC_CHUNK_FRAMES)
+			frames = HDA_SRC_CHUNK_FRAMES;
+		outFrames = src->resampler.process(floatMixBuf + done * numChannels, frames, out);
+		for (pos = 0; pos < outFrames; pos += count) {
+			count = outFrames - pos;
+			if (count > src->hwFrames - src->writeFrame)
+				count = src->hwFrames - src->writeFrame;
+			blitOutputSamples(out + pos * numChannels, sampleBuf, src->writeFrame, count, streamFormat);
+			src->writeFrame += count;
+			if (src->writeFrame == src->hwFrames)
+				src->writeFrame = 0;
 		}
-	} else {
-		// it's not linear PCM or it's not mixable, so just copy the data into the target buffer
-		UInt32 offset = firstSampleFrame * (streamFormat->fBitWidth / 8) * streamFormat->fNumChannels;
-		UInt32 size = numSampleFrames * (streamFormat->fBitWidth / 8) * streamFormat->fNumChannels;
-//        memcpy(&((SInt8 *) sampleBuf)[offset], &((SInt8 *) mixBuf)[offset], size);
-        memcpy((UInt8 *)sampleBuf + offset, (UInt8 *)mixBuf, size);
 	}
-	
+
+	src->nextFrame = firstSampleFrame + numSampleFrames;
+	if (src->nextFrame >= src->engineFrames)
+		src->nextFrame -= src->engineFrames;
+	return kIOReturnSuccess;
+}
+
+// the erase head goes by engine frames; at a converted rate the DMA buffer is in codec frames, so the span it
+// clears there is scaled like the position in getCurrentSampleFrame
+IOReturn VoodooHDAEngine::eraseOutputSamples(const void *mixBuf, void *sampleBuf, UInt32 firstSampleFrame,
+											 UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat,
+											 IOAudioStream *audioStream)
+{
+	ChannelSRC *src = &mChannel->src;
+	UInt32 first, end, frameSize;
+
+	if (!src->engineRate || !sampleBuf || !streamFormat)
+		return IOAudioEngine::eraseOutputSamples(mixBuf, sampleBuf, firstSampleFrame, numSampleFrames, streamFormat,
+				audioStream);
+
+	IOAudioEngine::eraseOutputSamples(mixBuf, NULL, firstSampleFrame, numSampleFrames, streamFormat, audioStream);
+	first = (UInt32) (((UInt64) firstSampleFrame * src->hwFrames) / src->engineFrames);
+	end = (UInt32) (((UInt64) (firstSampleFrame + numSampleFrames) * src->hwFrames) / src->engineFrames);
+	frameSize = streamFormat->fNumChannels * (streamFormat->fBitWidth / 8);
+	if (end > first)
+		bzero((UInt8 *) sampleBuf + first * frameSize, (end - first) * frameSize);
 	return kIOReturnSuccess;
 }
 
@@ -3924,21 +3701,47 @@ IOReturn VoodooHDAEngine::convertInputSamples(const void *sampleBuf, void *destB
 											  UInt32 firstSampleFrame, UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat,
 											  __unused IOAudioStream *audioStream)
 {
-	UInt32	numSamplesLeft, numSamples;
-	float 	*floatDestBuf;
+	UInt32	numSamples;
+	UInt32	numChannels = streamFormat->fNumChannels;
 	
-    floatDestBuf = (float *)destBuf;
-	UInt32 firstSample = firstSampleFrame * streamFormat->fNumChannels;
-	numSamples = numSamplesLeft = numSampleFrames * streamFormat->fNumChannels;
-	long int noiseMask = ~((long int)(1 << mChannel->noiseLevel) - 1);
+	UInt32 firstSample = firstSampleFrame * numChannels;
+	numSamples = numSampleFrames * numChannels;
 	
-	SInt8 *inputBuf8;
-	SInt16 *inputBuf16;
+	const SInt8 *inputBuf8;
+	const SInt16 *inputBuf16;
 	const UInt8 *inputBuf24;
-	SInt32 *inputBuf32;
+	const SInt32 *inputBuf32;
 #ifndef TIGER	
 	bool SSE2 = mChannel->vectorize;
+#else
+	bool SSE2 = false;
 #endif	
+	PCMInputProcessing proc;
+	UInt8 channelMap[MAX_INPUT_MAP];
+	
+	/*
+	 * Noise mask, channel map and InputBoost are applied while converting, in one read of the DMA
+	 * buffer (which is no longer masked in place) and one write of destBuf, and the same way with and
+	 * without Vectorize. The channel map generalizes SwitchCh, which is the map (1, 0).
+	 */
+	proc.gain = InputBoost ? (Float32) InputBoost : 1.0f;
+	proc.noiseMask = ~((1 << mChannel->noiseLevel) - 1);
+	proc.numChannels = numChannels;
+	proc.channelMap = NULL;
+	if (mDevice && (numChannels > 1) && (numChannels <= MAX_INPUT_MAP)) {
+		for (UInt32 c = 0; c < numChannels; c++) {
+			channelMap[c] = c;
+			if (c < mDevice->mInputChannelMapSize) {
+				if (mDevice->mInputChannelMap[c] < numChannels)
+					channelMap[c] = mDevice->mInputChannelMap[c];
+			} else if (mDevice->mSwitchCh && !mDevice->mInputChannelMapSize && (c < 2)) {
+				//Меняю местами значения для левого и правого канала
+				channelMap[c] = 1 - c;
+			}
+			if (channelMap[c] != c)
+				proc.channelMap = channelMap;
+		}
+	}
 	
 	// figure out what sort of blit we need to do
 	if ((streamFormat->fSampleFormat == kIOAudioStreamSampleFormatLinearPCM) && streamFormat->fIsMixable) {
@@ -3953,87 +3756,33 @@ IOReturn VoodooHDAEngine::convertInputSamples(const void *sampleBuf, void *destB
 			
 			switch (streamFormat->fBitWidth) {
 				case 8:
-					inputBuf8  = &(((SInt8 *)sampleBuf)[firstSample]);
-					while (numSamplesLeft-- > 0) 
-					{	
-						*(floatDestBuf++) = (float)(*(inputBuf8++) &= (SInt8)noiseMask) * kOneOverMaxSInt8Value;
-					}
+					inputBuf8  = &(((const SInt8 *)sampleBuf)[firstSample]);
+					Int8ToFloat32Processed(inputBuf8, floatDestBuf, numSamples, &proc);
 					break;
 				case 16:
-					inputBuf16 = &(((SInt16 *)sampleBuf)[firstSample]);
-					if (nativeEndianInts) {
-#ifndef TIGER						
-						if (SSE2) {
-							NativeInt16ToFloat32(inputBuf16, floatDestBuf, numSamples);
-						} else {
-#endif							
-							while (numSamplesLeft-- > 0) 
-							{	
-								*(floatDestBuf++) = (float)(*(inputBuf16++) &= (SInt16)noiseMask) * kOneOverMaxSInt16Value;
-							}
-							
-						}
-#ifndef TIGER							
-					} else
-						SwapInt16ToFloat32(inputBuf16, floatDestBuf, numSamples);
-#endif				
+					inputBuf16 = &(((const SInt16 *)sampleBuf)[firstSample]);
+					if (nativeEndianInts)
+						NativeInt16ToFloat32Processed(inputBuf16, floatDestBuf, numSamples, &proc, SSE2);
+					else
+						SwapInt16ToFloat32Processed(inputBuf16, floatDestBuf, numSamples, &proc, SSE2);
 					break;
 					
 				case 20:
 				case 24: //impossible for Intel chipset, dunno for other
-					inputBuf24 = &(((UInt8 *)sampleBuf)[firstSample * 3]);
-					if (nativeEndianInts){
-#ifndef TIGER						
-						if (SSE2) {
-							NativeInt24ToFloat32(inputBuf24, floatDestBuf, numSamples);
-						} else
-#endif							
-						{
-							// Multiply by 3 because 20 and 24 bit samples are packed into only three bytes, so we have to index bytes, not shorts or longs
-							register SInt32 inputSample;
-							
-							// [rdar://4311684] - Fixed 24-bit input convert routine. /thw
-							while (numSamplesLeft-- > 1) 
-							{	
-								inputSample = (* (UInt32 *)inputBuf24) & 0x00FFFFFF & noiseMask;
-								// Sign extend if necessary
-								if (inputSample > 0x7FFFFF)
-								{
-									inputSample |= 0xFF000000;
-								}
-								inputBuf24 += 3;
-								*(floatDestBuf++) = (float)inputSample * kOneOverMaxSInt24Value;
-							}
-							// Convert last sample. The following line does the same work as above without going over the edge of the buffer.
-							inputSample = SInt32 ((UInt32 (*(UInt16 *) inputBuf24) & 0x0000FFFF & noiseMask)
-												  | (SInt32 (*(inputBuf24 + 2)) << 16));
-							*(floatDestBuf++) = (float)inputSample * kOneOverMaxSInt24Value;
-						}
-					}
-#ifndef TIGER						
+					// 20 and 24 bit samples are packed into only three bytes
+					inputBuf24 = &(((const UInt8 *)sampleBuf)[firstSample * 3]);
+					if (nativeEndianInts)
+						NativeInt24ToFloat32Processed(inputBuf24, floatDestBuf, numSamples, &proc, SSE2);
 					else
-						SwapInt24ToFloat32(inputBuf24, floatDestBuf, numSamples);
-#endif					
+						SwapInt24ToFloat32Processed(inputBuf24, floatDestBuf, numSamples, &proc, SSE2);
 					break;
 					
 				case 32:
-					inputBuf32 = &(((SInt32 *)sampleBuf)[firstSample]);
-					if (nativeEndianInts) {
-#ifndef TIGER						
-						if (SSE2) {
-							NativeInt32ToFloat32(inputBuf32, floatDestBuf, numSamples);
-						} else
-#endif							
-						{
-							while (numSamplesLeft-- > 0) {	
-								*(floatDestBuf++) = (float)(*(inputBuf32++) & noiseMask) * kOneOverMaxSInt32Value;
-							}
-						}
-					}
-#ifndef TIGER						
+					inputBuf32 = &(((const SInt32 *)sampleBuf)[firstSample]);
+					if (nativeEndianInts)
+						NativeInt32ToFloat32Processed(inputBuf32, floatDestBuf, numSamples, &proc, SSE2);
 					else
-						SwapInt32ToFloat32(inputBuf32, floatDestBuf, numSamples);
-#endif					
+						SwapInt32ToFloat32Processed(inputBuf32, floatDestBuf, numSamples, &proc, SSE2);
 					break;
 					
 				default:
@@ -4042,19 +3791,6 @@ IOReturn VoodooHDAEngine::convertInputSamples(const void *sampleBuf, void *destB
 					break;
 					
 			}
-			
-			//Меняю местами значения для левого и правого канала
-			if(mDevice && mDevice->mSwitchCh && (streamFormat->fNumChannels > 1)) {
-				UInt32 i;
-				Float32 tempSamples;
-				
-				for(i = 0; i < numSamples; i+= streamFormat->fNumChannels) {
-					tempSamples = floatDestBuf[i];
-					floatDestBuf[i] = floatDestBuf[i+1];
-					floatDestBuf[i+1] = tempSamples;
-				}
-			}
-			
 		} else if (streamFormat->fNumericRepresentation == kIOAudioStreamNumericRepresentationIEEE754Float) {
 			// it is some kind of floating point format
 			if ((streamFormat->fBitWidth == 32) && (streamFormat->fBitDepth == 32) &&
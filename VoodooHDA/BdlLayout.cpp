@@ -0,0 +1,94 @@
+#include "License.h"
+
+#include "BdlLayout.h"
+
+/*
+ * numBlocks divides the ring into 128 byte aligned blocks whatever its size, and the interrupt on completion
+ * comes every iocInterval blocks, always including the last one.
+ */
+bool bdlLayoutValid(UInt32 numBlocks, UInt32 iocInterval)
+{
+	if ((numBlocks < HDA_BDL_MIN) || (numBlocks > HDA_BDL_MAX) || (numBlocks & (numBlocks - 1)))
+		return false;
+	if (!iocInterval || (iocInterval > numBlocks) || (iocInterval & (iocInterval - 1)))
+		return false;
+	return true;
+}
+
+void bdlFill(BdlEntry *bdl, UInt64 addr, UInt32 blockSize, UInt32 numBlocks, UInt32 iocInterval)
+{
+	for (UInt32 n = 1; n <= numBlocks; n++, bdl++) {
+		bdl->addrl = (UInt32) addr;
+		bdl->addrh = (UInt32) (addr >> 32);
+		bdl->len = blockSize;
+		bdl->ioc = ((n % iocInterval) == 0);
+		addr += blockSize;
+	}
+}
+
+/*
+ * Whether the interrupt on completion just taken, at DMA position, is the one for the last block. The position
+ * is rounded to the nearest interrupt boundary, so that one a little behind or ahead still counts. With one
+ * interrupt per ring they all are.
+ */
+bool bdlAtWrap(UInt32 position, UInt32 blockSize, UInt32 numBlocks, UInt32 iocInterval)
+{
+	UInt32 period;
+
+	if (iocInterval >= numBlocks)
+		return true;
+	period = blockSize * iocInterval;
+	return (((position + period / 2) / period) % (numBlocks / iocInterval)) == 0;
+}
+
+// the time between interrupts at speed Hz
+UInt64 bdlPeriodNs(UInt32 blockSize, UInt32 iocInterval, UInt32 speed, UInt32 frameBytes)
+{
+	return (UInt64) blockSize * iocInterval * 1000000000ULL / ((UInt64) speed * frameBytes);
+}
+
+UInt32 greatestCommonDivisor(UInt32 a, UInt32 b)
+{
+	while (b) {
+		UInt32 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/*
+ * Low latency ring: blocks of whole frames and 128 bytes about targetFrames long, HDA_LATENCY_BLOCKS_MIN or
+ * more of them and HDA_LATENCY_RING_FRAMES or more in all, as far as HDA_BDL_MAX and HDA_BUFSZ_MAX allow.
+ */
+void lowLatencyLayout(UInt32 targetFrames, UInt32 sampleSize, UInt32 *numBlocks, UInt32 *blockSize)
+{
+	UInt32 unit, size, blocks, minRing;
+
+	unit = HDAC_DMA_ALIGNMENT * sampleSize / greatestCommonDivisor(HDAC_DMA_ALIGNMENT, sampleSize);
+	size = ((targetFrames * sampleSize + unit - 1) / unit) * unit;
+	if (size > HDA_BUFSZ_MAX / HDA_BDL_MIN)
+		size = ((HDA_BUFSZ_MAX / HDA_BDL_MIN) / unit) * unit;
+	minRing = HDA_LATENCY_RING_FRAMES * sampleSize;
+	for (blocks = HDA_LATENCY_BLOCKS_MIN; (blocks < HDA_BDL_MAX) && (blocks * size < minRing); blocks *= 2)
+		;
+	while ((blocks > HDA_BDL_MIN) && (blocks * size > HDA_BUFSZ_MAX))
+		blocks /= 2;
+	// HDA_BDL_MAX blocks still too short: longer blocks, the latency is in the offset, not in them
+	if (blocks * size < minRing)
+		size = ((minRing / blocks + unit - 1) / unit) * unit;
+	*numBlocks = blocks;
+	*blockSize = size;
+}
+
+// the sample offset in low latency mode: a quarter of the target, within HDA_LATENCY_OFFSET_MIN and SAMPLE_OFFSET
+UInt32 lowLatencyOffset(UInt32 targetFrames)
+{
+	UInt32 offset = targetFrames / 4;
+
+	if (offset < HDA_LATENCY_OFFSET_MIN)
+		offset = HDA_LATENCY_OFFSET_MIN;
+	else if (offset > SAMPLE_OFFSET)
+		offset = SAMPLE_OFFSET;
+	return offset;
+}
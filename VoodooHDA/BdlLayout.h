@@ -0,0 +1,54 @@
+#include "License.h"
+
+#ifndef __BdlLayout_h__
+#define __BdlLayout_h__
+
+#include <IOKit/IOTypes.h>
+
+/*
+	Layout of a stream's DMA ring: its buffer descriptor list (BDL), where the interrupts on completion fall,
+	and the short rings of low latency mode.
+
+	Nothing in here touches the controller, so bench/bdlbench runs the same code on the host.
+*/
+
+#define HDAC_DMA_ALIGNMENT		128
+
+#define HDA_BDL_MIN				2
+#define HDA_BDL_MAX				256
+#define HDA_BDL_DEFAULT			HDA_BDL_MIN
+#define HDA_BDL_IOC_DEFAULT		HDA_BDL_DEFAULT	// blocks per interrupt: one at the end of the ring
+
+#define HDA_BLK_MIN				HDAC_DMA_ALIGNMENT
+#define HDA_BLK_ALIGN			(~(HDA_BLK_MIN - 1))
+
+#define HDA_BUFSZ_MIN			4096
+	//#define HDA_BUFSZ_MAX			65536
+#define HDA_BUFSZ_MAX			262144
+#define HDA_BUFSZ_DEFAULT		HDA_BUFSZ_MAX
+
+#define HDA_LATENCY_MIN			1000	// us, target latency of an engine in low latency mode
+#define HDA_LATENCY_MAX			50000
+#define HDA_LATENCY_RING_FRAMES	2048	// smallest ring then, room for the HAL's larger I/O cycles
+#define HDA_LATENCY_BLOCKS_MIN	4
+#define HDA_LATENCY_OFFSET_MIN	16		// frames
+
+#define SAMPLE_OFFSET			64		// note: these values definitely need to be tweaked
+
+typedef struct _BdlEntry {
+	volatile UInt32 addrl;
+	volatile UInt32 addrh;
+	volatile UInt32 len;
+	volatile UInt32 ioc;
+} __attribute__((__packed__)) BdlEntry;
+
+bool bdlLayoutValid(UInt32 numBlocks, UInt32 iocInterval);
+void bdlFill(BdlEntry *bdl, UInt64 addr, UInt32 blockSize, UInt32 numBlocks, UInt32 iocInterval);
+bool bdlAtWrap(UInt32 position, UInt32 blockSize, UInt32 numBlocks, UInt32 iocInterval);
+UInt64 bdlPeriodNs(UInt32 blockSize, UInt32 iocInterval, UInt32 speed, UInt32 frameBytes);
+
+UInt32 greatestCommonDivisor(UInt32 a, UInt32 b);
+void lowLatencyLayout(UInt32 targetFrames, UInt32 sampleSize, UInt32 *numBlocks, UInt32 *blockSize);
+UInt32 lowLatencyOffset(UInt32 targetFrames);
+
+#endif
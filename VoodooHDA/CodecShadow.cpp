@@ -0,0 +1,286 @@
+#include "License.h"
+
+#include <IOKit/IOLib.h>
+
+#include "CodecShadow.h"
+#include "Verbs.h"
+#include "Models.h"
+
+#define kCodecShadowValid	0x80000000	// where the codec address would be, so a used key is never 0
+
+enum {
+	kShadowNone = 0,
+	kShadowParam,
+	kShadowState
+};
+
+// the 12 bit verbs are 0x7xx (set) and 0xfxx (get); the 4 bit ones come out as 0x200 .. 0xd00
+static UInt32 ShadowVerbId(UInt32 verb)
+{
+	UInt32 id = (verb & HDA_CMD_VERB_MASK) >> HDA_CMD_VERB_12BIT_SHIFT;
+
+	if (((id >> 8) == 0x7) || ((id >> 8) == 0xf))
+		return id;
+	return id & 0xf00;
+}
+
+#define SHADOW_4BIT(verb)	((verb) << 8)
+
+static int ShadowClass(UInt32 id)
+{
+	switch (id) {
+	case HDA_CMD_VERB_GET_PARAMETER:
+	case HDA_CMD_VERB_GET_CONN_LIST_ENTRY:
+		return kShadowParam;
+	case SHADOW_4BIT(HDA_CMD_VERB_GET_AMP_GAIN_MUTE):
+	case SHADOW_4BIT(HDA_CMD_VERB_GET_CONV_FMT):
+	case HDA_CMD_VERB_GET_CONN_SELECT_CONTROL:
+	case HDA_CMD_VERB_GET_CONV_STREAM_CHAN:
+	case HDA_CMD_VERB_GET_PIN_WIDGET_CTRL:
+	case HDA_CMD_VERB_GET_EAPD_BTL_ENABLE:
+	case HDA_CMD_VERB_GET_DIGITAL_CONV_FMT1:
+	case HDA_CMD_VERB_GET_CONFIGURATION_DEFAULT:
+	case HDA_CMD_VERB_GET_CONV_CHAN_COUNT:
+		return kShadowState;
+	default:
+		return kShadowNone;
+	}
+}
+
+// the output amplifier ignores the index, so that all of them land on one entry
+static UInt32 ShadowKey(UInt32 verb)
+{
+	UInt32 key = verb & (HDA_CMD_NID_MASK | HDA_CMD_VERB_MASK);
+
+	if ((ShadowVerbId(verb) == SHADOW_4BIT(HDA_CMD_VERB_GET_AMP_GAIN_MUTE)) &&
+			(key & HDA_CMD_GET_AMP_GAIN_MUTE_OUTPUT))
+		key &= ~0xf;
+	return key | kCodecShadowValid;
+}
+
+static inline UInt32 ShadowHash(UInt32 key)
+{
+	return (key * 0x9e3779b1) >> 16;
+}
+
+#pragma mark -
+#pragma mark Setup
+
+bool CodecShadow::init()
+{
+	free();
+	mParams.entries = (Entry *) IOMalloc(kCodecShadowParamsSize * sizeof (Entry));
+	mState.entries = (Entry *) IOMalloc(kCodecShadowStateSize * sizeof (Entry));
+	if (!mParams.entries || !mState.entries) {
+		free();
+		return false;
+	}
+	mParams.size = kCodecShadowParamsSize;
+	mState.size = kCodecShadowStateSize;
+	invalidate();
+	return true;
+}
+
+void CodecShadow::free()
+{
+	if (mParams.entries)
+		IOFree(mParams.entries, mParams.size * sizeof (Entry));
+	if (mState.entries)
+		IOFree(mState.entries, mState.size * sizeof (Entry));
+	bzero(&mParams, sizeof (mParams));
+	bzero(&mState, sizeof (mState));
+	mHits = mMisses = 0;
+}
+
+void CodecShadow::invalidateState()
+{
+	if (mState.entries)
+		bzero(mState.entries, mState.size * sizeof (Entry));
+	mState.count = 0;
+	mGeneration++;
+}
+
+void CodecShadow::invalidate()
+{
+	if (mParams.entries)
+		bzero(mParams.entries, mParams.size * sizeof (Entry));
+	mParams.count = 0;
+	invalidateState();
+}
+
+#pragma mark -
+#pragma mark Lookup
+
+// linear probing; a table is never filled past 3/4, so an empty slot ends every search
+CodecShadow::Entry *CodecShadow::find(Table *table, UInt32 key, bool insert)
+{
+	UInt32 mask = table->size - 1;
+
+	if (!table->entries)
+		return NULL;
+	for (UInt32 i = ShadowHash(key) & mask; ; i = (i + 1) & mask) {
+		Entry *entry = &table->entries[i];
+		if (entry->key == key)
+			return entry;
+		if (entry->key == 0) {
+			if (!insert || (table->count >= table->size / 4 * 3))
+				return NULL;
+			entry->key = key;
+			table->count++;
+			return entry;
+		}
+	}
+}
+
+void CodecShadow::store(Table *table, UInt32 key, UInt32 value)
+{
+	Entry *entry = find(table, key, true);
+
+	if (entry)
+		entry->value = value;
+}
+
+// one byte of a register that is set a byte at a time: only if we know the rest of it
+void CodecShadow::storeByte(Table *table, UInt32 key, int byte, UInt32 value)
+{
+	Entry *entry = find(table, key, false);
+
+	if (entry)
+		entry->value = (entry->value & ~(0xff << (8 * byte))) | ((value & 0xff) << (8 * byte));
+}
+
+bool CodecShadow::isSet(UInt32 verb)
+{
+	UInt32 id = ShadowVerbId(verb);
+
+	return ((id >> 8) == 0x7) || (id == SHADOW_4BIT(HDA_CMD_VERB_SET_CONV_FMT)) ||
+			(id == SHADOW_4BIT(HDA_CMD_VERB_SET_AMP_GAIN_MUTE)) ||
+			(id == SHADOW_4BIT(HDA_CMD_VERB_SET_PROCESSING_COEFF)) ||
+			(id == SHADOW_4BIT(HDA_CMD_VERB_SET_COEFF_INDEX));
+}
+
+bool CodecShadow::lookup(UInt32 verb, UInt32 *response)
+{
+	Entry *entry;
+
+	switch (ShadowClass(ShadowVerbId(verb))) {
+	case kShadowParam:
+		entry = find(&mParams, ShadowKey(verb), false);
+		break;
+	case kShadowState:
+		entry = find(&mState, ShadowKey(verb), false);
+		break;
+	default:
+		return false;
+	}
+	if (!entry) {
+		mMisses++;
+		return false;
+	}
+	mHits++;
+	*response = entry->value;
+	return true;
+}
+
+void CodecShadow::update(UInt32 verb, UInt32 response)
+{
+	UInt32 id = ShadowVerbId(verb), node = verb & HDA_CMD_NID_MASK, payload;
+
+	if (!mParams.entries)
+		return;
+
+	if (!isSet(verb)) {
+		if (response == HDAC_INVALID)
+			return;
+		switch (ShadowClass(id)) {
+		case kShadowParam:
+			store(&mParams, ShadowKey(verb), response);
+			break;
+		case kShadowState:
+			store(&mState, ShadowKey(verb), response);
+			break;
+		}
+		return;
+	}
+
+	// a write that wasn't answered may or may not have happened
+	if (response == HDAC_INVALID) {
+		invalidateState();
+		return;
+	}
+
+	switch (id) {
+	case SHADOW_4BIT(HDA_CMD_VERB_SET_AMP_GAIN_MUTE):
+		// bits 15/14 output/input, 13/12 left/right, 11:8 index, 7 mute, 6:0 gain
+		payload = verb & 0xffff;
+		for (int output = 0; output < 2; output++) {
+			if (!(payload & (output ? 0x8000 : 0x4000)))
+				continue;
+			for (int left = 0; left < 2; left++) {
+				if (!(payload & (left ? 0x2000 : 0x1000)))
+					continue;
+				store(&mState, ShadowKey(node | HDA_CMD_VERB_4BIT(HDA_CMD_VERB_GET_AMP_GAIN_MUTE,
+						(output ? HDA_CMD_GET_AMP_GAIN_MUTE_OUTPUT : HDA_CMD_GET_AMP_GAIN_MUTE_INPUT) |
+						(left ? HDA_CMD_GET_AMP_GAIN_MUTE_LEFT : HDA_CMD_GET_AMP_GAIN_MUTE_RIGHT) |
+						((payload >> 8) & 0xf))), payload & 0xff);
+			}
+		}
+		break;
+	case SHADOW_4BIT(HDA_CMD_VERB_SET_CONV_FMT):
+		store(&mState, ShadowKey(node | HDA_CMD_VERB_4BIT(HDA_CMD_VERB_GET_CONV_FMT, 0)), verb & 0xffff);
+		break;
+	case HDA_CMD_VERB_SET_CONN_SELECT_CONTROL:
+	case HDA_CMD_VERB_SET_CONV_STREAM_CHAN:
+	case HDA_CMD_VERB_SET_PIN_WIDGET_CTRL:
+	case HDA_CMD_VERB_SET_EAPD_BTL_ENABLE:
+	case HDA_CMD_VERB_SET_CONV_CHAN_COUNT:
+		// read back by the same verb with 0xf for 0x7
+		store(&mState, ShadowKey(node | HDA_CMD_VERB_12BIT(id | 0x800, 0)), verb & 0xff);
+		break;
+	case HDA_CMD_VERB_SET_DIGITAL_CONV_FMT1:
+	case HDA_CMD_VERB_SET_DIGITAL_CONV_FMT2:
+		storeByte(&mState, ShadowKey(node | HDA_CMD_VERB_12BIT(HDA_CMD_VERB_GET_DIGITAL_CONV_FMT1, 0)),
+				id - HDA_CMD_VERB_SET_DIGITAL_CONV_FMT1, verb & 0xff);
+		break;
+	case HDA_CMD_VERB_SET_CONFIGURATION_DEFAULT1:
+	case HDA_CMD_VERB_SET_CONFIGURATION_DEFAULT2:
+	case HDA_CMD_VERB_SET_CONFIGURATION_DEFAULT3:
+	case HDA_CMD_VERB_SET_CONFIGURATION_DEFAULT4:
+		storeByte(&mState, ShadowKey(node | HDA_CMD_VERB_12BIT(HDA_CMD_VERB_GET_CONFIGURATION_DEFAULT, 0)),
+				id - HDA_CMD_VERB_SET_CONFIGURATION_DEFAULT1, verb & 0xff);
+		break;
+	// nothing that we keep
+	case HDA_CMD_VERB_SET_PROCESSING_STATE:
+	case HDA_CMD_VERB_SET_INPUT_CONVERTER_SDI_SELECT:
+	case HDA_CMD_VERB_SET_UNSOLICITED_RESPONSE:
+	case HDA_CMD_VERB_SET_PIN_SENSE:
+	case HDA_CMD_VERB_SET_BEEP_GENERATION:
+	case HDA_CMD_VERB_SET_VOLUME_KNOB:
+	case HDA_CMD_VERB_SET_GPI_DATA:
+	case HDA_CMD_VERB_SET_GPI_WAKE_ENABLE_MASK:
+	case HDA_CMD_VERB_SET_GPI_UNSOLICITED_ENABLE_MASK:
+	case HDA_CMD_VERB_SET_GPI_STICKY_MASK:
+	case HDA_CMD_VERB_SET_GPO_DATA:
+	case HDA_CMD_VERB_SET_GPIO_DATA:
+	case HDA_CMD_VERB_SET_GPIO_ENABLE_MASK:
+	case HDA_CMD_VERB_SET_GPIO_DIRECTION:
+	case HDA_CMD_VERB_SET_GPIO_WAKE_ENABLE_MASK:
+	case HDA_CMD_VERB_SET_GPIO_UNSOLICITED_ENABLE_MASK:
+	case HDA_CMD_VERB_SET_GPIO_STICKY_MASK:
+	case HDA_CMD_VERB_SET_SUSBYSTEM_ID1:
+	case HDA_CMD_VERB_SET_SUBSYSTEM_ID2:
+	case HDA_CMD_VERB_SET_SUBSYSTEM_ID3:
+	case HDA_CMD_VERB_SET_SUBSYSTEM_ID4:
+	case HDA_CMD_VERB_SET_STRIPE_CONTROL:
+	case HDA_CMD_VERB_SET_HDMI_DIP_INDEX:
+	case HDA_CMD_VERB_SET_HDMI_DIP_DATA:
+	case HDA_CMD_VERB_SET_HDMI_DIP_XMIT:
+	case HDA_CMD_VERB_SET_HDMI_CP_CTRL:
+	case HDA_CMD_VERB_SET_HDMI_CHAN_SLOT:
+		break;
+	// power state changes, resets, coefficients and vendor verbs may change anything
+	default:
+		invalidateState();
+		break;
+	}
+}
@@ -0,0 +1,75 @@
+#include "License.h"
+
+#ifndef __CodecShadow_h__
+#define __CodecShadow_h__
+
+#include <IOKit/IOTypes.h>
+
+/*
+	Shadow of the codec registers, so that reading them again doesn't take a verb.
+
+	Entries are keyed by what the GET verb puts on the link after the codec address: node, verb and payload.
+	There are two tables:
+	- the parameters: GET_PARAMETER and the connection lists, which are fixed by the silicon and stay valid
+	  for as long as the codec is there;
+	- the state: amplifier gain and mute, converter format and stream, connection select, pin control, EAPD
+	  and configuration default. These are taken from the answers to the GET verbs and from the SET verbs as
+	  they go out, and are dropped by invalidateState() whenever the codec may have changed them behind our
+	  back: controller or function group reset, unsolicited responses, and SET verbs we don't know the
+	  effect of (coefficients, vendor verbs).
+	Verbs that read something the codec changes on its own (pin sense, GPIO, power state) are never kept.
+
+	No constructor, like PCMResampler: zeroed memory is an empty shadow that isn't set up yet, and then
+	lookup() always misses.
+*/
+
+#define kCodecShadowParamsSize	2048	// entries, a power of two
+#define kCodecShadowStateSize	2048
+
+class CodecShadow {
+public:
+	bool	init();
+	void	free();
+
+	// true and the response if verb is a GET whose answer is known
+	bool	lookup(UInt32 verb, UInt32 *response);
+	// verb has gone out and got response (HDAC_INVALID if none)
+	void	update(UInt32 verb, UInt32 response);
+
+	void	invalidateState();
+	void	invalidate();
+
+	// SET verbs change what the shadow would answer, batches must not serve a GET after one from memory
+	static bool	isSet(UInt32 verb);
+
+	UInt32	numParams() const { return mParams.count; }
+	UInt32	numState() const { return mState.count; }
+	UInt32	hits() const { return mHits; }
+	UInt32	misses() const { return mMisses; }
+	// changes whenever the state is dropped, so that anything remembering what it wrote knows to write again
+	UInt32	generation() const { return mGeneration; }
+
+private:
+	typedef struct _Entry {
+		UInt32	key;	// kCodecShadowValid | node, verb and payload
+		UInt32	value;
+	} Entry;
+
+	typedef struct _Table {
+		Entry	*entries;
+		UInt32	size;
+		UInt32	count;
+	} Table;
+
+	static Entry	*find(Table *table, UInt32 key, bool insert);
+	static void		store(Table *table, UInt32 key, UInt32 value);
+	static void		storeByte(Table *table, UInt32 key, int byte, UInt32 value);
+
+	Table	mParams;
+	Table	mState;
+	UInt32	mHits;
+	UInt32	mMisses;
+	UInt32	mGeneration;
+};
+
+#endif // __CodecShadow_h__
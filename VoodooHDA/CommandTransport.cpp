@@ -0,0 +1,324 @@
+#include "License.h"
+
+#include "CommandTransport.h"
+#include "Registers.h"
+#include "Models.h"
+
+void CommandTransport::init(VoodooHDADevice *device, int immediateMax)
+{
+	mDevice = device;
+	mImmediateMax = immediateMax;
+	mImmediateFailed = 0;
+	mRirbMissed = 0;
+	for (int i = 0; i < HDAC_CODEC_MAX; i++) {
+		mQueues[i].commands = NULL;
+		mQueues[i].numVerbsSent = 0;
+		mQueues[i].numRespReceived = 0;
+	}
+}
+
+void CommandTransport::setCorb(UInt32 *corb, int size)
+{
+	mCorb = corb;
+	mCorbSize = size;
+	mCorbWritePtr = 0;
+}
+
+void CommandTransport::setRirb(RirbResponse *rirb, int size)
+{
+	mRirb = rirb;
+	mRirbSize = size;
+	mRirbReadPtr = 0;
+}
+
+/*
+ * Startup the corb DMA engine
+ */
+void CommandTransport::startCorb()
+{
+	UInt32 corbCtl;
+	corbCtl = readData8(HDAC_CORBCTL);
+	corbCtl |= HDAC_CORBCTL_CORBRUN;
+	writeData8(HDAC_CORBCTL, corbCtl);
+	mCorbRunning = true;
+}
+
+/*
+ * Stop the corb DMA engine, for the immediate command interface. The verbs
+ * queued so far have all been answered, so there's nothing in flight.
+ */
+bool CommandTransport::stopCorb()
+{
+	UInt32 corbCtl;
+	corbCtl = readData8(HDAC_CORBCTL);
+	corbCtl &= ~HDAC_CORBCTL_CORBRUN;
+	writeData8(HDAC_CORBCTL, corbCtl);
+	for (int timeout = 100; timeout > 0; timeout--) {
+		if (!(readData8(HDAC_CORBCTL) & HDAC_CORBCTL_CORBRUN)) {
+			mCorbRunning = false;
+			return true;
+		}
+		delay(1);
+	}
+	return false;
+}
+
+/*
+ * Send a command list to each codec that has one in lists, which is indexed by
+ * codec address. A short list for a single codec goes through the immediate
+ * command interface, which takes a verb straight from a register and has its
+ * answer in another, without the round trip through the corb and rirb rings;
+ * everything else through the corb, where the codecs take a verb every frame.
+ * The two must not be used at the same time, so the corb is stopped for the one
+ * and started again for the other. If the immediate interface lets us down the
+ * list goes through the corb anyway, and after a few times we stop trying it.
+ */
+void CommandTransport::sendCommandLists(CommandList **lists)
+{
+	int numLists = 0, numCommands = 0;
+	int cad = 0;
+
+	for (int i = 0; i < HDAC_CODEC_MAX; i++) {
+		if (!lists[i] || (lists[i]->numCommands < 1))
+			continue;
+		numLists++;
+		numCommands += lists[i]->numCommands;
+		cad = i;
+	}
+	if (numLists == 0)
+		return;
+
+	if ((numLists == 1) && (numCommands <= mImmediateMax)) {
+		if ((!mCorbRunning || stopCorb()) && sendCommandsImmediate(lists[cad]))
+			return;
+		if (++mImmediateFailed >= HDAC_IMMEDIATE_FAILED_MAX) {
+			mImmediateMax = 0;
+			errorMsg("warning: immediate command interface failed %d times, using the corb only\n",
+					mImmediateFailed);
+		}
+	}
+	if (!mCorbRunning)
+		startCorb();
+	sendCommandsCorb(lists);
+}
+
+/*
+ * Send a command list through the immediate command interface, one verb at a
+ * time. Returns false if the controller didn't take a verb or didn't answer it,
+ * in which case the list has to be sent again some other way.
+ */
+bool CommandTransport::sendCommandsImmediate(CommandList *commands)
+{
+	for (int i = 0; i < commands->numCommands; i++) {
+		int timeout;
+
+		for (timeout = HDAC_IMMEDIATE_TIMEOUT; readData16(HDAC_ICIS) & HDAC_ICIS_ICB; timeout--) {
+			if (timeout <= 0)
+				return false;
+			delay(1);
+		}
+		writeData16(HDAC_ICIS, HDAC_ICIS_IRV);
+		writeData32(HDAC_ICOI, commands->verbs[i]);
+		writeData16(HDAC_ICIS, HDAC_ICIS_ICB);
+		for (timeout = HDAC_IMMEDIATE_TIMEOUT; !(readData16(HDAC_ICIS) & HDAC_ICIS_IRV); timeout--) {
+			if (timeout <= 0)
+				return false;
+			delay(1);
+		}
+		commands->responses[i] = readData32(HDAC_ICII);
+	}
+	return true;
+}
+
+/*
+ * Send the command lists to their codecs via the corb. We queue as much verbs
+ * as we can, taking turns between the codecs so that all of them have verbs in
+ * flight, and sleep until the interrupt filter has got the responses back from
+ * the rirb, where they are told apart by codec address; then queue the
+ * remaining verbs if any. Without a working rirb interrupt we poll for the
+ * responses instead.
+ */
+void CommandTransport::sendCommandsCorb(CommandList **lists)
+{
+	Queue *queues[HDAC_CODEC_MAX];
+	int numQueues = 0;
+	int corbReadPtr;
+	int timeout;
+	int retry = 10;
+	int numCommands = 0, numVerbsSent = 0, numRespReceived = 0, received;
+	bool sleep;
+
+	lockRirb();
+	for (int i = 0; i < HDAC_CODEC_MAX; i++) {
+		if (!lists[i] || (lists[i]->numCommands < 1))
+			continue;
+		queues[numQueues++] = &mQueues[i];
+		mQueues[i].commands = lists[i];
+		mQueues[i].numRespReceived = 0;
+		mQueues[i].numVerbsSent = 0;
+		numCommands += lists[i]->numCommands;
+	}
+	unlockRirb();
+	if (numQueues == 0)
+		return;
+
+	/* Only with the controller interrupt on: not yet during start or resume */
+	sleep = mRirbInterrupts && HDA_FLAG_MATCH(readData32(HDAC_INTCTL), HDAC_INTCTL_CIE | HDAC_INTCTL_GIE);
+
+	do {
+		if (numVerbsSent != numCommands) {
+			/* Queue as many verbs as possible, one codec after the other */
+			corbReadPtr = readData16(HDAC_CORBRP);
+			syncCorb(false);
+			for (int next = 0; (numVerbsSent != numCommands) &&
+					(((mCorbWritePtr + 1) % mCorbSize) != corbReadPtr); next = (next + 1) % numQueues) {
+				Queue *queue = queues[next];
+				if (queue->numVerbsSent == queue->commands->numCommands)
+					continue;
+				mCorbWritePtr++;
+				mCorbWritePtr %= mCorbSize;
+				mCorb[mCorbWritePtr] = queue->commands->verbs[queue->numVerbsSent++];
+				numVerbsSent++;
+			}
+
+			/* Send the verbs to the codecs */
+			syncCorb(true);
+			writeData16(HDAC_CORBWP, mCorbWritePtr);
+		}
+
+		if (sleep)
+			rirbWait(200 * 10);
+		else {
+			timeout = 200;
+			while (timeout--) {
+				lockRirb();
+				int ret = rirbFlush();
+				unlockRirb();
+				if (ret != 0)
+					break;
+				delay(10);
+			}
+		}
+
+		/* A long list drains a few responses per pass, only count the passes that got nothing */
+		received = 0;
+		for (int i = 0; i < numQueues; i++)
+			received += queues[i]->numRespReceived;
+		if (received != numRespReceived) {
+			numRespReceived = received;
+			retry = 10;
+		}
+	} while (((numVerbsSent != numCommands) || (numRespReceived != numCommands)) && --retry);
+
+	if (retry == 0)
+		errorMsg("TIMEOUT numcmd=%d, sent=%d, received=%d\n", numCommands, numVerbsSent, numRespReceived);
+
+	lockRirb();
+	for (int i = 0; i < numQueues; i++) {
+		queues[i]->commands = NULL;
+		queues[i]->numRespReceived = 0;
+		queues[i]->numVerbsSent = 0;
+	}
+	unlockRirb();
+}
+
+/*
+ * Verbs sent to the codecs that haven't been answered yet. Call with the
+ * rirb lock held.
+ */
+int CommandTransport::rirbPending()
+{
+	int pending = 0;
+
+	for (int i = 0; i < HDAC_CODEC_MAX; i++)
+		if (mQueues[i].commands)
+			pending += mQueues[i].numVerbsSent - mQueues[i].numRespReceived;
+	return pending;
+}
+
+/*
+ * Sleep until the responses to everything queued so far are in, or timeoutUs
+ * has passed. They are brought in by the interrupt filter, which wakes us; if
+ * they turn out to have been in the rirb without it, the interrupt is no good
+ * and after a few of those we go back to polling for good.
+ */
+void CommandTransport::rirbWait(UInt32 timeoutUs)
+{
+	UInt64 deadline = rirbDeadline(timeoutUs);
+
+	lockRirb();
+	while ((rirbPending() != 0) && rirbSleep(deadline))
+		;
+	if ((rirbPending() != 0) && (rirbFlush() != 0) &&
+			(++mRirbMissed >= HDAC_RIRB_MISSED_MAX)) {
+		mRirbInterrupts = false;
+		errorMsg("warning: rirb interrupt missed %d times, polling for codec responses\n", mRirbMissed);
+	}
+	unlockRirb();
+}
+
+/*
+ * Call with the rirb lock held.
+ */
+int CommandTransport::rirbFlush()
+{
+	UInt8 rirbWritePtr;
+	int ret, unsol;
+
+	rirbWritePtr = readData8(HDAC_RIRBWP);
+
+	ret = 0;
+	unsol = 0;
+	while (mRirbReadPtr != rirbWritePtr) {
+		RirbResponse *rirb;
+		Queue *queue;
+		CommandList *commands;
+		int cad;
+		UInt32 resp;
+
+		mRirbReadPtr++;
+		mRirbReadPtr %= mRirbSize;
+		rirb = &mRirb[mRirbReadPtr];
+		cad = HDAC_RIRB_RESPONSE_EX_SDATA_IN(rirb->response_ex);
+		if ((cad < 0) || (cad >= HDAC_CODEC_MAX))
+			continue;
+		resp = rirb->response;
+		queue = &mQueues[cad];
+		commands = queue->commands;
+		if (rirb->response_ex & HDAC_RIRB_RESPONSE_EX_UNSOLICITED) {
+			queueUnsolicited(cad, resp);
+			unsol++;
+		} else if (commands && (commands->numCommands > 0) &&
+				(queue->numRespReceived < commands->numCommands))
+			commands->responses[queue->numRespReceived++] = resp;
+		ret++;
+	}
+		//Slice
+	UInt32 rirbCtl;
+	rirbCtl = readData8(HDAC_GCTL);
+	rirbCtl |= HDAC_GCTL_FCNTRL;
+	writeData8(HDAC_GCTL, rirbCtl);
+
+	if (unsol)
+		unsolicitedQueued();
+
+	return ret;
+}
+
+/*
+ * From the interrupt filter with the rirb lock held, for the controller
+ * interrupt: get as many responses as we can.
+ */
+int CommandTransport::rirbInterrupt()
+{
+	UInt8 rirbStatus;
+	int ret = 0;
+
+	rirbStatus = readData8(HDAC_RIRBSTS);
+	while (HDA_FLAG_MATCH(rirbStatus, HDAC_RIRBSTS_RINTFL)) {
+		writeData8(HDAC_RIRBSTS, HDAC_RIRBSTS_RINTFL);
+		ret += rirbFlush();
+		rirbStatus = readData8(HDAC_RIRBSTS);
+	}
+	return ret;
+}
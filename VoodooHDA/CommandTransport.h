@@ -0,0 +1,125 @@
+#include "License.h"
+
+#ifndef __CommandTransport_h__
+#define __CommandTransport_h__
+
+#include <IOKit/IOTypes.h>
+
+/*
+	The codec command transports: command lists go to the codecs through the immediate command interface
+	or through the corb, with the responses coming back through the rirb, where they are told apart by
+	codec address.
+
+	The hardware is reached through the hooks at the end of the class, which whoever builds this file
+	defines: VoodooHDADevice.cpp against the controller, bench/cmdbench against a model of it. So the
+	choice of transport, the turns the codecs take in the corb and the handling of the rirb are the same
+	code in both.
+
+	No constructor, like CodecShadow: zeroed memory is a transport with no rings, that init() and then
+	setCorb() and setRirb() set up.
+*/
+
+#define HDAC_CODEC_MAX				16
+
+#define HDAC_RIRB_MISSED_MAX		4		// rirb interrupts that may fail to show before we poll instead
+
+#define HDAC_IMMEDIATE_MAX_DEFAULT	1		// command lists up to this long go through the immediate interface
+#define HDAC_IMMEDIATE_TIMEOUT		1000	// us for one verb, a link frame is 20.8
+#define HDAC_IMMEDIATE_FAILED_MAX	4		// failures before we stay on the corb for good
+
+/* Hold a response from a verb sent to a codec received via the rirb. */
+typedef struct _RirbResponse {
+	UInt32 response;
+	UInt32 response_ex;
+} RirbResponse;
+
+#define HDAC_RIRB_RESPONSE_EX_SDATA_IN_MASK		0x0000000f
+#define HDAC_RIRB_RESPONSE_EX_SDATA_IN_OFFSET	0
+#define HDAC_RIRB_RESPONSE_EX_UNSOLICITED		0x00000010
+
+#define HDAC_RIRB_RESPONSE_EX_SDATA_IN(response_ex)					\
+		(((response_ex) & HDAC_RIRB_RESPONSE_EX_SDATA_IN_MASK) >>	\
+		HDAC_RIRB_RESPONSE_EX_SDATA_IN_OFFSET)
+
+/* This structure holds the list of verbs that are to be sent to the codec
+ * via the corb and the responses received via the rirb. It's allocated by
+ * the codec driver and is owned by it. */
+typedef struct _CommandList {
+	int numCommands;
+	UInt32 *verbs;
+	UInt32 *responses;
+} CommandList;
+
+class VoodooHDADevice;
+
+class CommandTransport {
+public:
+	void	init(VoodooHDADevice *device, int immediateMax);
+	// after the controller's ring pointers were reset
+	void	setCorb(UInt32 *corb, int size);
+	void	setRirb(RirbResponse *rirb, int size);
+	// whether sendCommandLists() may sleep for the rirb interrupt
+	void	setRirbInterrupts(bool on) { mRirbInterrupts = on; }
+
+	void	startCorb();
+	bool	stopCorb();
+	// the controller stopped it
+	void	corbStopped() { mCorbRunning = false; }
+
+	// lists is indexed by codec address, NULL for codecs with nothing to send
+	void	sendCommandLists(CommandList **lists);
+
+	// with the rirb lock held
+	int		rirbFlush();
+	int		rirbInterrupt();
+
+private:
+	typedef struct {
+		CommandList *commands;
+		int numVerbsSent;
+		int numRespReceived;
+	} Queue;
+
+	VoodooHDADevice *mDevice;
+
+	UInt32	*mCorb;
+	int		mCorbSize;
+	int		mCorbWritePtr;
+	bool	mCorbRunning;			// stopped while the immediate interface is in use
+
+	RirbResponse *mRirb;
+	int		mRirbSize;
+	int		mRirbReadPtr;
+	bool	mRirbInterrupts;		// sendCommandLists sleeps for the rirb interrupt rather than polling
+	int		mRirbMissed;
+
+	int		mImmediateMax;			// command lists up to this long use the immediate interface, 0 = never
+	int		mImmediateFailed;
+
+	Queue	mQueues[HDAC_CODEC_MAX];	// by codec address, under the rirb lock
+
+	bool	sendCommandsImmediate(CommandList *commands);
+	void	sendCommandsCorb(CommandList **lists);
+	int		rirbPending();
+	void	rirbWait(UInt32 timeoutUs);
+
+	/* The hooks, defined by whoever builds this file */
+	UInt8	readData8(UInt32 reg);
+	UInt16	readData16(UInt32 reg);
+	UInt32	readData32(UInt32 reg);
+	void	writeData8(UInt32 reg, UInt8 value);
+	void	writeData16(UInt32 reg, UInt16 value);
+	void	writeData32(UInt32 reg, UInt32 value);
+	void	delay(UInt32 us);
+	void	syncCorb(bool written);		// before the verbs go into it and after
+	void	lockRirb();
+	void	unlockRirb();
+	UInt64	rirbDeadline(UInt32 timeoutUs);
+	// with the rirb lock held, which it drops while asleep; false once deadline has passed
+	bool	rirbSleep(UInt64 deadline);
+	void	queueUnsolicited(int cad, UInt32 response);
+	void	unsolicitedQueued();
+	void	errorMsg(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+};
+
+#endif
@@ -0,0 +1,16 @@
+#include "License.h"
+
+#ifndef __Defaults_h__
+#define __Defaults_h__
+
+/*
+	Defaults of the Info.plist settings that the driver also falls back on when a key is missing. Info.plist is
+	run through the preprocessor with this file as its prefix header (INFOPLIST_PREFIX_HEADER), so the two
+	can't drift apart. Plain #defines only, with the comments above them: the traditional preprocessor leaves
+	a // comment in the value.
+*/
+
+/* kPCMResamplerQualityMedium */
+#define kSoftwareSRCDefault		16
+
+#endif
@@ -4,6 +4,7 @@
 #define __PCMBlitterLib_h__
 
 #include <IOKit/IOTypes.h>
+#include <string.h>
 
 typedef float	Float32;
 typedef double	Float64;
@@ -121,7 +122,7 @@ public:
 
 class PCMSInt32Swap {
 public:
-	typedef UInt32 value_type;
+	typedef SInt32 value_type;
 	
 	static value_type load(const value_type *p)
 	{
@@ -144,8 +145,8 @@ public:
 			UInt32	i[2];
 		} u;
 		UInt32 *p = (UInt32 *)vp;
-		u.i[0] = PCMSInt32Swap::load(p + 1);
-		u.i[1] = PCMSInt32Swap::load(p + 0);
+		u.i[0] = PCMSInt32Swap::load((SInt32 *)p + 1);
+		u.i[1] = PCMSInt32Swap::load((SInt32 *)p + 0);
 		return u.d;
 	}
 	static void store(value_type *vp, value_type val) {
@@ -155,8 +156,8 @@ public:
 		} u;
 		u.d = val;
 		UInt32 *p = (UInt32 *)vp;
-		PCMSInt32Swap::store(p + 1, u.i[0]);
-		PCMSInt32Swap::store(p + 0, u.i[1]);
+		PCMSInt32Swap::store((SInt32 *)p + 1, u.i[0]);
+		PCMSInt32Swap::store((SInt32 *)p + 0, u.i[1]);
 	}
 };
 
@@ -410,6 +411,43 @@ void	SwapInt32ToFloat32_X86(const SInt32 *src, Float32 *dest, unsigned int count
 void	Float32ToNativeInt32_X86(const Float32 *src, SInt32 *dest, unsigned int count);
 void	Float32ToSwapInt32_X86(const Float32 *src, SInt32 *dest, unsigned int count);
 
+// The SSSE3 and AVX2 kernels need a compiler which understands the target attribute;
+// the gcc 4.2 builds go without.
+#if defined(__clang__) || (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))
+#define PCMBLITTER_SSSE3 1
+#define PCMBLITTER_AVX2 1
+#else
+#define PCMBLITTER_SSSE3 0
+#define PCMBLITTER_AVX2 0
+#endif
+
+#pragma mark -
+#pragma mark X86 SSSE3
+// ____________________________________________________________________________________
+// X86 SSSE3
+void	NativeInt24ToFloat32_SSSE3(const UInt8 *src, Float32 *dest, unsigned int count);
+void	SwapInt24ToFloat32_SSSE3(const UInt8 *src, Float32 *dest, unsigned int count);
+
+#pragma mark -
+#pragma mark X86 AVX2
+// ____________________________________________________________________________________
+// X86 AVX2
+
+void	NativeInt16ToFloat32_AVX2(const SInt16 *src, Float32 *dest, unsigned int count);
+void	SwapInt16ToFloat32_AVX2(const SInt16 *src, Float32 *dest, unsigned int count);
+void	Float32ToNativeInt16_AVX2(const Float32 *src, SInt16 *dest, unsigned int count);
+void	Float32ToSwapInt16_AVX2(const Float32 *src, SInt16 *dest, unsigned int count);
+
+void	Float32ToNativeInt24_AVX2(const Float32 *src, UInt8 *dest, unsigned int count);
+void	Float32ToSwapInt24_AVX2(const Float32 *src, UInt8 *dest, unsigned int count);
+void	NativeInt24ToFloat32_AVX2(const UInt8 *src, Float32 *dest, unsigned int count);
+void	SwapInt24ToFloat32_AVX2(const UInt8 *src, Float32 *dest, unsigned int count);
+
+void	NativeInt32ToFloat32_AVX2(const SInt32 *src, Float32 *dest, unsigned int count);
+void	SwapInt32ToFloat32_AVX2(const SInt32 *src, Float32 *dest, unsigned int count);
+void	Float32ToNativeInt32_AVX2(const Float32 *src, SInt32 *dest, unsigned int count);
+void	Float32ToSwapInt32_AVX2(const Float32 *src, SInt32 *dest, unsigned int count);
+
 #pragma mark -
 #pragma mark Portable
 // ____________________________________________________________________________________
@@ -429,8 +467,474 @@ void	Float32ToSwapInt32_Portable(const Float32 *src, SInt32 *dest, unsigned int
 void	NativeInt32ToFloat32_Portable(const SInt32 *src, Float32 *dest, unsigned int count);
 void	SwapInt32ToFloat32_Portable(const SInt32 *src, Float32 *dest, unsigned int count);
 
+#pragma mark -
+#pragma mark Fused output
+// ____________________________________________________________________________________
+// Fused output
+//
+// What clipOutputSamples does to the mix on its way to the DMA buffer, in one pass and without
+// writing the mix back: each (even, odd) sample pair is crossfed as L += R * crossfeed, then
+// R += L * crossfeed, the result is multiplied by gain, converted, and ANDed with noiseMask at
+// the width of the output sample.
+typedef struct PCMOutputProcessing {
+	Float32	gain;			// 1.0 = unity
+	Float32	crossfeed;		// 0.0 = off; otherwise the sample count must be even
+	SInt32	noiseMask;		// ~0 = off
+} PCMOutputProcessing;
+
+void	Float32ToNativeInt16Fused_X86(const Float32 *src, SInt16 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+void	Float32ToSwapInt16Fused_X86(const Float32 *src, SInt16 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+void	Float32ToNativeInt24Fused_X86(const Float32 *src, UInt8 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+void	Float32ToSwapInt24Fused_X86(const Float32 *src, UInt8 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+void	Float32ToNativeInt32Fused_X86(const Float32 *src, SInt32 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+void	Float32ToSwapInt32Fused_X86(const Float32 *src, SInt32 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+
+void	Float32ToInt8Fused_Portable(const Float32 *src, SInt8 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+void	Float32ToNativeInt16Fused_Portable(const Float32 *src, SInt16 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+void	Float32ToSwapInt16Fused_Portable(const Float32 *src, SInt16 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+void	Float32ToNativeInt24Fused_Portable(const Float32 *src, UInt8 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+void	Float32ToSwapInt24Fused_Portable(const Float32 *src, UInt8 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+void	Float32ToNativeInt32Fused_Portable(const Float32 *src, SInt32 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+void	Float32ToSwapInt32Fused_Portable(const Float32 *src, SInt32 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+
+// float -> float with the same crossfeed and gain (no mask), for float output
+void	ProcessFloat32_Portable(const Float32 *src, Float32 *dest, unsigned int count,
+			const PCMOutputProcessing *proc);
+
+#pragma mark -
+#pragma mark Fused input
+// ____________________________________________________________________________________
+// Fused input
+//
+// The input side of the above, for convertInputSamples: every sample is ANDed with noiseMask (at the
+// width of the input sample), converted, and multiplied by gain; with a channelMap, channel c of each
+// output frame is taken from channel channelMap[c] of the input frame (the count must then be whole
+// frames). The source, usually the DMA buffer, is only read. The SSE2 and portable versions produce
+// identical floats.
+#define kPCMMaxMappedChannels	16
+
+typedef struct PCMInputProcessing {
+	Float32	gain;			// 1.0 = unity
+	SInt32	noiseMask;		// ~0 = off
+	UInt32	numChannels;	// frame size, only used with channelMap; at most kPCMMaxMappedChannels
+	const UInt8	*channelMap;	// NULL = identity
+} PCMInputProcessing;
+
+void	NativeInt16ToFloat32Fused_X86(const SInt16 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+void	SwapInt16ToFloat32Fused_X86(const SInt16 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+void	NativeInt24ToFloat32Fused_X86(const UInt8 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+void	SwapInt24ToFloat32Fused_X86(const UInt8 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+void	NativeInt32ToFloat32Fused_X86(const SInt32 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+void	SwapInt32ToFloat32Fused_X86(const SInt32 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+
+void	Int8ToFloat32Fused_Portable(const SInt8 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+void	NativeInt16ToFloat32Fused_Portable(const SInt16 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+void	SwapInt16ToFloat32Fused_Portable(const SInt16 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+void	NativeInt24ToFloat32Fused_Portable(const UInt8 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+void	SwapInt24ToFloat32Fused_Portable(const UInt8 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+void	NativeInt32ToFloat32Fused_Portable(const SInt32 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+void	SwapInt32ToFloat32Fused_Portable(const SInt32 *src, Float32 *dest, unsigned int count,
+			const PCMInputProcessing *proc);
+
+#pragma mark -
+#pragma mark Runtime dispatch
+// ____________________________________________________________________________________
+// Runtime dispatch
+//
+// The kernels actually used by PCMBlitterLibDispatch.h are looked up in gPCMBlitterKernels,
+// which PCMBlitterInitDispatch() fills in once at load time from CPUID (and, optionally,
+// from a short timing run of every candidate). Until then it points at the SSE2 kernels.
+enum {
+	kPCMBlitterTierPortable = 0,
+	kPCMBlitterTierSSE2,
+	kPCMBlitterTierSSSE3,
+	kPCMBlitterTierAVX2,
+	kPCMBlitterTierAVX512,
+	kPCMBlitterNumTiers
+};
+
+typedef struct PCMBlitterKernels {
+	void	(*NativeInt16ToFloat32)(const SInt16 *src, Float32 *dest, unsigned int count);
+	void	(*SwapInt16ToFloat32)(const SInt16 *src, Float32 *dest, unsigned int count);
+	void	(*NativeInt24ToFloat32)(const UInt8 *src, Float32 *dest, unsigned int count);
+	void	(*SwapInt24ToFloat32)(const UInt8 *src, Float32 *dest, unsigned int count);
+	void	(*NativeInt32ToFloat32)(const SInt32 *src, Float32 *dest, unsigned int count);
+	void	(*SwapInt32ToFloat32)(const SInt32 *src, Float32 *dest, unsigned int count);
+
+	void	(*Float32ToNativeInt16)(const Float32 *src, SInt16 *dest, unsigned int count);
+	void	(*Float32ToSwapInt16)(const Float32 *src, SInt16 *dest, unsigned int count);
+	void	(*Float32ToNativeInt24)(const Float32 *src, UInt8 *dest, unsigned int count);
+	void	(*Float32ToSwapInt24)(const Float32 *src, UInt8 *dest, unsigned int count);
+	void	(*Float32ToNativeInt32)(const Float32 *src, SInt32 *dest, unsigned int count);
+	void	(*Float32ToSwapInt32)(const Float32 *src, SInt32 *dest, unsigned int count);
+} PCMBlitterKernels;
+
+extern PCMBlitterKernels gPCMBlitterKernels;
+
+int		PCMBlitterCPUTier(void);
+int		PCMBlitterInitDispatch(int maxTier, Boolean benchmark);
+const char *PCMBlitterTierName(int tier);
+
 #ifdef __cplusplus
 };
 #endif
 
+#ifdef __cplusplus
+#pragma mark -
+#pragma mark Compile-time kernels
+// ____________________________________________________________________________
+//
+// TPCMSample: an integer sample format with its width and byte order fixed at compile time.
+// In registers a sample is always left-justified to 32 bits, so that every width shares the same
+// conversion arithmetic; the switches below fold away in each instantiation.
+template <int kBits, bool kSwap>
+class TPCMSample {
+public:
+	enum { kBitDepth = kBits, kBytes = (kBits + 7) / 8, kSwapped = kSwap };
+
+	static SInt32 load(const UInt8 *p, unsigned int i)
+	{
+		switch ((int)kBytes) {
+			case 1:
+				return (SInt32)((UInt32)p[i] << 24);
+			case 2:
+				if (kSwap)
+					return (SInt32)((UInt32)OSReadSwapInt16(p, 2 * i) << 16);
+				return (SInt32)((UInt32)((const UInt16 *)p)[i] << 16);
+			case 3:
+				p += 3 * i;
+				if (kSwap)
+					return (SInt32)(((UInt32)p[0] << 24) | (p[1] << 16) | (p[2] << 8));
+				return (SInt32)((p[0] << 8) | (p[1] << 16) | ((UInt32)p[2] << 24));
+			default:
+				if (kSwap)
+					return (SInt32)OSReadSwapInt32(p, 4 * i);
+				return ((const SInt32 *)p)[i];
+		}
+	}
+	// only the top kBits of value are stored
+	static void store(UInt8 *p, unsigned int i, SInt32 value)
+	{
+		UInt32 v = (UInt32)value;
+
+		switch ((int)kBytes) {
+			case 1:
+				p[i] = (UInt8)(v >> 24);
+				break;
+			case 2:
+				if (kSwap)
+					OSWriteSwapInt16(p, 2 * i, (UInt16)(v >> 16));
+				else
+					((UInt16 *)p)[i] = (UInt16)(v >> 16);
+				break;
+			case 3:
+				p += 3 * i;
+				if (kSwap) {
+					p[0] = (UInt8)(v >> 24);
+					p[1] = (UInt8)(v >> 16);
+					p[2] = (UInt8)(v >> 8);
+				} else {
+					p[0] = (UInt8)(v >> 8);
+					p[1] = (UInt8)(v >> 16);
+					p[2] = (UInt8)(v >> 24);
+				}
+				break;
+			default:
+				if (kSwap)
+					OSWriteSwapInt32(p, 4 * i, v);
+				else
+					((UInt32 *)p)[i] = v;
+				break;
+		}
+	}
+};
+
+typedef TPCMSample<8, false>	PCMSample8;
+typedef TPCMSample<16, false>	PCMSample16Native;
+typedef TPCMSample<16, true>	PCMSample16Swap;
+typedef TPCMSample<24, false>	PCMSample24Native;
+typedef TPCMSample<24, true>	PCMSample24Swap;
+typedef TPCMSample<32, false>	PCMSample32Native;
+typedef TPCMSample<32, true>	PCMSample32Swap;
+
+// ____________________________________________________________________________
+//
+// The vector operations TPCMKernel is written in, kWidth samples at a time: Floats and Ints hold
+// kWidth floats and kWidth converted samples. PCMScalarOps works on one sample and rounds to int in
+// double precision, like TFloatToIntBlitter; PCMSSE2Ops (PCMBlitterLibX86.cpp) and PCMAVX2Ops
+// (PCMBlitterLibAVX2.cpp) are the same operations eight samples at a time.
+//
+// ToInts rounds and clips for the output sample, under SET_ROUNDMODE, into whatever layout StoreInts
+// and OutputMask use; LoadInts returns samples left-justified to 32 bits, as TPCMSample::load does.
+class PCMScalarOps {
+public:
+	enum { kWidth = 1 };
+	typedef Float32	Floats;
+	typedef SInt32	Ints;
+
+	static Floats Load(const Float32 *p) { return *p; }
+	static void Store(Float32 *p, Floats v) { *p = v; }
+	static Floats Set(Float32 f) { return f; }
+	static Floats Add(Floats a, Floats b) { return a + b; }
+	static Floats Mul(Floats a, Floats b) { return a * b; }
+	// a and b hold kWidth (left, right) pairs; l and r their left and right samples, in order
+	static void Deinterleave(Floats a, Floats b, Floats &l, Floats &r) { l = a; r = b; }
+	static void Interleave(Floats l, Floats r, Floats &a, Floats &b) { a = l; b = r; }
+	// a single sample has no pair to swap with, TPCMKernel never asks
+	static Floats SwapPairs(Floats v) { return v; }
+
+	static Ints SetInts(SInt32 i) { return i; }
+	static Ints And(Ints a, Ints b) { return a & b; }
+	static Floats ToFloats(Ints v) { return (Float32)v * (1.0f / 2147483648.0f); }
+
+	template <class Sample> static Ints OutputMask(SInt32 noiseMask)
+	{
+		return (SInt32)((UInt32)noiseMask << (32 - Sample::kBitDepth));
+	}
+	template <class Sample> static Ints ToInts(Floats f)
+	{
+		const double round = (Sample::kBitDepth < 32) ? 2147483648.0 / (double)(1ULL << Sample::kBitDepth) : 0.;
+
+		return FloatToInt((double)f * 2147483648.0 + round, -2147483648.0, 2147483648.0 - 1.0 - round);
+	}
+	template <class Sample> static void StoreInts(UInt8 *p, Ints v) { Sample::store(p, 0, v); }
+	template <class Sample> static Ints LoadInts(const UInt8 *p) { return Sample::load(p, 0); }
+};
+
+// ____________________________________________________________________________
+//
+// TPCMKernel: the conversion loops, specialized at compile time on the sample format, the channel
+// count (0 = whatever the processing says, 1 = mono: no crossfeed and no channel map), on whether
+// the processing in PCMOutputProcessing/PCMInputProcessing is applied at all, and on the vector
+// operations above. No virtual calls; the portable kernels in PCMBlitterLib.cpp, the SSE2 fused
+// ones and the AVX2 ones are all instantiations of this.
+//
+// Whatever the operations, the crossfeed and gain arithmetic runs in the same order and under the
+// same rounding mode, and int -> float is exact for up to 24 bits and rounds 32-bit samples like
+// cvtdq2ps, so the floats always agree; the scalar and vector kernels only differ in the final
+// rounding to int, just as the plain kernels differ from the templates above. Whatever is left over
+// after the last whole vector is done by the last vector again, overlapping the one before, which
+// writes the same values over it (with crossfeed, the last pair of vectors, if that keeps the
+// pairs); only blocks shorter than that go through a bounce buffer. So the tail gets the same
+// arithmetic and nothing past either end of the buffers is touched.
+#define kPCMKernelBlockSamples	128
+
+template <class Sample, int kChannels, bool kProcessed, class Ops = PCMScalarOps>
+class TPCMKernel {
+public:
+	typedef typename Ops::Floats	Floats;
+	typedef typename Ops::Ints		Ints;
+
+	// samples per pass of the loops: two vectors, or four samples like the templates above
+	enum { kWidth = Ops::kWidth, kBytes = Sample::kBytes, kStep = (kWidth == 1) ? 4 : 2 * kWidth };
+
+	static void Float32ToInt(const Float32 * __restrict src, UInt8 * __restrict dest, unsigned int count,
+			const PCMOutputProcessing *proc)
+	{
+		Floats gain = Ops::Set(1.0f), cross = Ops::Set(0.0f);
+		Ints mask = Ops::SetInts(~0);
+		bool crossfeed = false;
+		unsigned int j;
+
+		if (kProcessed) {
+			mask = Ops::template OutputMask<Sample>(proc->noiseMask);
+			gain = Ops::Set(proc->gain);
+			if (kChannels != 1 && proc->crossfeed != 0.0f) {
+				cross = Ops::Set(proc->crossfeed);
+				crossfeed = true;
+			}
+		}
+
+		SET_ROUNDMODE
+		// a step is two vectors, which crossfeed needs to have whole pairs in each
+		for (j = count; count >= kStep; count -= kStep, src += kStep, dest += kStep * kBytes)
+			Float32ToIntSteps(src, dest, kStep, gain, cross, mask, crossfeed);
+		// without it the rest can go a vector at a time
+		if (!crossfeed) {
+			for (; count >= kWidth; count -= kWidth, src += kWidth, dest += kWidth * kBytes)
+				Float32ToIntVector(src, dest, gain, mask);
+		}
+		if (count == 0) {
+			// nothing left
+		} else if (!crossfeed && j >= kWidth) {
+			// the last vector again, overlapping the one before
+			Float32ToIntVector(src - (kWidth - count), dest - (kWidth - count) * kBytes, gain, mask);
+		} else if (crossfeed && j >= kStep && !(count & 1)) {
+			// the last pass again, overlapping the one before, which keeps the pairs
+			Float32ToIntSteps(src - (kStep - count), dest - (kStep - count) * kBytes, kStep, gain, cross, mask,
+					crossfeed);
+		} else {
+			Float32 in[kStep];
+			UInt8 out[kStep * kBytes];
+			memset(in, 0, sizeof(in));
+			memcpy(in, src, count * sizeof(Float32));
+			Float32ToIntSteps(in, out, count, gain, cross, mask, crossfeed);
+			memcpy(dest, out, count * kBytes);
+		}
+		RESTORE_ROUNDMODE
+	}
+
+	// with a channel map, only whole frames are converted
+	static void IntToFloat32(const UInt8 * __restrict src, Float32 * __restrict dest, unsigned int count,
+			const PCMInputProcessing *proc)
+	{
+		const UInt8 *map = NULL;
+		SInt32 mask = ~0;
+		Float32 gain = 1.0f;
+		Float32 block[kPCMKernelBlockSamples];
+		unsigned int c, f, n = kChannels, frames, todo;
+		bool swapPairs = false;
+
+		if (kProcessed) {
+			mask = (SInt32)((UInt32)proc->noiseMask << (32 - Sample::kBitDepth));
+			gain = proc->gain;
+			if (kChannels != 1)
+				map = proc->channelMap;
+			if (!kChannels)
+				n = proc->numChannels;
+			if (n == 0 || n > kPCMMaxMappedChannels)
+				map = NULL;
+		}
+		// the L/R swap is a shuffle in registers, if a vector holds whole pairs
+		if (map && !(kWidth & 1) && n == 2 && map[0] == 1 && map[1] == 0) {
+			map = NULL;
+			swapPairs = true;
+		}
+
+		if (!map) {
+			if (swapPairs)
+				IntToFloat32Run<true>(src, dest, count, mask, gain);
+			else
+				IntToFloat32Run<false>(src, dest, count, mask, gain);
+			return;
+		}
+		// any other map converts whole frames into a block and gathers from there
+		frames = (kPCMKernelBlockSamples / n) * n;
+		while (count >= n) {
+			todo = (count < frames) ? count - count % n : frames;
+			IntToFloat32Run<false>(src, block, todo, mask, gain);
+			for (f = 0; f < todo; f += n) {
+				for (c = 0; c < n; c++)
+					dest[f + c] = block[f + map[c]];
+			}
+			src += todo * kBytes;
+			dest += todo;
+			count -= todo;
+		}
+	}
+
+private:
+	// count samples, rounded up to whole steps
+	static inline void Float32ToIntSteps(const Float32 * __restrict src, UInt8 * __restrict dest,
+			unsigned int count, const Floats &gain, const Floats &cross, const Ints &mask, bool crossfeed)
+	{
+		for (unsigned int j = 0; j < count; j += 2 * kWidth)
+			Float32ToIntStep(src + j, dest + j * kBytes, gain, cross, mask, crossfeed);
+	}
+
+	static inline void Float32ToIntStep(const Float32 * __restrict src, UInt8 * __restrict dest,
+			const Floats &gain, const Floats &cross, const Ints &mask, bool crossfeed)
+	{
+		Floats a = Ops::Load(src), b = Ops::Load(src + kWidth), l, r;
+
+		if (crossfeed) {
+			Ops::Deinterleave(a, b, l, r);
+			l = Ops::Add(l, Ops::Mul(r, cross));
+			r = Ops::Add(r, Ops::Mul(l, cross));
+			Ops::Interleave(l, r, a, b);
+		}
+		Float32ToIntStore(a, dest, gain, mask);
+		Float32ToIntStore(b, dest + kWidth * kBytes, gain, mask);
+	}
+
+	static inline void Float32ToIntVector(const Float32 * __restrict src, UInt8 * __restrict dest,
+			const Floats &gain, const Ints &mask)
+	{
+		Float32ToIntStore(Ops::Load(src), dest, gain, mask);
+	}
+
+	static inline void Float32ToIntStore(Floats f, UInt8 * __restrict dest, const Floats &gain, const Ints &mask)
+	{
+		Ints v;
+
+		if (kProcessed)
+			f = Ops::Mul(f, gain);
+		v = Ops::template ToInts<Sample>(f);
+		if (kProcessed)
+			v = Ops::And(v, mask);
+		Ops::template StoreInts<Sample>(dest, v);
+	}
+
+	static inline void IntToFloat32Step(const UInt8 * __restrict src, Float32 * __restrict dest,
+			const Ints &mask, const Floats &gain, bool swapPairs)
+	{
+		Ints v = Ops::template LoadInts<Sample>(src);
+		Floats f;
+
+		if (kProcessed)
+			v = Ops::And(v, mask);
+		f = Ops::ToFloats(v);
+		if (kProcessed)
+			f = Ops::Mul(f, gain);
+		if (swapPairs)
+			f = Ops::SwapPairs(f);
+		Ops::Store(dest, f);
+	}
+
+	template <bool kSwapPairs>
+	static inline void IntToFloat32Run(const UInt8 * __restrict src, Float32 * __restrict dest,
+			unsigned int count, SInt32 mask, Float32 gain)
+	{
+		const Ints vmask = Ops::SetInts(mask);
+		const Floats vgain = Ops::Set(gain);
+		unsigned int total = count, j;
+
+		for (; count >= kStep; count -= kStep, src += kStep * kBytes, dest += kStep) {
+			for (j = 0; j < kStep; j += kWidth)
+				IntToFloat32Step(src + j * kBytes, dest + j, vmask, vgain, kSwapPairs);
+		}
+		for (; count >= kWidth; count -= kWidth, src += kWidth * kBytes, dest += kWidth)
+			IntToFloat32Step(src, dest, vmask, vgain, kSwapPairs);
+		if (count == 0)
+			return;
+		// the last vector again, overlapping the one before, as long as that keeps the pairs
+		if (total >= kWidth && !(kSwapPairs && (count & 1))) {
+			IntToFloat32Step(src - (kWidth - count) * kBytes, dest - (kWidth - count), vmask, vgain, kSwapPairs);
+		} else {
+			UInt8 in[kWidth * kBytes];
+			Float32 out[kWidth];
+			memset(in, 0, sizeof(in));
+			memcpy(in, src, count * kBytes);
+			IntToFloat32Step(in, out, vmask, vgain, kSwapPairs);
+			memcpy(dest, out, count * sizeof(Float32));
+		}
+	}
+};
+#endif // __cplusplus
+
 #endif // __PCMBlitterLib_h__
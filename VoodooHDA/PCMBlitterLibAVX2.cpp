@@ -0,0 +1,301 @@
+#include "License.h"
+#ifndef TIGER
+#include <TargetConditionals.h>
+#endif
+
+// TPCMKernel has no target attribute of its own, so the compiler warns about the AVX vectors it
+// passes around; it never exists on its own here, flatten inlines it into the AVX2 functions below.
+#if defined(__clang__)
+#if __has_warning("-Wpsabi")
+#pragma clang diagnostic ignored "-Wpsabi"
+#endif
+#else
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+#include "PCMBlitterLib.h"
+
+/*
+	AVX2 int<->float blitters.
+
+	These are TPCMKernel (PCMBlitterLib.h) instantiated on PCMAVX2Ops, eight samples in one register.
+	They do the same arithmetic as the SSE2 ones in PCMBlitterLibX86.cpp and produce bit-identical
+	output: the same multiply/round/clamp sequence under the same MXCSR rounding mode, and the same
+	(exact) int->float scaling. Blocks shorter than one vector are handed to the SSE2 kernel, whose
+	scalar path for them rounds differently, so that they, too, come out exactly as before.
+
+	The packed 24-bit inputs have no SSE2 kernel; theirs match the SSSE3 (and portable) ones.
+
+	The functions carry their own target attribute, so this file needs no special compiler flags
+	and the rest of the driver still runs on SSE2-only machines; flatten pulls the kernel template
+	and the operations into them, where they may use AVX2 too. Only called when
+	PCMBlitterInitDispatch() has found AVX2 (and OS support for it).
+*/
+
+#if PCMBLITTER_AVX2
+
+#define _MM_MALLOC_H_INCLUDED 1	// we don't want this header
+#define __MM_MALLOC_H 1
+#include <immintrin.h>
+#include <string.h>
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+#define AVX2_KERNEL __attribute__((target("avx2"), flatten))
+
+#define kMaxFloat32 2147483520.0f
+	// this is the biggest floating point number that result from a 32-bit int (bits are lost)
+	// it's 2^31 - 128
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Helpers
+
+static inline AVX2_TARGET __m256i ByteSwap16(__m256i v)
+{
+	const __m256i shuf = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+			1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	return _mm256_shuffle_epi8(v, shuf);
+}
+
+static inline AVX2_TARGET __m256i ByteSwap32(__m256i v)
+{
+	const __m256i shuf = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	return _mm256_shuffle_epi8(v, shuf);
+}
+
+// scale, round, clip and convert; the caller has set ROUNDMODE_NEG_INF (see F32TOLE16/F32TOLE32)
+static inline AVX2_TARGET __m256i F32ToI32(__m256 vf, Float32 scale, Float32 max)
+{
+	vf = _mm256_mul_ps(vf, _mm256_set1_ps(scale));
+	vf = _mm256_add_ps(vf, _mm256_set1_ps(0.5f));
+	vf = _mm256_max_ps(vf, _mm256_set1_ps(-scale));
+	vf = _mm256_min_ps(vf, _mm256_set1_ps(max));
+	return _mm256_cvtps_epi32(vf);
+}
+
+// 8 ints -> 8 shorts, in the low half
+static inline AVX2_TARGET __m256i Pack8(__m256i vi)
+{
+	return _mm256_castsi128_si256(_mm_packs_epi32(_mm256_castsi256_si128(vi), _mm256_extracti128_si256(vi, 1)));
+}
+
+// 8 ints -> 24 bytes (low 3/4 of the result), taking bytes [first, first + 2] of each int
+static inline AVX2_TARGET __m256i Pack24(__m256i vi, const __m256i shuf)
+{
+	vi = _mm256_shuffle_epi8(vi, shuf);
+	return _mm256_permutevar8x32_epi32(vi, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+}
+
+static inline AVX2_TARGET void Store24(UInt8 *dst, __m256i v)
+{
+	_mm_storeu_si128((__m128i *) dst, _mm256_castsi256_si128(v));
+	_mm_storel_epi64((__m128i *) (dst + 16), _mm256_extracti128_si256(v, 1));
+}
+
+// 24 bytes -> 8 ints, left-justified; byte 0 feeds the low lane and byte 8 the high one, so nothing
+// past the 24th byte is read (see PCMBlitterLibSSSE3.cpp)
+static inline AVX2_TARGET __m256i Load24(const UInt8 *src, const __m256i shuf)
+{
+	__m256i vi = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i const *) src)),
+			_mm_loadu_si128((__m128i const *) (src + 8)), 1);
+	return _mm256_shuffle_epi8(vi, shuf);
+}
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Vector operations
+
+// TPCMKernel's operations (see PCMScalarOps) on eight samples in one register; 16-bit samples are
+// packed into the low half.
+class PCMAVX2Ops {
+public:
+	enum { kWidth = 8 };
+	typedef __m256	Floats;
+	typedef __m256i	Ints;
+
+	static inline AVX2_TARGET Floats Load(const Float32 *p) { return _mm256_loadu_ps(p); }
+	static inline AVX2_TARGET void Store(Float32 *p, Floats v) { _mm256_storeu_ps(p, v); }
+	static inline AVX2_TARGET Floats Set(Float32 f) { return _mm256_set1_ps(f); }
+	static inline AVX2_TARGET Floats Add(Floats a, Floats b) { return _mm256_add_ps(a, b); }
+	static inline AVX2_TARGET Floats Mul(Floats a, Floats b) { return _mm256_mul_ps(a, b); }
+	static inline AVX2_TARGET void Deinterleave(Floats a, Floats b, Floats &l, Floats &r)
+	{
+		// shufps works per 128-bit lane: L0 L1 L4 L5 L2 L3 L6 L7, put back in order
+		l = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b,
+				_MM_SHUFFLE(2, 0, 2, 0))), 0xD8));
+		r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_shuffle_ps(a, b,
+				_MM_SHUFFLE(3, 1, 3, 1))), 0xD8));
+	}
+	static inline AVX2_TARGET void Interleave(Floats l, Floats r, Floats &a, Floats &b)
+	{
+		Floats lo = _mm256_unpacklo_ps(l, r), hi = _mm256_unpackhi_ps(l, r);
+		a = _mm256_permute2f128_ps(lo, hi, 0x20);
+		b = _mm256_permute2f128_ps(lo, hi, 0x31);
+	}
+	static inline AVX2_TARGET Floats SwapPairs(Floats v) { return _mm256_permute_ps(v, _MM_SHUFFLE(2, 3, 0, 1)); }
+
+	static inline AVX2_TARGET Ints SetInts(SInt32 i) { return _mm256_set1_epi32(i); }
+	static inline AVX2_TARGET Ints And(Ints a, Ints b) { return _mm256_and_si256(a, b); }
+	static inline AVX2_TARGET Floats ToFloats(Ints v)
+	{
+		return _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(1.0f / 2147483648.0f));
+	}
+
+	template <class Sample> static inline AVX2_TARGET Ints OutputMask(SInt32 noiseMask)
+	{
+		if (Sample::kBitDepth == 16)
+			return _mm256_set1_epi16((short) noiseMask);
+		return SetInts((SInt32)((UInt32)noiseMask << (32 - Sample::kBitDepth)));
+	}
+
+	template <class Sample> static inline AVX2_TARGET Ints ToInts(Floats f)
+	{
+		if (Sample::kBitDepth == 16)
+			return Pack8(F32ToI32(f, 32768.0f, 32767.0f));
+		return F32ToI32(f, 2147483648.0f, kMaxFloat32);
+	}
+
+	template <class Sample> static inline AVX2_TARGET void StoreInts(UInt8 *p, Ints v)
+	{
+		// high three bytes of each int, little or big endian (as Pack32ToLE24)
+		const __m256i shufLE = _mm256_setr_epi8(1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1,
+				1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1);
+		const __m256i shufBE = _mm256_setr_epi8(3, 2, 1, 7, 6, 5, 11, 10, 9, 15, 14, 13, -1, -1, -1, -1,
+				3, 2, 1, 7, 6, 5, 11, 10, 9, 15, 14, 13, -1, -1, -1, -1);
+
+		switch ((int)Sample::kBytes) {
+			case 2:
+				if (Sample::kSwapped)
+					v = ByteSwap16(v);
+				_mm_storeu_si128((__m128i *) p, _mm256_castsi256_si128(v));
+				break;
+			case 3:
+				Store24(p, Pack24(v, Sample::kSwapped ? shufBE : shufLE));
+				break;
+			default:
+				_mm256_storeu_si256((__m256i *) p, Sample::kSwapped ? ByteSwap32(v) : v);
+				break;
+		}
+	}
+
+	template <class Sample> static inline AVX2_TARGET Ints LoadInts(const UInt8 *p)
+	{
+		const __m256i shufLE = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+				-1, 4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15);
+		const __m256i shufBE = _mm256_setr_epi8(-1, 2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9,
+				-1, 6, 5, 4, -1, 9, 8, 7, -1, 12, 11, 10, -1, 15, 14, 13);
+		__m256i v;
+
+		switch ((int)Sample::kBytes) {
+			case 2:
+				v = _mm256_castsi128_si256(_mm_loadu_si128((__m128i const *) p));
+				if (Sample::kSwapped)
+					v = ByteSwap16(v);
+				return _mm256_slli_epi32(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(v)), 16);
+			case 3:
+				return Load24(p, Sample::kSwapped ? shufBE : shufLE);
+			default:
+				v = _mm256_loadu_si256((__m256i const *) p);
+				return Sample::kSwapped ? ByteSwap32(v) : v;
+		}
+	}
+};
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Float -> Int
+
+AVX2_KERNEL
+void Float32ToNativeInt16_AVX2(const Float32 *src, SInt16 *dst, unsigned int numToConvert)
+{
+	if (numToConvert < 8)
+		Float32ToNativeInt16_X86(src, dst, numToConvert);
+	else
+		TPCMKernel<PCMSample16Native, 1, false, PCMAVX2Ops>::Float32ToInt(src, (UInt8 *) dst, numToConvert, NULL);
+}
+
+AVX2_KERNEL
+void Float32ToSwapInt16_AVX2(const Float32 *src, SInt16 *dst, unsigned int numToConvert)
+{
+	if (numToConvert < 8)
+		Float32ToSwapInt16_X86(src, dst, numToConvert);
+	else
+		TPCMKernel<PCMSample16Swap, 1, false, PCMAVX2Ops>::Float32ToInt(src, (UInt8 *) dst, numToConvert, NULL);
+}
+
+AVX2_KERNEL
+void Float32ToNativeInt24_AVX2(const Float32 *src, UInt8 *dst, unsigned int numToConvert)
+{
+	if (numToConvert < 8)
+		Float32ToNativeInt24_X86(src, dst, numToConvert);
+	else
+		TPCMKernel<PCMSample24Native, 1, false, PCMAVX2Ops>::Float32ToInt(src, dst, numToConvert, NULL);
+}
+
+AVX2_KERNEL
+void Float32ToSwapInt24_AVX2(const Float32 *src, UInt8 *dst, unsigned int numToConvert)
+{
+	TPCMKernel<PCMSample24Swap, 1, false, PCMAVX2Ops>::Float32ToInt(src, dst, numToConvert, NULL);
+}
+
+AVX2_KERNEL
+void Float32ToNativeInt32_AVX2(const Float32 *src, SInt32 *dst, unsigned int numToConvert)
+{
+	if (numToConvert < 8)
+		Float32ToNativeInt32_X86(src, dst, numToConvert);
+	else
+		TPCMKernel<PCMSample32Native, 1, false, PCMAVX2Ops>::Float32ToInt(src, (UInt8 *) dst, numToConvert, NULL);
+}
+
+AVX2_KERNEL
+void Float32ToSwapInt32_AVX2(const Float32 *src, SInt32 *dst, unsigned int numToConvert)
+{
+	if (numToConvert < 8)
+		Float32ToSwapInt32_X86(src, dst, numToConvert);
+	else
+		TPCMKernel<PCMSample32Swap, 1, false, PCMAVX2Ops>::Float32ToInt(src, (UInt8 *) dst, numToConvert, NULL);
+}
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Int -> Float
+
+// exact, whatever the block size
+AVX2_KERNEL
+void NativeInt16ToFloat32_AVX2(const SInt16 *src, Float32 *dst, unsigned int numToConvert)
+{
+	TPCMKernel<PCMSample16Native, 1, false, PCMAVX2Ops>::IntToFloat32((const UInt8 *) src, dst, numToConvert, NULL);
+}
+
+AVX2_KERNEL
+void SwapInt16ToFloat32_AVX2(const SInt16 *src, Float32 *dst, unsigned int numToConvert)
+{
+	TPCMKernel<PCMSample16Swap, 1, false, PCMAVX2Ops>::IntToFloat32((const UInt8 *) src, dst, numToConvert, NULL);
+}
+
+AVX2_KERNEL
+void NativeInt24ToFloat32_AVX2(const UInt8 *src, Float32 *dst, unsigned int numToConvert)
+{
+	TPCMKernel<PCMSample24Native, 1, false, PCMAVX2Ops>::IntToFloat32(src, dst, numToConvert, NULL);
+}
+
+AVX2_KERNEL
+void SwapInt24ToFloat32_AVX2(const UInt8 *src, Float32 *dst, unsigned int numToConvert)
+{
+	TPCMKernel<PCMSample24Swap, 1, false, PCMAVX2Ops>::IntToFloat32(src, dst, numToConvert, NULL);
+}
+
+AVX2_KERNEL
+void NativeInt32ToFloat32_AVX2(const SInt32 *src, Float32 *dst, unsigned int numToConvert)
+{
+	TPCMKernel<PCMSample32Native, 1, false, PCMAVX2Ops>::IntToFloat32((const UInt8 *) src, dst, numToConvert, NULL);
+}
+
+AVX2_KERNEL
+void SwapInt32ToFloat32_AVX2(const SInt32 *src, Float32 *dst, unsigned int numToConvert)
+{
+	TPCMKernel<PCMSample32Swap, 1, false, PCMAVX2Ops>::IntToFloat32((const UInt8 *) src, dst, numToConvert, NULL);
+}
+
+#endif // PCMBLITTER_AVX2
@@ -0,0 +1,314 @@
+#include "License.h"
+
+#include "PCMBlitterLibDispatch.h"
+
+#include <IOKit/IOLib.h>
+#include <kern/clock.h>
+
+/*
+	This file contains the runtime selection of the int<->float blitters.
+
+	The CPU is probed once with CPUID; every format then gets the best kernel available at or below
+	the detected tier. Formats which have no kernel of their own at some tier fall through to the next
+	lower one, so a tier can be added one format at a time. If asked to, we also time every candidate
+	on a small buffer and keep the fastest one instead.
+*/
+
+#pragma mark -
+#pragma mark Kernel tables
+
+PCMBlitterKernels gPCMBlitterKernels = {
+	NativeInt16ToFloat32_X86,
+	SwapInt16ToFloat32_X86,
+	NativeInt24ToFloat32_Portable,
+	SwapInt24ToFloat32_Portable,
+	NativeInt32ToFloat32_X86,
+	SwapInt32ToFloat32_X86,
+
+	Float32ToNativeInt16_X86,
+	Float32ToSwapInt16_X86,
+	Float32ToNativeInt24_X86,
+	Float32ToSwapInt24_X86,
+	Float32ToNativeInt32_X86,
+	Float32ToSwapInt32_X86
+};
+
+// NULL means "no kernel at this tier, use the one below"
+static const PCMBlitterKernels sTierKernels[kPCMBlitterNumTiers] = {
+	{	// kPCMBlitterTierPortable
+		NativeInt16ToFloat32_Portable,
+		SwapInt16ToFloat32_Portable,
+		NativeInt24ToFloat32_Portable,
+		SwapInt24ToFloat32_Portable,
+		NativeInt32ToFloat32_Portable,
+		SwapInt32ToFloat32_Portable,
+
+		Float32ToNativeInt16_Portable,
+		Float32ToSwapInt16_Portable,
+		Float32ToNativeInt24_Portable,
+		Float32ToSwapInt24_Portable,
+		Float32ToNativeInt32_Portable,
+		Float32ToSwapInt32_Portable
+	},
+	{	// kPCMBlitterTierSSE2
+		NativeInt16ToFloat32_X86,
+		SwapInt16ToFloat32_X86,
+		NULL,
+		NULL,
+		NativeInt32ToFloat32_X86,
+		SwapInt32ToFloat32_X86,
+
+		Float32ToNativeInt16_X86,
+		Float32ToSwapInt16_X86,
+		Float32ToNativeInt24_X86,
+		Float32ToSwapInt24_X86,
+		Float32ToNativeInt32_X86,
+		Float32ToSwapInt32_X86
+	},
+	{	// kPCMBlitterTierSSSE3
+#if PCMBLITTER_SSSE3
+		NULL,
+		NULL,
+		NativeInt24ToFloat32_SSSE3,
+		SwapInt24ToFloat32_SSSE3,
+		NULL,
+		NULL,
+
+		NULL, NULL, NULL, NULL, NULL, NULL
+#else
+		NULL, NULL, NULL, NULL, NULL, NULL,
+		NULL, NULL, NULL, NULL, NULL, NULL
+#endif
+	},
+	{	// kPCMBlitterTierAVX2
+#if PCMBLITTER_AVX2
+		NativeInt16ToFloat32_AVX2,
+		SwapInt16ToFloat32_AVX2,
+		NativeInt24ToFloat32_AVX2,
+		SwapInt24ToFloat32_AVX2,
+		NativeInt32ToFloat32_AVX2,
+		SwapInt32ToFloat32_AVX2,
+
+		Float32ToNativeInt16_AVX2,
+		Float32ToSwapInt16_AVX2,
+		Float32ToNativeInt24_AVX2,
+		Float32ToSwapInt24_AVX2,
+		Float32ToNativeInt32_AVX2,
+		Float32ToSwapInt32_AVX2
+#else
+		NULL, NULL, NULL, NULL, NULL, NULL,
+		NULL, NULL, NULL, NULL, NULL, NULL
+#endif
+	},
+	{	// kPCMBlitterTierAVX512 - no kernels of its own yet, gets the AVX2 ones
+		NULL, NULL, NULL, NULL, NULL, NULL,
+		NULL, NULL, NULL, NULL, NULL, NULL
+	}
+};
+
+static const char *sTierNames[kPCMBlitterNumTiers] = {
+	"portable", "SSE2", "SSSE3", "AVX2", "AVX-512"
+};
+
+static int sCPUTier = -1;
+static int sDispatchTier = -1;
+
+#pragma mark -
+#pragma mark CPU detection
+
+static inline void pcmCpuid(UInt32 leaf, UInt32 subleaf, UInt32 regs[4])
+{
+#if defined(__i386__) && defined(__PIC__)
+	// ebx is the PIC register here
+	asm volatile ("xchgl %%ebx, %1\n\tcpuid\n\txchgl %%ebx, %1"
+			: "=a" (regs[0]), "=&r" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+			: "0" (leaf), "2" (subleaf));
+#else
+	asm volatile ("cpuid"
+			: "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+			: "0" (leaf), "2" (subleaf));
+#endif
+}
+
+static inline UInt64 pcmXgetbv(UInt32 index)
+{
+	UInt32 lo, hi;
+	// xgetbv, spelled out for assemblers which don't know it
+	asm volatile (".byte 0x0f, 0x01, 0xd0" : "=a" (lo), "=d" (hi) : "c" (index));
+	return ((UInt64) hi << 32) | lo;
+}
+
+#define CPUID1_EDX_SSE2			(1 << 26)
+#define CPUID1_ECX_SSSE3		(1 << 9)
+#define CPUID1_ECX_OSXSAVE		(1 << 27)
+#define CPUID1_ECX_AVX			(1 << 28)
+#define CPUID7_EBX_AVX2			(1 << 5)
+#define CPUID7_EBX_AVX512F		(1 << 16)
+#define CPUID7_EBX_AVX512BW		(1 << 30)
+
+#define XCR0_SSE_AVX			0x06	// XMM and YMM state
+#define XCR0_AVX512				0xE0	// opmask, ZMM0-15 upper halves, ZMM16-31
+
+int PCMBlitterCPUTier(void)
+{
+	UInt32 regs[4], maxLeaf, ecx1, edx1, ebx7 = 0;
+	UInt64 xcr0 = 0;
+	int tier = kPCMBlitterTierPortable;
+
+	if (sCPUTier >= 0)
+		return sCPUTier;
+
+	pcmCpuid(0, 0, regs);
+	maxLeaf = regs[0];
+	pcmCpuid(1, 0, regs);
+	ecx1 = regs[2];
+	edx1 = regs[3];
+	if (maxLeaf >= 7) {
+		pcmCpuid(7, 0, regs);
+		ebx7 = regs[1];
+	}
+	// the AVX tiers are only usable if the OS saves the wider register state
+	if (ecx1 & CPUID1_ECX_OSXSAVE)
+		xcr0 = pcmXgetbv(0);
+
+	if (edx1 & CPUID1_EDX_SSE2)
+		tier = kPCMBlitterTierSSE2;
+	if ((tier == kPCMBlitterTierSSE2) && (ecx1 & CPUID1_ECX_SSSE3))
+		tier = kPCMBlitterTierSSSE3;
+	if ((tier == kPCMBlitterTierSSSE3) && (ecx1 & CPUID1_ECX_AVX) && (ebx7 & CPUID7_EBX_AVX2) &&
+			((xcr0 & XCR0_SSE_AVX) == XCR0_SSE_AVX))
+		tier = kPCMBlitterTierAVX2;
+	if ((tier == kPCMBlitterTierAVX2) && (ebx7 & CPUID7_EBX_AVX512F) && (ebx7 & CPUID7_EBX_AVX512BW) &&
+			((xcr0 & XCR0_AVX512) == XCR0_AVX512))
+		tier = kPCMBlitterTierAVX512;
+
+	sCPUTier = tier;
+	return tier;
+}
+
+const char *PCMBlitterTierName(int tier)
+{
+	if ((tier < 0) || (tier >= kPCMBlitterNumTiers))
+		return "unknown";
+	return sTierNames[tier];
+}
+
+#pragma mark -
+#pragma mark Selection
+
+#define kBenchSamples	4096
+#define kBenchPasses	8
+
+// highest tier at or below maxTier which has a kernel for this format
+#define PICK_KERNEL(name) \
+	for (tier = maxTier; tier >= 0; tier--) { \
+		if (sTierKernels[tier].name) { \
+			kernels.name = sTierKernels[tier].name; \
+			break; \
+		} \
+	}
+
+// fastest of the candidates at or below maxTier; ties go to the higher tier
+#define TIME_KERNEL(name, srcType, destType, src, dest) \
+	best = ~0ULL; \
+	for (tier = maxTier; tier >= 0; tier--) { \
+		if (!sTierKernels[tier].name) \
+			continue; \
+		elapsed = ~0ULL; \
+		for (pass = 0; pass < kBenchPasses; pass++) { \
+			start = mach_absolute_time(); \
+			sTierKernels[tier].name((srcType) (src), (destType) (dest), kBenchSamples); \
+			start = mach_absolute_time() - start; \
+			if (start < elapsed) \
+				elapsed = start; \
+		} \
+		if (elapsed < best) { \
+			best = elapsed; \
+			kernels.name = sTierKernels[tier].name; \
+		} \
+	}
+
+static void benchmarkKernels(PCMBlitterKernels &kernels, int maxTier)
+{
+	Float32 *floatBuf, *outFloatBuf;
+	UInt8 *intBuf;
+	UInt64 start, elapsed, best;
+	int tier, pass;
+
+	floatBuf = (Float32 *) IOMalloc(kBenchSamples * sizeof(Float32));
+	outFloatBuf = (Float32 *) IOMalloc(kBenchSamples * sizeof(Float32));
+	intBuf = (UInt8 *) IOMalloc(kBenchSamples * sizeof(SInt32));
+	if (!floatBuf || !outFloatBuf || !intBuf)
+		goto done;
+
+	// full-scale ramp, a little over the top so that clipping is exercised too
+	for (int i = 0; i < kBenchSamples; i++)
+		floatBuf[i] = -1.125f + (2.25f * i) / kBenchSamples;
+	for (int i = 0; i < kBenchSamples * (int) sizeof(SInt32); i++)
+		intBuf[i] = (UInt8) (i * 131 + 7);
+
+	TIME_KERNEL(NativeInt16ToFloat32, const SInt16 *, Float32 *, intBuf, outFloatBuf)
+	TIME_KERNEL(SwapInt16ToFloat32, const SInt16 *, Float32 *, intBuf, outFloatBuf)
+	TIME_KERNEL(NativeInt24ToFloat32, const UInt8 *, Float32 *, intBuf, outFloatBuf)
+	TIME_KERNEL(SwapInt24ToFloat32, const UInt8 *, Float32 *, intBuf, outFloatBuf)
+	TIME_KERNEL(NativeInt32ToFloat32, const SInt32 *, Float32 *, intBuf, outFloatBuf)
+	TIME_KERNEL(SwapInt32ToFloat32, const SInt32 *, Float32 *, intBuf, outFloatBuf)
+
+	TIME_KERNEL(Float32ToNativeInt16, const Float32 *, SInt16 *, floatBuf, intBuf)
+	TIME_KERNEL(Float32ToSwapInt16, const Float32 *, SInt16 *, floatBuf, intBuf)
+	TIME_KERNEL(Float32ToNativeInt24, const Float32 *, UInt8 *, floatBuf, intBuf)
+	TIME_KERNEL(Float32ToSwapInt24, const Float32 *, UInt8 *, floatBuf, intBuf)
+	TIME_KERNEL(Float32ToNativeInt32, const Float32 *, SInt32 *, floatBuf, intBuf)
+	TIME_KERNEL(Float32ToSwapInt32, const Float32 *, SInt32 *, floatBuf, intBuf)
+
+done:
+	if (floatBuf)
+		IOFree(floatBuf, kBenchSamples * sizeof(Float32));
+	if (outFloatBuf)
+		IOFree(outFloatBuf, kBenchSamples * sizeof(Float32));
+	if (intBuf)
+		IOFree(intBuf, kBenchSamples * sizeof(SInt32));
+}
+
+/*
+ * Fill gPCMBlitterKernels for this CPU. maxTier < 0 means no limit, otherwise the selection is capped
+ * at that tier (useful for ruling out a misbehaving kernel). Returns the tier actually in effect.
+ * Only the first call does any work; the table is shared by all devices.
+ */
+int PCMBlitterInitDispatch(int maxTier, Boolean benchmark)
+{
+	PCMBlitterKernels kernels;
+	int tier;
+
+	if (sDispatchTier >= 0)
+		return sDispatchTier;
+
+	tier = PCMBlitterCPUTier();
+	if ((maxTier < 0) || (maxTier > tier))
+		maxTier = tier;
+	// everything we build for has SSE2, and there is no portable 16/32-bit kernel to fall back on
+	if (maxTier < kPCMBlitterTierSSE2)
+		maxTier = kPCMBlitterTierSSE2;
+
+	kernels = gPCMBlitterKernels;
+	PICK_KERNEL(NativeInt16ToFloat32)
+	PICK_KERNEL(SwapInt16ToFloat32)
+	PICK_KERNEL(NativeInt24ToFloat32)
+	PICK_KERNEL(SwapInt24ToFloat32)
+	PICK_KERNEL(NativeInt32ToFloat32)
+	PICK_KERNEL(SwapInt32ToFloat32)
+	PICK_KERNEL(Float32ToNativeInt16)
+	PICK_KERNEL(Float32ToSwapInt16)
+	PICK_KERNEL(Float32ToNativeInt24)
+	PICK_KERNEL(Float32ToSwapInt24)
+	PICK_KERNEL(Float32ToNativeInt32)
+	PICK_KERNEL(Float32ToSwapInt32)
+
+	if (benchmark)
+		benchmarkKernels(kernels, maxTier);
+
+	gPCMBlitterKernels = kernels;
+	sDispatchTier = maxTier;
+
+	return maxTier;
+}
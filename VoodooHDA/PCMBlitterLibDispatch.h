@@ -26,68 +26,234 @@ extern "C" {
 	24-bit samples have no alignment requirements.
 	16-bit ints must be 2-byte aligned.
 	
-	On Intel, some implementations assume SSE2.
+	On Intel, some implementations assume SSE2. The kernel behind each interface is picked at load
+	time by PCMBlitterInitDispatch() according to what the CPU supports.
 */
 
 inline void NativeInt16ToFloat32(const SInt16 *src, Float32 *dest, unsigned int count)
 {
-	NativeInt16ToFloat32_X86(src, dest, count);
+	gPCMBlitterKernels.NativeInt16ToFloat32(src, dest, count);
 }
 
 inline void SwapInt16ToFloat32(const SInt16 *src, Float32 *dest, unsigned int count)
 {
-	SwapInt16ToFloat32_X86(src, dest, count);
+	gPCMBlitterKernels.SwapInt16ToFloat32(src, dest, count);
 }
 
 inline void NativeInt24ToFloat32(const UInt8 *src, Float32 *dest, unsigned int count)
 {
-	NativeInt24ToFloat32_Portable(src, dest, count);
+	gPCMBlitterKernels.NativeInt24ToFloat32(src, dest, count);
 }
 
 inline void SwapInt24ToFloat32(const UInt8 *src, Float32 *dest, unsigned int count)
 {
-	SwapInt24ToFloat32_Portable(src, dest, count);
+	gPCMBlitterKernels.SwapInt24ToFloat32(src, dest, count);
 }
 
 inline void NativeInt32ToFloat32(const SInt32 *src, Float32 *dest, unsigned int count)
 {
-	NativeInt32ToFloat32_X86(src, dest, count);
+	gPCMBlitterKernels.NativeInt32ToFloat32(src, dest, count);
 }
 
 inline void SwapInt32ToFloat32(const SInt32 *src, Float32 *dest, unsigned int count)
 {
-	SwapInt32ToFloat32_X86(src, dest, count);
+	gPCMBlitterKernels.SwapInt32ToFloat32(src, dest, count);
 }
 
 
 inline void Float32ToNativeInt16(const Float32 *src, SInt16 *dest, unsigned int count)
 {
-	Float32ToNativeInt16_X86(src, dest, count);
+	gPCMBlitterKernels.Float32ToNativeInt16(src, dest, count);
 }
 
 inline void Float32ToSwapInt16(const Float32 *src, SInt16 *dest, unsigned int count)
 {
-	Float32ToSwapInt16_X86(src, dest, count);
+	gPCMBlitterKernels.Float32ToSwapInt16(src, dest, count);
 }
 
 inline void Float32ToNativeInt24(const Float32 *src, UInt8 *dest, unsigned int count)
 {
-	Float32ToNativeInt24_X86(src, dest, count);
+	gPCMBlitterKernels.Float32ToNativeInt24(src, dest, count);
 }
 
 inline void Float32ToSwapInt24(const Float32 *src, UInt8 *dest, unsigned int count)
 {
-	Float32ToSwapInt24_Portable(src, dest, count);
+	gPCMBlitterKernels.Float32ToSwapInt24(src, dest, count);
 }
 
 inline void Float32ToNativeInt32(const Float32 *src, SInt32 *dest, unsigned int count)
 {
-	Float32ToNativeInt32_X86(src, dest, count);
+	gPCMBlitterKernels.Float32ToNativeInt32(src, dest, count);
 }
 
 inline void Float32ToSwapInt32(const Float32 *src, SInt32 *dest, unsigned int count)
 {
-	Float32ToSwapInt32_X86(src, dest, count);
+	gPCMBlitterKernels.Float32ToSwapInt32(src, dest, count);
+}
+
+// Float -> int with the output processing of PCMOutputProcessing folded in; the source is not modified.
+// The SSE2 kernels (vectorize) and the portable ones agree to within the rounding of the last bit;
+// with nothing to do besides the conversion the vectorized path uses the dispatched kernel instead.
+inline bool PCMOutputIsPlain(const PCMOutputProcessing *proc)
+{
+	return (proc->gain == 1.0f) && (proc->crossfeed == 0.0f) && (proc->noiseMask == ~0);
+}
+
+inline void Float32ToInt8Processed(const Float32 *src, SInt8 *dest, unsigned int count,
+		const PCMOutputProcessing *proc)
+{
+	Float32ToInt8Fused_Portable(src, dest, count, proc);
+}
+
+inline void Float32ToNativeInt16Processed(const Float32 *src, SInt16 *dest, unsigned int count,
+		const PCMOutputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMOutputIsPlain(proc))
+		gPCMBlitterKernels.Float32ToNativeInt16(src, dest, count);
+	else if (vectorize)
+		Float32ToNativeInt16Fused_X86(src, dest, count, proc);
+	else
+		Float32ToNativeInt16Fused_Portable(src, dest, count, proc);
+}
+
+inline void Float32ToSwapInt16Processed(const Float32 *src, SInt16 *dest, unsigned int count,
+		const PCMOutputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMOutputIsPlain(proc))
+		gPCMBlitterKernels.Float32ToSwapInt16(src, dest, count);
+	else if (vectorize)
+		Float32ToSwapInt16Fused_X86(src, dest, count, proc);
+	else
+		Float32ToSwapInt16Fused_Portable(src, dest, count, proc);
+}
+
+inline void Float32ToNativeInt24Processed(const Float32 *src, UInt8 *dest, unsigned int count,
+		const PCMOutputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMOutputIsPlain(proc))
+		gPCMBlitterKernels.Float32ToNativeInt24(src, dest, count);
+	else if (vectorize)
+		Float32ToNativeInt24Fused_X86(src, dest, count, proc);
+	else
+		Float32ToNativeInt24Fused_Portable(src, dest, count, proc);
+}
+
+inline void Float32ToSwapInt24Processed(const Float32 *src, UInt8 *dest, unsigned int count,
+		const PCMOutputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMOutputIsPlain(proc))
+		gPCMBlitterKernels.Float32ToSwapInt24(src, dest, count);
+	else if (vectorize)
+		Float32ToSwapInt24Fused_X86(src, dest, count, proc);
+	else
+		Float32ToSwapInt24Fused_Portable(src, dest, count, proc);
+}
+
+inline void Float32ToNativeInt32Processed(const Float32 *src, SInt32 *dest, unsigned int count,
+		const PCMOutputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMOutputIsPlain(proc))
+		gPCMBlitterKernels.Float32ToNativeInt32(src, dest, count);
+	else if (vectorize)
+		Float32ToNativeInt32Fused_X86(src, dest, count, proc);
+	else
+		Float32ToNativeInt32Fused_Portable(src, dest, count, proc);
+}
+
+inline void Float32ToSwapInt32Processed(const Float32 *src, SInt32 *dest, unsigned int count,
+		const PCMOutputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMOutputIsPlain(proc))
+		gPCMBlitterKernels.Float32ToSwapInt32(src, dest, count);
+	else if (vectorize)
+		Float32ToSwapInt32Fused_X86(src, dest, count, proc);
+	else
+		Float32ToSwapInt32Fused_Portable(src, dest, count, proc);
+}
+
+inline void ProcessFloat32(const Float32 *src, Float32 *dest, unsigned int count, const PCMOutputProcessing *proc)
+{
+	ProcessFloat32_Portable(src, dest, count, proc);
+}
+
+// Int -> float with the input processing of PCMInputProcessing folded in; the source is only read.
+// The SSE2 kernels (vectorize) and the portable ones produce the same floats; with nothing to do besides
+// the conversion the vectorized path uses the dispatched kernel, which gives the same floats again.
+inline bool PCMInputIsPlain(const PCMInputProcessing *proc)
+{
+	return (proc->gain == 1.0f) && (proc->noiseMask == ~0) && !proc->channelMap;
+}
+
+inline void Int8ToFloat32Processed(const SInt8 *src, Float32 *dest, unsigned int count,
+		const PCMInputProcessing *proc)
+{
+	Int8ToFloat32Fused_Portable(src, dest, count, proc);
+}
+
+inline void NativeInt16ToFloat32Processed(const SInt16 *src, Float32 *dest, unsigned int count,
+		const PCMInputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMInputIsPlain(proc))
+		gPCMBlitterKernels.NativeInt16ToFloat32(src, dest, count);
+	else if (vectorize)
+		NativeInt16ToFloat32Fused_X86(src, dest, count, proc);
+	else
+		NativeInt16ToFloat32Fused_Portable(src, dest, count, proc);
+}
+
+inline void SwapInt16ToFloat32Processed(const SInt16 *src, Float32 *dest, unsigned int count,
+		const PCMInputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMInputIsPlain(proc))
+		gPCMBlitterKernels.SwapInt16ToFloat32(src, dest, count);
+	else if (vectorize)
+		SwapInt16ToFloat32Fused_X86(src, dest, count, proc);
+	else
+		SwapInt16ToFloat32Fused_Portable(src, dest, count, proc);
+}
+
+inline void NativeInt24ToFloat32Processed(const UInt8 *src, Float32 *dest, unsigned int count,
+		const PCMInputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMInputIsPlain(proc))
+		gPCMBlitterKernels.NativeInt24ToFloat32(src, dest, count);
+	else if (vectorize)
+		NativeInt24ToFloat32Fused_X86(src, dest, count, proc);
+	else
+		NativeInt24ToFloat32Fused_Portable(src, dest, count, proc);
+}
+
+inline void SwapInt24ToFloat32Processed(const UInt8 *src, Float32 *dest, unsigned int count,
+		const PCMInputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMInputIsPlain(proc))
+		gPCMBlitterKernels.SwapInt24ToFloat32(src, dest, count);
+	else if (vectorize)
+		SwapInt24ToFloat32Fused_X86(src, dest, count, proc);
+	else
+		SwapInt24ToFloat32Fused_Portable(src, dest, count, proc);
+}
+
+inline void NativeInt32ToFloat32Processed(const SInt32 *src, Float32 *dest, unsigned int count,
+		const PCMInputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMInputIsPlain(proc))
+		gPCMBlitterKernels.NativeInt32ToFloat32(src, dest, count);
+	else if (vectorize)
+		NativeInt32ToFloat32Fused_X86(src, dest, count, proc);
+	else
+		NativeInt32ToFloat32Fused_Portable(src, dest, count, proc);
+}
+
+inline void SwapInt32ToFloat32Processed(const SInt32 *src, Float32 *dest, unsigned int count,
+		const PCMInputProcessing *proc, bool vectorize)
+{
+	if (vectorize && PCMInputIsPlain(proc))
+		gPCMBlitterKernels.SwapInt32ToFloat32(src, dest, count);
+	else if (vectorize)
+		SwapInt32ToFloat32Fused_X86(src, dest, count, proc);
+	else
+		SwapInt32ToFloat32Fused_Portable(src, dest, count, proc);
 }
 
 // Alternate names for the above: these explicitly specify the endianism of the integer format instead of "native"/"swap"
@@ -0,0 +1,76 @@
+#include "License.h"
+#ifndef TIGER
+#include <TargetConditionals.h>
+#endif
+
+#include "PCMBlitterLib.h"
+
+/*
+	SSSE3 packed 24-bit -> float blitters.
+
+	pshufb moves each 3-byte sample into the top three bytes of a 32-bit lane (low byte zero), which is
+	exactly the "lv << 8" of NativeInt24ToFloat32_Portable; the conversion and scaling are exact, so
+	the output is identical to the portable code. Eight samples (24 bytes) are read as two overlapping
+	16-byte loads at offsets 0 and 8, so nothing past the end of the source is ever touched; the last
+	0..7 samples go through a small bounce buffer.
+
+	Like the AVX2 file, everything here carries its own target attribute.
+*/
+
+#if PCMBLITTER_SSSE3
+
+#define _MM_MALLOC_H_INCLUDED 1	// we don't want this header
+#define __MM_MALLOC_H 1
+#include <tmmintrin.h>
+#include <string.h>
+
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+
+// load at byte 0 -> samples 0..3, load at byte 8 -> samples 4..7
+#define kShufLE24Lo		 -1,  0,  1,  2,  -1,  3,  4,  5,  -1,  6,  7,  8,  -1,  9, 10, 11
+#define kShufLE24Hi		 -1,  4,  5,  6,  -1,  7,  8,  9,  -1, 10, 11, 12,  -1, 13, 14, 15
+#define kShufBE24Lo		 -1,  2,  1,  0,  -1,  5,  4,  3,  -1,  8,  7,  6,  -1, 11, 10,  9
+#define kShufBE24Hi		 -1,  6,  5,  4,  -1,  9,  8,  7,  -1, 12, 11, 10,  -1, 15, 14, 13
+
+static inline SSSE3_TARGET void Int24ToFloat32x8(const UInt8 *src, Float32 *dst, __m128i shufLo,
+		__m128i shufHi)
+{
+	const __m128 vscale = _mm_set1_ps(1.0/2147483648.0f);
+	__m128i vi0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) src), shufLo);
+	__m128i vi1 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *) (src + 8)), shufHi);
+	_mm_storeu_ps(dst, _mm_mul_ps(_mm_cvtepi32_ps(vi0), vscale));
+	_mm_storeu_ps(dst + 4, _mm_mul_ps(_mm_cvtepi32_ps(vi1), vscale));
+}
+
+static inline SSSE3_TARGET void Int24ToFloat32(const UInt8 *src, Float32 *dst, unsigned int count,
+		__m128i shufLo, __m128i shufHi)
+{
+	while (count >= 8) {
+		Int24ToFloat32x8(src, dst, shufLo, shufHi);
+		src += 24;	// bytes
+		dst += 8;
+		count -= 8;
+	}
+	if (count > 0) {
+		UInt8 in[24];
+		Float32 out[8];
+		memset(in, 0, sizeof(in));
+		memcpy(in, src, 3 * count);
+		Int24ToFloat32x8(in, out, shufLo, shufHi);
+		memcpy(dst, out, count * sizeof(Float32));
+	}
+}
+
+SSSE3_TARGET
+void NativeInt24ToFloat32_SSSE3(const UInt8 *src, Float32 *dst, unsigned int numToConvert)
+{
+	Int24ToFloat32(src, dst, numToConvert, _mm_setr_epi8(kShufLE24Lo), _mm_setr_epi8(kShufLE24Hi));
+}
+
+SSSE3_TARGET
+void SwapInt24ToFloat32_SSSE3(const UInt8 *src, Float32 *dst, unsigned int numToConvert)
+{
+	Int24ToFloat32(src, dst, numToConvert, _mm_setr_epi8(kShufBE24Lo), _mm_setr_epi8(kShufBE24Hi));
+}
+
+#endif // PCMBLITTER_SSSE3
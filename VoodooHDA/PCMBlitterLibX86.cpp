@@ -4,9 +4,14 @@
 #endif
 
 #define _MM_MALLOC_H_INCLUDED 1	// we don't want this header
+#ifdef VOODOOHDA_HOST_BENCH
+#include <emmintrin.h>	// the bundled headers are too old for current host compilers
+#else
 #include "xmmintrin.h"
-#include "PCMBlitterLib.h"
+#endif
+#include "PCMBlitterLibDispatch.h"
 #include <libkern/OSByteOrder.h>
+#include <string.h>
 
 #define kMaxFloat32 2147483520.0f
 	// this is the biggest floating point number that result from a 32-bit int (bits are lost)
@@ -892,3 +897,322 @@ VectorCleanup:
 		}
 	}
 }
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Vector operations
+
+/*
+	PCMSSE2Ops: TPCMKernel's operations (see PCMScalarOps) on eight samples in two registers, with
+	unaligned loads and stores. Float -> int is the same multiply/round/clamp sequence as F32TOLE16
+	and F32TOLE32 above; 16-bit samples are packed into the first register, 24-bit ones are stored
+	as Pack32ToLE24 does, or one by one when byte swapped, which is rare enough not to deserve a
+	vector byte shuffle.
+*/
+
+class PCMSSE2Ops {
+public:
+	enum { kWidth = 8 };
+	typedef struct { __m128 lo, hi; } Floats;
+	typedef struct { __m128i lo, hi; } Ints;
+
+	static Floats Load(const Float32 *p)
+	{
+		Floats v = { _mm_loadu_ps(p), _mm_loadu_ps(p + 4) };
+		return v;
+	}
+	static void Store(Float32 *p, Floats v)
+	{
+		_mm_storeu_ps(p, v.lo);
+		_mm_storeu_ps(p + 4, v.hi);
+	}
+	static Floats Set(Float32 f)
+	{
+		Floats v = { _mm_set1_ps(f), _mm_set1_ps(f) };
+		return v;
+	}
+	static Floats Add(Floats a, Floats b)
+	{
+		Floats v = { _mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi) };
+		return v;
+	}
+	static Floats Mul(Floats a, Floats b)
+	{
+		Floats v = { _mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi) };
+		return v;
+	}
+	static void Deinterleave(Floats a, Floats b, Floats &l, Floats &r)
+	{
+		l.lo = _mm_shuffle_ps(a.lo, a.hi, _MM_SHUFFLE(2, 0, 2, 0));
+		r.lo = _mm_shuffle_ps(a.lo, a.hi, _MM_SHUFFLE(3, 1, 3, 1));
+		l.hi = _mm_shuffle_ps(b.lo, b.hi, _MM_SHUFFLE(2, 0, 2, 0));
+		r.hi = _mm_shuffle_ps(b.lo, b.hi, _MM_SHUFFLE(3, 1, 3, 1));
+	}
+	static void Interleave(Floats l, Floats r, Floats &a, Floats &b)
+	{
+		a.lo = _mm_unpacklo_ps(l.lo, r.lo);
+		a.hi = _mm_unpackhi_ps(l.lo, r.lo);
+		b.lo = _mm_unpacklo_ps(l.hi, r.hi);
+		b.hi = _mm_unpackhi_ps(l.hi, r.hi);
+	}
+	static Floats SwapPairs(Floats v)
+	{
+		v.lo = _mm_shuffle_ps(v.lo, v.lo, _MM_SHUFFLE(2, 3, 0, 1));
+		v.hi = _mm_shuffle_ps(v.hi, v.hi, _MM_SHUFFLE(2, 3, 0, 1));
+		return v;
+	}
+
+	static Ints SetInts(SInt32 i)
+	{
+		Ints v = { _mm_set1_epi32(i), _mm_set1_epi32(i) };
+		return v;
+	}
+	static Ints And(Ints a, Ints b)
+	{
+		Ints v = { _mm_and_si128(a.lo, b.lo), _mm_and_si128(a.hi, b.hi) };
+		return v;
+	}
+	static Floats ToFloats(Ints v)
+	{
+		const __m128 vscale = _mm_set1_ps(1.0f / 2147483648.0f);
+		Floats f = { _mm_mul_ps(_mm_cvtepi32_ps(v.lo), vscale), _mm_mul_ps(_mm_cvtepi32_ps(v.hi), vscale) };
+		return f;
+	}
+
+	template <class Sample> static Ints OutputMask(SInt32 noiseMask)
+	{
+		if (Sample::kBitDepth == 16)
+			return SetInts((SInt32)((UInt32)noiseMask << 16 | (UInt16)noiseMask));
+		return SetInts((SInt32)((UInt32)noiseMask << (32 - Sample::kBitDepth)));
+	}
+
+	template <class Sample> static Ints ToInts(Floats f)
+	{
+		Ints v;
+
+		if (Sample::kBitDepth == 16) {
+			v.lo = _mm_packs_epi32(ToInt(f.lo, 32768.0f, 32767.0f), ToInt(f.hi, 32768.0f, 32767.0f));
+			v.hi = v.lo;
+		} else {
+			v.lo = ToInt(f.lo, 2147483648.0f, kMaxFloat32);
+			v.hi = ToInt(f.hi, 2147483648.0f, kMaxFloat32);
+		}
+		return v;
+	}
+
+	template <class Sample> static void StoreInts(UInt8 *p, Ints v)
+	{
+		switch ((int)Sample::kBytes) {
+			case 2:
+				_mm_storeu_si128((__m128i *)p, Sample::kSwapped ? byteswap16(v.lo) : v.lo);
+				break;
+			case 3:
+				if (Sample::kSwapped) {
+					union {
+						SInt32 i[8];
+						__m128i v[2];
+					} u;
+
+					u.v[0] = v.lo;
+					u.v[1] = v.hi;
+					for (int k = 0; k < 8; k++)
+						Sample::store(p, k, u.i[k]);
+				} else {
+					Store24(p, v.lo);
+					Store24(p + 12, v.hi);
+				}
+				break;
+			default:
+				_mm_storeu_si128((__m128i *)p, Sample::kSwapped ? byteswap32(v.lo) : v.lo);
+				_mm_storeu_si128((__m128i *)(p + 16), Sample::kSwapped ? byteswap32(v.hi) : v.hi);
+				break;
+		}
+	}
+
+	template <class Sample> static Ints LoadInts(const UInt8 *p)
+	{
+		Ints v;
+
+		switch ((int)Sample::kBytes) {
+			case 2: {
+				__m128i w = _mm_loadu_si128((__m128i const *)p);
+				if (Sample::kSwapped)
+					w = byteswap16(w);
+				v.lo = _mm_unpacklo_epi16(_mm_setzero_si128(), w);
+				v.hi = _mm_unpackhi_epi16(_mm_setzero_si128(), w);
+				break;
+			}
+			case 3: {
+				union {
+					SInt32 i[8];
+					__m128i v[2];
+				} u;
+
+				for (int k = 0; k < 8; k++)
+					u.i[k] = Sample::load(p, k);
+				v.lo = u.v[0];
+				v.hi = u.v[1];
+				break;
+			}
+			default:
+				v.lo = _mm_loadu_si128((__m128i const *)p);
+				v.hi = _mm_loadu_si128((__m128i const *)(p + 16));
+				if (Sample::kSwapped) {
+					v.lo = byteswap32(v.lo);
+					v.hi = byteswap32(v.hi);
+				}
+				break;
+		}
+		return v;
+	}
+
+private:
+	// the caller has set ROUNDMODE_NEG_INF
+	static __m128i ToInt(__m128 vf, Float32 scale, Float32 max)
+	{
+		vf = _mm_mul_ps(vf, _mm_set1_ps(scale));
+		vf = _mm_add_ps(vf, _mm_set1_ps(0.5f));
+		vf = _mm_max_ps(vf, _mm_set1_ps(-scale));
+		vf = _mm_min_ps(vf, _mm_set1_ps(max));
+		return _mm_cvtps_epi32(vf);
+	}
+	// four samples, 12 bytes
+	static void Store24(UInt8 *p, __m128i vi)
+	{
+		union {
+			UInt32 i[4];
+			__m128i v;
+		} u;
+
+		u.v = Pack32ToLE24(vi, _mm_setr_epi32(0x00FFFFFF, 0, 0, 0));
+		((UInt32 *)p)[0] = u.i[0];
+		((UInt32 *)p)[1] = u.i[1];
+		((UInt32 *)p)[2] = u.i[2];
+	}
+};
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Float -> Int, from TPCMKernel
+
+// the only format without a kernel of Apple's
+void Float32ToSwapInt24_X86(const Float32 *src, UInt8 *dst, unsigned int numToConvert)
+{
+	TPCMKernel<PCMSample24Swap, 1, false, PCMSSE2Ops>::Float32ToInt(src, dst, numToConvert, NULL);
+}
+
+/*
+	Fused output kernels (see PCMOutputProcessing): one load of the mix, crossfeed and gain in
+	registers, then the same rounding and clipping as the plain kernels above, the noise mask and the
+	store, eight samples (four stereo pairs) per step. The rounding mode is set once per call, so the
+	crossfeed and gain arithmetic also rounds toward -inf. Chosen like the portable ones.
+*/
+
+template <class Sample>
+static void Float32ToIntFused(const Float32 *src, void *dst, unsigned int numToConvert,
+		const PCMOutputProcessing *proc)
+{
+	if (PCMOutputIsPlain(proc))
+		TPCMKernel<Sample, 1, false, PCMSSE2Ops>::Float32ToInt(src, (UInt8 *)dst, numToConvert, proc);
+	else if (proc->crossfeed != 0.0f)
+		TPCMKernel<Sample, 0, true, PCMSSE2Ops>::Float32ToInt(src, (UInt8 *)dst, numToConvert, proc);
+	else
+		TPCMKernel<Sample, 1, true, PCMSSE2Ops>::Float32ToInt(src, (UInt8 *)dst, numToConvert, proc);
+}
+
+void Float32ToNativeInt16Fused_X86(const Float32 *src, SInt16 *dst, unsigned int numToConvert,
+		const PCMOutputProcessing *proc)
+{
+	Float32ToIntFused<PCMSample16Native>(src, dst, numToConvert, proc);
+}
+
+void Float32ToSwapInt16Fused_X86(const Float32 *src, SInt16 *dst, unsigned int numToConvert,
+		const PCMOutputProcessing *proc)
+{
+	Float32ToIntFused<PCMSample16Swap>(src, dst, numToConvert, proc);
+}
+
+void Float32ToNativeInt24Fused_X86(const Float32 *src, UInt8 *dst, unsigned int numToConvert,
+		const PCMOutputProcessing *proc)
+{
+	Float32ToIntFused<PCMSample24Native>(src, dst, numToConvert, proc);
+}
+
+void Float32ToSwapInt24Fused_X86(const Float32 *src, UInt8 *dst, unsigned int numToConvert,
+		const PCMOutputProcessing *proc)
+{
+	Float32ToIntFused<PCMSample24Swap>(src, dst, numToConvert, proc);
+}
+
+void Float32ToNativeInt32Fused_X86(const Float32 *src, SInt32 *dst, unsigned int numToConvert,
+		const PCMOutputProcessing *proc)
+{
+	Float32ToIntFused<PCMSample32Native>(src, dst, numToConvert, proc);
+}
+
+void Float32ToSwapInt32Fused_X86(const Float32 *src, SInt32 *dst, unsigned int numToConvert,
+		const PCMOutputProcessing *proc)
+{
+	Float32ToIntFused<PCMSample32Swap>(src, dst, numToConvert, proc);
+}
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Int -> Float, from TPCMKernel
+
+/*
+	Fused input kernels (see PCMInputProcessing): eight samples are loaded and left-justified to
+	32 bits, masked, converted and scaled by 2^-31 and then by gain, in the same order as the
+	portable versions, so both give the same floats. The plain L/R swap is a shuffle in registers;
+	any other channel map converts whole frames into a block on the stack and gathers from there.
+*/
+
+template <class Sample>
+static void IntToFloat32Fused(const void *src, Float32 *dst, unsigned int numToConvert,
+		const PCMInputProcessing *proc)
+{
+	if (PCMInputIsPlain(proc))
+		TPCMKernel<Sample, 1, false, PCMSSE2Ops>::IntToFloat32((const UInt8 *)src, dst, numToConvert, proc);
+	else if (!proc->channelMap)
+		TPCMKernel<Sample, 1, true, PCMSSE2Ops>::IntToFloat32((const UInt8 *)src, dst, numToConvert, proc);
+	else if (proc->numChannels == 2)
+		TPCMKernel<Sample, 2, true, PCMSSE2Ops>::IntToFloat32((const UInt8 *)src, dst, numToConvert, proc);
+	else
+		TPCMKernel<Sample, 0, true, PCMSSE2Ops>::IntToFloat32((const UInt8 *)src, dst, numToConvert, proc);
+}
+
+void NativeInt16ToFloat32Fused_X86(const SInt16 *src, Float32 *dst, unsigned int numToConvert,
+		const PCMInputProcessing *proc)
+{
+	IntToFloat32Fused<PCMSample16Native>(src, dst, numToConvert, proc);
+}
+
+void SwapInt16ToFloat32Fused_X86(const SInt16 *src, Float32 *dst, unsigned int numToConvert,
+		const PCMInputProcessing *proc)
+{
+	IntToFloat32Fused<PCMSample16Swap>(src, dst, numToConvert, proc);
+}
+
+void NativeInt24ToFloat32Fused_X86(const UInt8 *src, Float32 *dst, unsigned int numToConvert,
+		const PCMInputProcessing *proc)
+{
+	IntToFloat32Fused<PCMSample24Native>(src, dst, numToConvert, proc);
+}
+
+void SwapInt24ToFloat32Fused_X86(const UInt8 *src, Float32 *dst, unsigned int numToConvert,
+		const PCMInputProcessing *proc)
+{
+	IntToFloat32Fused<PCMSample24Swap>(src, dst, numToConvert, proc);
+}
+
+void NativeInt32ToFloat32Fused_X86(const SInt32 *src, Float32 *dst, unsigned int numToConvert,
+		const PCMInputProcessing *proc)
+{
+	IntToFloat32Fused<PCMSample32Native>(src, dst, numToConvert, proc);
+}
+
+void SwapInt32ToFloat32Fused_X86(const SInt32 *src, Float32 *dst, unsigned int numToConvert,
+		const PCMInputProcessing *proc)
+{
+	IntToFloat32Fused<PCMSample32Swap>(src, dst, numToConvert, proc);
+}
@@ -0,0 +1,377 @@
+#include "License.h"
+#ifndef TIGER
+#include <TargetConditionals.h>
+#endif
+
+#include <IOKit/IOLib.h>
+#include <string.h>
+
+#include "PCMResampler.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#define _MM_MALLOC_H_INCLUDED 1	// we don't want this header
+#ifdef VOODOOHDA_HOST_BENCH
+#include <xmmintrin.h>
+#else
+#include "xmmintrin.h"
+#endif
+#define RESAMPLER_SSE 1
+#endif
+
+// ____________________________________________________________________________
+//
+// No libm in the kernel; these are only used by init(), in double.
+
+static const double kPi = 3.14159265358979323846;
+
+static double ResamplerSin(double x)
+{
+	double x2, term, sum;
+
+	x -= 2.0 * kPi * (double) (SInt64) (x / (2.0 * kPi));	// |x| < 2 pi
+	if (x > kPi)
+		x -= 2.0 * kPi;
+	else if (x < -kPi)
+		x += 2.0 * kPi;
+	x2 = x * x;
+	term = sum = x;
+	for (int n = 1; n <= 14; n++) {
+		term *= -x2 / ((2 * n) * (2 * n + 1));
+		sum += term;
+	}
+	return sum;
+}
+
+static double ResamplerSqrt(double x)
+{
+	double r = (x > 1.0) ? x : 1.0;
+
+	if (x <= 0.0)
+		return 0.0;
+	for (int n = 0; n < 64; n++) {
+		double next = 0.5 * (r + x / r);
+		if (next >= r)
+			break;
+		r = next;
+	}
+	return r;
+}
+
+// modified Bessel function of the first kind, order 0
+static double ResamplerBesselI0(double x)
+{
+	double term = 1.0, sum = 1.0, q = x * x / 4.0;
+
+	for (int k = 1; k < 64; k++) {
+		term *= q / ((double) k * k);
+		sum += term;
+		if (term < sum * 1e-17)
+			break;
+	}
+	return sum;
+}
+
+static UInt32 ResamplerGCD(UInt32 a, UInt32 b)
+{
+	while (b) {
+		UInt32 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// Kaiser beta and where the passband ends, as a fraction of the lower Nyquist, for each quality
+static void ResamplerDesign(UInt32 quality, double *beta, double *cutoff)
+{
+	if (quality >= kPCMResamplerQualityBest) {
+		*beta = 10.0;
+		*cutoff = 0.95;
+	} else if (quality >= kPCMResamplerQualityHigh) {
+		*beta = 8.6;
+		*cutoff = 0.92;
+	} else if (quality >= kPCMResamplerQualityMedium) {
+		*beta = 7.0;
+		*cutoff = 0.86;
+	} else {
+		*beta = 5.0;
+		*cutoff = 0.76;
+	}
+}
+
+#pragma mark -
+#pragma mark Setup
+
+bool PCMResampler::init(UInt32 inRate, UInt32 outRate, UInt32 numChannels, UInt32 quality)
+{
+	UInt32 gcd, ratio, phase, tap;
+	double beta, cutoff, fc, delay, i0Beta;
+
+	free();
+	if (!inRate || !outRate || !numChannels || (numChannels > kPCMResamplerMaxChannels))
+		return false;
+
+	gcd = ResamplerGCD(inRate, outRate);
+	mNumPhases = outRate / gcd;
+	mStepWhole = (inRate / gcd) / mNumPhases;
+	mStepFrac = (inRate / gcd) % mNumPhases;
+
+	// no table, so any ratio goes
+	if (quality == kPCMResamplerQualityLinear) {
+		mTaps = 2;
+		mPhaseScale = 1.0f / mNumPhases;
+		mInRate = inRate;
+		mOutRate = outRate;
+		mNumChannels = numChannels;
+		mWorkSize = numChannels * sizeof(Float32);
+		mWork = (Float32 *) IOMalloc(mWorkSize);
+		if (!mWork) {
+			free();
+			return false;
+		}
+		reset();
+		return true;
+	}
+
+	if (quality < kPCMResamplerQualityLow)
+		quality = kPCMResamplerQualityLow;
+	else if (quality > kPCMResamplerQualityBest)
+		quality = kPCMResamplerQualityBest;
+	ratio = (inRate + outRate - 1) / outRate;
+	if (ratio < 1)
+		ratio = 1;
+	mTaps = (quality * ratio + 7) & ~7;
+	if ((mNumPhases > kPCMResamplerMaxPhases) || (mTaps > kPCMResamplerMaxTaps))
+		return false;
+
+	mInRate = inRate;
+	mOutRate = outRate;
+	mNumChannels = numChannels;
+	mCoeffsSize = mNumPhases * mTaps * sizeof(Float32);
+	mWorkSize = numChannels * (mTaps - 1 + kPCMResamplerChunkFrames) * sizeof(Float32);
+	mCoeffs = (Float32 *) IOMalloc(mCoeffsSize);
+	mWork = (Float32 *) IOMalloc(mWorkSize);
+	if (!mCoeffs || !mWork) {
+		free();
+		return false;
+	}
+
+	// h(u) = fc sinc(fc u) kaiser(u / delay), u in input samples from the center
+	ResamplerDesign(quality, &beta, &cutoff);
+	fc = cutoff * ((outRate < inRate) ? (double) outRate / inRate : 1.0);
+	delay = mTaps / 2;
+	i0Beta = ResamplerBesselI0(beta);
+	for (phase = 0; phase < mNumPhases; phase++) {
+		Float32 *coeffs = mCoeffs + phase * mTaps;
+		double sum = 0.0;
+		for (tap = 0; tap < mTaps; tap++) {
+			// tap 0 is the oldest input; output "phase" falls phase/L after the newest
+			double u = (double) (mTaps - 1 - tap) + (double) phase / mNumPhases - delay;
+			double r = u / delay, h;
+			h = (u == 0.0) ? fc : ResamplerSin(kPi * fc * u) / (kPi * u);
+			h *= (r >= 1.0 || r <= -1.0) ? 0.0 : ResamplerBesselI0(beta * ResamplerSqrt(1.0 - r * r)) / i0Beta;
+			coeffs[tap] = h;
+			sum += h;
+		}
+		for (tap = 0; tap < mTaps; tap++)
+			coeffs[tap] /= sum;
+	}
+
+	reset();
+	return true;
+}
+
+void PCMResampler::free()
+{
+	if (mCoeffs)
+		IOFree(mCoeffs, mCoeffsSize);
+	if (mWork)
+		IOFree(mWork, mWorkSize);
+	mCoeffs = NULL;
+	mWork = NULL;
+	mCoeffsSize = mWorkSize = 0;
+	mNumChannels = 0;
+	mTaps = 0;
+}
+
+void PCMResampler::reset()
+{
+	if (mWork)
+		memset(mWork, 0, mWorkSize);
+	mPhase = 0;
+	mIndex = 0;
+}
+
+UInt32 PCMResampler::maxOutputFrames(UInt32 inFrames) const
+{
+	if (!mWork)
+		return 0;
+	return (UInt32) (((UInt64) inFrames * mOutRate + mInRate - 1) / mInRate) + 1;
+}
+
+#pragma mark -
+#pragma mark Processing
+
+// the sums are formed exactly as in DotProduct4, so that an output doesn't depend on how it was batched
+static inline Float32 DotProduct(const Float32 *coeffs, const Float32 *x, UInt32 taps)
+{
+#if RESAMPLER_SSE
+	__m128 acc = _mm_setzero_ps(), t;
+
+	for (UInt32 i = 0; i < taps; i += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(coeffs + i), _mm_loadu_ps(x + i)));
+	// (0 + 1) + (2 + 3)
+	t = _mm_add_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	t = _mm_add_ss(t, _mm_movehl_ps(t, t));
+	return _mm_cvtss_f32(t);
+#else
+	Float32 sum = 0.0f;
+
+	for (UInt32 i = 0; i < taps; i++)
+		sum += coeffs[i] * x[i];
+	return sum;
+#endif
+}
+
+#if RESAMPLER_SSE
+// four outputs at once: one sum each, added across at the end in a single transpose
+static inline __m128 DotProduct4(const Float32 *const *coeffs, const Float32 *const *x, UInt32 taps)
+{
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps(), acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+
+	for (UInt32 i = 0; i < taps; i += 4) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(coeffs[0] + i), _mm_loadu_ps(x[0] + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(coeffs[1] + i), _mm_loadu_ps(x[1] + i)));
+		acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_loadu_ps(coeffs[2] + i), _mm_loadu_ps(x[2] + i)));
+		acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_loadu_ps(coeffs[3] + i), _mm_loadu_ps(x[3] + i)));
+	}
+	_MM_TRANSPOSE4_PS(acc0, acc1, acc2, acc3);
+	return _mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3));
+}
+#endif
+
+UInt32 PCMResampler::process(const Float32 *in, UInt32 inFrames, Float32 *out)
+{
+	const UInt32 history = mTaps - 1, stride = history + kPCMResamplerChunkFrames;
+	const UInt32 channels = mNumChannels;
+	UInt32 outFrames = 0, done = 0, n, ch, i;
+
+	if (!mCoeffs)
+		return mWork ? processLinear(in, inFrames, out) : 0;
+	while (done < inFrames) {
+		n = inFrames - done;
+		if (n > kPCMResamplerChunkFrames)
+			n = kPCMResamplerChunkFrames;
+
+		// deinterleave the new frames behind the history
+		for (ch = 0; ch < channels; ch++) {
+			Float32 *w = mWork + ch * stride + history;
+			const Float32 *src = in + done * channels + ch;
+			for (i = 0; i < n; i++)
+				w[i] = src[i * channels];
+		}
+
+#if RESAMPLER_SSE
+		// every output whose newest input is in this chunk, four at a time while there are four
+		for (;;) {
+			const Float32 *coeffs[4];
+			SInt32 index[4];
+			UInt32 phase = mPhase, k;
+			index[0] = mIndex;
+			for (k = 0; k < 4; k++) {
+				coeffs[k] = mCoeffs + phase * mTaps;
+				if (k < 3) {
+					index[k + 1] = index[k] + mStepWhole;
+					phase += mStepFrac;
+					if (phase >= mNumPhases) {
+						phase -= mNumPhases;
+						index[k + 1]++;
+					}
+				}
+			}
+			if (index[3] >= (SInt32) n)
+				break;
+			for (ch = 0; ch < channels; ch++) {
+				const Float32 *w = mWork + ch * stride, *x[4] = { w + index[0], w + index[1], w + index[2], w + index[3] };
+				Float32 sums[4];
+				if (channels == 1) {
+					_mm_storeu_ps(out + outFrames, DotProduct4(coeffs, x, mTaps));
+					continue;
+				}
+				_mm_storeu_ps(sums, DotProduct4(coeffs, x, mTaps));
+				for (k = 0; k < 4; k++)
+					out[(outFrames + k) * channels + ch] = sums[k];
+			}
+			outFrames += 4;
+			mIndex = index[3] + mStepWhole;
+			mPhase = phase + mStepFrac;
+			if (mPhase >= mNumPhases) {
+				mPhase -= mNumPhases;
+				mIndex++;
+			}
+		}
+#endif
+		// and the rest one at a time
+		while (mIndex < (SInt32) n) {
+			const Float32 *coeffs = mCoeffs + mPhase * mTaps;
+			for (ch = 0; ch < channels; ch++)
+				out[outFrames * channels + ch] = DotProduct(coeffs, mWork + ch * stride + mIndex, mTaps);
+			outFrames++;
+			mIndex += mStepWhole;
+			mPhase += mStepFrac;
+			if (mPhase >= mNumPhases) {
+				mPhase -= mNumPhases;
+				mIndex++;
+			}
+		}
+		mIndex -= n;
+
+		for (ch = 0; ch < channels; ch++) {
+			Float32 *w = mWork + ch * stride;
+			memmove(w, w + n, history * sizeof(Float32));
+		}
+		done += n;
+	}
+	return outFrames;
+}
+
+// quality 0: mWork holds the last frame of the previous call, which the first output may still need;
+// mIndex counts from it, so that input frame i is at i + 1
+UInt32 PCMResampler::processLinear(const Float32 *in, UInt32 inFrames, Float32 *out)
+{
+	const UInt32 channels = mNumChannels, numPhases = mNumPhases, stepWhole = mStepWhole, stepFrac = mStepFrac;
+	const Float32 scale = mPhaseScale;
+	SInt32 index = mIndex, frames = inFrames;
+	UInt32 phase = mPhase, outFrames = 0, ch, carry;
+	Float32 frac;
+
+	while (index < frames) {
+		const Float32 *x1 = in + index * channels, *x0 = index ? x1 - channels : mWork;
+		frac = phase * scale;
+		for (ch = 0; ch < channels; ch++)
+			out[outFrames * channels + ch] = x0[ch] + frac * (x1[ch] - x0[ch]);
+		outFrames++;
+		phase += stepFrac;
+		carry = (phase >= numPhases);
+		phase -= carry ? numPhases : 0;
+		index += stepWhole + carry;
+		// from here on both inputs are in this call's, which leaves the loops below nothing to check
+		if (index <= 0)
+			continue;
+		if (channels == 1) {
+			while (index < frames) {
+				frac = phase * scale;
+				out[outFrames++] = in[index - 1] + frac * (in[index] - in[index - 1]);
+				phase += stepFrac;
+				carry = (phase >= numPhases);
+				phase -= carry ? numPhases : 0;
+				index += stepWhole + carry;
+			}
+		}
+	}
+	if (inFrames)
+		memcpy(mWork, in + (inFrames - 1) * channels, channels * sizeof(Float32));
+	mPhase = phase;
+	mIndex = index - frames;
+	return outFrames;
+}
@@ -0,0 +1,80 @@
+#include "License.h"
+
+#ifndef __PCMResampler_h__
+#define __PCMResampler_h__
+
+#include <IOKit/IOTypes.h>
+
+#include "PCMBlitterLib.h"
+
+/*
+	Polyphase windowed-sinc sample rate converter.
+
+	The ratio is reduced to outRate/inRate = L/M; output n lands between two inputs at phase (n*M mod L)/L,
+	and each of the L phases has its own set of taps, Kaiser windowed and normalized to unity gain at DC.
+	The table is built by init(), which is also the only place anything is allocated: process() works
+	out of a fixed per-channel buffer (the history plus kPCMResamplerChunkFrames new frames), so it can run
+	on the audio path. The inner products run four taps at a time in SSE.
+
+	quality is the filter length in samples of the lower of the two rates (8 to 64); when decimating the
+	taps per phase grow by the ratio, so that the filter still cuts off at the output's Nyquist. Latency is
+	half the taps per phase, in input frames. Quality 0 skips the filter and interpolates linearly between
+	the two nearest inputs, straight out of the interleaved input, at the cost of the interpolator it
+	replaces and with all of its aliasing; the filtered qualities are for when that is worth paying for.
+
+	There is no constructor, so that it can live in the C structures of the driver: zeroed memory is a valid
+	resampler that isn't set up yet.
+*/
+
+#define kPCMResamplerMaxChannels	8
+#define kPCMResamplerMaxPhases		512
+#define kPCMResamplerMaxTaps		512
+#define kPCMResamplerChunkFrames	256
+
+enum {
+	kPCMResamplerQualityLinear = 0,
+	kPCMResamplerQualityLow = 8,
+	kPCMResamplerQualityMedium = 16,
+	kPCMResamplerQualityHigh = 32,
+	kPCMResamplerQualityBest = 64
+};
+
+class PCMResampler {
+public:
+	// not on the audio path: builds the phase table and allocates the buffers, after free()ing the old ones
+	bool	init(UInt32 inRate, UInt32 outRate, UInt32 numChannels, UInt32 quality);
+	void	free();
+	// back to silence, as after init()
+	void	reset();
+
+	// takes all of inFrames and returns how many frames went to out, which has room for
+	// maxOutputFrames(inFrames); in and out are interleaved and may not overlap
+	UInt32	process(const Float32 *in, UInt32 inFrames, Float32 *out);
+	UInt32	maxOutputFrames(UInt32 inFrames) const;
+
+	bool	isActive() const { return mWork != NULL; }
+	UInt32	inRate() const { return mInRate; }
+	UInt32	outRate() const { return mOutRate; }
+	UInt32	numChannels() const { return mNumChannels; }
+	UInt32	tapsPerPhase() const { return mTaps; }
+	UInt32	latency() const { return mTaps / 2; }
+
+private:
+	UInt32	mInRate, mOutRate;
+	UInt32	mNumChannels;
+	UInt32	mTaps;					// per phase, a multiple of 8
+	UInt32	mNumPhases;				// L
+	UInt32	mStepWhole, mStepFrac;	// M = mStepWhole * L + mStepFrac
+	UInt32	mPhase;					// of the next output, 0..L-1
+	SInt32	mIndex;					// its first tap, relative to the start of the current chunk
+	Float32	mPhaseScale;			// 1 / L, for quality 0
+
+	Float32	*mCoeffs;				// mNumPhases * mTaps, each phase in input order; NULL for quality 0
+	size_t	mCoeffsSize;
+	Float32	*mWork;					// per channel: mTaps - 1 frames of history, then the chunk;
+	size_t	mWorkSize;				// for quality 0 only the last input frame
+
+	UInt32	processLinear(const Float32 *in, UInt32 inFrames, Float32 *out);
+};
+
+#endif // __PCMResampler_h__
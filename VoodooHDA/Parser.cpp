@@ -28,7 +28,8 @@ const char *gJacks[11] = {"Unknown", "1/8", "1/4", "ATAPI", "RCA", "Optic", "Dig
 const ChannelCaps gDefaultChanCaps = { 48000, 48000, (UInt32 []) { AFMT_STEREO | AFMT_S16_LE, 0 }, 0, 2};
 
 /*
- * Scan the bus for available codecs, starting with num.
+ * Scan the bus for available codecs. They are all probed together, see
+ * probeCodecs(), and then set up one after the other.
  */
 void VoodooHDADevice::scanCodecs()
 {
@@ -43,15 +44,20 @@ void VoodooHDADevice::scanCodecs()
 				errorMsg("error: couldn't allocate memory for codec\n");
 				continue;
 			}
-			codec->commands = NULL;
-			codec->numRespReceived = 0;
-			codec->numVerbsSent = 0;
+			bzero(codec, sizeof (*codec));
+			if (!codec->shadow.init())
+				errorMsg("warning: couldn't allocate the codec shadow, reading everything from the codec\n");
 			codec->numFuncGroups = 0;
 			codec->cad = i;
 			mCodecs[i] = codec;
-			probeCodec(codec);
 		}
 	}
+
+	probeCodecs();
+
+	for (int i = 0; i < HDAC_CODEC_MAX; i++)
+		if (mCodecs[i])
+			probeCodec(mCodecs[i]);
 }
 
 const char *VoodooHDADevice::findCodecName(Codec *codec)
@@ -68,86 +74,157 @@ const char *VoodooHDADevice::findCodecName(Codec *codec)
 }
 
 /*
- * Probe a the given codec_id for available function groups.
+ * GET_CONN_LIST_ENTRY verbs it takes to read the list whose
+ * HDA_PARAM_CONN_LIST_LENGTH is connListLength: each returns four short form
+ * or two long form entries.
  */
-void VoodooHDADevice::probeCodec(Codec *codec)
+static int widgetConnectionListEntries(UInt32 connListLength)
 {
-	UInt32 vendorId, revisionId, subNode;
-	int startNode, endNode;
-	nid_t cad = codec->cad;
+	int ents, entnum;
 
-	dumpMsg("\nProbing codec #%d...\n", cad);
-	vendorId = sendCommand(HDA_CMD_GET_PARAMETER(cad, 0, HDA_PARAM_VENDOR_ID), cad);
-	revisionId = sendCommand(HDA_CMD_GET_PARAMETER(cad, 0, HDA_PARAM_REVISION_ID), cad);
-	codec->vendorId = HDA_PARAM_VENDOR_ID_VENDOR_ID(vendorId);
-	codec->deviceId = HDA_PARAM_VENDOR_ID_DEVICE_ID(vendorId);
-	codec->revisionId = HDA_PARAM_REVISION_ID_REVISION_ID(revisionId);
-	codec->steppingId = HDA_PARAM_REVISION_ID_STEPPING_ID(revisionId);
-
-	if ((vendorId == HDAC_INVALID) && (revisionId == HDAC_INVALID)) {
-		errorMsg("error: codec #%d is not responding, probing aborted\n", cad);
-		return;
+	if (connListLength == HDAC_INVALID)
+		return 0;
+	ents = HDA_PARAM_CONN_LIST_LENGTH_LIST_LENGTH(connListLength);
+	entnum = HDA_PARAM_CONN_LIST_LENGTH_LONG_FORM(connListLength) ? 2 : 4;
+	return (ents < 1) ? 0 : ((ents + entnum - 1) / entnum);
+}
+
+/*
+ * Read everything the parse needs from all codecs at once. The reads go in
+ * rounds, each of which depends on the answers to the one before: the codec
+ * IDs and nodes, the function groups, the power up, then the three rounds over
+ * the widgets of the audio function groups (their capabilities, then what
+ * they say is there: amplifiers, formats, pin and connection list lengths,
+ * then the connection lists and EAPD). Each round is one batch for all the
+ * codecs, which take its verbs in turns, so the probe takes as many round
+ * trips as the busiest codec needs rather than the sum of them all.
+ */
+void VoodooHDADevice::probeCodecs()
+{
+	UInt32 ids[HDAC_CODEC_MAX][3];
+	UInt32 *funcGroupTypes[HDAC_CODEC_MAX], *subNodes[HDAC_CODEC_MAX];
+
+	batchBegin();
+	for (int i = 0; i < HDAC_CODEC_MAX; i++) {
+		if (!mCodecs[i])
+			continue;
+		batchCommand(HDA_CMD_GET_PARAMETER(i, 0, HDA_PARAM_VENDOR_ID), &ids[i][0]);
+		batchCommand(HDA_CMD_GET_PARAMETER(i, 0, HDA_PARAM_REVISION_ID), &ids[i][1]);
+		batchCommand(HDA_CMD_GET_PARAMETER(i, 0, HDA_PARAM_SUB_NODE_COUNT), &ids[i][2]);
 	}
+	batchFlush();
 
-	dumpMsg(" HDA Codec #%d: %s\n", cad, findCodecName(codec));
-	dumpMsg(" HDA Codec ID: 0x%08lx\n", (long unsigned int)CODEC_ID(codec));
-	dumpMsg("       Vendor: 0x%04x\n", codec->vendorId);
-	dumpMsg("       Device: 0x%04x\n", codec->deviceId);
-	dumpMsg("     Revision: 0x%02x\n", codec->revisionId);
-	dumpMsg("     Stepping: 0x%02x\n", codec->steppingId);
-	dumpMsg("PCI Subvendor: 0x%08lx\n", (long unsigned int)mSubDeviceId);
+	batchBegin();
+	for (int i = 0; i < HDAC_CODEC_MAX; i++) {
+		Codec *codec = mCodecs[i];
+		funcGroupTypes[i] = subNodes[i] = NULL;
+		if (!codec)
+			continue;
+		codec->vendorId = HDA_PARAM_VENDOR_ID_VENDOR_ID(ids[i][0]);
+		codec->deviceId = HDA_PARAM_VENDOR_ID_DEVICE_ID(ids[i][0]);
+		codec->revisionId = HDA_PARAM_REVISION_ID_REVISION_ID(ids[i][1]);
+		codec->steppingId = HDA_PARAM_REVISION_ID_STEPPING_ID(ids[i][1]);
 
-	subNode = sendCommand(HDA_CMD_GET_PARAMETER(cad, 0, HDA_PARAM_SUB_NODE_COUNT), cad);
-	startNode = HDA_PARAM_SUB_NODE_COUNT_START(subNode);
-	endNode = startNode + HDA_PARAM_SUB_NODE_COUNT_TOTAL(subNode);
-	dumpMsg("\tstartNode=%d endNode=%d\n", startNode, endNode);
-	
-	codec->funcGroups = (FunctionGroup *) allocMem(sizeof (FunctionGroup) * (endNode - startNode));
-	if (!codec->funcGroups) {
-		errorMsg("error: couldn't allocate memory for function groups\n");
-		return;
+		if ((ids[i][0] == HDAC_INVALID) && (ids[i][1] == HDAC_INVALID)) {
+			errorMsg("error: codec #%d is not responding, probing aborted\n", i);
+			continue;
+		}
+
+		codec->startNode = HDA_PARAM_SUB_NODE_COUNT_START(ids[i][2]);
+		codec->endNode = codec->startNode + HDA_PARAM_SUB_NODE_COUNT_TOTAL(ids[i][2]);
+		if (codec->endNode <= codec->startNode)
+			continue;
+		codec->funcGroups = (FunctionGroup *) allocMem(sizeof (FunctionGroup) * (codec->endNode - codec->startNode));
+		funcGroupTypes[i] = (UInt32 *) allocMem(sizeof (UInt32) * (codec->endNode - codec->startNode));
+		subNodes[i] = (UInt32 *) allocMem(sizeof (UInt32) * (codec->endNode - codec->startNode));
+		if (!codec->funcGroups || !funcGroupTypes[i] || !subNodes[i]) {
+			errorMsg("error: couldn't allocate memory for function groups\n");
+			if (codec->funcGroups)
+				freeMem(codec->funcGroups);
+			codec->funcGroups = NULL;
+			continue;
+		}
+		for (int nid = codec->startNode; nid < codec->endNode; nid++) {
+			batchCommand(HDA_CMD_GET_PARAMETER(i, nid, HDA_PARAM_FCT_GRP_TYPE),
+					&funcGroupTypes[i][nid - codec->startNode]);
+			batchCommand(HDA_CMD_GET_PARAMETER(i, nid, HDA_PARAM_SUB_NODE_COUNT),
+					&subNodes[i][nid - codec->startNode]);
+		}
 	}
+	batchFlush();
 
-	for (int i = startNode; i < endNode; i++)
-		probeFunction(codec, i);
+	for (int i = 0; i < HDAC_CODEC_MAX; i++) {
+		Codec *codec = mCodecs[i];
+		if (codec && codec->funcGroups && funcGroupTypes[i] && subNodes[i])
+			for (int nid = codec->startNode; nid < codec->endNode; nid++)
+				probeFunctionSetup(codec, nid, funcGroupTypes[i][nid - codec->startNode],
+						subNodes[i][nid - codec->startNode]);
+		if (funcGroupTypes[i])
+			freeMem(funcGroupTypes[i]);
+		if (subNodes[i])
+			freeMem(subNodes[i]);
+	}
 
-	return;
+	powerupCodecs();
+
+	/* The audio function groups and the capabilities of their widgets */
+	batchBegin();
+	for (int i = 0; i < HDAC_CODEC_MAX; i++) {
+		Codec *codec = mCodecs[i];
+		if (!codec)
+			continue;
+		for (int n = 0; n < codec->numFuncGroups; n++)
+			if (codec->funcGroups[n].nodeType == HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO)
+				audioQueryCaps(&codec->funcGroups[n]);
+	}
+	batchFlush();
+
+	/* What the capabilities say is there */
+	for (int i = 0; i < HDAC_CODEC_MAX; i++) {
+		Codec *codec = mCodecs[i];
+		if (!codec)
+			continue;
+		for (int n = 0; n < codec->numFuncGroups; n++)
+			if (codec->funcGroups[n].nodeType == HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO)
+				audioQueryParams(&codec->funcGroups[n]);
+	}
+	batchFlush();
+
+	/* The connection lists */
+	for (int i = 0; i < HDAC_CODEC_MAX; i++) {
+		Codec *codec = mCodecs[i];
+		if (!codec)
+			continue;
+		for (int n = 0; n < codec->numFuncGroups; n++)
+			if (codec->funcGroups[n].nodeType == HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO)
+				audioQueryConnections(&codec->funcGroups[n]);
+	}
+	batchFlush();
 }
 
 /*
- * Probe codec function and add it to the list.
+ * Set up the function group at nid from its type and sub node count, as read
+ * by probeCodecs(), and add it to the codec.
  */
-void VoodooHDADevice::probeFunction(Codec *codec, nid_t nid)
+void VoodooHDADevice::probeFunctionSetup(Codec *codec, nid_t nid, UInt32 funcGroupType, UInt32 subNode)
 {
 	FunctionGroup *funcGroup = &codec->funcGroups[codec->numFuncGroups];
-	UInt32 funcGroupType;
-	UInt32 res;
-	nid_t cad = codec->cad;
-//	AudioControl *control;
 
-	funcGroupType = HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE(sendCommand(HDA_CMD_GET_PARAMETER(cad, nid,
-			HDA_PARAM_FCT_GRP_TYPE), cad));
+	funcGroupType = HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE(funcGroupType);
 
 	funcGroup->nid = nid;
 	funcGroup->nodeType = funcGroupType;
 	funcGroup->codec = codec;
 
-	res = sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_SUB_NODE_COUNT), cad);
-
-	funcGroup->numNodes = HDA_PARAM_SUB_NODE_COUNT_TOTAL(res);
-	funcGroup->startNode = HDA_PARAM_SUB_NODE_COUNT_START(res);
+	funcGroup->numNodes = HDA_PARAM_SUB_NODE_COUNT_TOTAL(subNode);
+	funcGroup->startNode = HDA_PARAM_SUB_NODE_COUNT_START(subNode);
 	funcGroup->endNode = funcGroup->startNode + funcGroup->numNodes;
 
-	dumpMsg("\tFound %s FG nid=%d startNode=%d endNode=%d total=%d\n",
-			(funcGroupType == HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO) ? "audio" :
-			(funcGroupType == HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_MODEM) ? "modem" : "unknown",
-			nid, funcGroup->startNode, funcGroup->endNode, funcGroup->numNodes);
-
 	if (funcGroup->numNodes > 0)
 		funcGroup->widgets = (Widget *) allocMem(sizeof (*(funcGroup->widgets)) * funcGroup->numNodes);
 	else {
 		funcGroup->widgets = NULL;
-		errorMsg("error: no nodes present in function group\n");
+		errorMsg("error: no nodes present in function group cad=%d nid=%d\n", codec->cad, nid);
 		return;
 	}
 
@@ -159,20 +236,193 @@ void VoodooHDADevice::probeFunction(Codec *codec, nid_t nid)
 	}
 
 	codec->numFuncGroups++;
+}
+
+/*
+ * Power up the audio function groups of all codecs and their widgets, and
+ * power down the others: in two batches, so that all the codecs get over it
+ * in one wait.
+ */
+void VoodooHDADevice::powerupCodecs()
+{
+	batchBegin();
+	for (int i = 0; i < HDAC_CODEC_MAX; i++) {
+		Codec *codec = mCodecs[i];
+		if (!codec)
+			continue;
+		for (int n = 0; n < codec->numFuncGroups; n++) {
+			FunctionGroup *funcGroup = &codec->funcGroups[n];
+			batchCommand(HDA_CMD_SET_POWER_STATE(i, funcGroup->nid,
+					(funcGroup->nodeType == HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO) ?
+					HDA_CMD_POWER_STATE_D0 : HDA_CMD_POWER_STATE_D3), NULL);
+		}
+	}
+	batchFlush();
+	IODelay(100);
+
+	batchBegin();
+	for (int i = 0; i < HDAC_CODEC_MAX; i++) {
+		Codec *codec = mCodecs[i];
+		if (!codec)
+			continue;
+		for (int n = 0; n < codec->numFuncGroups; n++) {
+			FunctionGroup *funcGroup = &codec->funcGroups[n];
+			if (funcGroup->nodeType != HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO)
+				continue;
+			for (int nid = funcGroup->startNode; nid < funcGroup->endNode; nid++)
+				batchCommand(HDA_CMD_SET_POWER_STATE(i, nid, HDA_CMD_POWER_STATE_D0), NULL);
+		}
+	}
+	batchFlush();
+	IODelay(1000);
+}
+
+/*
+ * The first round of the widget reads: the function group parameters and the
+ * widget capabilities. Queued only; probeCodecs() flushes.
+ */
+void VoodooHDADevice::audioQueryCaps(FunctionGroup *funcGroup)
+{
+	nid_t cad, nid;
+
+	cad = funcGroup->codec->cad;
+	nid = funcGroup->nid;
+
+	batchCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_GPIO_COUNT), &funcGroup->audio.gpio);
+	batchCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_SUPP_STREAM_FORMATS),
+			&funcGroup->audio.supStreamFormats);
+	batchCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_SUPP_PCM_SIZE_RATE),
+			&funcGroup->audio.supPcmSizeRates);
+	batchCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_OUTPUT_AMP_CAP), &funcGroup->audio.outAmpCap);
+	batchCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_INPUT_AMP_CAP), &funcGroup->audio.inAmpCap);
+
+	for (int i = funcGroup->startNode; i < funcGroup->endNode; i++) {
+		Widget *widget = widgetGet(funcGroup, i);
+		if (!widget)
+			dumpMsg("Ghost widget! nid=%d!\n", i);
+		else {
+			widget->funcGroup = funcGroup;
+			widget->nid = i;
+			widget->enable = 1;
+			widget->selconn = -1;
+			widget->pflags = 0;
+			widget->ossdev = -1;
+			widget->bindAssoc = -1;
+			widget->traceDir = TRACE_DIR_NONE;
+			widget->params.eapdBtl = HDAC_INVALID;
+			widget->favoritDAC = 0;
+			batchCommand(HDA_CMD_GET_PARAMETER(cad, i, HDA_PARAM_AUDIO_WIDGET_CAP), &widget->params.widgetCap);
+		}
+	}
+}
+
+/*
+ * The second round: what the widget capabilities say is there, including the
+ * connection list lengths, which are kept for the third.
+ */
+void VoodooHDADevice::audioQueryParams(FunctionGroup *funcGroup)
+{
+	UInt32 *connListLengths;
+
+	connListLengths = (UInt32 *) allocMem(sizeof (UInt32) * funcGroup->numNodes);
+	if (!connListLengths) {
+		errorMsg("error: couldn't allocate memory for connection list lengths\n");
+		return;
+	}
+	funcGroup->audio.connListLengths = connListLengths;
+
+	for (int i = funcGroup->startNode; i < funcGroup->endNode; i++) {
+		Widget *widget = widgetGet(funcGroup, i);
+		connListLengths[i - funcGroup->startNode] = 0;
+		if (widget)
+			widgetQueryParams(widget, &connListLengths[i - funcGroup->startNode]);
+	}
+}
+
+/*
+ * The third round: the connection lists and EAPD.
+ */
+void VoodooHDADevice::audioQueryConnections(FunctionGroup *funcGroup)
+{
+	UInt32 *connListLengths = funcGroup->audio.connListLengths;
+	UInt32 *connLists;
+	int numEntries;
+
+	if (!connListLengths)
+		return;
+
+	numEntries = 0;
+	for (int i = 0; i < funcGroup->numNodes; i++)
+		numEntries += widgetConnectionListEntries(connListLengths[i]);
+	connLists = (numEntries > 0) ? (UInt32 *) allocMem(sizeof (UInt32) * numEntries) : NULL;
+	if ((numEntries > 0) && !connLists) {
+		errorMsg("error: couldn't allocate memory for connection lists\n");
+		freeMem(connListLengths);
+		funcGroup->audio.connListLengths = NULL;
+		return;
+	}
+	funcGroup->audio.connLists = connLists;
+
+	for (int i = funcGroup->startNode, entry = 0; i < funcGroup->endNode; i++) {
+		Widget *widget = widgetGet(funcGroup, i);
+		UInt32 connListLength = connListLengths[i - funcGroup->startNode];
+		if (widget)
+			widgetQueryConnections(widget, connListLength, &connLists[entry]);
+		entry += widgetConnectionListEntries(connListLength);
+	}
+}
+
+/*
+ * Set up the given codec from what probeCodecs() has read.
+ */
+void VoodooHDADevice::probeCodec(Codec *codec)
+{
+	nid_t cad = codec->cad;
+
+	dumpMsg("\nProbing codec #%d...\n", cad);
+	if (CODEC_ID(codec) == HDAC_INVALID)
+		return;
+
+	dumpMsg(" HDA Codec #%d: %s\n", cad, findCodecName(codec));
+	dumpMsg(" HDA Codec ID: 0x%08lx\n", (long unsigned int)CODEC_ID(codec));
+	dumpMsg("       Vendor: 0x%04x\n", codec->vendorId);
+	dumpMsg("       Device: 0x%04x\n", codec->deviceId);
+	dumpMsg("     Revision: 0x%02x\n", codec->revisionId);
+	dumpMsg("     Stepping: 0x%02x\n", codec->steppingId);
+	dumpMsg("PCI Subvendor: 0x%08lx\n", (long unsigned int)mSubDeviceId);
+
+	dumpMsg("\tstartNode=%d endNode=%d\n", codec->startNode, codec->endNode);
+
+	for (int i = 0; i < codec->numFuncGroups; i++)
+		probeFunction(&codec->funcGroups[i]);
+
+	dumpMsg("Codec shadow: %d parameters, %d state values, %d verbs saved\n", (int) codec->shadow.numParams(),
+			(int) codec->shadow.numState(), (int) codec->shadow.hits());
+
+	return;
+}
+
+/*
+ * Set up the given codec function.
+ */
+void VoodooHDADevice::probeFunction(FunctionGroup *funcGroup)
+{
+//	AudioControl *control;
+
+	dumpMsg("\tFound %s FG nid=%d startNode=%d endNode=%d total=%d\n",
+			(funcGroup->nodeType == HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO) ? "audio" :
+			(funcGroup->nodeType == HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_MODEM) ? "modem" : "unknown",
+			funcGroup->nid, funcGroup->startNode, funcGroup->endNode, funcGroup->numNodes);
 
 	dumpMsg("\n");
 	dumpMsg("Processing %s FG cad=%d nid=%d...\n",
 			(funcGroup->nodeType == HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO) ? "audio" :
 			(funcGroup->nodeType == HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_MODEM) ? "modem" : "unknown",
 			funcGroup->codec->cad, funcGroup->nid);
-	if (funcGroup->nodeType != HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO) {
-		dumpMsg("Powering down...\n");
-		sendCommand(HDA_CMD_SET_POWER_STATE(codec->cad, funcGroup->nid, HDA_CMD_POWER_STATE_D3), codec->cad);
+	/* powerupCodecs() has already powered it up, or down if it isn't audio */
+	if (funcGroup->nodeType != HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO)
 		return;
-	}
 
-	dumpMsg("Powering up...\n");
-	powerup(funcGroup);
 	dumpMsg("Parsing audio FG...\n");
 	audioParse(funcGroup);
 	dumpMsg("Parsing vendor patch...\n");
@@ -218,14 +468,11 @@ void VoodooHDADevice::probeFunction(Codec *codec, nid_t nid)
 //	dumpMsg("HP switch init...\n");
 //	switchInit(funcGroup);  //Slice - move below
 
-	static bool dmaPosMemAllocated = false; // xxx
-	if ((funcGroup->audio.quirks & HDA_QUIRK_DMAPOS) && !dmaPosMemAllocated) {
-		errorMsg("XXX\nXXX dma pos quirk untested\nXXX\n");
+	// stream positions come from here, streams it turns out to be wrong for fall back to LPIB
+	if (!mDmaPosMem) {
 		mDmaPosMem = allocateDmaMemory((mInStreamsSup + mOutStreamsSup + mBiStreamsSup) * 8, "dmaPosMem");
 		if (!mDmaPosMem)
 			errorMsg("error: failed to allocate DMA pos buffer (non-fatal)\n");
-		else
-			dmaPosMemAllocated = true;
 	}
 
 	dumpMsg("Creating PCM devices...\n");
@@ -270,28 +517,14 @@ void VoodooHDADevice::probeFunction(Codec *codec, nid_t nid)
 	createPrefPanelMemoryBuf(funcGroup);
 }
 
-void VoodooHDADevice::powerup(FunctionGroup *funcGroup)
-{
-	nid_t cad = funcGroup->codec->cad;
-	//logMsg("VoodooHDADevice::PowerUp\n");
-	sendCommand(HDA_CMD_SET_POWER_STATE(cad, funcGroup->nid, HDA_CMD_POWER_STATE_D0), cad);
-	IODelay(100);
-
-	for (int i = funcGroup->startNode; i < funcGroup->endNode; i++)
-		sendCommand(HDA_CMD_SET_POWER_STATE(cad, i, HDA_CMD_POWER_STATE_D0), cad);
-	IODelay(1000);
-}
-
+/*
+ * Make sense of the widgets once probeCodecs() has read them all, and let go
+ * of the connection lists it has kept for the purpose.
+ */
 void VoodooHDADevice::audioParse(FunctionGroup *funcGroup)
 {
-	UInt32 res;
-	nid_t cad, nid;
-
-	cad = funcGroup->codec->cad;
-	nid = funcGroup->nid;
-
-	res = sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_GPIO_COUNT), cad);
-	funcGroup->audio.gpio = res;
+	UInt32 *connListLengths = funcGroup->audio.connListLengths;
+	UInt32 *connLists = funcGroup->audio.connLists;
 
 	dumpMsg("GPIO: 0x%08lx NumGPIO=%ld NumGPO=%ld NumGPI=%ld GPIWake=%ld GPIUnsol=%ld\n",
 			(long unsigned int)funcGroup->audio.gpio,
@@ -301,36 +534,22 @@ void VoodooHDADevice::audioParse(FunctionGroup *funcGroup)
 			(long int)HDA_PARAM_GPIO_COUNT_GPI_WAKE(funcGroup->audio.gpio),
 			(long int)HDA_PARAM_GPIO_COUNT_GPI_UNSOL(funcGroup->audio.gpio));
 
-	res = sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_SUPP_STREAM_FORMATS), cad);
-	funcGroup->audio.supStreamFormats = res;
-
-	res = sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_SUPP_PCM_SIZE_RATE), cad);
-	funcGroup->audio.supPcmSizeRates = res;
-
-	res = sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_OUTPUT_AMP_CAP), cad);
-	funcGroup->audio.outAmpCap = res;
-
-	res = sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_INPUT_AMP_CAP), cad);
-	funcGroup->audio.inAmpCap = res;
+	if (!connListLengths)
+		return;
 
-	for (int i = funcGroup->startNode; i < funcGroup->endNode; i++) {
+	for (int i = funcGroup->startNode, entry = 0; i < funcGroup->endNode; i++) {
 		Widget *widget = widgetGet(funcGroup, i);
-		if (!widget)
-			dumpMsg("Ghost widget! nid=%d!\n", i);
-		else {
-			widget->funcGroup = funcGroup;
-			widget->nid = i;
-			widget->enable = 1;
-			widget->selconn = -1;
-			widget->pflags = 0;
-			widget->ossdev = -1;
-			widget->bindAssoc = -1;
-			widget->traceDir = TRACE_DIR_NONE;
-			widget->params.eapdBtl = HDAC_INVALID;
-			widget->favoritDAC = 0;
-			widgetParse(widget);
-		}
+		UInt32 connListLength = connListLengths[i - funcGroup->startNode];
+		if (widget)
+			widgetParse(widget, connListLength, &connLists[entry]);
+		entry += widgetConnectionListEntries(connListLength);
 	}
+
+	if (connLists)
+		freeMem(connLists);
+	freeMem(connListLengths);
+	funcGroup->audio.connLists = NULL;
+	funcGroup->audio.connListLengths = NULL;
 }
 
 void VoodooHDADevice::audioCtlParse(FunctionGroup *funcGroup)
@@ -2187,7 +2406,7 @@ void VoodooHDADevice::audioCommit(FunctionGroup *funcGroup)
 	/* Commit controls. */
 	audioCtlCommit(funcGroup);
 
-	/* Commit selectors, pins and EAPD. */
+	/* Commit selectors, then pins and EAPD in one batch. */
 	for (int i = 0; i < funcGroup->numNodes; i++) {
 		Widget *widget = &funcGroup->widgets[i];
 		if (!widget)
@@ -2196,16 +2415,21 @@ void VoodooHDADevice::audioCommit(FunctionGroup *funcGroup)
 			widget->selconn = 0;
 		if (widget->nconns > 0)
 			widgetConnectionSelect(widget, widget->selconn);
+	}
+	batchBegin();
+	for (int i = 0; i < funcGroup->numNodes; i++) {
+		Widget *widget = &funcGroup->widgets[i];
 		if (widget->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX)
-			sendCommand(HDA_CMD_SET_PIN_WIDGET_CTRL(cad, widget->nid, widget->pin.ctrl), cad);
+			batchCommand(HDA_CMD_SET_PIN_WIDGET_CTRL(cad, widget->nid, widget->pin.ctrl), NULL);
 		if (widget->params.eapdBtl != HDAC_INVALID) {
 		    UInt32 val;
 			val = widget->params.eapdBtl;
 			if (funcGroup->audio.quirks & HDA_QUIRK_EAPDINV)
 				val ^= HDA_CMD_SET_EAPD_BTL_ENABLE_EAPD;
-			sendCommand(HDA_CMD_SET_EAPD_BTL_ENABLE(cad, widget->nid, val), cad);
+			batchCommand(HDA_CMD_SET_EAPD_BTL_ENABLE(cad, widget->nid, val), NULL);
 		}
 	}
+	batchFlush();
 
 	/* Commit GPIOs. */
 	gdata = 0;
@@ -2855,23 +3079,42 @@ void VoodooHDADevice::pinDump()
 /********************************************************************************************/
 /********************************************************************************************/
 
-void VoodooHDADevice::widgetConnectionParse(Widget *widget)
+/*
+ * Queue the reads that depend on the first round of the parse: the connection
+ * list and, for pins that have one, the EAPD/BTL state.
+ */
+void VoodooHDADevice::widgetQueryConnections(Widget *widget, UInt32 connListLength, UInt32 *connList)
+{
+	int entnum;
+	nid_t cad = widget->funcGroup->codec->cad;
+	nid_t nid = widget->nid;
+
+	entnum = HDA_PARAM_CONN_LIST_LENGTH_LONG_FORM(connListLength) ? 2 : 4;
+	for (int n = 0; n < widgetConnectionListEntries(connListLength); n++)
+		batchCommand(HDA_CMD_GET_CONN_LIST_ENTRY(cad, nid, n * entnum), &connList[n]);
+
+	if (widget->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX) {
+		widget->pin.config = widgetPinGetConfig(widget);
+		widget->pin.cap = widgetPinGetCaps(widget);
+		if (HDA_PARAM_PIN_CAP_EAPD_CAP(widget->pin.cap))
+			batchCommand(HDA_CMD_GET_EAPD_BTL_ENABLE(cad, nid), &widget->params.eapdBtl);
+	}
+}
+
+void VoodooHDADevice::widgetConnectionParse(Widget *widget, UInt32 connListLength, const UInt32 *connList)
 {
 	UInt32 res;
 	int max, ents, entnum;
-	nid_t cad = widget->funcGroup->codec->cad;
 	nid_t nid = widget->nid;
 	nid_t cnid, addcnid, prevcnid;
 
 	widget->nconns = 0;
 
-	res = sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_CONN_LIST_LENGTH), cad);
-
-	ents = HDA_PARAM_CONN_LIST_LENGTH_LIST_LENGTH(res);
-	if (ents < 1)
+	if (widgetConnectionListEntries(connListLength) == 0)
 		return;
 
-	entnum = HDA_PARAM_CONN_LIST_LENGTH_LONG_FORM(res) ? 2 : 4;
+	ents = HDA_PARAM_CONN_LIST_LENGTH_LIST_LENGTH(connListLength);
+	entnum = HDA_PARAM_CONN_LIST_LENGTH_LONG_FORM(connListLength) ? 2 : 4;
 	max = (sizeof (widget->conns) / sizeof (widget->conns[0])) - 1;
 	prevcnid = 0;
 
@@ -2882,7 +3125,7 @@ void VoodooHDADevice::widgetConnectionParse(Widget *widget)
 #define CONN_CNID(r, e, n)		(CONN_RESVAL(r, e, n) & CONN_NMASK(e))
 
 	for (int i = 0; i < ents; i += entnum) {
-		res = sendCommand(HDA_CMD_GET_CONN_LIST_ENTRY(cad, nid, i), cad);
+		res = connList[i / entnum];
 		for (int j = 0; j < entnum; j++) {
 			cnid = CONN_CNID(res, entnum, j);
 			if (cnid == 0) {
@@ -3037,7 +3280,7 @@ UInt32 VoodooHDADevice::widgetPinGetConfig(Widget *widget)
 	nid = widget->nid;
 	id = CODEC_ID(widget->funcGroup->codec);
 
-	config = sendCommand(HDA_CMD_GET_CONFIGURATION_DEFAULT(cad, nid), cad);
+	config = widget->pin.config;
 	orig = config;
 
 	dumpPinConfig(widget, orig);
@@ -3216,13 +3459,12 @@ UInt32 VoodooHDADevice::widgetPinGetConfig(Widget *widget)
 UInt32 VoodooHDADevice::widgetPinGetCaps(Widget *widget)
 {
 	UInt32 caps, orig, id;
-	nid_t cad, nid;
+	nid_t nid;
 
-	cad = widget->funcGroup->codec->cad;
 	nid = widget->nid;
 	id = CODEC_ID(widget->funcGroup->codec);
 
-	caps = sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_PIN_CAP), cad);
+	caps = widget->pin.cap;
 	orig = caps;
 
 	if (caps != orig)
@@ -3233,22 +3475,13 @@ UInt32 VoodooHDADevice::widgetPinGetCaps(Widget *widget)
 
 void VoodooHDADevice::widgetPinParse(Widget *widget)
 {
-	UInt32 config, pincap;
+	UInt32 pincap;
 //	const char *devstr;
-	nid_t cad = widget->funcGroup->codec->cad;
-	nid_t nid = widget->nid;
 //	int conn, color;
 
-	config = widgetPinGetConfig(widget);
-	widget->pin.config = config;
-
-	pincap = widgetPinGetCaps(widget);
-	widget->pin.cap = pincap;
-
-	widget->pin.ctrl = sendCommand(HDA_CMD_GET_PIN_WIDGET_CTRL(cad, nid), cad);
+	pincap = widget->pin.cap;
 
 	if (HDA_PARAM_PIN_CAP_EAPD_CAP(pincap)) {
-		widget->params.eapdBtl = sendCommand(HDA_CMD_GET_EAPD_BTL_ENABLE(cad, nid), cad);
 		widget->params.eapdBtl &= 0x7;
 		widget->params.eapdBtl |= HDA_CMD_SET_EAPD_BTL_ENABLE_EAPD;
 	} else
@@ -3260,13 +3493,12 @@ void VoodooHDADevice::widgetPinParse(Widget *widget)
 UInt32 VoodooHDADevice::widgetGetCaps(Widget *widget, int *waspin)
 {
 	UInt32 caps, orig, id;
-	nid_t cad, nid, beeper = -1;
+	nid_t nid, beeper = -1;
 
-	cad = widget->funcGroup->codec->cad;
 	nid = widget->nid;
 	id = CODEC_ID(widget->funcGroup->codec);
 
-	caps = sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_AUDIO_WIDGET_CAP), cad);
+	caps = widget->params.widgetCap;
 	orig = caps;
 
 	/* On some codecs beeper is an input pin, but it is not recordable
@@ -3315,10 +3547,13 @@ UInt32 VoodooHDADevice::widgetGetCaps(Widget *widget, int *waspin)
 	return caps;
 }
 
-void VoodooHDADevice::widgetParse(Widget *widget)
+/*
+ * Queue the reads that the widget capabilities call for: the connection list
+ * length, the amplifier and format overrides, and the pin registers.
+ */
+void VoodooHDADevice::widgetQueryParams(Widget *widget, UInt32 *connListLength)
 {
-	UInt32 wcap, cap;
-	const char *typestr;
+	UInt32 wcap;
 	nid_t cad = widget->funcGroup->codec->cad;
 	nid_t nid = widget->nid;
 
@@ -3327,6 +3562,36 @@ void VoodooHDADevice::widgetParse(Widget *widget)
 	widget->params.widgetCap = wcap;
 	widget->type = HDA_PARAM_AUDIO_WIDGET_CAP_TYPE(wcap);
 
+	batchCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_CONN_LIST_LENGTH), connListLength);
+
+	if (HDA_PARAM_AUDIO_WIDGET_CAP_OUT_AMP(wcap) && HDA_PARAM_AUDIO_WIDGET_CAP_AMP_OVR(wcap))
+		batchCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_OUTPUT_AMP_CAP), &widget->params.outAmpCap);
+	if (HDA_PARAM_AUDIO_WIDGET_CAP_IN_AMP(wcap) && HDA_PARAM_AUDIO_WIDGET_CAP_AMP_OVR(wcap))
+		batchCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_INPUT_AMP_CAP), &widget->params.inAmpCap);
+
+	if (((widget->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_OUTPUT) ||
+			(widget->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_INPUT)) &&
+			HDA_PARAM_AUDIO_WIDGET_CAP_FORMAT_OVR(wcap)) {
+		batchCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_SUPP_STREAM_FORMATS),
+				&widget->params.supStreamFormats);
+		batchCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_SUPP_PCM_SIZE_RATE),
+				&widget->params.supPcmSizeRates);
+	}
+
+	if (widget->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_PIN_COMPLEX) {
+		batchCommand(HDA_CMD_GET_CONFIGURATION_DEFAULT(cad, nid), &widget->pin.config);
+		batchCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_PIN_CAP), &widget->pin.cap);
+		batchCommand(HDA_CMD_GET_PIN_WIDGET_CTRL(cad, nid), &widget->pin.ctrl);
+	}
+}
+
+void VoodooHDADevice::widgetParse(Widget *widget, UInt32 connListLength, const UInt32 *connList)
+{
+	UInt32 wcap;
+	const char *typestr;
+
+	wcap = widget->params.widgetCap;
+
 	switch (widget->type) {
 	case HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_OUTPUT:
 		typestr = "audio output";
@@ -3366,22 +3631,17 @@ void VoodooHDADevice::widgetParse(Widget *widget)
 	strlcpy(widget->name, typestr, sizeof (widget->name));
 #endif
 
-	widgetConnectionParse(widget);
+	widgetConnectionParse(widget, connListLength, connList);
 
+	/* the overrides were read by widgetQueryParams() */
 	if (HDA_PARAM_AUDIO_WIDGET_CAP_OUT_AMP(wcap)) {
-		if (HDA_PARAM_AUDIO_WIDGET_CAP_AMP_OVR(wcap))
-			widget->params.outAmpCap =
-					sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_OUTPUT_AMP_CAP), cad);
-		else
+		if (!HDA_PARAM_AUDIO_WIDGET_CAP_AMP_OVR(wcap))
 			widget->params.outAmpCap = widget->funcGroup->audio.outAmpCap;
 	} else
 		widget->params.outAmpCap = 0;
 
 	if (HDA_PARAM_AUDIO_WIDGET_CAP_IN_AMP(wcap)) {
-		if (HDA_PARAM_AUDIO_WIDGET_CAP_AMP_OVR(wcap))
-			widget->params.inAmpCap =
-					sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_INPUT_AMP_CAP), cad);
-		else
+		if (!HDA_PARAM_AUDIO_WIDGET_CAP_AMP_OVR(wcap))
 			widget->params.inAmpCap = widget->funcGroup->audio.inAmpCap;
 	} else
 		widget->params.inAmpCap = 0;
@@ -3389,10 +3649,10 @@ void VoodooHDADevice::widgetParse(Widget *widget)
 	if ((widget->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_OUTPUT) ||
 			(widget->type == HDA_PARAM_AUDIO_WIDGET_CAP_TYPE_AUDIO_INPUT)) {
 		if (HDA_PARAM_AUDIO_WIDGET_CAP_FORMAT_OVR(wcap)) {
-			cap = sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_SUPP_STREAM_FORMATS), cad);
-			widget->params.supStreamFormats = (cap != 0) ? cap : widget->funcGroup->audio.supStreamFormats;
-			cap = sendCommand(HDA_CMD_GET_PARAMETER(cad, nid, HDA_PARAM_SUPP_PCM_SIZE_RATE), cad);
-			widget->params.supPcmSizeRates = (cap != 0) ? cap : widget->funcGroup->audio.supPcmSizeRates;
+			if (widget->params.supStreamFormats == 0)
+				widget->params.supStreamFormats = widget->funcGroup->audio.supStreamFormats;
+			if (widget->params.supPcmSizeRates == 0)
+				widget->params.supPcmSizeRates = widget->funcGroup->audio.supPcmSizeRates;
 		} else {
 			widget->params.supStreamFormats = widget->funcGroup->audio.supStreamFormats;
 			widget->params.supPcmSizeRates = widget->funcGroup->audio.supPcmSizeRates;
@@ -3472,28 +3732,46 @@ AudioControl *VoodooHDADevice::audioCtlAmpGet(FunctionGroup *funcGroup, nid_t ni
 	return NULL;
 }
 
-void VoodooHDADevice::audioCtlAmpSetInternal(nid_t cad, nid_t nid, int index, int lmute, int rmute, int left,
-		int right, int dir)
+/*
+ * Queue the amplifier writes for the given channels into the current batch; both
+ * go in one verb when they get the same value. Returns the number of verbs.
+ */
+int VoodooHDADevice::audioCtlAmpSetInternal(nid_t cad, nid_t nid, int index, int lmute, int rmute, int left,
+		int right, int dir, int channels)
 {
-	UInt16 v = 0;
+	UInt16 v = (1 << (15 - dir)) | (index << 8);
+	int count = 0;
 // dir = 0 - out, = 1 -IN
-	if ((left != right) || (lmute != rmute)) {
-		v = (1 << (15 - dir)) | (1 << 13) | (index << 8) | (lmute << 7) | left;
-		sendCommand(HDA_CMD_SET_AMP_GAIN_MUTE(cad, nid, v), cad);
-		v = (1 << (15 - dir)) | (1 << 12) | (index << 8) | (rmute << 7) | right;
-	} else
-		v = (1 << (15 - dir)) | (3 << 12) | (index << 8) | (lmute << 7) | left;
-
-	sendCommand(HDA_CMD_SET_AMP_GAIN_MUTE(cad, nid, v), cad);
+	if ((channels == HDA_AMP_CHAN_BOTH) && (left == right) && (lmute == rmute)) {
+		batchCommand(HDA_CMD_SET_AMP_GAIN_MUTE(cad, nid, v | (3 << 12) | (lmute << 7) | left), NULL);
+		return 1;
+	}
+	if (channels & HDA_AMP_CHAN_LEFT) {
+		batchCommand(HDA_CMD_SET_AMP_GAIN_MUTE(cad, nid, v | (1 << 13) | (lmute << 7) | left), NULL);
+		count++;
+	}
+	if (channels & HDA_AMP_CHAN_RIGHT) {
+		batchCommand(HDA_CMD_SET_AMP_GAIN_MUTE(cad, nid, v | (1 << 12) | (rmute << 7) | right), NULL);
+		count++;
+	}
+	return count;
 }
 
-void VoodooHDADevice::audioCtlAmpSet(AudioControl *control, UInt32 mute, int left, int right)
+/*
+ * Like audioCtlAmpSet(), into a batch the caller has begun: only the channels whose
+ * effective value differs from what was last sent are written. What was sent is only
+ * trusted for as long as the codec shadow's state is, so that a reset or a jack event
+ * has everything written again. Returns the number of verbs queued.
+ */
+int VoodooHDADevice::audioCtlAmpQueue(AudioControl *control, UInt32 mute, int left, int right)
 {
+	Codec *codec = control->widget->funcGroup->codec;
 	nid_t nid, cad;
-	int lmute, rmute;
+	int lmute, rmute, channels, count = 0;
+	UInt32 written;
+	UInt8 lval, rval;
 
-	
-	cad = control->widget->funcGroup->codec->cad;
+	cad = codec->cad;
 	nid = control->widget->nid;
 
 	// Save new values if valid.
@@ -3515,13 +3793,35 @@ void VoodooHDADevice::audioCtlAmpSet(AudioControl *control, UInt32 mute, int lef
 		left = control->left;
 		right = control->right;
 	}
-	
+
+	// Skip what the codec already has
+	lval = (lmute << 7) | left;
+	rval = (rmute << 7) | right;
+	written = codec->shadow.generation() + 1;
+	channels = 0;
+	if ((control->written != written) || (control->hwLeft != lval))
+		channels |= HDA_AMP_CHAN_LEFT;
+	if ((control->written != written) || (control->hwRight != rval))
+		channels |= HDA_AMP_CHAN_RIGHT;
+	if (!channels)
+		return 0;
+
 	// Apply effective values 
 	if (control->dir & HDA_CTL_OUT)
-		audioCtlAmpSetInternal(cad, nid, control->index, lmute, rmute, left, right, 0);
+		count += audioCtlAmpSetInternal(cad, nid, control->index, lmute, rmute, left, right, 0, channels);
 	if (control->dir & HDA_CTL_IN)
-		audioCtlAmpSetInternal(cad, nid, control->index, lmute, rmute, left, right, 1);
-	 
+		count += audioCtlAmpSetInternal(cad, nid, control->index, lmute, rmute, left, right, 1, channels);
+	control->written = written;
+	control->hwLeft = lval;
+	control->hwRight = rval;
+	return count;
+}
+
+void VoodooHDADevice::audioCtlAmpSet(AudioControl *control, UInt32 mute, int left, int right)
+{
+	batchBegin();
+	audioCtlAmpQueue(control, mute, left, right);
+	batchFlush();
 }
 //AutumnRain
 void VoodooHDADevice::audioCtlAmpGetInternal(nid_t cad, nid_t nid, int index, int *lmute, int *rmute, int *left,
@@ -6,20 +6,26 @@
 #include "Registers.h"
 #include "OssCompat.h"
 #include "Shared.h"
+#include "PCMResampler.h"
+#include "iSubCrossover.h"
+#include "CodecShadow.h"
+#include "BdlLayout.h"
+#include "WallClock.h"
+#include "CommandTransport.h"
 
 /* Miscellaneous defines */
 
-#define HDAC_DMA_ALIGNMENT		128
-#define HDAC_CODEC_MAX			16
-
 // xxx: check what these flags were for
 
 #define HDAC_F_DMA_NOCACHE		0x00000001
 #define HDAC_F_MSI				0x00000002
 
-#define HDAC_UNSOLQ_MAX			64
-#define HDAC_UNSOLQ_READY		0
-#define HDAC_UNSOLQ_BUSY		1
+#define HDAC_DPIB_SLACK			512		// bytes the DMA position buffer may be off LPIB at a completion
+#define HDAC_DPIB_MISSED_MAX	4		// completions in a row it may be off before the stream reads LPIB
+
+#define HDAC_STREAM_MAX			kVoodooHDAMaxStreams	// stream interrupt status bits in HDAC_INTSTS
+
+#define HDAC_UNSOLQ_MAX			64		// a power of two, the queue pointers run free
 
 /* Misc constants.. */
 
@@ -33,6 +39,10 @@
 #define HDA_AMP_LEFT_MUTED(v)	((v) & (HDA_AMP_MUTE_LEFT))
 #define HDA_AMP_RIGHT_MUTED(v)	(((v) & HDA_AMP_MUTE_RIGHT) >> 1)
 
+#define HDA_AMP_CHAN_LEFT		(1 << 0)
+#define HDA_AMP_CHAN_RIGHT		(1 << 1)
+#define HDA_AMP_CHAN_BOTH		(HDA_AMP_CHAN_LEFT | HDA_AMP_CHAN_RIGHT)
+
 #define HDA_ADC_MONITOR			(1 << 0)
 
 #define HDA_CTL_OUT				1
@@ -40,17 +50,10 @@
 
 /*********/
 
-#define HDA_BDL_MIN				2
-#define HDA_BDL_MAX				256
-#define HDA_BDL_DEFAULT			HDA_BDL_MIN
-
-#define HDA_BLK_MIN				HDAC_DMA_ALIGNMENT
-#define HDA_BLK_ALIGN			(~(HDA_BLK_MIN - 1))
-
-#define HDA_BUFSZ_MIN			4096
-	//#define HDA_BUFSZ_MAX			65536
-#define HDA_BUFSZ_MAX			262144
-#define HDA_BUFSZ_DEFAULT		HDA_BUFSZ_MAX
+#define HDA_SRC_CHUNK_FRAMES	32	// engine frames per pass through the software rate converter
+#define HDA_SRC_MAX_OUT_FRAMES	40	// the most it may return for them: 36 at 44.1 -> 48 kHz
+#define HDA_ISUB_CHUNK_FRAMES	256	// engine frames per pass through the iSub crossover
+#define HDA_ISUB_SRC_INTERPOLATOR	0xffffffff	// iSub rate conversion by the interpolator, not a PCMResampler
 
 #define HDA_PARSE_MAXDEPTH		10
 
@@ -93,10 +96,6 @@ typedef int nid_t;
 
 typedef struct _DmaMemory DmaMemory;
 
-typedef struct _RirbResponse RirbResponse;
-typedef struct _CommandList CommandList;
-typedef struct _BdlEntry BdlEntry;
-
 typedef struct _ChannelCaps ChannelCaps;
 
 typedef struct _Widget Widget;
@@ -108,6 +107,7 @@ typedef struct _Channel Channel;
 typedef struct _Codec Codec;
 
 class IODMACommand;
+class VoodooHDAEngine;
 
 typedef struct _DmaMemory {
 	const char *description;
@@ -118,35 +118,20 @@ typedef struct _DmaMemory {
 	IOVirtualAddress virtAddr;
 } DmaMemory;
 
-/* Hold a response from a verb sent to a codec received via the rirb. */
-typedef struct _RirbResponse {
-	UInt32 response;
-	UInt32 response_ex;
-} RirbResponse;
-
-#define HDAC_RIRB_RESPONSE_EX_SDATA_IN_MASK		0x0000000f
-#define HDAC_RIRB_RESPONSE_EX_SDATA_IN_OFFSET	0
-#define HDAC_RIRB_RESPONSE_EX_UNSOLICITED		0x00000010
-
-#define HDAC_RIRB_RESPONSE_EX_SDATA_IN(response_ex)					\
-		(((response_ex) & HDAC_RIRB_RESPONSE_EX_SDATA_IN_MASK) >>	\
-		HDAC_RIRB_RESPONSE_EX_SDATA_IN_OFFSET)
+/* Verbs gathered by batchCommand() to go out together, at most as many as
+ * fit in the CORB at once; they may be for any number of codecs, and go out
+ * as one CommandList for each. Each response is stored where the caller
+ * asked for it when the batch is flushed; HDAC_INVALID if none came back. */
+#define HDA_CMD_BATCH_MAX		255
 
-/* This structure holds the list of verbs that are to be sent to the codec
- * via the corb and the responses received via the rirb. It's allocated by
- * the codec driver and is owned by it. */
-typedef struct _CommandList {
+typedef struct _CommandBatch {
 	int numCommands;
-	UInt32 *verbs;
-	UInt32 *responses;
-} CommandList;
-
-typedef struct _BdlEntry {
-	volatile UInt32 addrl;
-	volatile UInt32 addrh;
-	volatile UInt32 len;
-	volatile UInt32 ioc;
-} __attribute__((__packed__)) BdlEntry;
+	int numSets;		// SET verbs among them
+	UInt32 verbs[HDA_CMD_BATCH_MAX];
+	UInt32 *results[HDA_CMD_BATCH_MAX];
+	UInt32 codecVerbs[HDA_CMD_BATCH_MAX];		// the same verbs by codec, for the CommandLists
+	UInt32 codecResponses[HDA_CMD_BATCH_MAX];
+} CommandBatch;
 
 #define HDA_MAX_CONNS	32
 #define HDA_MAX_NAMELEN	32
@@ -197,6 +182,8 @@ typedef struct _AudioControl {
 	int left, right, forcemute;
 	UInt32 muted;
 	UInt32 ossmask, possmask;
+	UInt32 written;			// codec shadow generation + 1 when hwLeft/hwRight went out, 0 if never
+	UInt8 hwLeft, hwRight;	// mute << 7 | gain, as last sent
 } AudioControl;
 
 typedef struct _NidForSwitch {
@@ -259,6 +246,7 @@ typedef struct _FunctionGroup {
 		UInt32 gpio;
 		PcmDevice *pcmDevices;
 		int numPcmDevices;
+		UInt32 *connListLengths, *connLists;	// only while probing, from the queries to audioParse()
 	} audio; /* function */
 	/* XXX undefined: modem, hdmi. */
 } FunctionGroup;
@@ -273,6 +261,39 @@ typedef struct _ChannelCaps {
 	UInt32 channels;
 } ChannelCaps;
 
+/*
+ * Software rate conversion, for the rates CoreAudio is offered that the converters can't do: the engine
+ * runs at engineRate with engineFrames per buffer, the codec at speed with hwFrames, in the same ratio,
+ * so that both buffers wrap at the same moment.
+ */
+typedef struct _ChannelSRC {
+	PCMResampler resampler;
+	UInt32 engineRate;		// 0 when the codec runs at the engine's rate
+	UInt32 engineFrames, hwFrames;
+	UInt32 nextFrame;		// engine frame the next clip should start at, anything else resets the resampler
+	UInt32 writeFrame;		// where its next output goes in the DMA buffer
+	Float32 out[HDA_SRC_MAX_OUT_FRAMES * kPCMResamplerMaxChannels];	// one chunk's output, off the stack
+} ChannelSRC;
+
+/*
+ * An iSub fed by an output engine, the way AppleUSBAudio fed it: the crossover splits the mix, the low band
+ * goes to the iSub's ring at its rate and the high band on to the codec. Set up with the engine stopped, see
+ * VoodooHDAEngine::attachiSub().
+ */
+typedef struct _ChanneliSub {
+	SInt16 *buffer;			// the iSub's ring, NULL when there is none
+	UInt32 bufferLen;		// in samples
+	SInt32 offset;			// where the next sample goes in it
+	UInt32 loopCount;		// times it wrapped
+	iSubAudioFormatType format;
+	UInt32 sampleRate;		// the crossover is set up for, 0 when it couldn't be
+	const iSubCrossoverCoeffs *coeffs;	// for sampleRate, out of the engine's cache
+	iSubCrossover crossover;	// with the filter state of every channel
+	float srcPhase, srcState;	// the interpolator's
+	PCMResampler resampler;	// sampleRate -> format.outputSampleRate, idle with the interpolator
+	Float32 *low, *high;	// HDA_ISUB_CHUNK_FRAMES frames of up to kiSubMaxChannels
+} ChanneliSub;
+
 typedef struct _Channel {
 	ChannelCaps caps;
 	FunctionGroup *funcGroup;
@@ -281,7 +302,10 @@ typedef struct _Channel {
 	UInt32 formats[8], pcmRates[16];
 	UInt32 supStreamFormats, supPcmSizeRates;
 	UInt32 numBlocks, blockSize;
-	UInt32 *dmaPos;
+	UInt32 iocInterval;			// blocks per interrupt, a divisor of numBlocks
+	UInt32 *dmaPos;				// entry in the DMA position buffer, NULL to read LPIB instead
+	UInt32 dmaPosMissed;
+	UInt32 frameBytes;			// of the stream format, from streamSetup()
 	UInt32 flags;
 	int direction;
 	int off;
@@ -294,25 +318,31 @@ typedef struct _Channel {
 	bool useStereo;
     UInt8 noiseLevel;	
 	UInt8 StereoBase;
+	ChannelSRC src;
+	ChanneliSub isub;
 	
 	DmaMemory *bdlMem;
 	DmaMemory *buffer;
+	VoodooHDAEngine *engine;	// once createAudioEngine() has made it
+
+	StreamStats stats;			// written under the device lock, read under statsSeq without it
+	volatile UInt32 statsSeq;	// odd while stats is being written
+	UInt64 lastIntTime;			// of the last buffer completion, 0 since the stream started
 } Channel;
 
 #define CODEC_ID(codec) ((((UInt32) (codec)->vendorId & 0xffff) << 16) | \
 		((UInt32) (codec)->deviceId & 0xffff))
 
 typedef struct _Codec {
-	int	numVerbsSent;
-	int	numRespReceived;
 	nid_t cad;
 	UInt16 vendorId;
 	UInt16 deviceId;
 	UInt8 revisionId;
 	UInt8 steppingId;
-	CommandList *commands;
+	nid_t startNode, endNode;	// of the function groups
 	FunctionGroup *funcGroups;
 	int	numFuncGroups;
+	CodecShadow shadow;
 } Codec;
 
 #endif
@@ -201,6 +201,14 @@
 #define HDAC_RIRBSTS_RINTFL				0x01
 #define HDAC_RIRBSTS_RIRBOIS			0x04
 
+/* ICIS - Immediate Command Status */
+#define HDAC_ICIS_ICB					0x0001
+#define HDAC_ICIS_IRV					0x0002
+#define HDAC_ICIS_ICVER					0x0004
+#define HDAC_ICIS_IRRUNSOL				0x0008
+#define HDAC_ICIS_IRRADD_MASK			0x00f0
+#define HDAC_ICIS_IRRADD_SHIFT			4
+
 /* RIRBSIZE - RIRB Size */
 #define HDAC_RIRBSIZE_RIRBSIZE_MASK		0x03
 #define HDAC_RIRBSIZE_RIRBSIZE_SHIFT	0
@@ -18,7 +18,8 @@ enum {
 	kVoodooHDAMemoryMessageBuffer = 0x2000,
 	kVoodooHDAMemoryPinDump,
 	kVoodooHDAMemoryCommand = 0x3000,
-	kVoodooHDAMemoryExtMessageBuffer
+	kVoodooHDAMemoryExtMessageBuffer,
+	kVoodooHDAMemoryStreamStats
 };
 #define MAX_SLIDER_TAB_NAME_LENGTH 32
 
@@ -45,7 +46,9 @@ enum {
 enum {
 	kVoodooHDAActionSetMixer = 0x40,
 	kVoodooHDAActionGetMixers = 0x50,
-	kVoodooHDAActionSetMath = 0x60
+	kVoodooHDAActionSetMath = 0x60,
+	kVoodooHDAActionSetBDL = 0x80,	// channel, log2 of the BDL blocks as device, log2 of blocks per interrupt as val
+	kVoodooHDAActionSetLatency = 0x90	// channel, target latency in us in the upper 16 bits, 0 for the full ring
 };
 
 typedef union {
@@ -77,4 +80,32 @@ typedef struct _ChannelInfo {
 	UInt8 empty[3]; //align to 8 bytes
 } ChannelInfo;
 
+/* Interrupt statistics of a stream, since its engine was created (kVoodooHDAMemoryStreamStats, and
+ * the StreamStats property of the device). The histogram counts the periods between buffer completion
+ * interrupts by how they compare to the expected one, in quarters of it rounded: bucket 4 is on time,
+ * the last one twice as long or more. */
+#define kVoodooHDAStreamStatsVersion	2	// 2: expectedNs is the interrupt period, not a block
+#define kVoodooHDAStreamStatsBuckets	9
+#define kVoodooHDAMaxStreams			30
+
+typedef struct _StreamStats {
+	UInt32 stream;				// index, as in the interrupt status
+	UInt32 direction;			// 0 = playback, 1 = record
+	UInt64 interrupts;			// buffer completions
+	UInt64 late;				// a quarter to half a period late
+	UInt64 missed;				// periods skipped, from half a period late on
+	UInt64 fifoErrors;
+	UInt64 descErrors;
+	UInt64 expectedNs;			// between interrupts at the current format and BDL layout
+	UInt64 lastNs, minNs, maxNs;	// periods between interrupts
+	UInt32 histogram[kVoodooHDAStreamStatsBuckets];
+	UInt32 pad;
+} StreamStats;
+
+typedef struct _StreamStatsBuffer {
+	UInt32 version;
+	UInt32 numStreams;
+	StreamStats streams[kVoodooHDAMaxStreams];
+} StreamStatsBuffer;
+
 #endif
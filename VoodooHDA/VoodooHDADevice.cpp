@@ -9,13 +9,19 @@
 #include "OssCompat.h"
 
 #include "Shared.h"
+#include "PCMBlitterLib.h"
+#include "Defaults.h"
 
 #include <IOKit/IOFilterInterruptEventSource.h>
 #include <IOKit/IOTimerEventSource.h>
 #include <IOKit/IODMACommand.h>
 #include <IOKit/pci/IOPCIDevice.h>
 
+#include <libkern/OSAtomic.h>
+
 #include <kern/locks.h>
+#include <kern/clock.h>
+#include <kern/sched_prim.h>
 
 #ifdef TIGER
 #include "TigerAdditionals.h"
@@ -26,6 +32,47 @@
 #define LOCK()		lock(__FUNCTION__)
 #define UNLOCK()	unlock(__FUNCTION__)
 
+/*
+ * Stream statistics: kept up by handleStreamInterrupt() and the stream setup,
+ * all under the device lock, and read without it, starting over if statsSeq
+ * says they changed meanwhile.
+ */
+static inline void streamStatsBegin(Channel *channel)
+{
+	channel->statsSeq++;
+	OSMemoryBarrier();
+}
+
+static inline void streamStatsEnd(Channel *channel)
+{
+	OSMemoryBarrier();
+	channel->statsSeq++;
+}
+
+static void streamStatsPeriod(StreamStats *stats, UInt64 period)
+{
+	UInt64 expected = stats->expectedNs, periods, bucket;
+
+	stats->lastNs = period;
+	if (!stats->minNs || (period < stats->minNs))
+		stats->minNs = period;
+	if (period > stats->maxNs)
+		stats->maxNs = period;
+	if (!expected)
+		return;
+
+	bucket = (period * 4 + expected / 2) / expected;
+	if (bucket >= kVoodooHDAStreamStatsBuckets)
+		bucket = kVoodooHDAStreamStatsBuckets - 1;
+	stats->histogram[bucket]++;
+
+	periods = (period + expected / 2) / expected;
+	if (periods >= 2)
+		stats->missed += periods - 1;
+	else if (period * 4 >= expected * 5)
+		stats->late++;
+}
+
 #define super IOAudioDevice
 OSDefineMetaClassAndStructors(VoodooHDADevice, IOAudioDevice)
 
@@ -48,6 +95,7 @@ bool VoodooHDADevice::init(OSDictionary *dict)
 {
 	OSNumber *verboseLevelNum;
 	OSBoolean *osBool;
+	int blitterTier;
 	extern kmod_info_t kmod_info;
 	mVerbose = 0;
 	if (!super::init(dict))
@@ -126,11 +174,67 @@ bool VoodooHDADevice::init(OSDictionary *dict)
 		Boost = verboseLevelNum->unsigned32BitValue();
 	else
 		Boost = 0;
-	
 
-	mLock = IOLockAlloc();
+	verboseLevelNum = OSDynamicCast(OSNumber, dict->getObject("InputBoost"));
+	if (verboseLevelNum)
+		InputBoost = verboseLevelNum->unsigned32BitValue();
+	else
+		InputBoost = 0;
 
-	mUnsolqState = HDAC_UNSOLQ_READY;
+	// 44.1 kHz and its multiples on codecs that only do the 48 kHz family, resampled in the driver
+	verboseLevelNum = OSDynamicCast(OSNumber, dict->getObject("SoftwareSRC"));
+	if (verboseLevelNum)
+		mSoftwareSRC = verboseLevelNum->unsigned32BitValue();
+	else
+		mSoftwareSRC = kSoftwareSRCDefault;
+
+	// codec command lists up to this long go through the immediate command interface instead of the corb
+	verboseLevelNum = OSDynamicCast(OSNumber, dict->getObject("ImmediateCommandMax"));
+	mCommands.init(this, verboseLevelNum ? verboseLevelNum->unsigned32BitValue() : HDAC_IMMEDIATE_MAX_DEFAULT);
+
+	// BDL entries per stream and entries per interrupt on completion, the engines' timestamp granularity
+	verboseLevelNum = OSDynamicCast(OSNumber, dict->getObject("BDLBlocks"));
+	mBdlBlocks = verboseLevelNum ? verboseLevelNum->unsigned32BitValue() : HDA_BDL_DEFAULT;
+	verboseLevelNum = OSDynamicCast(OSNumber, dict->getObject("BDLInterruptEvery"));
+	mBdlIocInterval = verboseLevelNum ? verboseLevelNum->unsigned32BitValue() : mBdlBlocks;
+	if (!bdlLayoutValid(mBdlBlocks, mBdlIocInterval)) {
+		errorMsg("warning: ignoring BDL layout of %ld blocks, interrupt every %ld\n", (long int)mBdlBlocks,
+				(long int)mBdlIocInterval);
+		mBdlBlocks = HDA_BDL_DEFAULT;
+		mBdlIocInterval = HDA_BDL_IOC_DEFAULT;
+	}
+
+	// low latency mode: ring, blocks and safety offset cut to this many us instead of the whole buffer
+	verboseLevelNum = OSDynamicCast(OSNumber, dict->getObject("TargetLatency"));
+	mTargetLatency = verboseLevelNum ? verboseLevelNum->unsigned32BitValue() : 0;
+	if (mTargetLatency && ((mTargetLatency < HDA_LATENCY_MIN) || (mTargetLatency > HDA_LATENCY_MAX))) {
+		errorMsg("warning: ignoring target latency of %ld us\n", (long int)mTargetLatency);
+		mTargetLatency = 0;
+	}
+
+	// input channel c is taken from channel InputChannelMap[c]; SwitchCh in NodesToPatch is the same as (1, 0)
+	mInputChannelMapSize = 0;
+	OSArray *inputMap = OSDynamicCast(OSArray, dict->getObject("InputChannelMap"));
+	if (inputMap) {
+		for (unsigned int c = 0; (c < inputMap->getCount()) && (c < MAX_INPUT_MAP); c++) {
+			OSNumber *mapNum = OSDynamicCast(OSNumber, inputMap->getObject(c));
+			if (!mapNum)
+				break;
+			mInputChannelMap[c] = (UInt8) mapNum->unsigned32BitValue();
+			mInputChannelMapSize = c + 1;
+		}
+	}
+
+	// pick the int<->float blitters for this CPU, optionally by timing them
+	verboseLevelNum = OSDynamicCast(OSNumber, dict->getObject("BlitterMaxTier"));
+	osBool = OSDynamicCast(OSBoolean, dict->getObject("BlitterBenchmark"));
+	blitterTier = PCMBlitterInitDispatch(verboseLevelNum ? (int) verboseLevelNum->unsigned32BitValue() : -1,
+			osBool ? (bool) osBool->getValue() : false);
+	dumpMsg("Blitters: CPU supports %s, using %s kernels%s\n", PCMBlitterTierName(PCMBlitterCPUTier()),
+			PCMBlitterTierName(blitterTier), (osBool && osBool->getValue()) ? " (benchmarked)" : "");
+
+	mLock = IOLockAlloc();
+	mRirbLock = IOSimpleLockAlloc();
 
 	mActionHandler = (IOCommandGate::Action) &VoodooHDADevice::handleAction;
 	if (!mActionHandler) {
@@ -521,7 +625,7 @@ bool VoodooHDADevice::initHardware(IOService *provider)
 	LOCK();
 
 //	logMsg("Starting CORB Engine...\n");
-	startCorb();
+	mCommands.startCorb();
 // logMsg("Starting RIRB Engine...\n");
 	startRirb();
 
@@ -610,6 +714,12 @@ void VoodooHDADevice::stop(IOService *provider)
 			mInterruptSource = NULL;
 		}
 
+		if (mUnsolSource) {
+			mWorkLoop->removeEventSource(mUnsolSource);
+			mUnsolSource->release();
+			mUnsolSource = NULL;
+		}
+
 		mWorkLoop->release();
 		mWorkLoop = NULL;
 	}
@@ -636,7 +746,14 @@ void VoodooHDADevice::deactivateAllAudioEngines()
 
 	// warning: this is called twice by super, once in stop() and another in free()
 
+	/* The engines stop in here, and their streams get their interrupts until they have */
 	super::deactivateAllAudioEngines();
+
+	mStreamMask = 0;
+	bzero(mStreamChannels, sizeof (mStreamChannels));
+	if (mChannels)
+		for (int i = 0; i < mNumChannels; i++)
+			mChannels[i].engine = NULL;
 }
 
 #define FREE_LOCK(x)		do { if (x) { IOLockLock(x); IOLockFree(x); (x) = NULL; } } while (0)
@@ -658,6 +775,10 @@ void VoodooHDADevice::free()
 	freePrefPanelMemoryBuf();
 
 	FREE_LOCK(mLock);
+	if (mRirbLock) {
+		IOSimpleLockFree(mRirbLock);
+		mRirbLock = NULL;
+	}
 
 	if (mRegBase)
 		mRegBase = 0;
@@ -688,6 +809,7 @@ void VoodooHDADevice::free()
 			}
 		}
 		FREE(codec->funcGroups);
+		codec->shadow.free();
 		FREE(codec);
 	}
 
@@ -711,6 +833,7 @@ bool VoodooHDADevice::createAudioEngine(Channel *channel)
 {
 	VoodooHDAEngine *audioEngine = NULL;
 	bool result = false;
+	int stream;
 
 	//logMsg("VoodooHDADevice[%p]::createAudioEngine\n", this);
 
@@ -726,6 +849,7 @@ bool VoodooHDADevice::createAudioEngine(Channel *channel)
 	audioEngine->mEnableMuteFix = mEnableMuteFix;
 	
 	audioEngine->Boost = Boost;
+	audioEngine->InputBoost = InputBoost;
 	// Active the audio engine - this will cause the audio engine to have start() and
 	// initHardware() called on it. After this function returns, that audio engine should
 	// be ready to begin vending audio services to the system.
@@ -734,6 +858,19 @@ bool VoodooHDADevice::createAudioEngine(Channel *channel)
 		goto done;
 	}
 
+	/* For the interrupt handler, which goes by stream; audioEngines holds on to the engine */
+	channel->engine = audioEngine;
+	stream = channel->off >> 5;
+	if ((stream < HDAC_STREAM_MAX) && !mStreamChannels[stream]) {
+		streamStatsBegin(channel);
+		channel->stats.stream = stream;
+		channel->stats.direction = (channel->direction == PCMDIR_PLAY) ? 0 : 1;
+		streamStatsEnd(channel);
+		mStreamChannels[stream] = channel;
+		mStreamMask |= 1 << stream;
+	} else
+		errorMsg("warning: stream %d is taken, its engine gets no interrupts\n", stream);
+
 	result = true;
 done:
 	RELEASE(audioEngine);
@@ -860,7 +997,7 @@ bool VoodooHDADevice::resume()
 //	enableEventSources();
 
 //	logMsg("Starting CORB Engine...\n");
-	startCorb();
+	mCommands.startCorb();
 //	logMsg("Starting RIRB Engine...\n");
 	startRirb();
 
@@ -869,22 +1006,18 @@ bool VoodooHDADevice::resume()
 	writeData32(HDAC_INTCTL, HDAC_INTCTL_CIE | HDAC_INTCTL_GIE);
 	IODelay(1000);
 
+	/* Audio function groups up and the others down, on all codecs at once */
+	powerupCodecs();
+
 	for (int codecNum = 0; codecNum < HDAC_CODEC_MAX; codecNum++) {
 		Codec *codec = mCodecs[codecNum];
 		if (!codec)
 			continue;
 		for (int funcGroupNum = 0; funcGroupNum < codec->numFuncGroups; funcGroupNum++) {
 			FunctionGroup *funcGroup = &codec->funcGroups[funcGroupNum];
-			if (funcGroup->nodeType != HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO) {
-				logMsg("Power down unsupported non-audio FG cad=%d nid=%d to the D3 state...\n",
-						codec->cad, funcGroup->nid);
-				sendCommand(HDA_CMD_SET_POWER_STATE(codec->cad, funcGroup->nid, HDA_CMD_POWER_STATE_D3),
-						codec->cad);
+			if (funcGroup->nodeType != HDA_PARAM_FCT_GRP_TYPE_NODE_TYPE_AUDIO)
 				continue;
-			}
 
-//			logMsg("Power up audio FG cad=%d nid=%d...\n", funcGroup->codec->cad, funcGroup->nid);
-			powerup(funcGroup);
 //			logMsg("AFG commit...\n");
 			audioCommit(funcGroup);
 //			logMsg("HP switch init...\n");
@@ -952,6 +1085,12 @@ bool VoodooHDADevice::resetController(bool wakeup)
 	/* Stop Control DMA engines. */
 	writeData8(HDAC_CORBCTL, 0);
 	writeData8(HDAC_RIRBCTL, 0);
+	mCommands.corbStopped();
+
+	/* The codecs come back with their defaults, only the parameters are still good */
+	for (int i = 0; i < HDAC_CODEC_MAX; i++)
+		if (mCodecs[i])
+			mCodecs[i]->shadow.invalidateState();
 
 	/* Reset DMA position buffer. */
 	writeData32(HDAC_DPIBLBASE, 0);
@@ -1241,6 +1380,39 @@ IOReturn VoodooHDADevice::handleAction(OSObject *owner, void *arg0, void *arg1,
 		return result;
 	}
 	
+	if ((action & 0xFF) == kVoodooHDAActionSetBDL) {
+		VoodooHDAEngine *engine;
+		UInt8 blocksLog2, iocLog2;
+
+		engine = device->lookupEngine((action >> 8) & 0xFF);
+		blocksLog2 = ((action >> 16) & 0xFF);
+		iocLog2 = ((action >> 24) & 0xFF);
+		if (!engine || (blocksLog2 >= 32) || (iocLog2 >= 32))
+			result = kIOReturnBadArgument;
+		else
+			result = engine->setBlockLayout(1 << blocksLog2, 1 << iocLog2);
+
+		*outSize = 0;
+		*outData = NULL;
+
+		return result;
+	}
+
+	if ((action & 0xFF) == kVoodooHDAActionSetLatency) {
+		VoodooHDAEngine *engine;
+
+		engine = device->lookupEngine((action >> 8) & 0xFF);
+		if (!engine)
+			result = kIOReturnBadArgument;
+		else
+			result = engine->setTargetLatency((action >> 16) & 0xFFFF);
+
+		*outSize = 0;
+		*outData = NULL;
+
+		return result;
+	}
+
 	if((action & 0x60)  == kVoodooHDAActionSetMath) {
 		UInt8 ch, opt, val;
 		ch = ((action >> 8) & 0xFF);
@@ -1381,6 +1553,19 @@ bool VoodooHDADevice::setupWorkloop()
 		return false;
 	}
 
+	/* Not tied to the hardware interrupt, so that responses read by polling get handled as well */
+	mUnsolSource = IOInterruptEventSource::interruptEventSource(this,
+			(IOInterruptEventAction) &VoodooHDADevice::unsolicitedHandler);
+	if (!mUnsolSource) {
+		errorMsg("error: couldn't allocate unsolicited response event source\n");
+		return false;
+	}
+	mUnsolSource->disable();
+	if (mWorkLoop->addEventSource(mUnsolSource) != kIOReturnSuccess) {
+		errorMsg("error: couldn't add unsolicited response event source to workloop\n");
+		return false;
+	}
+
 	return true;
 }
 
@@ -1388,9 +1573,13 @@ void VoodooHDADevice::enableEventSources()
 {
 	//logMsg("VoodooHDADevice[%p]::enableEventSources\n", this);
 
-	if (mInterruptSource)
+	if (mInterruptSource) {
 		mInterruptSource->enable();
-	if (mTimerSource && (mVerbose >= 3))
+		mCommands.setRirbInterrupts(true);
+	}
+	if (mUnsolSource)
+		mUnsolSource->enable();
+	if (mTimerSource)
 		mTimerSource->enable();
 }
 
@@ -1398,16 +1587,19 @@ void VoodooHDADevice::disableEventSources()
 {
 	//logMsg("VoodooHDADevice[%p]::disableEventSources\n", this);
 
+	mCommands.setRirbInterrupts(false);
 	if (mTimerSource)
 		mTimerSource->disable();
 	if (mInterruptSource)
 		mInterruptSource->disable();
+	if (mUnsolSource)
+		mUnsolSource->disable();
 }
 
 bool VoodooHDADevice::interruptFilter(OSObject *owner, __unused IOFilterInterruptEventSource *source)
 {
 	VoodooHDADevice *device;
-	UInt32 status;
+	UInt32 status, streams;
 
 	device = OSDynamicCast(VoodooHDADevice, owner);
 	if (!device)
@@ -1417,11 +1609,63 @@ bool VoodooHDADevice::interruptFilter(OSObject *owner, __unused IOFilterInterrup
 	if (!HDA_FLAG_MATCH(status, HDAC_INTSTS_GIS))
 		return false;
 	*(UInt32 *) ((UInt8 *) device->mRegBase + HDAC_INTSTS) = status;
-	device->mIntStatus = status;
+
+	/* The streams' state as of now rather than whenever the workloop gets to them; a stream without an
+	 * engine still has to be cleared, or its status bit keeps the interrupt coming */
+	streams = status & HDAC_INTSTS_SIS_MASK;
+	while (streams) {
+		int stream = __builtin_ctz(streams);
+		streams &= streams - 1;
+		if (device->mStreamMask & (1 << stream))
+			device->latchStreamInterrupt(stream);
+		else
+			device->writeData8((stream << 5) + HDAC_SDSTS, HDAC_SDSTS_DESE | HDAC_SDSTS_FIFOE |
+					HDAC_SDSTS_BCIS);
+	}
+	/* Another interrupt may come before the handler runs */
+	OSBitOrAtomic(status, &device->mIntStatus);
+
+	/* Get the codec responses in here, so that sendCommands doesn't wait on the workloop */
+	if (HDA_FLAG_MATCH(status, HDAC_INTSTS_CIS)) {
+		IOSimpleLockLock(device->mRirbLock);
+		device->mCommands.rirbInterrupt();
+		if (device->mRirbWaiting)
+			thread_wakeup((event_t) &device->mRirbWaiting);
+		IOSimpleLockUnlock(device->mRirbLock);
+	}
 
 	return true;
 }
 
+/*
+ * From interruptFilter: clears the stream's interrupt, keeping its status for
+ * handleStreamInterrupt(), and at a completion reads LPIB and the wall clock
+ * between two reads of the host clock.
+ */
+void VoodooHDADevice::latchStreamInterrupt(int stream)
+{
+	StreamIntLatch *latch = &mIntLatches[stream];
+	UInt32 off = stream << 5, status;
+	UInt64 before, after;
+
+	status = readData8(off + HDAC_SDSTS) & (HDAC_SDSTS_DESE | HDAC_SDSTS_FIFOE | HDAC_SDSTS_BCIS);
+	if (status & HDAC_SDSTS_BCIS) {
+		latch->seq++;
+		OSMemoryBarrier();
+		before = mach_absolute_time();
+		latch->wallClock = readData32(HDAC_WALCLK);
+		latch->position = readData32(off + HDAC_SDLPIB);
+		after = mach_absolute_time();
+		latch->time = before + (after - before) / 2;
+		latch->spread = after - before;
+		OSMemoryBarrier();
+		latch->seq++;
+	}
+	writeData8(off + HDAC_SDSTS, status);
+	/* After the rest, so that whoever takes the status finds them */
+	OSBitOrAtomic(status, &latch->status);
+}
+
 void VoodooHDADevice::interruptHandler(OSObject *owner, __unused IOInterruptEventSource *source,
 		__unused int count)
 {
@@ -1431,35 +1675,86 @@ void VoodooHDADevice::interruptHandler(OSObject *owner, __unused IOInterruptEven
 	device->handleInterrupt();
 }
 
-VoodooHDAEngine *VoodooHDADevice::lookupEngine(int channelId)
+void VoodooHDADevice::unsolicitedHandler(OSObject *owner, __unused IOInterruptEventSource *source,
+		__unused int count)
 {
-	OSCollectionIterator *engineIter;
-	VoodooHDAEngine *engine = NULL;
-
-	engineIter = OSCollectionIterator::withCollection(audioEngines);
-	engineIter->reset();
-	while ((engine = (VoodooHDAEngine *) engineIter->getNextObject())) {
-		ASSERT(OSDynamicCast(VoodooHDAEngine, engine));
-		if (engine->getEngineId() == channelId)
-			break;
-	}
-	RELEASE(engineIter);
+	VoodooHDADevice *device = OSDynamicCast(VoodooHDADevice, owner);
+	if (!device)
+		return;
+	device->unsolqFlush();
+}
 
-	return engine;
+VoodooHDAEngine *VoodooHDADevice::lookupEngine(int channelId)
+{
+	if (!mChannels || (channelId < 0) || (channelId >= mNumChannels))
+		return NULL;
+	return mChannels[channelId].engine;
 }
 
-void VoodooHDADevice::handleChannelInterrupt(int channelId)
+void VoodooHDADevice::handleChannelInterrupt(Channel *channel, StreamIntLatch *latched)
 {
-	VoodooHDAEngine *engine;
+	AbsoluteTime timestamp;
 
 	mTotalChanInt++;
 
-	engine = lookupEngine(channelId);
-	if (!engine) {
-		errorMsg("warning: couldn't find engine matching channel %d\n", channelId);
+	if (!channel->engine) {
+		errorMsg("warning: couldn't find engine matching stream %d\n", channel->off >> 5);
 		return;
 	}
-	engine->takeTimeStamp();
+	// with more than one interrupt per ring, only the one at the wrap is the engine's timestamp
+	if (!bdlAtWrap(latched->position, channel->blockSize, channel->numBlocks, channel->iocInterval))
+		return;
+	if (channelWrapTime(channel, latched, &timestamp))
+		channel->engine->takeTimeStamp(true, &timestamp);
+	else
+		channel->engine->takeTimeStamp();
+}
+
+/*
+ * Reads the wall clock between two reads of the host clock, for the filter.
+ * From the timer, on the workloop.
+ */
+void VoodooHDADevice::wallClockSample()
+{
+	UInt64 before, after;
+	UInt32 raw;
+
+	before = mach_absolute_time();
+	raw = readData32(HDAC_WALCLK);
+	after = mach_absolute_time();
+	wallClockFeed(raw, before + (after - before) / 2, after - before);
+}
+
+/*
+ * Feeds a wall clock read taken at host absolute time, give or take half of
+ * spread, to the filter; unless the host reads were too far apart to say
+ * when it was taken. On the workloop.
+ */
+void VoodooHDADevice::wallClockFeed(UInt32 raw, UInt64 time, UInt64 spread)
+{
+	UInt64 spreadNs, hostNs;
+
+	absolutetime_to_nanoseconds(spread, &spreadNs);
+	absolutetime_to_nanoseconds(time, &hostNs);
+	wallClockUpdate(&mWallClock, raw, hostNs, spreadNs);
+}
+
+/*
+ * When the DMA went past the end of the ring, in host time, from what
+ * interruptFilter latched; see wallClockWrapNs(). This leaves out how long
+ * the interrupt took to get here. False until the filter has settled.
+ */
+bool VoodooHDADevice::channelWrapTime(Channel *channel, StreamIntLatch *latched, AbsoluteTime *timestamp)
+{
+	UInt64 wrapNs, abs;
+
+	wallClockFeed(latched->wallClock, latched->time, latched->spread);
+	if (!wallClockWrapNs(&mWallClock, latched->wallClock, latched->position,
+			channel->blockSize * channel->numBlocks, channel->speed, channel->frameBytes, &wrapNs))
+		return false;
+	nanoseconds_to_absolutetime(wrapNs, &abs);
+	*((UInt64 *) timestamp) = abs;
+	return true;
 }
 
 /******************************************************************************************/
@@ -1661,70 +1956,238 @@ UInt32 VoodooHDADevice::sendCommand(UInt32 verb, nid_t cad)
 
 	//assertLock(mLock, LCK_MTX_ASSERT_OWNED);
 
+	if (mCodecs[cad] && mCodecs[cad]->shadow.lookup(verb, &response))
+		return response;
+
 	cmdList.numCommands = 1;
 	cmdList.verbs = &verb;
 	cmdList.responses = &response;
 
 	sendCommands(&cmdList, cad);
 
+	if (mCodecs[cad])
+		mCodecs[cad]->shadow.update(verb, response);
+
 	return response;
 }
 
-/*
- * Send a command list to the codec via the corb. We queue as much verbs as
- * we can and msleep on the codec. When the interrupt get the responses
- * back from the rirb, it will wake us up so we can queue the remaining verbs
- * if any.
- */
 void VoodooHDADevice::sendCommands(CommandList *commands, nid_t cad)
 {
-	Codec *codec;
-	int corbReadPtr;
-	UInt32 *corb;
-	int timeout;
-	int retry = 10;
+	CommandList *lists[HDAC_CODEC_MAX];
 
 	if (!mCodecs[cad] || !commands || (commands->numCommands < 1))
 		return;
 
-	codec = mCodecs[cad];
-	codec->commands = commands;
-	codec->numRespReceived = 0;
-	codec->numVerbsSent = 0;
-	corb = (UInt32 *) mCorbMem->virtAddr;
+	bzero(lists, sizeof (lists));
+	lists[cad] = commands;
+	sendCommandLists(lists);
+}
 
-	do {
-		if (codec->numVerbsSent != commands->numCommands) {
-			/* Queue as many verbs as possible */
-			corbReadPtr = readData16(HDAC_CORBRP);
-			mCorbMem->command->synchronize(kIODirectionOut); // xxx
-			while ((codec->numVerbsSent != commands->numCommands) &&
-					(((mCorbWritePtr + 1) % mCorbSize) != corbReadPtr)) {
-				mCorbWritePtr++;
-				mCorbWritePtr %= mCorbSize;
-				corb[mCorbWritePtr] = commands->verbs[codec->numVerbsSent++];
-			}
+/*
+ * Hand the command lists to the transport, except those for codecs that
+ * aren't there.
+ */
+void VoodooHDADevice::sendCommandLists(CommandList **lists)
+{
+	CommandList *present[HDAC_CODEC_MAX];
 
-			/* Send the verbs to the codecs */
-			mCorbMem->command->synchronize(kIODirectionIn); // xxx
-			writeData16(HDAC_CORBWP, mCorbWritePtr);
-		}
+	for (int i = 0; i < HDAC_CODEC_MAX; i++)
+		present[i] = mCodecs[i] ? lists[i] : NULL;
+	mCommands.sendCommandLists(present);
+}
+
+/*
+ * The command transport's hooks, see CommandTransport.h.
+ */
+UInt8 CommandTransport::readData8(UInt32 reg)
+{
+	return mDevice->readData8(reg);
+}
 
-		timeout = 200;
-		while ((rirbFlush() == 0) && --timeout)
-			IODelay(10);
-	} while (((codec->numVerbsSent != commands->numCommands) ||
-			(codec->numRespReceived != commands->numCommands)) && --retry);
+UInt16 CommandTransport::readData16(UInt32 reg)
+{
+	return mDevice->readData16(reg);
+}
+
+UInt32 CommandTransport::readData32(UInt32 reg)
+{
+	return mDevice->readData32(reg);
+}
+
+void CommandTransport::writeData8(UInt32 reg, UInt8 value)
+{
+	mDevice->writeData8(reg, value);
+}
+
+void CommandTransport::writeData16(UInt32 reg, UInt16 value)
+{
+	mDevice->writeData16(reg, value);
+}
 
-	if (retry == 0)
-		errorMsg("TIMEOUT numcmd=%d, sent=%d, received=%d\n", commands->numCommands,
-				codec->numVerbsSent, codec->numRespReceived);
+void CommandTransport::writeData32(UInt32 reg, UInt32 value)
+{
+	mDevice->writeData32(reg, value);
+}
 
-	codec->commands = NULL;
-	codec->numRespReceived = 0;
-	codec->numVerbsSent = 0;
+void CommandTransport::delay(UInt32 us)
+{
+	IODelay(us);
+}
 
-	unsolqFlush();
+void CommandTransport::syncCorb(bool written)
+{
+	mDevice->mCorbMem->command->synchronize(written ? kIODirectionIn : kIODirectionOut); // xxx
+}
+
+void CommandTransport::lockRirb()
+{
+	mDevice->mRirbIntState = IOSimpleLockLockDisableInterrupt(mDevice->mRirbLock);
+}
+
+void CommandTransport::unlockRirb()
+{
+	IOSimpleLockUnlockEnableInterrupt(mDevice->mRirbLock, mDevice->mRirbIntState);
+}
+
+UInt64 CommandTransport::rirbDeadline(UInt32 timeoutUs)
+{
+	UInt64 deadline;
+
+	clock_interval_to_deadline(timeoutUs, kMicrosecondScale, &deadline);
+	return deadline;
+}
+
+/*
+ * Woken by interruptFilter, which brings the responses in.
+ */
+bool CommandTransport::rirbSleep(UInt64 deadline)
+{
+	wait_result_t result;
+
+	mDevice->mRirbWaiting = true;
+	assert_wait_deadline((event_t) &mDevice->mRirbWaiting, THREAD_UNINT, deadline);
+	unlockRirb();
+	result = thread_block(THREAD_CONTINUE_NULL);
+	lockRirb();
+	mDevice->mRirbWaiting = false;
+	return (result != THREAD_TIMED_OUT);
+}
+
+void CommandTransport::queueUnsolicited(int cad, UInt32 response)
+{
+	if (!mDevice->mCodecs[cad])
+		return;
+	if ((mDevice->mUnsolqWritePtr - mDevice->mUnsolqReadPtr) >= HDAC_UNSOLQ_MAX)
+		mDevice->mUnsolqDropped++;
+	else {
+		mDevice->mUnsolq[mDevice->mUnsolqWritePtr % HDAC_UNSOLQ_MAX] = (cad << 16) |
+				((response >> 26) & 0xffff);
+		OSMemoryBarrier();	// the entry is there before the reader sees it
+		mDevice->mUnsolqWritePtr++;
+	}
+}
+
+/*
+ * Safe from interruptFilter, the handler runs on the workloop.
+ */
+void CommandTransport::unsolicitedQueued()
+{
+	if (mDevice->mUnsolSource)
+		mDevice->mUnsolSource->interruptOccurred(NULL, NULL, 0);
+}
+
+void CommandTransport::errorMsg(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	mDevice->messageHandler(kVoodooHDAMessageTypeError, format, args);
+	va_end(args);
+}
+
+/*
+ * Verb batching: independent verbs are gathered with batchCommand() and go
+ * out together on batchFlush(), so that the codecs work through a full CORB
+ * for each doorbell instead of one verb per round trip. The verbs may be for
+ * different codecs, which then take them in turns. A full batch is flushed by
+ * batchCommand() itself, so callers only flush where they need the responses.
+ */
+void VoodooHDADevice::batchBegin()
+{
+	mBatch.numCommands = 0;
+	mBatch.numSets = 0;
+}
+
+void VoodooHDADevice::batchCommand(UInt32 verb, UInt32 *result)
+{
+	int max = (mCorbSize - 1 < HDA_CMD_BATCH_MAX) ? (mCorbSize - 1) : HDA_CMD_BATCH_MAX;
+	Codec *codec = mCodecs[(verb & HDA_CMD_CAD_MASK) >> HDA_CMD_CAD_SHIFT];
+
+	/* Known answers come from the shadow, unless a write still in the batch may change them */
+	if (codec && (mBatch.numSets == 0) && result && codec->shadow.lookup(verb, result))
+		return;
+
+	if (max < 1)
+		max = 1;
+	if (mBatch.numCommands >= max)
+		batchFlush();
+	if (CodecShadow::isSet(verb))
+		mBatch.numSets++;
+	mBatch.verbs[mBatch.numCommands] = verb;
+	mBatch.results[mBatch.numCommands] = result;
+	mBatch.numCommands++;
+}
+
+void VoodooHDADevice::batchFlush()
+{
+	CommandList cmdLists[HDAC_CODEC_MAX];
+	CommandList *lists[HDAC_CODEC_MAX];
+	int next[HDAC_CODEC_MAX];
+	int count[HDAC_CODEC_MAX];
+	int start, cad;
+
+	if (mBatch.numCommands < 1)
+		return;
+
+	/* Sort the verbs by codec, keeping their order for each */
+	bzero(count, sizeof (count));
+	for (int i = 0; i < mBatch.numCommands; i++)
+		count[(mBatch.verbs[i] & HDA_CMD_CAD_MASK) >> HDA_CMD_CAD_SHIFT]++;
+	start = 0;
+	for (cad = 0; cad < HDAC_CODEC_MAX; cad++) {
+		next[cad] = start;
+		lists[cad] = NULL;
+		if (count[cad] > 0) {
+			cmdLists[cad].numCommands = count[cad];
+			cmdLists[cad].verbs = &mBatch.codecVerbs[start];
+			cmdLists[cad].responses = &mBatch.codecResponses[start];
+			lists[cad] = &cmdLists[cad];
+		}
+		start += count[cad];
+	}
+	for (int i = 0; i < mBatch.numCommands; i++) {
+		cad = (mBatch.verbs[i] & HDA_CMD_CAD_MASK) >> HDA_CMD_CAD_SHIFT;
+		mBatch.codecVerbs[next[cad]] = mBatch.verbs[i];
+		mBatch.codecResponses[next[cad]] = HDAC_INVALID;
+		next[cad]++;
+	}
+
+	sendCommandLists(lists);
+
+	/* And back into the order they were asked for */
+	for (cad = 0; cad < HDAC_CODEC_MAX; cad++)
+		next[cad] -= count[cad];
+	for (int i = 0; i < mBatch.numCommands; i++) {
+		UInt32 response;
+
+		cad = (mBatch.verbs[i] & HDA_CMD_CAD_MASK) >> HDA_CMD_CAD_SHIFT;
+		response = mBatch.codecResponses[next[cad]++];
+		if (mCodecs[cad])
+			mCodecs[cad]->shadow.update(mBatch.verbs[i], response);
+		if (mBatch.results[i])
+			*mBatch.results[i] = response;
+	}
+	mBatch.numCommands = 0;
+	mBatch.numSets = 0;
 }
 
 /*
@@ -1760,8 +2223,8 @@ void VoodooHDADevice::initCorb()
 	writeData32(HDAC_CORBUBASE, (UInt32) (corbPhysAddr >> 32));
 
 	/* Set the WP and RP */
-	mCorbWritePtr = 0;
-	writeData16(HDAC_CORBWP, mCorbWritePtr);
+	mCommands.setCorb((UInt32 *) mCorbMem->virtAddr, mCorbSize);
+	writeData16(HDAC_CORBWP, 0);
 	writeData16(HDAC_CORBRP, HDAC_CORBRP_CORBRPRST);
 	/* The HDA specification indicates that the CORBRPRST bit will always
 	 * read as zero. Unfortunately, it seems that at least the 82801G
@@ -1808,7 +2271,7 @@ void VoodooHDADevice::initRirb()
 	writeData32(HDAC_RIRBUBASE, (UInt32) (rirbPhysAddr >> 32));
 
 	/* Setup the WP and RP */
-	mRirbReadPtr = 0;
+	mCommands.setRirb((RirbResponse *) mRirbMem->virtAddr, mRirbSize);
 	writeData16(HDAC_RIRBWP, HDAC_RIRBWP_RIRBWPRST);
 
 	/* Setup the interrupt threshold */
@@ -1828,17 +2291,6 @@ void VoodooHDADevice::initRirb()
 	mRirbMem->command->synchronize(kIODirectionOut); // xxx
 }
 
-/*
- * Startup the corb DMA engine
- */
-void VoodooHDADevice::startCorb()
-{
-	UInt32 corbCtl;
-	corbCtl = readData8(HDAC_CORBCTL);
-	corbCtl |= HDAC_CORBCTL_CORBRUN;
-	writeData8(HDAC_CORBCTL, corbCtl);
-}
-
 /*
  * Startup the rirb DMA engine
  */
@@ -1853,68 +2305,49 @@ void VoodooHDADevice::startRirb()
 /********************************************************************************************/
 /********************************************************************************************/
 
-int VoodooHDADevice::rirbFlush()
-{
-	RirbResponse *rirbBase;
-	UInt8 rirbWritePtr;
-	int ret;
-
-	rirbBase = (RirbResponse *) mRirbMem->virtAddr;
-	rirbWritePtr = readData8(HDAC_RIRBWP);
-		//mRirbMem->command->synchronize(kIODirectionIn); // xxx
-
-	ret = 0;
-	while (mRirbReadPtr != rirbWritePtr) {
-		RirbResponse *rirb;
-		Codec *codec;
-		CommandList *commands;
-		nid_t cad;
-		UInt32 resp;
-
-		mRirbReadPtr++;
-		mRirbReadPtr %= mRirbSize;
-		rirb = &rirbBase[mRirbReadPtr];
-		cad = HDAC_RIRB_RESPONSE_EX_SDATA_IN(rirb->response_ex);
-		if ((cad < 0) || (cad >= HDAC_CODEC_MAX) || !mCodecs[cad])
-			continue;
-		resp = rirb->response;
-		codec = mCodecs[cad];
-		commands = codec->commands;
-		if (rirb->response_ex & HDAC_RIRB_RESPONSE_EX_UNSOLICITED) {
-			mUnsolq[mUnsolqWritePtr++] = (cad << 16) | ((resp >> 26) & 0xffff);
-			mUnsolqWritePtr %= HDAC_UNSOLQ_MAX;
-		} else if (commands && (commands->numCommands > 0) &&
-				(codec->numRespReceived < commands->numCommands))
-			commands->responses[codec->numRespReceived++] = resp;
+/*
+ * Handle the queued unsolicited responses, on the workloop only. They are
+ * taken off the queue first, so that rirbFlush() has room again while we talk
+ * to the codecs, and each event is handled once however many times it came:
+ * a jack that bounces sends a burst of the same one, and the handlers read
+ * the state of the jack anyway.
+ */
+int VoodooHDADevice::unsolqFlush()
+{
+	UInt32 events[HDAC_UNSOLQ_MAX];
+	UInt32 writePtr, dropped;
+	int numEvents = 0, ret = 0;
+
+	writePtr = mUnsolqWritePtr;
+	OSMemoryBarrier();	// the entries are read after the pointer
+	while ((mUnsolqReadPtr != writePtr) && (numEvents < HDAC_UNSOLQ_MAX)) {
+		UInt32 event = mUnsolq[mUnsolqReadPtr % HDAC_UNSOLQ_MAX];
+		int i;
+
+		for (i = 0; (i < numEvents) && (events[i] != event); i++)
+			;
+		if (i == numEvents)
+			events[numEvents++] = event;
+		OSMemoryBarrier();	// done with the entry before the writer may have it
+		mUnsolqReadPtr++;
 		ret++;
 	}
-		//Slice
-	UInt32 rirbCtl;
-	rirbCtl = readData8(HDAC_GCTL);
-	rirbCtl |= HDAC_GCTL_FCNTRL;
-	writeData8(HDAC_GCTL, rirbCtl);
-	
-	return ret;
-}
 
-int VoodooHDADevice::unsolqFlush()
-{
-	int ret = 0;
-
-	if (mUnsolqState == HDAC_UNSOLQ_READY) {
-		mUnsolqState = HDAC_UNSOLQ_BUSY;
-		while (mUnsolqReadPtr != mUnsolqWritePtr) {
-			nid_t cad;
-			UInt32 tag;
-			cad = mUnsolq[mUnsolqReadPtr] >> 16;
-			tag = mUnsolq[mUnsolqReadPtr++] & 0xffff;
-			mUnsolqReadPtr %= HDAC_UNSOLQ_MAX;
-			handleUnsolicited(mCodecs[cad], tag);
-			ret++;
-		}
-		mUnsolqState = HDAC_UNSOLQ_READY;
+	dropped = mUnsolqDropped;
+	if (dropped != mUnsolqDroppedReported) {
+		errorMsg("warning: unsolicited response queue full, %ld responses dropped\n",
+				(long int) (dropped - mUnsolqDroppedReported));
+		mUnsolqDroppedReported = dropped;
 	}
 
+	if (numEvents == 0)
+		return 0;
+
+	LOCK();
+	for (int i = 0; i < numEvents; i++)
+		handleUnsolicited(mCodecs[events[i] >> 16], events[i] & 0xffff);
+	UNLOCK();
+
 	return ret;
 }
 
@@ -1928,6 +2361,9 @@ void VoodooHDADevice::handleUnsolicited(Codec *codec, UInt32 tag)
 	if (!codec)
 		return;
 
+	/* Jack events are when codecs change their own amps and pins */
+	codec->shadow.invalidateState();
+
 //	logMsg("Unsol Tag: 0x%08lx\n", tag);
 
 	for (int i = 0; i < codec->numFuncGroups; i++) {
@@ -1953,24 +2389,52 @@ void VoodooHDADevice::handleUnsolicited(Codec *codec, UInt32 tag)
 /********************************************************************************************/
 /********************************************************************************************/
 
-int VoodooHDADevice::handleStreamInterrupt(Channel *channel)
+/*
+ * Takes what interruptFilter latched for the stream, into latched at a
+ * completion, and keeps the statistics. Returns 1 at a completion.
+ */
+int VoodooHDADevice::handleStreamInterrupt(Channel *channel, StreamIntLatch *latched)
 {
-	/* XXX to be removed */
-	UInt32 res;
+	StreamIntLatch *latch = &mIntLatches[channel->off >> 5];
+	UInt32 res, seq;
+	UInt64 period;
 
+	res = OSBitAndAtomic(0, &latch->status);
 	if (!(channel->flags & HDAC_CHN_RUNNING))
 		return 0;
-
-	/* XXX to be removed */
-	res = readData8(channel->off + HDAC_SDSTS);
+	if (res & HDAC_SDSTS_BCIS) {
+		do {
+			seq = latch->seq;
+			OSMemoryBarrier();
+			*latched = *latch;
+			OSMemoryBarrier();
+		} while ((seq & 1) || (seq != latch->seq));
+	}
+
+	streamStatsBegin(channel);
+	if (res & HDAC_SDSTS_FIFOE)
+		channel->stats.fifoErrors++;
+	if (res & HDAC_SDSTS_DESE)
+		channel->stats.descErrors++;
+	if (res & HDAC_SDSTS_BCIS) {
+		UInt64 missed = channel->stats.missed;
+		channel->stats.interrupts++;
+		if (channel->lastIntTime) {
+			absolutetime_to_nanoseconds(latched->time - channel->lastIntTime, &period);
+			streamStatsPeriod(&channel->stats, period);
+		}
+		channel->lastIntTime = latched->time;
+		mChanIntMissed += channel->stats.missed - missed;
+	}
+	streamStatsEnd(channel);
+	if ((res & HDAC_SDSTS_BCIS) && channel->dmaPos)
+		dmaPosCheck(channel);
 
 	/* XXX to be removed */
 	if (res & (HDAC_SDSTS_DESE | HDAC_SDSTS_FIFOE))
 		errorMsg("PCMDIR_%s intr triggered beyond stream boundary: %08lx\n",
 				(channel->direction == PCMDIR_PLAY) ? "PLAY" : "REC", (long unsigned int)res);
 
-	writeData8(channel->off + HDAC_SDSTS, HDAC_SDSTS_DESE | HDAC_SDSTS_FIFOE | HDAC_SDSTS_BCIS);
-
 	/* XXX to be removed */
 	if (res & HDAC_SDSTS_BCIS)
 		return 1;
@@ -1978,56 +2442,32 @@ int VoodooHDADevice::handleStreamInterrupt(Channel *channel)
 	return 0;
 }
 
-/* Make room for possible 4096 playback/record channels, in 100 years to come. */
-
-#define HDAC_TRIGGER_NONE	0x00000000
-#define HDAC_TRIGGER_PLAY	0x00000fff
-#define HDAC_TRIGGER_REC	0x00fff000
-#define HDAC_TRIGGER_UNSOL	0x80000000
-
 void VoodooHDADevice::handleInterrupt()
 {
-	UInt32 status, trigger;
+	StreamIntLatch latched;
+	UInt32 status, streams;
 
 	mTotalInt++;
 
-	status = mIntStatus;
-	mIntStatus = 0;
+	status = OSBitAndAtomic(0, &mIntStatus);
 	if (!HDA_FLAG_MATCH(status, HDAC_INTSTS_GIS)) {
 		errorMsg("warning: reached handler with blank global interrupt status\n");
 		return;
 	}
 
-	trigger = 0;
-
 	LOCK();
 
-	/* Was this a controller interrupt? */
-	if (HDA_FLAG_MATCH(status, HDAC_INTSTS_CIS)) {
-		UInt8 rirbStatus = readData8(HDAC_RIRBSTS);
-		/* Get as many responses that we can */
-		while (HDA_FLAG_MATCH(rirbStatus, HDAC_RIRBSTS_RINTFL)) {
-			writeData8(HDAC_RIRBSTS, HDAC_RIRBSTS_RINTFL);
-			if (rirbFlush() != 0)
-				trigger |= HDAC_TRIGGER_UNSOL;
-			rirbStatus = readData8(HDAC_RIRBSTS);
-		}
+	/* Only the streams that have an engine, straight from their status bits */
+	streams = status & HDAC_INTSTS_SIS_MASK & mStreamMask;
+	while (streams) {
+		int stream = __builtin_ctz(streams);
+		Channel *channel = mStreamChannels[stream];
+		streams &= streams - 1;
+		/* deactivateAllAudioEngines() doesn't take the lock */
+		if (channel && (handleStreamInterrupt(channel, &latched) != 0))
+			handleChannelInterrupt(channel, &latched);
 	}
 
-	if (status & HDAC_INTSTS_SIS_MASK) {
-		for (int i = 0; i < mNumChannels; i++) {
-			if ((status & (1 << (mChannels[i].off >> 5))) &&
-					(handleStreamInterrupt(&mChannels[i]) != 0))
-				trigger |= (1 << i);
-		}
-	}
-
-	for (int i = 0; i < mNumChannels; i++)
-		if (trigger & (1 << i))
-			handleChannelInterrupt(i);
-	if (trigger & HDAC_TRIGGER_UNSOL)
-		unsolqFlush();
-
 	UNLOCK();
 }
 
@@ -2037,12 +2477,104 @@ void VoodooHDADevice::timeoutOccurred(OSObject *owner, IOTimerEventSource *sourc
 	if (!device)
 		return;
 
-	device->logMsg("total interrupts: %lld (%lld channel interrupts)\n", device->mTotalInt,
-			device->mTotalChanInt);
+	if (device->mVerbose >= 3)
+		device->logMsg("total interrupts: %lld (%lld channel interrupts, %lld missed)\n", device->mTotalInt,
+				device->mTotalChanInt, device->mChanIntMissed);
+	device->publishStreamStats();
+	// keeps the wall clock filter going while no stream runs, well within the 179 s the clock takes to wrap
+	device->wallClockSample();
 
 	source->setTimeoutMS(5000);
 }
 
+void VoodooHDADevice::readStreamStats(Channel *channel, StreamStats *stats)
+{
+	UInt32 seq;
+
+	do {
+		seq = channel->statsSeq;
+		OSMemoryBarrier();
+		*stats = channel->stats;
+		OSMemoryBarrier();
+	} while ((seq & 1) || (seq != channel->statsSeq));
+}
+
+void VoodooHDADevice::copyStreamStats(StreamStatsBuffer *buffer)
+{
+	bzero(buffer, sizeof (*buffer));
+	buffer->version = kVoodooHDAStreamStatsVersion;
+	for (int stream = 0; stream < HDAC_STREAM_MAX; stream++)
+		if (mStreamChannels[stream])
+			readStreamStats(mStreamChannels[stream], &buffer->streams[buffer->numStreams++]);
+}
+
+static void setNumber(OSDictionary *dict, const char *key, UInt64 value)
+{
+	OSNumber *number = OSNumber::withNumber(value, 64);
+	if (!number)
+		return;
+	dict->setObject(key, number);
+	number->release();
+}
+
+/*
+ * The stream statistics as the StreamStats property, an array with a
+ * dictionary for each stream; from the timer, every five seconds.
+ */
+void VoodooHDADevice::publishStreamStats()
+{
+	OSArray *array;
+
+	array = OSArray::withCapacity(HDAC_STREAM_MAX);
+	if (!array)
+		return;
+	for (int stream = 0; stream < HDAC_STREAM_MAX; stream++) {
+		OSDictionary *dict;
+		OSArray *histogram;
+		OSString *direction;
+		StreamStats stats;
+
+		if (!mStreamChannels[stream])
+			continue;
+		readStreamStats(mStreamChannels[stream], &stats);
+		dict = OSDictionary::withCapacity(12);
+		histogram = OSArray::withCapacity(kVoodooHDAStreamStatsBuckets);
+		if (!dict || !histogram) {
+			RELEASE(dict);
+			RELEASE(histogram);
+			break;
+		}
+		setNumber(dict, "Stream", stats.stream);
+		direction = OSString::withCString(stats.direction ? "Record" : "Playback");
+		if (direction) {
+			dict->setObject("Direction", direction);
+			direction->release();
+		}
+		setNumber(dict, "Interrupts", stats.interrupts);
+		setNumber(dict, "Late", stats.late);
+		setNumber(dict, "Missed", stats.missed);
+		setNumber(dict, "FIFOErrors", stats.fifoErrors);
+		setNumber(dict, "DescriptorErrors", stats.descErrors);
+		setNumber(dict, "ExpectedPeriodNs", stats.expectedNs);
+		setNumber(dict, "LastPeriodNs", stats.lastNs);
+		setNumber(dict, "MinPeriodNs", stats.minNs);
+		setNumber(dict, "MaxPeriodNs", stats.maxNs);
+		for (int i = 0; i < kVoodooHDAStreamStatsBuckets; i++) {
+			OSNumber *number = OSNumber::withNumber(stats.histogram[i], 32);
+			if (number) {
+				histogram->setObject(number);
+				number->release();
+			}
+		}
+		dict->setObject("PeriodHistogram", histogram);
+		histogram->release();
+		array->setObject(dict);
+		dict->release();
+	}
+	setProperty("StreamStats", array);
+	array->release();
+}
+
 /********************************************************************************************/
 /********************************************************************************************/
 
@@ -2176,6 +2708,7 @@ int VoodooHDADevice::audioCtlOssMixerSet(PcmDevice *pcmDevice, UInt32 dev, UInt3
 	FunctionGroup *funcGroup = pcmDevice->funcGroup;
 	AudioControl *control;
 	UInt32 mask = 0;
+	int numControls = 0, numVerbs = 0;
 	
 	LOCK();
 	
@@ -2225,7 +2758,8 @@ int VoodooHDADevice::audioCtlOssMixerSet(PcmDevice *pcmDevice, UInt32 dev, UInt3
 	mask = (1 << dev);
 /*	if(dev == SOUND_MIXER_MIC)
 		mask |= SOUND_MASK_MONITOR;*/
-	// Recalculate all controls related to this OSS device.
+	// Recalculate all controls related to this OSS device, and send what changed in one go.
+	batchBegin();
 	for (int i = 0; (control = audioCtlEach(funcGroup, &i)); ) {
 		UInt32 mute;
 		int lvol, rvol;
@@ -2261,8 +2795,14 @@ int VoodooHDADevice::audioCtlOssMixerSet(PcmDevice *pcmDevice, UInt32 dev, UInt3
 			rvol = (rvol * control->step + 50) / 100;
 		}
         
-		audioCtlAmpSet(control, mute, lvol, rvol);
+		numVerbs += audioCtlAmpQueue(control, mute, lvol, rvol);
+		numControls++;
 	}
+	batchFlush();
+
+	if (mVerbose >= 2)
+		logMsg("Mixer dev %ld (%ld, %ld): %d amp verbs for %d controls\n", (long int) dev, (long int) left,
+				(long int) right, numVerbs, numControls);
 
 	UNLOCK();
 
@@ -2380,14 +2920,17 @@ Channel *VoodooHDADevice::channelInit(PcmDevice *pcmDevice, int direction)
 		channel->pcmRates[0] = 48000;
 		channel->pcmRates[1] = 0;
 	}
+	// one entry of 8 bytes for each stream descriptor, in the order of the descriptors
 	if (mDmaPosMem)
-		channel->dmaPos = (UInt32 *) (mDmaPosMem->virtAddr + (mStreamCount * 8));
+		channel->dmaPos = (UInt32 *) (mDmaPosMem->virtAddr + ((channel->off >> 5) * 8));
 	else
 		channel->dmaPos = NULL;
+	channel->dmaPosMissed = 0;
 	channel->streamId = ++mStreamCount;
 	channel->direction = direction;
 	channel->blockSize = pcmDevice->chanSize / pcmDevice->chanNumBlocks;
 	channel->numBlocks = pcmDevice->chanNumBlocks;
+	channel->iocInterval = mBdlIocInterval;
 
 	if (bdlAlloc(channel) != 0) {
 		channel->numBlocks = 0;
@@ -2477,32 +3020,63 @@ void VoodooHDADevice::channelStart(Channel *channel, const bool shouldLock)
 	bdlSetup(channel);
 	streamSetId(channel);
 	streamSetup(channel);
+	channel->lastIntTime = 0;
 	streamStart(channel);
 
 	if (shouldLock)
 		UNLOCK();
 }
 
+/*
+ * The byte the stream's DMA is at in its ring, from the DMA position buffer or else LPIB. IOAudioFamily asks
+ * for it from the erase and mix threads, so no lock: either is a single 32 bit read, dmaPos only ever goes
+ * to NULL, and the ring doesn't change while the engine runs.
+ */
 int VoodooHDADevice::channelGetPosition(Channel *channel)
 {
-	UInt32 position;
+	volatile UInt32 *dmaPos = channel->dmaPos;
+	UInt32 position, ring = channel->blockSize * channel->numBlocks;
 
-	LOCK();
-
-	if (channel->dmaPos)
-		position = *(channel->dmaPos);
+	if (dmaPos)
+		position = *dmaPos;
 	else
 		position = readData32(channel->off + HDAC_SDLPIB);
 
-	UNLOCK();
-
-	/* Round to available space and force 128 bytes aligment. */
-	position %= channel->blockSize * channel->numBlocks;
-	position &= HDA_BLK_ALIGN;
+	/* Past the end only just after a stream reset, or from a controller that got it wrong */
+	if (position >= ring)
+		position = ring ? (position % ring) : 0;
 
 	return position;
 }
 
+/*
+ * At a completion interrupt the DMA position buffer has to agree with LPIB. Some controllers never update it
+ * or lag far behind; after HDAC_DPIB_MISSED_MAX completions in a row that it doesn't, the stream reads LPIB.
+ */
+void VoodooHDADevice::dmaPosCheck(Channel *channel)
+{
+	UInt32 ring = channel->blockSize * channel->numBlocks, slack, lpib, dpib, diff;
+
+	slack = (ring / 4 < HDAC_DPIB_SLACK) ? ring / 4 : HDAC_DPIB_SLACK;
+	lpib = readData32(channel->off + HDAC_SDLPIB);
+	dpib = *(volatile UInt32 *) channel->dmaPos;
+	if ((dpib < ring) && (lpib < ring)) {
+		diff = (lpib > dpib) ? lpib - dpib : dpib - lpib;
+		if (diff > ring / 2)
+			diff = ring - diff;		// either side of the wrap
+	} else
+		diff = ring;
+	if (diff <= slack) {
+		channel->dmaPosMissed = 0;
+		return;
+	}
+	if (++channel->dmaPosMissed < HDAC_DPIB_MISSED_MAX)
+		return;
+	errorMsg("warning: stream %d DMA position buffer is %ld bytes off LPIB, using LPIB\n", channel->off >> 5,
+			(long int)diff);
+	channel->dmaPos = NULL;
+}
+
 /*******************************************************************************************/
 /*******************************************************************************************/
 
@@ -2554,6 +3128,14 @@ void VoodooHDADevice::streamSetup(Channel *channel)
 		digFormat |= HDA_CMD_SET_DIGITAL_CONV_FMT1_NAUDIO;
 	
 	writeData16(channel->off + HDAC_SDFMT, format);
+
+	/* The time between interrupts at this format, for the statistics; 20 to 32 bits take four bytes */
+	channel->frameBytes = totalchn * ((channel->format & AFMT_S32_LE) ? 4 : 2);
+	streamStatsBegin(channel);
+	if (channel->speed)
+		channel->stats.expectedNs = bdlPeriodNs(channel->blockSize, channel->iocInterval, channel->speed,
+				channel->frameBytes);
+	streamStatsEnd(channel);
     
 	for (int i = 0, chn = 0; channel->io[i] != -1; i++) {
 		Widget *widget;
@@ -2686,13 +3268,7 @@ void VoodooHDADevice::bdlSetup(Channel *channel)
 	blockSize = channel->blockSize;
 	numBlocks = channel->numBlocks;
 
-	for (UInt32 n = 1; n <= numBlocks; n++, bdlEntry++) {
-		bdlEntry->addrl = (UInt32) addr;
-		bdlEntry->addrh = (UInt32) (addr >> 32);
-		bdlEntry->len = blockSize;
-		bdlEntry->ioc = (n == numBlocks);
-		addr += blockSize;
-	}
+	bdlFill(bdlEntry, addr, blockSize, numBlocks, channel->iocInterval);
 
 	writeData32(channel->off + HDAC_SDCBL, blockSize * numBlocks);
 	writeData16(channel->off + HDAC_SDLVI, numBlocks - 1);
@@ -2713,7 +3289,8 @@ int VoodooHDADevice::bdlAlloc(Channel *channel)
 	ASSERT(pcmDevice);
 	ASSERT(pcmDevice->chanNumBlocks);
 
-	channel->bdlMem = allocateDmaMemory(sizeof (BdlEntry) * pcmDevice->chanNumBlocks, "bdlMem");
+	// room for any layout, so the user client can change it without reallocating
+	channel->bdlMem = allocateDmaMemory(sizeof (BdlEntry) * HDA_BDL_MAX, "bdlMem");
 	if (!channel->bdlMem) {
 		errorMsg("error: couldn't allocate bdl\n");
 		return -1;
@@ -2740,7 +3317,7 @@ int VoodooHDADevice::pcmAttach(PcmDevice *pcmDevice)
 	dumpMsg("pcmAttach: %s\n", buf);
 
 	pcmDevice->chanSize = HDA_BUFSZ_DEFAULT;
-	pcmDevice->chanNumBlocks = HDA_BDL_DEFAULT;
+	pcmDevice->chanNumBlocks = mBdlBlocks;
 
 	dumpMsg("+--------------------------------------+\n");
 	dumpMsg("| DUMPING PCM Playback/Record Channels |\n");
@@ -20,6 +20,7 @@ enum {
 };
 //Slice
 #define MAX_NODES 100
+#define MAX_INPUT_MAP 16	// channels, same as kPCMMaxMappedChannels
 typedef struct {
 	UInt32 Enable;
 	UInt32 cad; //Codec number
@@ -78,6 +79,7 @@ class VoodooHDADevice : public IOAudioDevice
 {
 //	friend class AppleHDAEngine;
 	friend class VoodooHDAEngine;
+	friend class CommandTransport;
 
 	OSDeclareDefaultStructors(VoodooHDADevice)
 
@@ -93,7 +95,11 @@ public:
 	UInt16 oldConfig;
 //
 	bool mSwitchCh;
+	UInt8 mInputChannelMap[MAX_INPUT_MAP];	// input channel c <- channel mInputChannelMap[c]
+	UInt32 mInputChannelMapSize;
 	UInt32 Boost;
+	UInt32 InputBoost;
+	UInt32 mSoftwareSRC;	// PCMResampler quality for the 44.1 kHz rates the codec lacks, 0 = don't offer them
 	
 	const char *mControllerName;
 	UInt32 mDeviceId, mSubDeviceId;
@@ -110,15 +116,23 @@ public:
 	int mSDO; //SDO ?
 
 	int mCorbSize;
-	int mCorbWritePtr; // WP
 	DmaMemory *mCorbMem;
 
 	int mRirbSize;
-	int mRirbReadPtr; // RP
 	DmaMemory *mRirbMem;
 
+	CommandTransport mCommands;	// the corb, the rirb and the immediate command interface
+	IOSimpleLock *mRirbLock;	// rirb read pointer and codec responses, shared with interruptFilter
+	IOInterruptState mRirbIntState;
+	volatile bool mRirbWaiting;
+
+	CommandBatch mBatch;
+
 	int mStreamCount;
 	DmaMemory *mDmaPosMem;
+	UInt32 mBdlBlocks;			// BDL layout for new channels, see bdlLayoutValid()
+	UInt32 mBdlIocInterval;
+	UInt32 mTargetLatency;		// us, for new engines; 0 = the whole DMA buffer as the ring
 
 	UInt32 mQuirksOn;
 	UInt32 mQuirksOff;
@@ -127,19 +141,25 @@ public:
 
 	Channel *mChannels;
 	int mNumChannels;
-
-	int mUnsolqReadPtr;
-	int mUnsolqWritePtr;
-	int mUnsolqState;
+	Channel *mStreamChannels[HDAC_STREAM_MAX];	// by stream index, those with an engine
+	UInt32 mStreamMask;							// and their bits in HDAC_INTSTS
+	StreamIntLatch mIntLatches[HDAC_STREAM_MAX];	// from interruptFilter to handleStreamInterrupt()
+
+	/* Unsolicited responses, from rirbFlush() to unsolqFlush() on the workloop: rirbFlush() runs
+	 * under mRirbLock, so there is one writer and one reader and the queue needs no lock */
+	volatile UInt32 mUnsolqReadPtr;
+	volatile UInt32 mUnsolqWritePtr;
 	UInt32 mUnsolq[HDAC_UNSOLQ_MAX];
-	// todo: unsolq task
+	volatile UInt32 mUnsolqDropped;	// lost to a full queue
+	UInt32 mUnsolqDroppedReported;
 
 	IOTimerEventSource *mTimerSource;
 	IOFilterInterruptEventSource *mInterruptSource;
+	IOInterruptEventSource *mUnsolSource;	// runs unsolqFlush(), signalled by rirbFlush()
 
-	UInt64 mIntTimestamp;
+	WallClock mWallClock;		// on the workloop only
 	UInt64 mChanIntMissed;
-	UInt32 mIntStatus;
+	volatile UInt32 mIntStatus;	// gathered by interruptFilter until handleInterrupt() takes it
 	UInt64 mTotalInt;
 	UInt64 mTotalChanInt;
 
@@ -207,13 +227,18 @@ public:
 			void *arg3 = 0);
 	ChannelInfo *getChannelInfo();
 	void pinDump();
+	void readStreamStats(Channel *channel, StreamStats *stats);
+	void copyStreamStats(StreamStatsBuffer *buffer);
+	void publishStreamStats();
 
 	void enableEventSources();
 	void disableEventSources();
 
 	static void timeoutOccurred(OSObject *owner, IOTimerEventSource *source);
 	static bool interruptFilter(OSObject *owner, IOFilterInterruptEventSource *source);
+	void latchStreamInterrupt(int stream);
 	static void interruptHandler(OSObject *owner, IOInterruptEventSource *source, int count);
+	static void unsolicitedHandler(OSObject *owner, IOInterruptEventSource *source, int count);
 	void handleInterrupt();
 
 	bool setupWorkloop();
@@ -234,21 +259,28 @@ public:
 
 	void initCorb();
 	void initRirb();
-	void startCorb();
 	void startRirb();
 
-	int rirbFlush();
-	int handleStreamInterrupt(Channel *channel);
+	int handleStreamInterrupt(Channel *channel, StreamIntLatch *latched);
 	VoodooHDAEngine *lookupEngine(int channelId);
-	void handleChannelInterrupt(int channelId);
+	void handleChannelInterrupt(Channel *channel, StreamIntLatch *latched);
+	void wallClockSample();
+	void wallClockFeed(UInt32 raw, UInt64 time, UInt64 spread);
+	bool channelWrapTime(Channel *channel, StreamIntLatch *latched, AbsoluteTime *timestamp);
 
 	UInt32 sendCommand(UInt32 verb, nid_t cad);
 	void sendCommands(CommandList *commands, nid_t cad);
+	void sendCommandLists(CommandList **lists);
+	void batchBegin();
+	void batchCommand(UInt32 verb, UInt32 *result);
+	void batchFlush();
 
 	static const char *findCodecName(Codec *codec);
 	void scanCodecs();
+	void probeCodecs();
+	void probeFunctionSetup(Codec *codec, nid_t nid, UInt32 funcGroupType, UInt32 subNode);
 	void probeCodec(Codec *codec);
-	void probeFunction(Codec *codec, nid_t nid);
+	void probeFunction(FunctionGroup *funcGroup);
 
 	int unsolqFlush();
 	void handleUnsolicited(Codec *codec, UInt32 tag);
@@ -263,8 +295,9 @@ public:
 
 	AudioControl *audioCtlEach(FunctionGroup *funcGroup, int *index);
 	AudioControl *audioCtlAmpGet(FunctionGroup *funcGroup, nid_t nid, int direction, int index, int cnt);
-	void audioCtlAmpSetInternal(nid_t cad, nid_t nid, int index, int lmute, int rmute, int left, int right,
-			int direction);
+	int audioCtlAmpSetInternal(nid_t cad, nid_t nid, int index, int lmute, int rmute, int left, int right,
+			int direction, int channels);
+	int audioCtlAmpQueue(AudioControl *ctl, UInt32 mute, int left, int right);
 	void audioCtlAmpSet(AudioControl *ctl, UInt32 mute, int left, int right);
 	void audioCtlAmpGetInternal(nid_t cad, nid_t nid, int index, int *lmute, int *rmute, int *left, int *right, 
 								int direction);
@@ -277,13 +310,15 @@ public:
 	void audioCtlDestAmp(FunctionGroup *funcGroup, nid_t nid, int index, int ossdev,
 						 int depth, int need);
 
-	void widgetConnectionParse(Widget *widget);
+	void widgetQueryConnections(Widget *widget, UInt32 connListLength, UInt32 *connList);
+	void widgetConnectionParse(Widget *widget, UInt32 connListLength, const UInt32 *connList);
 	UInt32 widgetPinPatch(UInt32 config, const char *str);
 	UInt32 widgetPinGetConfig(Widget *widget);
 	UInt32 widgetPinGetCaps(Widget *widget);
 	void widgetPinParse(Widget *widget);
 	UInt32 widgetGetCaps(Widget *widget, int *waspin);
-	void widgetParse(Widget *widget);
+	void widgetQueryParams(Widget *widget, UInt32 *connListLength);
+	void widgetParse(Widget *widget, UInt32 connListLength, const UInt32 *connList);
 	Widget *widgetGet(FunctionGroup *funcGroup, nid_t nid);
 
 	void dumpCtls(PcmDevice *pcmDevice, const char *banner, UInt32 flag);
@@ -299,7 +334,10 @@ public:
 	void dumpMix(PcmDevice *pcmDevice);
 	void dumpPcmChannels(PcmDevice *pcmDevice);
 
-	void powerup(FunctionGroup *funcGroup);
+	void powerupCodecs();
+	void audioQueryCaps(FunctionGroup *funcGroup);
+	void audioQueryParams(FunctionGroup *funcGroup);
+	void audioQueryConnections(FunctionGroup *funcGroup);
 	void audioParse(FunctionGroup *funcGroup);
 	void audioCtlParse(FunctionGroup *funcGroup);
 	void vendorPatchParse(FunctionGroup *funcGroup);
@@ -344,6 +382,7 @@ public:
 	void channelStop(Channel *channel, bool shouldLock = true);
 	void channelStart(Channel *channel, bool shouldLock = true);
 	int channelGetPosition(Channel *channel);
+	void dmaPosCheck(Channel *channel);
 
 	void streamSetup(Channel *channel);
 	void streamStop(Channel *channel);
@@ -22,11 +22,13 @@ OSDefineMetaClassAndStructors(VoodooHDAEngine, IOAudioEngine)
 
 #define SAMPLE_CHANNELS		2	// forced stereo quirk is always enabled
 
-#define SAMPLE_OFFSET		64	// note: these values definitely need to be tweaked
 #define SAMPLE_LATENCY		32
 
 extern const char *gDeviceTypes[], *gConnTypes[];
 
+// offered on output engines whose codec lacks them, converted from the mix in clipOutputSamples
+static const UInt32 gResampledRates[] = { 44100, 88200, 176400, 0 };
+
 #define kVoodooHDAPortSubTypeBase		'voo\x40'
 #define VOODOO_OSS_TO_SUBTYPE(type)		(kVoodooHDAPortSubTypeBase + 1 + type)
 #define VOODOO_SUBTYPE_TO_OSS(type)		(type - 1 - kVoodooHDAPortSubTypeBase)
@@ -71,6 +73,14 @@ bool VoodooHDAEngine::init(Channel *channel)
 
 	mChannel = channel;
 	mActiveOssDev = -1;
+	mBdlBlocks = channel->numBlocks;
+	mBdlIocInterval = channel->iocInterval;
+
+	mCrossoverCache.invalidate();
+	mCrossoverFrequency = kiSubCrossoverFrequency4thOrder;
+	miSubSRCQuality = HDA_ISUB_SRC_INTERPOLATOR;
+	mChannel->src.engineRate = 0;
+	mChannel->isub.buffer = NULL;
 
 	result = true;
 done:
@@ -98,6 +108,11 @@ void VoodooHDAEngine::free()
 
 	RELEASE(mDevice);
 
+	if (mChannel) {
+		mChannel->src.resampler.free();
+		detachiSub();
+	}
+
 	super::free();
 }
 
@@ -285,6 +300,7 @@ bool VoodooHDAEngine::initHardware(IOService *provider)
 	mDevice->retain();
 
 	mVerbose = mDevice->mVerbose;
+	mTargetLatency = mDevice->mTargetLatency;
 	identifyPaths();
 	getPortName();
 
@@ -332,7 +348,6 @@ bool VoodooHDAEngine::initHardware(IOService *provider)
 		errorMsg("error: createAudioStream failed\n");
 		goto done;
 	}
-	emptyStream = true;
 	if (!createAudioControls()) {
 		errorMsg("error: createAudioControls failed\n");
 		goto done;
@@ -499,6 +514,40 @@ bool VoodooHDAEngine::createAudioStream(IOAudioStreamDirection direction, void *
             mStream->addAvailableFormat(&format, &formatEx, &sampleRate, &sampleRate);
         }
 	}
+
+	// the rest of the 44.1 kHz family, when the codec can't do it itself: mixable linear PCM only, as the
+	// conversion runs on the float mix
+	for (int i = 0; gResampledRates[i]; i++) {
+		IOAudioSampleRate resampledRate = { gResampledRates[i], 0 };
+		IOAudioStreamFormat resampledFormat = format;
+		IOAudioStreamFormatExtension resampledFormatEx = formatEx;
+
+		if (isNativeRate(resampledRate.whole) || !getHardwareRate(resampledRate.whole))
+			continue;
+		resampledFormat.fSampleFormat = kIOAudioStreamSampleFormatLinearPCM;
+		resampledFormat.fIsMixable = true;
+		resampledFormatEx.fFramesPerPacket = 1;
+		if (HDA_PARAM_SUPP_PCM_SIZE_RATE_16BIT(supPcmSizeRates)) {
+			resampledFormat.fBitDepth = 16;
+			resampledFormat.fBitWidth = 16;
+			resampledFormatEx.fBytesPerPacket = resampledFormat.fNumChannels * 2;
+			mStream->addAvailableFormat(&resampledFormat, &resampledFormatEx, &resampledRate, &resampledRate);
+		}
+		if (HDA_PARAM_SUPP_PCM_SIZE_RATE_24BIT(supPcmSizeRates)) {
+			resampledFormat.fBitDepth = 24;
+			resampledFormat.fBitWidth = 32;
+			resampledFormatEx.fBytesPerPacket = resampledFormat.fNumChannels * 4;
+			mStream->addAvailableFormat(&resampledFormat, &resampledFormatEx, &resampledRate, &resampledRate);
+		}
+		if (HDA_PARAM_SUPP_PCM_SIZE_RATE_32BIT(supPcmSizeRates)) {
+			resampledFormat.fBitDepth = 32;
+			resampledFormat.fBitWidth = 32;
+			resampledFormatEx.fBytesPerPacket = resampledFormat.fNumChannels * 4;
+			mStream->addAvailableFormat(&resampledFormat, &resampledFormatEx, &resampledRate, &resampledRate);
+		}
+		logMsg("%ld Hz by software conversion from %ld Hz\n", (long int)resampledRate.whole,
+				(long int)getHardwareRate(resampledRate.whole));
+	}
         
 	if (!format.fBitDepth || !format.fBitWidth) {
 		errorMsg("error: couldn't find supported bit depth (16, 24, or 32-bit)\n");
@@ -567,7 +616,12 @@ IOReturn VoodooHDAEngine::performAudioEngineStop()
 	
 UInt32 VoodooHDAEngine::getCurrentSampleFrame()
 {
-	return (mDevice->channelGetPosition(mChannel) / mSampleSize);
+	UInt32 frame = mDevice->channelGetPosition(mChannel) / mSampleSize;
+
+	// the two buffers wrap together, so the position scales
+	if (mChannel->src.engineRate)
+		frame = (UInt32) (((UInt64) frame * mChannel->src.engineFrames) / mChannel->src.hwFrames);
+	return frame;
 }
 
 // pauseAudioEngine, beginConfigurationChange, completeConfigurationChange, resumeAudioEngine
@@ -578,7 +632,7 @@ IOReturn VoodooHDAEngine::performFormatChange(IOAudioStream *audioStream,
 {
 	IOReturn result = kIOReturnError;
 	int setResult;
-	UInt32 ossFormat;
+	UInt32 ossFormat, hwRate;
 	bool wasRunning = (getState() == kIOAudioEngineRunning);
 
 	// ASSERT(audioStream == mStream);
@@ -649,24 +703,34 @@ IOReturn VoodooHDAEngine::performFormatChange(IOAudioStream *audioStream,
 			channels = 2;
 		} */
 		mSampleSize = channels * (newFormat->fBitWidth / 8);
-		mNumSampleFrames = mBufferSize / mSampleSize;
-		setNumSampleFramesPerBuffer(mNumSampleFrames);
-
-		logMsg("buffer size: %ld, channels: %d, bit depth: %d, # samp. frames: %ld\n", (long int)mBufferSize,
-				channels, newFormat->fBitDepth, (long int)mNumSampleFrames);
+		mNumChannels = channels;
 		//goto done;
 	}
 
 	if (newSampleRate) {
-		setResult = mDevice->channelSetSpeed(mChannel, newSampleRate->whole);
-//		logMsg("channelSetSpeed(%ld) for channel %d returned %d\n", newSampleRate->whole, getEngineId(),
+		hwRate = getHardwareRate(newSampleRate->whole);
+		setResult = hwRate ? mDevice->channelSetSpeed(mChannel, hwRate) : 0;
+//		logMsg("channelSetSpeed(%ld) for channel %d returned %d\n", hwRate, getEngineId(),
 //				setResult);
-		if ((UInt32) setResult != newSampleRate->whole) {
+		if (!hwRate || ((UInt32) setResult != hwRate)) {
 			errorMsg("error: couldn't set sample rate %ld\n", (long int)newSampleRate->whole);
 			goto done;
 		}
 	}
 
+	// the frames per buffer depend on the format, and with software rate conversion on the rate as well
+	if (!setupSRC(newSampleRate ? newSampleRate->whole : getSampleRate()->whole))
+		goto done;
+	// the only place the coefficients go stale; the engine is stopped, so nobody is using them
+	if (newSampleRate)
+		mCrossoverCache.invalidate();
+	// the crossover on the channels and the rate; without it the iSub goes quiet, the codec still plays
+	if (mChannel->isub.buffer)
+		setupiSub(newSampleRate ? newSampleRate->whole : getSampleRate()->whole);
+	if (newFormat)
+		logMsg("buffer size: %ld, channels: %d, bit depth: %d, # samp. frames: %ld\n", (long int)mBufferSize,
+				(int)mNumChannels, newFormat->fBitDepth, (long int)mNumSampleFrames);
+
 	if (wasRunning)
 		startAudioEngine();
 
@@ -675,6 +739,271 @@ done:
 	return result;
 }
 
+bool VoodooHDAEngine::isNativeRate(UInt32 sampleRate)
+{
+	for (int i = 0; (i < 16) && mChannel->pcmRates[i]; i++)
+		if (mChannel->pcmRates[i] == sampleRate)
+			return true;
+	return false;
+}
+
+// the rate the codec runs at for sampleRate: the rate itself, or for the resampled ones the same multiple of
+// 48 kHz if the codec has it, else 48 kHz; 0 if there is none
+UInt32 VoodooHDAEngine::getHardwareRate(UInt32 sampleRate)
+{
+	UInt32 hwRate;
+
+	if (isNativeRate(sampleRate))
+		return sampleRate;
+	if (!mDevice || !mDevice->mSoftwareSRC || (getEngineDirection() != kIOAudioStreamDirectionOutput))
+		return 0;
+	for (int i = 0; gResampledRates[i]; i++) {
+		if (gResampledRates[i] != sampleRate)
+			continue;
+		hwRate = (sampleRate / 44100) * 48000;
+		if (isNativeRate(hwRate))
+			return hwRate;
+		return isNativeRate(48000) ? 48000 : 0;
+	}
+	return 0;
+}
+
+/*
+ * The ring the engine uses out of the DMA buffer, its BDL layout and the sample offset: the whole buffer with
+ * the configured layout, or in low latency mode a short ring from lowLatencyLayout() with one interrupt per
+ * ring and the offset cut to a quarter of the target latency. The mix buffer follows the frames per buffer.
+ * Resampled rates keep the whole buffer, their conversion unit needs rings of several times the target.
+ */
+void VoodooHDAEngine::setupRing(bool lowLatency)
+{
+	UInt32 targetFrames, offset;
+
+	mBufferSize = HDA_BUFSZ_MAX;
+	mChannel->numBlocks = mBdlBlocks;
+	mChannel->iocInterval = mBdlIocInterval;
+	offset = SAMPLE_OFFSET;
+
+	if (lowLatency && mTargetLatency && mChannel->speed) {
+		targetFrames = (UInt32) (((UInt64) mChannel->speed * mTargetLatency) / 1000000);
+		lowLatencyLayout(targetFrames, mSampleSize, &mChannel->numBlocks, &mChannel->blockSize);
+		mChannel->iocInterval = mChannel->numBlocks;
+		mBufferSize = mChannel->blockSize * mChannel->numBlocks;
+		offset = lowLatencyOffset(targetFrames);
+		logMsg("low latency: %ld frame ring in %ld blocks, sample offset %ld\n",
+				(long int)(mBufferSize / mSampleSize), (long int)mChannel->numBlocks, (long int)offset);
+	}
+	setSampleOffset(offset);
+}
+
+/*
+ * Frames per buffer, and the resampler when the engine doesn't run at the codec's rate (mChannel->speed).
+ * The DMA buffer is then cut down to a whole number of hwUnit frames, with engineUnit frames for each on the
+ * engine side, so both wrap together and the interrupt at the end of the last block is still the engine's
+ * timestamp. Not on the audio path: the engine is stopped.
+ */
+bool VoodooHDAEngine::setupSRC(UInt32 sampleRate)
+{
+	ChannelSRC *src = &mChannel->src;
+	UInt32 hwRate = mChannel->speed, gcd, engineUnit, hwUnit, align, step, count;
+
+	ASSERT(mSampleSize);
+	src->resampler.free();
+	src->engineRate = 0;
+	setupRing(sampleRate == hwRate);
+	mChannel->blockSize = mBufferSize / mChannel->numBlocks;
+	mNumSampleFrames = mBufferSize / mSampleSize;
+	setSampleLatency(SAMPLE_LATENCY);
+
+	if (sampleRate != hwRate) {
+		gcd = greatestCommonDivisor(sampleRate, hwRate);
+		engineUnit = sampleRate / gcd;
+		hwUnit = hwRate / gcd;
+		// every BDL block has to stay 128 byte aligned
+		align = HDAC_DMA_ALIGNMENT * mChannel->numBlocks;
+		step = align / greatestCommonDivisor(align, hwUnit * mSampleSize);
+		count = mBufferSize / (((engineUnit > hwUnit) ? engineUnit : hwUnit) * mSampleSize);
+		count -= count % step;
+		if (!count || !src->resampler.init(sampleRate, hwRate, mNumChannels, mDevice->mSoftwareSRC) ||
+				(src->resampler.maxOutputFrames(HDA_SRC_CHUNK_FRAMES) > HDA_SRC_MAX_OUT_FRAMES)) {
+			errorMsg("error: couldn't set up rate conversion from %ld to %ld Hz\n", (long int)sampleRate,
+					(long int)hwRate);
+			src->resampler.free();
+			setNumSampleFramesPerBuffer(mNumSampleFrames);
+			return false;
+		}
+		src->engineFrames = count * engineUnit;
+		src->hwFrames = count * hwUnit;
+		src->nextFrame = src->engineFrames;	// never asked for, so the first clip starts afresh
+		src->writeFrame = 0;
+		src->engineRate = sampleRate;
+		mChannel->blockSize = (src->hwFrames * mSampleSize) / mChannel->numBlocks;
+		mNumSampleFrames = src->engineFrames;
+		setSampleLatency(SAMPLE_LATENCY + src->resampler.latency());
+		logMsg("%ld Hz converted to %ld Hz: %ld taps per phase, %ld engine / %ld codec frames per buffer\n",
+				(long int)sampleRate, (long int)hwRate, (long int)src->resampler.tapsPerPhase(),
+				(long int)src->engineFrames, (long int)src->hwFrames);
+	}
+	setNumSampleFramesPerBuffer(mNumSampleFrames);
+	return true;
+}
+
+/*
+ * Hands the low band of the mix to an iSub from now on: buffer is its ring of bufferLen 16-bit samples at
+ * format->outputSampleRate, and the rest of the mix goes on to the codec. srcQuality takes it there: a
+ * PCMResampler quality, or HDA_ISUB_SRC_INTERPOLATOR for the linear interpolator AppleUSBAudio used. Output
+ * engines only, with the engine stopped, like a format change. Nothing in this driver finds an iSub yet; this
+ * is where one goes in.
+ */
+bool VoodooHDAEngine::attachiSub(SInt16 *buffer, UInt32 bufferLen, const iSubAudioFormatType *format,
+		UInt32 srcQuality)
+{
+	ChanneliSub *isub = &mChannel->isub;
+	UInt32 size = HDA_ISUB_CHUNK_FRAMES * kiSubMaxChannels * sizeof (Float32);
+
+	if (!buffer || !bufferLen || !format || !format->outputSampleRate ||
+			(getEngineDirection() != kIOAudioStreamDirectionOutput))
+		return false;
+
+	detachiSub();
+	isub->low = (Float32 *) IOMalloc(size);
+	isub->high = (Float32 *) IOMalloc(size);
+	if (!isub->low || !isub->high) {
+		errorMsg("error: couldn't allocate the iSub crossover buffers\n");
+		detachiSub();
+		return false;
+	}
+	isub->buffer = buffer;
+	isub->bufferLen = bufferLen;
+	isub->offset = 0;
+	isub->loopCount = 0;
+	isub->format = *format;
+	miSubSRCQuality = srcQuality;
+	if (!setupiSub(getSampleRate()->whole)) {
+		detachiSub();
+		return false;
+	}
+	return true;
+}
+
+void VoodooHDAEngine::detachiSub()
+{
+	ChanneliSub *isub = &mChannel->isub;
+	UInt32 size = HDA_ISUB_CHUNK_FRAMES * kiSubMaxChannels * sizeof (Float32);
+
+	isub->buffer = NULL;
+	isub->sampleRate = 0;
+	isub->resampler.free();
+	if (isub->low)
+		IOFree(isub->low, size);
+	if (isub->high)
+		IOFree(isub->high, size);
+	isub->low = NULL;
+	isub->high = NULL;
+}
+
+/*
+ * The crossover for sampleRate and the engine's channels, each of which the iSub gets its share of, starting
+ * from silence; the coefficients come out of the cache, built on the first use of a rate, and the resampler
+ * is set up for miSubSRCQuality. Not on the audio path: the engine is stopped.
+ */
+bool VoodooHDAEngine::setupiSub(UInt32 sampleRate)
+{
+	ChanneliSub *isub = &mChannel->isub;
+
+	isub->sampleRate = 0;
+	isub->srcPhase = 0;
+	isub->srcState = 0;
+	isub->resampler.free();
+	if ((isub->format.numChannels < 1) || (isub->format.numChannels > 2) ||
+			(mNumChannels % isub->format.numChannels) ||
+			!(isub->coeffs = mCrossoverCache.lookup(sampleRate, mCrossoverFrequency, 4, true)) ||
+			!isub->crossover.init(isub->coeffs, mNumChannels)) {
+		errorMsg("error: no iSub crossover for %ld channels at %ld Hz\n", (long int)mNumChannels,
+				(long int)sampleRate);
+		return false;
+	}
+	if ((miSubSRCQuality != HDA_ISUB_SRC_INTERPOLATOR) && !isub->resampler.init(sampleRate,
+			isub->format.outputSampleRate, isub->format.numChannels, miSubSRCQuality)) {
+		errorMsg("error: couldn't set up rate conversion from %ld to %ld Hz for the iSub\n", (long int)sampleRate,
+				(long int)isub->format.outputSampleRate);
+		return false;
+	}
+	isub->sampleRate = sampleRate;
+	return true;
+}
+
+/*
+ * Redoes the ring for a new BDL layout or target latency with the engine stopped, inside a configuration
+ * change so the HAL picks up the new buffer size. If setupSRC() can't have the new settings the old ones
+ * are put back.
+ */
+IOReturn VoodooHDAEngine::changeRing(UInt32 numBlocks, UInt32 iocInterval, UInt32 latency)
+{
+	IOReturn result = kIOReturnSuccess;
+	bool wasRunning = (getState() == kIOAudioEngineRunning);
+	UInt32 oldBlocks = mBdlBlocks, oldIocInterval = mBdlIocInterval, oldLatency = mTargetLatency;
+	UInt32 sampleRate = getSampleRate()->whole;
+
+	beginConfigurationChange();
+	if (wasRunning)
+		stopAudioEngine();
+	mBdlBlocks = numBlocks;
+	mBdlIocInterval = iocInterval;
+	mTargetLatency = latency;
+	if (!setupSRC(sampleRate)) {
+		errorMsg("error: can't set up the ring, keeping the old one\n");
+		mBdlBlocks = oldBlocks;
+		mBdlIocInterval = oldIocInterval;
+		mTargetLatency = oldLatency;
+		setupSRC(sampleRate);
+		result = kIOReturnError;
+	}
+	if (wasRunning)
+		startAudioEngine();
+	completeConfigurationChange();
+
+	return result;
+}
+
+/*
+ * The BDL layout, from the user client: more blocks and interrupts per ring give finer timestamps at a higher
+ * interrupt rate. The block size follows from the buffer as setupSRC() cuts it, so a running engine restarts.
+ * Low latency mode has its own layout; this one is kept for when it is off.
+ */
+IOReturn VoodooHDAEngine::setBlockLayout(UInt32 numBlocks, UInt32 iocInterval)
+{
+	IOReturn result;
+
+	if (!bdlLayoutValid(numBlocks, iocInterval)) {
+		errorMsg("error: invalid BDL layout of %ld blocks, interrupt every %ld\n", (long int)numBlocks,
+				(long int)iocInterval);
+		return kIOReturnBadArgument;
+	}
+	if ((numBlocks == mBdlBlocks) && (iocInterval == mBdlIocInterval))
+		return kIOReturnSuccess;
+
+	result = changeRing(numBlocks, iocInterval, mTargetLatency);
+	if (result == kIOReturnSuccess)
+		logMsg("%ld BDL blocks of %ld bytes, interrupt every %ld\n", (long int)numBlocks,
+				(long int)mChannel->blockSize, (long int)iocInterval);
+	return result;
+}
+
+/*
+ * Low latency mode from the user client, latency in us or 0 for the whole DMA buffer; see setupRing().
+ */
+IOReturn VoodooHDAEngine::setTargetLatency(UInt32 latency)
+{
+	if (latency && ((latency < HDA_LATENCY_MIN) || (latency > HDA_LATENCY_MAX))) {
+		errorMsg("error: invalid target latency of %ld us\n", (long int)latency);
+		return kIOReturnBadArgument;
+	}
+	if (latency == mTargetLatency)
+		return kIOReturnSuccess;
+
+	return changeRing(mBdlBlocks, mBdlIocInterval, latency);
+}
+
 bool VoodooHDAEngine::createAudioControls()
 {
 	bool			result = false;
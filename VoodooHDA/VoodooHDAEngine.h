@@ -23,20 +23,27 @@ class VoodooHDAEngine : public IOAudioEngine
 public:
 	UInt32 mVerbose;
 
-	UInt32 mBufferSize;
+	UInt32 mBufferSize;			// of the DMA buffer in use as the ring
 	UInt32 mSampleSize;
 	UInt32 mNumSampleFrames;
+	UInt32 mNumChannels;
 	UInt32 Boost;
+	UInt32 InputBoost;
 /*	bool vectorize;
 	int noiseLevel;
 	bool useStereo;
 	int StereoBase;*/
 
 	Channel *mChannel;
+	UInt32 mBdlBlocks, mBdlIocInterval;	// BDL layout for the full ring
+	UInt32 mTargetLatency;				// us, 0 = the whole DMA buffer as the ring
 	VoodooHDADevice *mDevice;
 	IOAudioStream *mStream;
-	bool emptyStream;
-	float *floatMixBufOld;
+
+	// iSub crossover coefficients, rebuilt after every change of rate
+	iSubCrossoverCache mCrossoverCache;
+	UInt32 mCrossoverFrequency;
+	UInt32 miSubSRCQuality;		// PCMResampler quality to the iSub's rate, or HDA_ISUB_SRC_INTERPOLATOR
 
 	const char *mPortName;
 	const char *mName;
@@ -83,6 +90,23 @@ public:
 	bool createAudioStream();
 
 	bool createAudioControls();
+
+	bool isNativeRate(UInt32 sampleRate);
+	UInt32 getHardwareRate(UInt32 sampleRate);
+	void setupRing(bool lowLatency);
+	bool setupSRC(UInt32 sampleRate);
+	bool attachiSub(SInt16 *buffer, UInt32 bufferLen, const iSubAudioFormatType *format, UInt32 srcQuality);
+	void detachiSub();
+	bool setupiSub(UInt32 sampleRate);
+	IOReturn changeRing(UInt32 numBlocks, UInt32 iocInterval, UInt32 latency);
+	IOReturn setBlockLayout(UInt32 numBlocks, UInt32 iocInterval);
+	IOReturn setTargetLatency(UInt32 latency);
+	IOReturn blitOutputSamples(const Float32 *floatMixBuf, void *sampleBuf, UInt32 firstSampleFrame,
+			UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat);
+	IOReturn resampleOutputSamples(const Float32 *floatMixBuf, void *sampleBuf, UInt32 firstSampleFrame,
+			UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat);
+	IOReturn clipiSubOutputSamples(const Float32 *floatMixBuf, void *sampleBuf, UInt32 firstSampleFrame,
+			UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat);
 	
 	static IOReturn volumeChangeHandler(IOService *target, IOAudioControl *volumeControl, SInt32 oldValue, SInt32 newValue);
 	static IOReturn muteChangeHandler(IOService *target, IOAudioControl *muteControl, SInt32 oldValue, SInt32 newValue);
@@ -108,6 +132,8 @@ public:
 
 	virtual IOReturn clipOutputSamples(const void *mixBuf, void *sampleBuf, UInt32 firstSampleFrame,
 			UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat, IOAudioStream *audioStream);
+	virtual IOReturn eraseOutputSamples(const void *mixBuf, void *sampleBuf, UInt32 firstSampleFrame,
+			UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat, IOAudioStream *audioStream);
 	virtual IOReturn convertInputSamples(const void *sampleBuf, void *destBuf, UInt32 firstSampleFrame,
 			UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat, IOAudioStream *audioStream);
 	virtual OSString *getLocalUniqueID();
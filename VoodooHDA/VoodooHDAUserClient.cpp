@@ -278,6 +278,19 @@ IOReturn VoodooHDAUserClient::clientMemoryForType(UInt32 type, IOOptionBits *opt
 		*memory = memDesc; // automatically released after memory is mapped into task
 		result = kIOReturnSuccess;
 		break;
+	case kVoodooHDAMemoryStreamStats:
+		memDesc = IOBufferMemoryDescriptor::withOptions(kIOMemoryKernelUserShared, sizeof (StreamStatsBuffer));
+		if (!memDesc) {
+			errorMsg("error: couldn't allocate buffer memory descriptor (size: %ld)\n",
+					(long) sizeof (StreamStatsBuffer));
+			result = kIOReturnVMError;
+			break;
+		}
+		mDevice->copyStreamStats((StreamStatsBuffer *) memDesc->getBytesNoCopy());
+		*options |= kIOMapReadOnly;
+		*memory = memDesc; // automatically released after memory is mapped into task
+		result = kIOReturnSuccess;
+		break;
 	default:
 		result = kIOReturnBadArgument;
 		break;
@@ -0,0 +1,72 @@
+#include "License.h"
+
+#include "WallClock.h"
+
+SInt64 wallClockNs(UInt64 rate, SInt64 ticks)
+{
+	return ticks * (SInt64) (rate >> 32) + ((ticks * (SInt64) (rate & 0xffffffffULL)) >> 32);
+}
+
+void wallClockUpdate(WallClock *clock, UInt32 raw, UInt64 hostNs, UInt64 spreadNs)
+{
+	UInt64 nominal = (1000000000ULL << 32) / HDAC_WALCLK_HZ;
+	SInt64 ticks = (UInt32) (raw - clock->lastRaw), predicted = 0, error = 0;
+
+	/* The host reads were too far apart to say when it was taken */
+	if (spreadNs > HDAC_WALCLK_SPREAD_MAX)
+		return;
+	/* Latched by interruptFilter before the last one but fed after it: nothing new */
+	if (clock->samples && ((SInt32) (raw - clock->lastRaw) < 0) &&
+			((SInt32) (raw - clock->lastRaw) > -HDAC_WALCLK_HZ))
+		return;
+	if (clock->samples) {
+		predicted = (SInt64) clock->hostNs + wallClockNs(clock->rate, ticks);
+		error = (SInt64) hostNs - predicted;
+	}
+	/* The first sample, or the wall clock was reset or stopped, or nothing was heard for minutes */
+	if (!clock->samples || !ticks || (error > HDAC_WALCLK_RESYNC) || (error < -HDAC_WALCLK_RESYNC)) {
+		clock->lastRaw = raw;
+		clock->hostNs = hostNs;
+		clock->rate = nominal;
+		clock->samples = 1;
+		return;
+	}
+	/* The second one far enough from the first sets the rate outright, later ones steer it */
+	if (clock->samples == 1) {
+		if (ticks < HDAC_WALCLK_RATE_TICKS)
+			return;
+		clock->hostNs = hostNs;
+		clock->rate = nominal + (error * (SInt64) (1ULL << 32)) / ticks;
+	} else {
+		clock->hostNs = predicted + error / HDAC_WALCLK_PHASE_GAIN;
+		clock->rate += ((error * (SInt64) (1ULL << 32)) / ((ticks > HDAC_WALCLK_RATE_TICKS) ? ticks :
+				HDAC_WALCLK_RATE_TICKS)) / HDAC_WALCLK_RATE_GAIN;
+	}
+	clock->lastRaw = raw;
+	if (clock->rate > nominal + nominal / HDAC_WALCLK_RATE_RANGE)
+		clock->rate = nominal + nominal / HDAC_WALCLK_RATE_RANGE;
+	else if (clock->rate < nominal - nominal / HDAC_WALCLK_RATE_RANGE)
+		clock->rate = nominal - nominal / HDAC_WALCLK_RATE_RANGE;
+	clock->samples++;
+}
+
+/*
+ * When the DMA went past the end of a ring of ring bytes, in host ns: position
+ * says how many frames ago at wall clock raw, read together, the link clocks
+ * both, and the filter maps the wall clock to host time. False until the
+ * filter has settled.
+ */
+bool wallClockWrapNs(const WallClock *clock, UInt32 raw, UInt32 position, UInt32 ring, UInt32 speed,
+		UInt32 frameBytes, UInt64 *wrapNs)
+{
+	SInt64 since, ticks;
+
+	if ((clock->samples < HDAC_WALCLK_SETTLE) || !speed || !frameBytes || (position >= ring))
+		return false;
+
+	/* Just short of the end rather than past it, if the interrupt came early */
+	since = (position <= ring / 2) ? (SInt64) position : (SInt64) position - ring;
+	ticks = since * HDAC_WALCLK_HZ / ((SInt64) speed * frameBytes);
+	*wrapNs = clock->hostNs + wallClockNs(clock->rate, (SInt32) (raw - clock->lastRaw) - ticks);
+	return true;
+}
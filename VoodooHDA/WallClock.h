@@ -0,0 +1,53 @@
+#include "License.h"
+
+#ifndef __WallClock_h__
+#define __WallClock_h__
+
+#include <IOKit/IOTypes.h>
+
+/*
+	The link wall clock filter behind the engines' timestamps: each usable sample of the wall clock against
+	host time moves the mapping part of the way to it, both in phase and in rate, which follows the drift of
+	the two clocks and averages out the jitter of the samples.
+
+	Nothing in here touches the controller, so bench/clockbench runs the same code on the host.
+*/
+
+#define HDAC_WALCLK_HZ			24000000	// the link wall clock, which also clocks the codecs' sample rates
+#define HDAC_WALCLK_SPREAD_MAX	10000		// ns between the host clock reads around a usable sample
+#define HDAC_WALCLK_RESYNC		10000000	// ns a sample may be off before the filter starts over
+#define HDAC_WALCLK_SETTLE		4			// samples before its timestamps are used
+#define HDAC_WALCLK_PHASE_GAIN	8			// of a sample's error, 1 / this goes into the phase
+#define HDAC_WALCLK_RATE_GAIN	64			// and 1 / this into the rate
+#define HDAC_WALCLK_RATE_TICKS	2400000		// wall clock ticks the rate is measured over at least
+#define HDAC_WALCLK_RATE_RANGE	1000		// the rate stays within 1 / this of nominal
+
+/* The wall clock's mapping to host time: host time hostNs at wall clock
+ * lastRaw, and host ns per tick in 32.32 fixed point, following the drift
+ * between the two clocks. */
+typedef struct _WallClock {
+	UInt32 lastRaw;
+	UInt64 hostNs;
+	UInt64 rate;
+	UInt32 samples;		// since it last started over
+} WallClock;
+
+/* A stream's interrupt as interruptFilter saw it. status gathers the SDSTS
+ * bits until handleStreamInterrupt() takes them; the rest is from the latest
+ * completion, written under seq, which is odd while the filter is at it. */
+typedef struct _StreamIntLatch {
+	volatile UInt32 status;
+	volatile UInt32 seq;
+	UInt32 wallClock;
+	UInt32 position;	// LPIB
+	UInt64 time;		// host absolute time halfway through the two reads
+	UInt64 spread;		// between the host clock reads around them
+} StreamIntLatch;
+
+SInt64 wallClockNs(UInt64 rate, SInt64 ticks);
+// a wall clock read at host time hostNs, give or take half of spreadNs
+void wallClockUpdate(WallClock *clock, UInt32 raw, UInt64 hostNs, UInt64 spreadNs);
+bool wallClockWrapNs(const WallClock *clock, UInt32 raw, UInt32 position, UInt32 ring, UInt32 speed,
+		UInt32 frameBytes, UInt64 *wrapNs);
+
+#endif
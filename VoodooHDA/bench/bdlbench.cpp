@@ -0,0 +1,227 @@
+/*
+	bdlbench - simulated stream DMA check of the BDL layouts of VoodooHDADevice.
+
+	Runs on any host, without hardware. It builds with the driver's BdlLayout.cpp, so the layout checks, the
+	BDL, the wrap test that decides the engine's timestamps, the expected period and the low latency rings
+	are the driver's own. A model of a stream's DMA engine walks the BDL at the format's byte rate and
+	raises an interrupt at the end of every entry with IOC set, after an interrupt latency of 5 to 40 us.
+	The position the driver reads back is off by up to a DPIB update granule either way.
+
+	For every layout it checks the BDL, that there are numBlocks / iocInterval
+	interrupts per ring at the expected period, and that the engine gets exactly one timestamp per ring,
+	from the interrupt for the last entry. The "latency" rows do the same for the rings of low latency mode,
+	and check that they hold whole frames, within HDA_BUFSZ_MAX and with the sample offset in range. The
+	"invalid" rows check that bad layouts are refused.
+
+	Results go to stdout as CSV, one row per layout or target latency and format:
+		suite,rate,channels,bits,target_us,blocks,ioc_every,block_bytes,ring_frames,offset,irqs_per_s,
+		expected_us,mean_us,max_dev_us,timestamps,wraps,ok
+	The exit status is 1 if anything failed.
+
+	usage: bdlbench
+*/
+
+#include <IOKit/IOTypes.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "BdlLayout.h"
+
+#define NUM_ELEMENTS(a)	(sizeof(a) / sizeof((a)[0]))
+
+// what the stream uses of Channel
+typedef struct {
+	UInt32 numBlocks, blockSize;
+	UInt32 iocInterval;
+	UInt32 position;	// what DPIB or LPIB reads back
+	UInt64 bufferAddr;
+	BdlEntry bdl[HDA_BDL_MAX];
+} SimChannel;
+
+static const UInt64 kLatencyMinNs = 5000, kLatencyMaxNs = 40000;
+static const UInt32 kPositionJitter = 128;
+static const int kRings = 8;
+
+static int sFailures;
+static UInt32 sRandom = 1;
+
+static UInt32 simRandom(UInt32 range)
+{
+	sRandom = sRandom * 1664525 + 1013904223;
+	return (sRandom >> 8) % range;
+}
+
+#pragma mark -
+#pragma mark Simulated stream
+
+static bool checkBdl(SimChannel *channel)
+{
+	UInt64 addr = channel->bufferAddr;
+
+	if ((channel->blockSize % HDAC_DMA_ALIGNMENT) || (channel->blockSize * channel->numBlocks > HDA_BUFSZ_MAX))
+		return false;
+	for (UInt32 n = 0; n < channel->numBlocks; n++) {
+		BdlEntry *entry = &channel->bdl[n];
+		if ((((UInt64) entry->addrh << 32) | entry->addrl) != addr)
+			return false;
+		if ((entry->len != channel->blockSize) || (entry->ioc != (((n + 1) % channel->iocInterval) == 0)))
+			return false;
+		addr += entry->len;
+	}
+	return channel->bdl[channel->numBlocks - 1].ioc != 0;
+}
+
+static void run(const char *suite, UInt32 rate, UInt32 channels, UInt32 bits, UInt32 targetUs,
+		UInt32 numBlocks, UInt32 iocInterval, UInt32 blockSize, UInt32 offset, bool ok)
+{
+	static SimChannel channel;
+	UInt32 frameBytes = channels * ((bits > 16) ? 4 : 2);
+	UInt64 bytesPerSec = (UInt64) rate * frameBytes;
+	UInt64 expected, lastIrq = 0, sumPeriod = 0, maxDev = 0, ringBytes;
+	UInt32 irqs = 0, timestamps = 0, wraps = 0, periods = 0, irqsPerRing;
+
+	memset(&channel, 0, sizeof (channel));
+	channel.bufferAddr = 0x1234000000ULL;
+	channel.numBlocks = numBlocks;
+	channel.iocInterval = iocInterval;
+	channel.blockSize = blockSize;
+	bdlFill(channel.bdl, channel.bufferAddr, blockSize, numBlocks, iocInterval);
+	ringBytes = (UInt64) blockSize * numBlocks;
+	if (!bdlLayoutValid(numBlocks, iocInterval) || !checkBdl(&channel) || (ringBytes % frameBytes))
+		ok = false;
+	expected = bdlPeriodNs(blockSize, iocInterval, rate, frameBytes);
+	irqsPerRing = numBlocks / iocInterval;
+
+	// the DMA engine finishes entry n of ring r when (r * numBlocks + n + 1) blocks have gone
+	for (int r = 0; r < kRings; r++) {
+		for (UInt32 n = 0; n < numBlocks; n++) {
+			UInt64 bytes, irq, now;
+			SInt64 position;
+
+			if (!channel.bdl[n].ioc)
+				continue;
+			bytes = ((UInt64) r * numBlocks + n + 1) * channel.blockSize;
+			irq = bytes * 1000000000ULL / bytesPerSec;
+			now = irq + kLatencyMinNs + simRandom(kLatencyMaxNs - kLatencyMinNs);
+			position = (SInt64) (now * bytesPerSec / 1000000000ULL) + simRandom(2 * kPositionJitter) -
+					kPositionJitter;
+			channel.position = (UInt32) (((position % (SInt64) ringBytes) + ringBytes) % ringBytes);
+
+			irqs++;
+			if (lastIrq) {
+				UInt64 period = now - lastIrq;
+				UInt64 dev = (period > expected) ? period - expected : expected - period;
+				sumPeriod += period;
+				periods++;
+				if (dev > maxDev)
+					maxDev = dev;
+			}
+			lastIrq = now;
+
+			if (n == numBlocks - 1)
+				wraps++;
+			// handleChannelInterrupt: whether the engine gets its timestamp
+			if (bdlAtWrap(channel.position, blockSize, numBlocks, iocInterval)) {
+				timestamps++;
+				if (n != numBlocks - 1)
+					ok = false;
+			}
+		}
+	}
+
+	if ((irqs != irqsPerRing * kRings) || (timestamps != wraps) || (wraps != kRings))
+		ok = false;
+	if (periods && ((sumPeriod / periods > expected + expected / 100) ||
+			(sumPeriod / periods + expected / 100 < expected)))
+		ok = false;
+	if (maxDev > kLatencyMaxNs - kLatencyMinNs + 1000)
+		ok = false;
+	if (!ok)
+		sFailures++;
+
+	printf("%s,%u,%u,%u,%u,%u,%u,%u,%u,%u,%.1f,%.1f,%.1f,%.1f,%u,%u,%d\n", suite, (unsigned int) rate,
+			(unsigned int) channels, (unsigned int) bits, (unsigned int) targetUs, (unsigned int) numBlocks,
+			(unsigned int) iocInterval, (unsigned int) channel.blockSize, (unsigned int) (ringBytes / frameBytes),
+			(unsigned int) offset, 1e9 / expected, expected / 1000.0,
+			periods ? sumPeriod / periods / 1000.0 : 0.0, maxDev / 1000.0, (unsigned int) timestamps,
+			(unsigned int) wraps, ok ? 1 : 0);
+}
+
+static void runInvalid(UInt32 numBlocks, UInt32 iocInterval)
+{
+	bool ok = !bdlLayoutValid(numBlocks, iocInterval);
+
+	if (!ok)
+		sFailures++;
+	printf("invalid,0,0,0,0,%u,%u,0,0,0,0,0,0,0,0,0,%d\n", (unsigned int) numBlocks, (unsigned int) iocInterval,
+			ok ? 1 : 0);
+}
+
+static const struct {
+	UInt32 rate, channels, bits;
+} sFormats[] = {
+	{ 44100, 2, 16 },
+	{ 48000, 2, 16 },
+	{ 96000, 2, 24 },
+	{ 192000, 8, 32 },
+};
+
+static const struct {
+	UInt32 numBlocks, iocInterval;
+} sLayouts[] = {
+	{ 2, 2 },	// the default, one interrupt per ring
+	{ 2, 1 },
+	{ 8, 8 },
+	{ 8, 2 },
+	{ 8, 1 },
+	{ 32, 4 },
+	{ 32, 1 },
+	{ 256, 256 },
+	{ 256, 16 },
+	{ 256, 1 },
+};
+
+static const UInt32 sTargetLatencies[] = { 1000, 2000, 3000, 5000, 10000, 50000 };
+
+static const struct {
+	UInt32 numBlocks, iocInterval;
+} sInvalid[] = {
+	{ 0, 0 },
+	{ 1, 1 },
+	{ 3, 3 },
+	{ 512, 512 },
+	{ 8, 0 },
+	{ 8, 3 },
+	{ 8, 16 },
+};
+
+int main(int argc, char **argv)
+{
+	printf("suite,rate,channels,bits,target_us,blocks,ioc_every,block_bytes,ring_frames,offset,irqs_per_s,"
+			"expected_us,mean_us,max_dev_us,timestamps,wraps,ok\n");
+	for (unsigned int f = 0; f < NUM_ELEMENTS(sFormats); f++)
+		for (unsigned int l = 0; l < NUM_ELEMENTS(sLayouts); l++)
+			run("layout", sFormats[f].rate, sFormats[f].channels, sFormats[f].bits, 0, sLayouts[l].numBlocks,
+					sLayouts[l].iocInterval, HDA_BUFSZ_MAX / sLayouts[l].numBlocks, SAMPLE_OFFSET, true);
+	for (unsigned int f = 0; f < NUM_ELEMENTS(sFormats); f++)
+		for (unsigned int t = 0; t < NUM_ELEMENTS(sTargetLatencies); t++) {
+			UInt32 frameBytes = sFormats[f].channels * ((sFormats[f].bits > 16) ? 4 : 2);
+			UInt32 targetFrames = (UInt32) (((UInt64) sFormats[f].rate * sTargetLatencies[t]) / 1000000);
+			UInt32 numBlocks, blockSize, offset;
+			bool ok;
+
+			lowLatencyLayout(targetFrames, frameBytes, &numBlocks, &blockSize);
+			offset = lowLatencyOffset(targetFrames);
+			// the ring holds the HAL's I/O cycles unless HDA_BUFSZ_MAX stops it, and the offset fits the target
+			ok = ((numBlocks * blockSize >= HDA_LATENCY_RING_FRAMES * frameBytes) ||
+					(numBlocks * blockSize * 2 > HDA_BUFSZ_MAX)) && (offset <= targetFrames);
+			run("latency", sFormats[f].rate, sFormats[f].channels, sFormats[f].bits, sTargetLatencies[t],
+					numBlocks, numBlocks, blockSize, offset, ok);
+		}
+	for (unsigned int i = 0; i < NUM_ELEMENTS(sInvalid); i++)
+		runInvalid(sInvalid[i].numBlocks, sInvalid[i].iocInterval);
+
+	fprintf(stderr, "bdlbench: %d failures\n", sFailures);
+	return sFailures ? 1 : 0;
+}
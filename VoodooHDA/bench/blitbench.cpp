@@ -0,0 +1,1421 @@
+/*
+	blitbench - host benchmark and reference check for the PCM blitters and the clip/convert paths.
+
+	Builds against the shim in bench/shim instead of Kernel.framework, so it runs on any x86 host
+	(Linux included) with "./helper.sh bench". Every kernel, and clipOutputSamples/convertInputSamples
+	on a stub engine, is checked against the TIntToFloatBlitter/TFloatToIntBlitter templates and timed
+	over a range of buffer sizes, channel counts and misalignments.
+
+	Results go to stdout as CSV, one row per measurement:
+		suite,name,tier,variant,format,channels,samples,misalign,ns_per_sample,max_err_lsb,ok
+	max_err_lsb is the largest difference from the reference in LSBs of the integer format; int->float
+	must be exact and float->int within 1 LSB (the kernels round where the templates truncate), or within
+	the float's own 24-bit precision for 32-bit ints; with the noise mask on, 1 LSB of the unmasked
+	value. The kernels of the tiers above SSE2 must also give exactly the bytes of the kernel the SSE2
+	tier dispatches for the format, at every size, odd ones included. The clip/convert rows also fail if the source buffer was modified, and convert rows if
+	Vectorize on and off disagree. The convert rows with "map" or "switchch" in the variant set up
+	InputChannelMap or SwitchCh on a stub device, and must give exactly the floats of the scalar path
+	without a map, with the channels moved around as the settings say. The crossover rows compare iSubCrossover with the scalar iSub filters
+	of AppleAudioClip.cpp, block after block, and fail on any difference in the output or the carried
+	state (max_err_lsb in 24-bit LSBs); the coefficient rows compare the bilinear design with the tables
+	(max_err_lsb is the largest coefficient difference in float LSBs at 1.0) and check the cache.
+	The resample rows time PCMResampler and the linear interpolator of clipAppleAudioToOutputStreamiSub
+	per input frame; max_err_lsb is the RMS error in 24-bit LSBs against the ideal output for a tone in
+	the passband ("passband"), or what is left of a tone that should have been filtered out ("alias").
+	The resampler must come out ahead of the interpolator on the worse of the two (quality 0, which is
+	linear interpolation itself, only as good), and give the same output however the input is split.
+	The src rows run clipOutputSamples at a rate the codec doesn't have (time per engine sample), in odd
+	pieces around the buffer twice, against one resampler over the same input written around the codec's
+	buffer, and check that eraseOutputSamples clears the matching codec frames.
+	The isub rows run clipOutputSamples with an iSub attached to the channel, in odd pieces: the DMA buffer
+	must hold exactly the high band of the scalar 4th order filters blitted as usual, and the iSub's ring
+	exactly their low band mixed down to mono and through the interpolator, or the resampler at the
+	quality the channel's is set up for, wrapped around it as often as loopCount says (time per sample of
+	the mix).
+	The exit status is 1 if anything failed.
+
+	usage: blitbench [-q]	(-q: fewer sizes and alignments, for a quick check)
+*/
+
+#include "PCMBlitterLibDispatch.h"
+#include "VoodooHDAEngine.h"
+#include "VoodooHDADevice.h"
+#include "iSubCrossover.h"
+#include "PCMResampler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <kern/clock.h>
+
+#pragma mark -
+#pragma mark Engine stubs
+
+// the parts of VoodooHDAEngine that live in VoodooHDAEngine.cpp; the conversion paths don't use them
+bool VoodooHDAEngine::init(Channel *) { return true; }
+void VoodooHDAEngine::free() { }
+bool VoodooHDAEngine::initHardware(IOService *) { return true; }
+void VoodooHDAEngine::stop(IOService *) { }
+IOReturn VoodooHDAEngine::performAudioEngineStart() { return kIOReturnSuccess; }
+IOReturn VoodooHDAEngine::performAudioEngineStop() { return kIOReturnSuccess; }
+UInt32 VoodooHDAEngine::getCurrentSampleFrame() { return 0; }
+IOReturn VoodooHDAEngine::performFormatChange(IOAudioStream *, const IOAudioStreamFormat *,
+		const IOAudioSampleRate *) { return kIOReturnSuccess; }
+OSString *VoodooHDAEngine::getLocalUniqueID() { return NULL; }
+
+// and of VoodooHDADevice, of which convertInputSamples only reads the input channel map
+bool VoodooHDADevice::init(OSDictionary *) { return true; }
+IOService *VoodooHDADevice::probe(IOService *, SInt32 *) { return NULL; }
+bool VoodooHDADevice::initHardware(IOService *) { return true; }
+bool VoodooHDADevice::createAudioEngine(Channel *) { return true; }
+void VoodooHDADevice::deactivateAllAudioEngines() { }
+void VoodooHDADevice::stop(IOService *) { }
+void VoodooHDADevice::free() { }
+IOReturn VoodooHDADevice::performPowerStateChange(IOAudioDevicePowerState, IOAudioDevicePowerState,
+		UInt32 *) { return kIOReturnSuccess; }
+
+#pragma mark -
+#pragma mark Formats
+
+typedef struct {
+	const char *name;
+	int bytes;		// per sample
+	int bits;
+	bool swap;		// big endian
+} Format;
+
+enum { kS16LE, kS16BE, kS24LE, kS24BE, kS32LE, kS32BE, kNumFormats };
+
+static const Format sFormats[kNumFormats] = {
+	{ "s16le", 2, 16, false },
+	{ "s16be", 2, 16, true },
+	{ "s24le", 3, 24, false },
+	{ "s24be", 3, 24, true },
+	{ "s32le", 4, 32, false },
+	{ "s32be", 4, 32, true }
+};
+
+// sample i of a packed buffer, sign-extended
+static SInt32 readSample(const UInt8 *p, const Format &f, unsigned int i)
+{
+	UInt32 v = 0;
+
+	p += i * f.bytes;
+	for (int b = 0; b < f.bytes; b++)
+		v |= (UInt32) p[f.swap ? (f.bytes - 1 - b) : b] << (8 * b);
+	return (SInt32) (v << (32 - f.bits)) >> (32 - f.bits);
+}
+
+
+#pragma mark -
+#pragma mark References
+
+// the templates from PCMBlitterLib.h, on native 16/32-bit integers; 24-bit goes through 32-bit
+static void referenceIntToFloat(const UInt8 *src, Float32 *dest, const Format &f, unsigned int count)
+{
+	if (f.bits == 16) {
+		SInt16 *tmp = new SInt16[count];
+		for (unsigned int i = 0; i < count; i++)
+			tmp[i] = (SInt16) readSample(src, f, i);
+		TIntToFloatBlitter<PCMSInt16Native, PCMFloat32> blitter(16);
+		blitter.Convert(tmp, dest, count);
+		delete [] tmp;
+	} else {
+		SInt32 *tmp = new SInt32[count];
+		for (unsigned int i = 0; i < count; i++)
+			tmp[i] = (SInt32) ((UInt32) readSample(src, f, i) << (32 - f.bits));
+		TIntToFloatBlitter<PCMSInt32Native, PCMFloat32> blitter(32);
+		blitter.Convert(tmp, dest, count);
+		delete [] tmp;
+	}
+}
+
+// reference integer values, sign-extended
+static void referenceFloatToInt(const Float32 *src, SInt32 *dest, const Format &f, unsigned int count)
+{
+	if (f.bits == 16) {
+		SInt16 *tmp = new SInt16[count];
+		TFloatToIntBlitter<PCMFloat32, PCMSInt16Native> blitter(16);
+		blitter.Convert(src, tmp, count);
+		for (unsigned int i = 0; i < count; i++)
+			dest[i] = tmp[i];
+		delete [] tmp;
+	} else {
+		TFloatToIntBlitter<PCMFloat32, PCMSInt32Native> blitter(f.bits);
+		blitter.Convert(src, dest, count);
+	}
+}
+
+static double floatErrLSB(const Float32 *a, const Float32 *b, const Format &f, unsigned int count)
+{
+	double maxErr = 0, scale = (double) (1U << (f.bits - 1));
+
+	for (unsigned int i = 0; i < count; i++) {
+		double e = ((double) a[i] - (double) b[i]) * scale;
+		if (e < 0)
+			e = -e;
+		if (e > maxErr)
+			maxErr = e;
+	}
+	return maxErr;
+}
+
+// what the float->int paths may be off by
+static double intTolerance(const Format &f, int noiseLevel)
+{
+	double tolerance = (f.bits > 24) ? (double) (1 << (f.bits - 24)) : 1;
+
+	return noiseLevel ? tolerance * (1 << noiseLevel) : tolerance;
+}
+
+// Boost and the stereo crossfeed the way clipOutputSamples did them before they were fused into the
+// blit, as separate passes over the mix; base is the old StereoBase * 2 - 14
+static void referenceOutputProcessing(Float32 *mix, unsigned int count, unsigned int channels, int base,
+		UInt32 boost)
+{
+	if (base && !(channels & 1)) {
+		if (base < 0)
+			base = -base;
+		for (unsigned int i = 0; i < count; i += 2) {
+			mix[i] += (mix[i + 1] / 10.0) * base;
+			mix[i + 1] += (mix[i] / 10.0) * base;
+		}
+	}
+	if (boost) {
+		for (unsigned int i = 0; i < count; i++)
+			mix[i] *= boost;
+	}
+}
+
+static double intErrLSB(const UInt8 *out, const SInt32 *ref, const Format &f, unsigned int count)
+{
+	double maxErr = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		double e = (double) readSample(out, f, i) - (double) ref[i];
+		if (e < 0)
+			e = -e;
+		if (e > maxErr)
+			maxErr = e;
+	}
+	return maxErr;
+}
+
+#pragma mark -
+#pragma mark Test data and timing
+
+static UInt32 sRandom = 12345;
+
+static UInt32 nextRandom()
+{
+	sRandom = sRandom * 1664525 + 1013904223;
+	return sRandom;
+}
+
+// mostly in range, some full scale and some over it, so that clipping is exercised
+static void fillFloats(Float32 *p, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++) {
+		UInt32 r = nextRandom();
+		if ((r & 63) == 0)
+			p[i] = (r & 64) ? 1.0f : -1.0f;
+		else
+			p[i] = ((Float32) (r >> 8) / (Float32) (1 << 24)) * 2.25f - 1.125f;
+	}
+}
+
+static void fillBytes(UInt8 *p, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++)
+		p[i] = (UInt8) (nextRandom() >> 24);
+}
+
+static bool sQuick = false;
+
+// best of several batches, each long enough to swamp the clock
+template <class F>
+static double nsPerSample(F run, unsigned int samples)
+{
+	UInt64 start, elapsed, best = ~0ULL;
+	unsigned int reps = 1;
+
+	for (;;) {
+		start = mach_absolute_time();
+		for (unsigned int r = 0; r < reps; r++)
+			run();
+		elapsed = mach_absolute_time() - start;
+		if ((elapsed > (sQuick ? 50000ULL : 200000ULL)) || (reps >= (1U << 20)))
+			break;
+		reps *= 2;
+	}
+	for (int batch = 0; batch < (sQuick ? 3 : 7); batch++) {
+		start = mach_absolute_time();
+		for (unsigned int r = 0; r < reps; r++)
+			run();
+		elapsed = mach_absolute_time() - start;
+		if (elapsed < best)
+			best = elapsed;
+	}
+	return (double) best / reps / (samples ? samples : 1);
+}
+
+static int sFailures = 0;
+
+static void report(const char *suite, const char *name, const char *tier, const char *variant,
+		const char *format, unsigned int channels, unsigned int samples, unsigned int misalign,
+		double ns, double maxErr, bool ok)
+{
+	if (!ok)
+		sFailures++;
+	printf("%s,%s,%s,%s,%s,%u,%u,%u,%.4f,%g,%d\n", suite, name, tier, variant, format, channels, samples,
+			misalign, ns, maxErr, ok ? 1 : 0);
+}
+
+#pragma mark -
+#pragma mark Kernels
+
+typedef void (*IntToFloatFn)(const void *src, Float32 *dest, unsigned int count);
+typedef void (*FloatToIntFn)(const Float32 *src, void *dest, unsigned int count);
+
+typedef struct {
+	const char *name;
+	int tier;
+	int format;
+	IntToFloatFn fn;
+} IntToFloatKernel;
+
+typedef struct {
+	const char *name;
+	int tier;
+	int format;
+	FloatToIntFn fn;
+} FloatToIntKernel;
+
+#define IN_KERNEL(fn, tier, format)		{ #fn, tier, format, (IntToFloatFn) fn }
+#define OUT_KERNEL(fn, tier, format)	{ #fn, tier, format, (FloatToIntFn) fn }
+
+static const IntToFloatKernel sIntToFloatKernels[] = {
+	IN_KERNEL(NativeInt16ToFloat32_Portable, kPCMBlitterTierPortable, kS16LE),
+	IN_KERNEL(SwapInt16ToFloat32_Portable, kPCMBlitterTierPortable, kS16BE),
+	IN_KERNEL(NativeInt24ToFloat32_Portable, kPCMBlitterTierPortable, kS24LE),
+	IN_KERNEL(SwapInt24ToFloat32_Portable, kPCMBlitterTierPortable, kS24BE),
+	IN_KERNEL(NativeInt32ToFloat32_Portable, kPCMBlitterTierPortable, kS32LE),
+	IN_KERNEL(SwapInt32ToFloat32_Portable, kPCMBlitterTierPortable, kS32BE),
+	IN_KERNEL(NativeInt16ToFloat32_X86, kPCMBlitterTierSSE2, kS16LE),
+	IN_KERNEL(SwapInt16ToFloat32_X86, kPCMBlitterTierSSE2, kS16BE),
+	IN_KERNEL(NativeInt32ToFloat32_X86, kPCMBlitterTierSSE2, kS32LE),
+	IN_KERNEL(SwapInt32ToFloat32_X86, kPCMBlitterTierSSE2, kS32BE),
+#if PCMBLITTER_SSSE3
+	IN_KERNEL(NativeInt24ToFloat32_SSSE3, kPCMBlitterTierSSSE3, kS24LE),
+	IN_KERNEL(SwapInt24ToFloat32_SSSE3, kPCMBlitterTierSSSE3, kS24BE),
+#endif
+#if PCMBLITTER_AVX2
+	IN_KERNEL(NativeInt16ToFloat32_AVX2, kPCMBlitterTierAVX2, kS16LE),
+	IN_KERNEL(SwapInt16ToFloat32_AVX2, kPCMBlitterTierAVX2, kS16BE),
+	IN_KERNEL(NativeInt24ToFloat32_AVX2, kPCMBlitterTierAVX2, kS24LE),
+	IN_KERNEL(SwapInt24ToFloat32_AVX2, kPCMBlitterTierAVX2, kS24BE),
+	IN_KERNEL(NativeInt32ToFloat32_AVX2, kPCMBlitterTierAVX2, kS32LE),
+	IN_KERNEL(SwapInt32ToFloat32_AVX2, kPCMBlitterTierAVX2, kS32BE),
+#endif
+};
+
+static const FloatToIntKernel sFloatToIntKernels[] = {
+	OUT_KERNEL(Float32ToNativeInt16_Portable, kPCMBlitterTierPortable, kS16LE),
+	OUT_KERNEL(Float32ToSwapInt16_Portable, kPCMBlitterTierPortable, kS16BE),
+	OUT_KERNEL(Float32ToNativeInt24_Portable, kPCMBlitterTierPortable, kS24LE),
+	OUT_KERNEL(Float32ToSwapInt24_Portable, kPCMBlitterTierPortable, kS24BE),
+	OUT_KERNEL(Float32ToNativeInt32_Portable, kPCMBlitterTierPortable, kS32LE),
+	OUT_KERNEL(Float32ToSwapInt32_Portable, kPCMBlitterTierPortable, kS32BE),
+	OUT_KERNEL(Float32ToNativeInt16_X86, kPCMBlitterTierSSE2, kS16LE),
+	OUT_KERNEL(Float32ToSwapInt16_X86, kPCMBlitterTierSSE2, kS16BE),
+	OUT_KERNEL(Float32ToNativeInt24_X86, kPCMBlitterTierSSE2, kS24LE),
+	OUT_KERNEL(Float32ToSwapInt24_X86, kPCMBlitterTierSSE2, kS24BE),
+	OUT_KERNEL(Float32ToNativeInt32_X86, kPCMBlitterTierSSE2, kS32LE),
+	OUT_KERNEL(Float32ToSwapInt32_X86, kPCMBlitterTierSSE2, kS32BE),
+#if PCMBLITTER_AVX2
+	OUT_KERNEL(Float32ToNativeInt16_AVX2, kPCMBlitterTierAVX2, kS16LE),
+	OUT_KERNEL(Float32ToSwapInt16_AVX2, kPCMBlitterTierAVX2, kS16BE),
+	OUT_KERNEL(Float32ToNativeInt24_AVX2, kPCMBlitterTierAVX2, kS24LE),
+	OUT_KERNEL(Float32ToSwapInt24_AVX2, kPCMBlitterTierAVX2, kS24BE),
+	OUT_KERNEL(Float32ToNativeInt32_AVX2, kPCMBlitterTierAVX2, kS32LE),
+	OUT_KERNEL(Float32ToSwapInt32_AVX2, kPCMBlitterTierAVX2, kS32BE),
+#endif
+};
+
+#define NUM_ELEMENTS(a)	(sizeof(a) / sizeof((a)[0]))
+
+// the odd counts leave tails for the masked AVX2 stores and the short buffer paths
+static const unsigned int sSizes[] = { 1, 3, 7, 13, 64, 512, 1023, 4096, 32768 };
+static const unsigned int sMisaligns[] = { 0, 1, 3 };	// in samples
+#define kMaxSamples		32768
+#define kGuard			64							// bytes; checked for overruns
+
+static bool guardIntact(const UInt8 *p)
+{
+	for (int i = 0; i < kGuard; i++) {
+		if (p[i] != 0xA5)
+			return false;
+	}
+	return true;
+}
+
+// what the SSE2 tier dispatches for the format: its own kernel, or the portable one if it has none
+template <class Kernel, unsigned int N>
+static const Kernel *sse2Kernel(const Kernel (&kernels)[N], int format)
+{
+	const Kernel *found = NULL;
+
+	for (unsigned int k = 0; k < N; k++) {
+		if ((kernels[k].format == format) && (kernels[k].tier <= kPCMBlitterTierSSE2) &&
+				(!found || (kernels[k].tier > found->tier)))
+			found = &kernels[k];
+	}
+	return found;
+}
+
+static void runKernels(int cpuTier)
+{
+	UInt8 *ints = new UInt8[kMaxSamples * 4 + 16 + kGuard];
+	UInt8 *tierInts = new UInt8[kMaxSamples * 4 + 16];
+	Float32 *floats = new Float32[kMaxSamples + 4];
+	Float32 *outFloats = new Float32[kMaxSamples + 4 + kGuard / 4];
+	Float32 *tierFloats = new Float32[kMaxSamples];
+	Float32 *refFloats = new Float32[kMaxSamples];
+	SInt32 *refInts = new SInt32[kMaxSamples];
+
+	for (unsigned int s = 0; s < NUM_ELEMENTS(sSizes); s++) {
+		unsigned int count = sSizes[s];
+		if (sQuick && (count != 512) && (count != 13))
+			continue;
+		for (unsigned int m = 0; m < NUM_ELEMENTS(sMisaligns); m++) {
+			unsigned int misalign = sMisaligns[m];
+			if (sQuick && (misalign == 3))
+				continue;
+
+			for (unsigned int k = 0; k < NUM_ELEMENTS(sIntToFloatKernels); k++) {
+				const IntToFloatKernel &kernel = sIntToFloatKernels[k];
+				const Format &f = sFormats[kernel.format];
+				const UInt8 *src = ints + misalign * f.bytes;
+				Float32 *dest = outFloats + misalign;
+				if (kernel.tier > cpuTier)
+					continue;
+				fillBytes(ints, count * f.bytes + 16);
+				memset((UInt8 *) (dest + count), 0xA5, kGuard);
+				referenceIntToFloat(src, refFloats, f, count);
+				sse2Kernel(sIntToFloatKernels, kernel.format)->fn(src, tierFloats, count);
+				kernel.fn(src, dest, count);
+				double err = floatErrLSB(dest, refFloats, f, count);
+				bool ok = (err == 0) && guardIntact((UInt8 *) (dest + count)) &&
+						((kernel.tier <= kPCMBlitterTierSSE2) ||
+						!memcmp(dest, tierFloats, count * sizeof(Float32)));
+				double ns = nsPerSample([&]() { kernel.fn(src, dest, count); }, count);
+				report("kernel", kernel.name, PCMBlitterTierName(kernel.tier), "plain", f.name, 1, count,
+						misalign, ns, err, ok);
+			}
+
+			for (unsigned int k = 0; k < NUM_ELEMENTS(sFloatToIntKernels); k++) {
+				const FloatToIntKernel &kernel = sFloatToIntKernels[k];
+				const Format &f = sFormats[kernel.format];
+				const Float32 *src = floats + misalign;
+				UInt8 *dest = ints + misalign * f.bytes;
+				if (kernel.tier > cpuTier)
+					continue;
+				fillFloats(floats, count + 4);
+				memset(dest + count * f.bytes, 0xA5, kGuard);
+				referenceFloatToInt(src, refInts, f, count);
+				sse2Kernel(sFloatToIntKernels, kernel.format)->fn(src, tierInts, count);
+				kernel.fn(src, dest, count);
+				double err = intErrLSB(dest, refInts, f, count);
+				bool ok = (err <= intTolerance(f, 0)) && guardIntact(dest + count * f.bytes) &&
+						((kernel.tier <= kPCMBlitterTierSSE2) || !memcmp(dest, tierInts, count * f.bytes));
+				double ns = nsPerSample([&]() { kernel.fn(src, dest, count); }, count);
+				report("kernel", kernel.name, PCMBlitterTierName(kernel.tier), "plain", f.name, 1, count,
+						misalign, ns, err, ok);
+			}
+		}
+	}
+
+	delete [] ints;
+	delete [] tierInts;
+	delete [] floats;
+	delete [] outFloats;
+	delete [] tierFloats;
+	delete [] refFloats;
+	delete [] refInts;
+}
+
+#pragma mark -
+#pragma mark clipOutputSamples / convertInputSamples
+
+static const unsigned int sFrames[] = { 64, 512, 4096 };
+static const int sStreamFormats[] = { kS16LE, kS24LE, kS32LE, kS16BE, kS32BE };
+
+static void setFormat(IOAudioStreamFormat &fmt, const Format &f, unsigned int channels)
+{
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.fNumChannels = channels;
+	fmt.fSampleFormat = kIOAudioStreamSampleFormatLinearPCM;
+	fmt.fNumericRepresentation = kIOAudioStreamNumericRepresentationSignedInt;
+	fmt.fBitDepth = f.bits;
+	fmt.fBitWidth = f.bits;
+	fmt.fByteOrder = f.swap ? kIOAudioStreamByteOrderBigEndian : kIOAudioStreamByteOrderLittleEndian;
+	fmt.fIsMixable = true;
+}
+
+static void runClip(VoodooHDAEngine &engine, Channel &channel)
+{
+	const unsigned int maxSamples = 4096 * 8 + 3 * 8;
+	Float32 *mix = new Float32[maxSamples];
+	Float32 *mixCopy = new Float32[maxSamples];
+	Float32 *refMix = new Float32[maxSamples];
+	UInt8 *dma = new UInt8[maxSamples * 4 + kGuard];
+	SInt32 *refInts = new SInt32[maxSamples];
+
+	for (unsigned int s = 0; s < NUM_ELEMENTS(sFrames); s++) {
+		unsigned int frames = sFrames[s];
+		if (sQuick && (frames != 512))
+			continue;
+		for (unsigned int c = 1; c <= 8; c++) {
+			for (unsigned int m = 0; m < NUM_ELEMENTS(sMisaligns); m++) {
+				unsigned int first = sMisaligns[m];		// in frames
+				if (sQuick && (first == 3))
+					continue;
+				for (unsigned int fi = 0; fi < NUM_ELEMENTS(sStreamFormats); fi++) {
+					const Format &f = sFormats[sStreamFormats[fi]];
+					unsigned int samples = frames * c, firstSample = first * c;
+					IOAudioStreamFormat fmt;
+					setFormat(fmt, f, c);
+
+					for (int processed = 0; processed < 2; processed++) {
+						engine.Boost = processed ? 2 : 0;
+						channel.useStereo = processed;
+						channel.StereoBase = processed ? 10 : 0;
+						channel.noiseLevel = processed ? 4 : 0;
+
+						for (int vectorize = 1; vectorize >= 0; vectorize--) {
+							channel.vectorize = vectorize;
+							fillFloats(mix, firstSample + samples);
+							for (unsigned int i = 0; i < firstSample + samples; i++)
+								mix[i] *= 0.4f;	// leave headroom for Boost and the crossfeed
+							memcpy(mixCopy, mix, (firstSample + samples) * sizeof(Float32));
+							memset(dma + (firstSample + samples) * f.bytes, 0xA5, kGuard);
+							engine.clipOutputSamples(mix, dma, first, frames, &fmt, NULL);
+
+							bool ok = guardIntact(dma + (firstSample + samples) * f.bytes) &&
+									!memcmp(mix, mixCopy, (firstSample + samples) * sizeof(Float32));
+							// the noise mask only ever applied to native endian 16 and 32-bit output
+							bool masked = processed && !f.swap && (f.bits != 24);
+							SInt32 mask = masked ? ~((1 << channel.noiseLevel) - 1) : ~0;
+
+							memcpy(refMix, mix + firstSample, samples * sizeof(Float32));
+							if (processed)
+								referenceOutputProcessing(refMix, samples, c, channel.StereoBase * 2 - 14,
+										engine.Boost);
+							referenceFloatToInt(refMix, refInts, f, samples);
+							for (unsigned int i = 0; i < samples; i++) {
+								refInts[i] &= mask;
+								ok = ok && !(readSample(dma + firstSample * f.bytes, f, i) & ~mask);
+							}
+							// the old passes worked in double, the fused blit in float rounding toward -inf:
+							// a few float ulps apart
+							double err = intErrLSB(dma + firstSample * f.bytes, refInts, f, samples);
+							ok = ok && (err <= intTolerance(f, masked ? channel.noiseLevel : 0) * (processed ? 4 : 1));
+							double ns = nsPerSample([&]() {
+								engine.clipOutputSamples(mix, dma, first, frames, &fmt, NULL);
+							}, samples);
+							report("clip", "clipOutputSamples", vectorize ? "vector" : "scalar",
+									processed ? "boost+crossfeed+noise" : "plain", f.name, c, samples, first,
+									ns, err, ok);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	engine.Boost = 0;
+	channel.useStereo = false;
+	channel.StereoBase = 0;
+	channel.noiseLevel = 0;
+
+	delete [] mix;
+	delete [] mixCopy;
+	delete [] refMix;
+	delete [] dma;
+	delete [] refInts;
+}
+
+static void runConvert(VoodooHDAEngine &engine, Channel &channel)
+{
+	const unsigned int maxSamples = 4096 * 8 + 3 * 8;
+	UInt8 *dma = new UInt8[maxSamples * 4];
+	UInt8 *dmaCopy = new UInt8[maxSamples * 4];
+	Float32 *out = new Float32[maxSamples + kGuard / 4];
+	Float32 *outOther = new Float32[maxSamples];
+	Float32 *refFloats = new Float32[maxSamples];
+
+	for (unsigned int s = 0; s < NUM_ELEMENTS(sFrames); s++) {
+		unsigned int frames = sFrames[s];
+		if (sQuick && (frames != 512))
+			continue;
+		for (unsigned int c = 1; c <= 8; c++) {
+			for (unsigned int m = 0; m < NUM_ELEMENTS(sMisaligns); m++) {
+				unsigned int first = sMisaligns[m];
+				if (sQuick && (first == 3))
+					continue;
+				for (unsigned int fi = 0; fi < NUM_ELEMENTS(sStreamFormats); fi++) {
+					const Format &f = sFormats[sStreamFormats[fi]];
+					unsigned int samples = frames * c, firstSample = first * c;
+					IOAudioStreamFormat fmt;
+					setFormat(fmt, f, c);
+
+					for (int processed = 0; processed < 2; processed++) {
+						engine.InputBoost = processed ? 3 : 0;
+						channel.noiseLevel = processed ? 4 : 0;
+
+						for (int vectorize = 1; vectorize >= 0; vectorize--) {
+							channel.vectorize = vectorize;
+							fillBytes(dma, (firstSample + samples) * f.bytes);
+							memcpy(dmaCopy, dma, (firstSample + samples) * f.bytes);
+							memset((UInt8 *) (out + samples), 0xA5, kGuard);
+							engine.convertInputSamples(dma, out, first, frames, &fmt, NULL);
+
+							bool ok = guardIntact((UInt8 *) (out + samples)) &&
+									!memcmp(dma, dmaCopy, (firstSample + samples) * f.bytes);
+							double err = 0;
+							if (!processed) {
+								referenceIntToFloat(dma + firstSample * f.bytes, refFloats, f, samples);
+								err = floatErrLSB(out, refFloats, f, samples);
+							}
+							// both paths must give the same floats, processed or not
+							channel.vectorize = !vectorize;
+							engine.convertInputSamples(dma, outOther, first, frames, &fmt, NULL);
+							channel.vectorize = vectorize;
+							ok = ok && (err == 0) && !memcmp(out, outOther, samples * sizeof(Float32));
+							double ns = nsPerSample([&]() {
+								engine.convertInputSamples(dma, out, first, frames, &fmt, NULL);
+							}, samples);
+							report("convert", "convertInputSamples", vectorize ? "vector" : "scalar",
+									processed ? "boost+noise" : "plain", f.name, c, samples, first, ns, err, ok);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	engine.InputBoost = 0;
+	channel.noiseLevel = 0;
+
+	delete [] dma;
+	delete [] dmaCopy;
+	delete [] out;
+	delete [] outOther;
+	delete [] refFloats;
+}
+
+// InputChannelMap and SwitchCh as the device has them from Info.plist; names are the variant column
+typedef struct {
+	const char		*name;
+	unsigned int	channels;
+	bool			switchCh;
+	UInt32			mapSize;
+	UInt8			map[8];
+} ChannelMapCase;
+
+static const ChannelMapCase sChannelMapCases[] = {
+	{ "switchch", 2, true, 0, { 0 } },
+	{ "switchch", 4, true, 0, { 0 } },
+	{ "map 1-0", 2, false, 2, { 1, 0 } },
+	{ "map 2-0-1", 3, false, 3, { 2, 0, 1 } },
+	{ "map 1-0-9", 4, false, 3, { 1, 0, 9 } },			// out of range, and short of the channels
+	{ "map 1-0-3-2-5-4", 6, false, 6, { 1, 0, 3, 2, 5, 4 } },
+	{ "map 2-1-0 switchch", 3, true, 3, { 2, 1, 0 } },	// the map wins over SwitchCh
+	{ "map 7-6-5-4-3-2-1-0", 8, false, 8, { 7, 6, 5, 4, 3, 2, 1, 0 } },
+};
+
+// input channel c comes from channel map[c]: what the settings say, written out
+static void expectedChannelMap(const ChannelMapCase &mc, UInt8 *map)
+{
+	for (unsigned int c = 0; c < mc.channels; c++) {
+		map[c] = c;
+		if (c < mc.mapSize) {
+			if (mc.map[c] < mc.channels)
+				map[c] = mc.map[c];
+		} else if (mc.switchCh && !mc.mapSize && (c < 2))
+			map[c] = 1 - c;
+	}
+}
+
+static void runConvertMap(VoodooHDAEngine &engine, Channel &channel)
+{
+	const unsigned int maxSamples = 4096 * 8 + 3 * 8;
+	UInt8 *dma = new UInt8[maxSamples * 4];
+	Float32 *out = new Float32[maxSamples + kGuard / 4];
+	Float32 *plain = new Float32[maxSamples];
+	Float32 *refFloats = new Float32[maxSamples];
+	VoodooHDADevice *device = new VoodooHDADevice();
+	UInt8 map[8];
+	char variant[64];
+
+	engine.mDevice = device;
+	for (unsigned int mi = 0; mi < NUM_ELEMENTS(sChannelMapCases); mi++) {
+		const ChannelMapCase &mc = sChannelMapCases[mi];
+		unsigned int n = mc.channels;
+		expectedChannelMap(mc, map);
+		for (unsigned int s = 0; s < NUM_ELEMENTS(sFrames); s++) {
+			unsigned int frames = sFrames[s];
+			if (sQuick && (frames != 512))
+				continue;
+			for (unsigned int m = 0; m < NUM_ELEMENTS(sMisaligns); m++) {
+				unsigned int first = sMisaligns[m];
+				if (sQuick && (first == 3))
+					continue;
+				for (unsigned int fi = 0; fi < NUM_ELEMENTS(sStreamFormats); fi++) {
+					const Format &f = sFormats[sStreamFormats[fi]];
+					unsigned int samples = frames * n, firstSample = first * n;
+					IOAudioStreamFormat fmt;
+					setFormat(fmt, f, n);
+
+					for (int processed = 0; processed < 2; processed++) {
+						engine.InputBoost = processed ? 3 : 0;
+						channel.noiseLevel = processed ? 4 : 0;
+						snprintf(variant, sizeof(variant), "%s%s", processed ? "boost+noise " : "", mc.name);
+
+						for (int vectorize = 1; vectorize >= 0; vectorize--) {
+							fillBytes(dma, (firstSample + samples) * f.bytes);
+
+							// the reference: the scalar path without a map, then the channels moved around
+							device->mSwitchCh = false;
+							device->mInputChannelMapSize = 0;
+							channel.vectorize = false;
+							engine.convertInputSamples(dma, plain, first, frames, &fmt, NULL);
+							for (unsigned int i = 0; i < samples; i += n) {
+								for (unsigned int c = 0; c < n; c++)
+									refFloats[i + c] = plain[i + map[c]];
+							}
+
+							device->mSwitchCh = mc.switchCh;
+							device->mInputChannelMapSize = mc.mapSize;
+							memcpy(device->mInputChannelMap, mc.map, sizeof(mc.map));
+							channel.vectorize = vectorize;
+							memset((UInt8 *) (out + samples), 0xA5, kGuard);
+							engine.convertInputSamples(dma, out, first, frames, &fmt, NULL);
+
+							double err = floatErrLSB(out, refFloats, f, samples);
+							bool ok = guardIntact((UInt8 *) (out + samples)) && (err == 0) &&
+									!memcmp(out, refFloats, samples * sizeof(Float32));
+							double ns = nsPerSample([&]() {
+								engine.convertInputSamples(dma, out, first, frames, &fmt, NULL);
+							}, samples);
+							report("convert", "convertInputSamples", vectorize ? "vector" : "scalar", variant,
+									f.name, n, samples, first, ns, err, ok);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	engine.mDevice = NULL;
+	engine.InputBoost = 0;
+	channel.noiseLevel = 0;
+
+	delete device;
+	delete [] dma;
+	delete [] out;
+	delete [] plain;
+	delete [] refFloats;
+}
+
+#pragma mark -
+#pragma mark iSub crossover
+
+extern "C" {
+void MonoFilter (Float32 *in, Float32 *low, Float32 *high, UInt32 frames, UInt32 samplingRate);
+void StereoFilter (Float32 *in, Float32 *low, Float32 *high, UInt32 frames, UInt32 SamplingRate, PreviousValues *theValue);
+void StereoFilter4thOrder (Float32 *in, Float32 *low, Float32 *high, UInt32 frames, UInt32 samplingRate,
+		PreviousValues *section1State, PreviousValues *section2State);
+void StereoFilter4thOrderPhaseComp (Float32 *in, Float32 *low, Float32 *high, UInt32 frames, UInt32 samplingRate,
+		PreviousValues *section1State, PreviousValues *section2State, PreviousValues *phaseCompState);
+}
+
+struct CrossoverCase {
+	const char		*name;
+	UInt32			order;
+	bool			phaseComp;
+	unsigned int	channels;
+};
+
+// 2 channels: against the stereo filter itself; more: against it run on each pair of channels
+static const CrossoverCase sCrossoverCases[] = {
+	{ "MonoFilter", 2, false, 1 },
+	{ "StereoFilter", 2, false, 2 },
+	{ "StereoFilter4thOrder", 4, false, 2 },
+	{ "StereoFilter4thOrderPhaseComp", 4, true, 2 },
+	{ "StereoFilter4thOrderPhaseComp", 4, true, 6 },
+};
+static const UInt32 sCrossoverRates[] = { 44100, 48000, 96000 };
+#define kCrossoverBlocks	3
+
+static void referenceFilter(const CrossoverCase &cc, Float32 *in, Float32 *low, Float32 *high, UInt32 frames,
+		UInt32 rate, PreviousValues *state)
+{
+	if (cc.channels == 1)
+		MonoFilter(in, low, high, frames, rate);
+	else if (cc.order == 2)
+		StereoFilter(in, low, high, frames, rate, &state[0]);
+	else if (!cc.phaseComp)
+		StereoFilter4thOrder(in, low, high, frames, rate, &state[0], &state[1]);
+	else
+		StereoFilter4thOrderPhaseComp(in, low, high, frames, rate, &state[0], &state[1], &state[2]);
+}
+
+static double crossoverErr(const Float32 *a, const Float32 *b, unsigned int count)
+{
+	double maxErr = 0;
+
+	for (unsigned int i = 0; i < count; i++) {
+		double e = ((double) a[i] - (double) b[i]) * (double) (1 << 23);
+		if (e < 0)
+			e = -e;
+		// bit for bit, so any difference at all is an error
+		if ((a[i] != b[i]) && (e == 0))
+			e = 1;
+		if (e > maxErr)
+			maxErr = e;
+	}
+	return maxErr;
+}
+
+static double biquadErr(const iSubBiquad &a, const iSubBiquad &b)
+{
+	const Float32 *pa = &a.b0, *pb = &b.b0;
+	double maxErr = 0;
+
+	for (int i = 0; i < 5; i++) {
+		double e = ((double) pa[i] - (double) pb[i]) * (double) (1 << 23);
+		if (e < 0)
+			e = -e;
+		if (e > maxErr)
+			maxErr = e;
+	}
+	return maxErr;
+}
+
+static void runCrossoverCoeffs()
+{
+	static const UInt32 tableRates[] = { 8000, 11025, 22050, 44100, 48000, 96000 };
+	iSubCrossoverCache cache;
+	const iSubCrossoverCoeffs *entry;
+	bool ok;
+
+	// the tables were made the same way; they only differ by the rounding of their decimal digits
+	for (unsigned int r = 0; r < NUM_ELEMENTS(tableRates); r++) {
+		for (UInt32 order = 2; order <= 4; order += 2) {
+			iSubCrossoverCoeffs table, bilinear;
+			UInt32 frequency = (order == 2) ? kiSubCrossoverFrequency2ndOrder : kiSubCrossoverFrequency4thOrder;
+			ok = iSubCrossoverCoeffsForRate(&table, tableRates[r], order, order == 4) &&
+					iSubCrossoverCoeffsBilinear(&bilinear, tableRates[r], frequency, order, order == 4);
+			double err = biquadErr(table.lowpass, bilinear.lowpass);
+			if (order == 4) {
+				double e = biquadErr(table.allpass, bilinear.allpass);
+				if (e > err)
+					err = e;
+			}
+			ok = ok && (err <= 1);
+			report("crossover", "iSubCrossoverCoeffsBilinear", "-", (order == 2) ? "2nd order" : "4th order", "f32",
+					0, tableRates[r], 0, 0, err, ok);
+		}
+	}
+
+	// same pointer for the same key, NULL once full, all slots back after invalidate()
+	cache.invalidate();
+	entry = cache.lookup(48000, 80, 4, true);
+	ok = entry && (cache.lookup(48000, 80, 4, true) == entry) && (entry->frequency == 80);
+	ok = ok && cache.lookup(48000, kiSubCrossoverFrequency4thOrder, 4, true) &&
+			cache.lookup(44100, 80, 4, true) && cache.lookup(44100, 80, 2, false) &&
+			!cache.lookup(96000, 80, 4, true) && !cache.lookup(48000, 30000, 4, true);
+	cache.invalidate();
+	ok = ok && cache.lookup(96000, 80, 4, true);
+	report("crossover", "iSubCrossoverCache", "-", "lookup", "f32", 0, 0, 0, 0, 0, ok);
+}
+
+static void runCrossover()
+{
+	const unsigned int maxSamples = 4096 * kiSubMaxChannels;
+	Float32 *in = new Float32[maxSamples], *low = new Float32[maxSamples], *high = new Float32[maxSamples];
+	Float32 *pairIn = new Float32[4096 * 2], *refLow = new Float32[4096 * 2], *refHigh = new Float32[4096 * 2];
+
+	for (unsigned int k = 0; k < NUM_ELEMENTS(sCrossoverCases); k++) {
+		const CrossoverCase &cc = sCrossoverCases[k];
+		for (unsigned int r = 0; r < NUM_ELEMENTS(sCrossoverRates); r++) {
+			UInt32 rate = sCrossoverRates[r];
+			if (sQuick && (rate != 48000))
+				continue;
+			for (unsigned int s = 0; s < NUM_ELEMENTS(sFrames); s++) {
+				unsigned int frames = sFrames[s], samples = frames * cc.channels;
+				unsigned int pairs = (cc.channels + 1) / 2;
+				PreviousValues refState[kiSubMaxChannels / 2][kiSubNumStages];
+				iSubCrossoverCoeffs coeffs;
+				iSubCrossover crossover;
+				double err = 0;
+				bool ok;
+				if (sQuick && (frames != 512))
+					continue;
+
+				memset(refState, 0, sizeof(refState));
+				ok = iSubCrossoverCoeffsForRate(&coeffs, rate, cc.order, cc.phaseComp) &&
+						crossover.init(&coeffs, cc.channels);
+				for (int block = 0; ok && (block < kCrossoverBlocks); block++) {
+					fillFloats(in, samples);
+					if (cc.channels == 1)
+						crossover.reset();	// MonoFilter starts from scratch every time
+					crossover.process(in, low, high, frames);
+					for (unsigned int p = 0; p < pairs; p++) {
+						unsigned int width = (cc.channels == 1) ? 1 : 2;
+						for (unsigned int i = 0; i < frames; i++)
+							for (unsigned int c = 0; c < width; c++)
+								pairIn[i * width + c] = in[i * cc.channels + p * 2 + c];
+						referenceFilter(cc, pairIn, refLow, refHigh, frames, rate, refState[p]);
+						for (unsigned int i = 0; i < frames; i++) {
+							for (unsigned int c = 0; c < width; c++) {
+								double e = crossoverErr(&low[i * cc.channels + p * 2 + c], &refLow[i * width + c], 1);
+								double eh = crossoverErr(&high[i * cc.channels + p * 2 + c], &refHigh[i * width + c], 1);
+								if (eh > e)
+									e = eh;
+								if (e > err)
+									err = e;
+							}
+						}
+					}
+					if ((cc.channels == 2) && (err == 0)) {
+						for (UInt32 stage = 0; stage < kiSubNumStages; stage++) {
+							PreviousValues state;
+							if ((stage == kiSubSection2) && (cc.order == 2))
+								continue;
+							if ((stage == kiSubPhaseComp) && !cc.phaseComp)
+								continue;
+							crossover.saveState(stage, &state);
+							if (memcmp(&state, &refState[0][stage], sizeof(state)))
+								err = 1;
+						}
+					}
+				}
+				ok = ok && (err == 0);
+
+				memcpy(pairIn, in, frames * ((cc.channels == 1) ? 1 : 2) * sizeof(Float32));
+				double ns = nsPerSample([&]() {
+					for (unsigned int p = 0; p < pairs; p++)
+						referenceFilter(cc, pairIn, refLow, refHigh, frames, rate, refState[p]);
+				}, samples);
+				report("crossover", cc.name, "scalar", "reference", "f32", cc.channels, samples, 0, ns, 0, true);
+				ns = nsPerSample([&]() { crossover.process(in, low, high, frames); }, samples);
+				report("crossover", cc.name, "vector", "iSubCrossover", "f32", cc.channels, samples, 0, ns, err, ok);
+			}
+		}
+	}
+
+	delete [] in;
+	delete [] low;
+	delete [] high;
+	delete [] pairIn;
+	delete [] refLow;
+	delete [] refHigh;
+}
+
+#pragma mark -
+#pragma mark Resampler
+
+// the interpolator of clipAppleAudioToOutputStreamiSub, on a mono buffer: output n sits at input n * inc - 1
+static UInt32 linearResample(const Float32 *in, UInt32 frames, Float32 *out, float phaseInc, float *srcPhase,
+		float *srcState)
+{
+	UInt32 i = 0, n = 0;
+	float phase = *srcPhase, x0, x1;
+
+	while (i < frames) {
+		if (phase >= 1.0) {
+			phase -= 1.0;
+			i++;
+		} else {
+			x0 = i ? in[i - 1] : *srcState;
+			x1 = in[i];
+			out[n++] = x0 + phase * (x1 - x0);
+			phase += phaseInc;
+		}
+	}
+	*srcState = (phase < 1) ? in[frames - 1] : 0;
+	*srcPhase = phase;
+	return n;
+}
+
+struct RateCase {
+	UInt32	inRate, outRate;
+};
+
+static const RateCase sRateCases[] = {
+	{ 48000, 6000 },	// the iSub
+	{ 44100, 6000 },
+	{ 44100, 48000 },
+	{ 48000, 44100 },
+};
+static const UInt32 sQualities[] = {
+	kPCMResamplerQualityLinear, kPCMResamplerQualityLow, kPCMResamplerQualityMedium, kPCMResamplerQualityHigh, kPCMResamplerQualityBest
+};
+#define kResampleFrames		48000
+#define kResampleAmplitude	0.5
+
+static void fillTone(Float32 *p, UInt32 frames, double frequency, UInt32 rate)
+{
+	for (UInt32 i = 0; i < frames; i++)
+		p[i] = kResampleAmplitude * sin(2.0 * M_PI * frequency * i / rate);
+}
+
+// RMS difference from the tone, output n being at input frame n * inRate / outRate - delay; the start is
+// left out while the filter fills
+static double toneErrLSB(const Float32 *out, UInt32 outFrames, const RateCase &rc, double frequency, double delay)
+{
+	double sum = 0;
+	UInt32 first = rc.outRate / 100, count = 0;
+
+	for (UInt32 n = first; n < outFrames; n++) {
+		double t = (double) n * rc.inRate / rc.outRate - delay;
+		double e = out[n] - kResampleAmplitude * sin(2.0 * M_PI * frequency * t / rc.inRate);
+		sum += e * e;
+		count++;
+	}
+	return count ? sqrt(sum / count) * (double) (1 << 23) : 0;
+}
+
+static double rmsLSB(const Float32 *out, UInt32 outFrames, UInt32 first)
+{
+	double sum = 0;
+
+	for (UInt32 n = first; n < outFrames; n++)
+		sum += (double) out[n] * out[n];
+	return (outFrames > first) ? sqrt(sum / (outFrames - first)) * (double) (1 << 23) : 0;
+}
+
+static void runResample()
+{
+	Float32 *tone = new Float32[kResampleFrames * 2], *alias = new Float32[kResampleFrames];
+	Float32 *out = new Float32[kResampleFrames * 4 + 8], *outSplit = new Float32[kResampleFrames * 4 + 8];
+	UInt32 frames = sQuick ? 4800 : kResampleFrames;
+
+	for (unsigned int r = 0; r < NUM_ELEMENTS(sRateCases); r++) {
+		const RateCase &rc = sRateCases[r];
+		UInt32 lowRate = (rc.inRate < rc.outRate) ? rc.inRate : rc.outRate;
+		double passband = 0.3 * lowRate / 2, stopband = 0;
+		double linearPass, linearAlias = 0, ns;
+		char format[32];
+		float phase, state, phaseInc = (float) rc.inRate / (float) rc.outRate;
+		UInt32 n;
+
+		snprintf(format, sizeof(format), "%u>%u", (unsigned int) rc.inRate, (unsigned int) rc.outRate);
+		// between the two Nyquists, where only a decimator has anything to take out
+		if (rc.outRate < rc.inRate)
+			stopband = (rc.outRate / 2.0) * 1.25 < rc.inRate / 2.0 * 0.9 ? (rc.outRate / 2.0) * 1.25 : 0;
+		fillTone(tone, frames, passband, rc.inRate);
+		if (stopband)
+			fillTone(alias, frames, stopband, rc.inRate);
+
+		phase = state = 0;
+		n = linearResample(tone, frames, out, phaseInc, &phase, &state);
+		linearPass = toneErrLSB(out, n, rc, passband, 1.0);
+		ns = nsPerSample([&]() {
+			phase = state = 0;
+			linearResample(tone, frames, out, phaseInc, &phase, &state);
+		}, frames);
+		report("resample", "linear", "scalar", "passband", format, 1, frames, 0, ns, linearPass, true);
+		if (stopband) {
+			phase = state = 0;
+			n = linearResample(alias, frames, out, phaseInc, &phase, &state);
+			linearAlias = rmsLSB(out, n, rc.outRate / 100);
+			report("resample", "linear", "scalar", "alias", format, 1, frames, 0, 0, linearAlias, true);
+		}
+
+		for (unsigned int q = 0; q < NUM_ELEMENTS(sQualities); q++) {
+			PCMResampler resampler = PCMResampler(), split = PCMResampler();
+			char variant[32];
+			bool ok = resampler.init(rc.inRate, rc.outRate, 1, sQualities[q]) &&
+					split.init(rc.inRate, rc.outRate, 1, sQualities[q]);
+			double err = 0, aliasErr = 0;
+			UInt32 nSplit = 0, pos = 0, piece = 1;
+
+			if (sQuick && (sQualities[q] != kPCMResamplerQualityLinear) &&
+					(sQualities[q] != kPCMResamplerQualityMedium))
+				continue;
+			snprintf(variant, sizeof(variant), "passband q%u", (unsigned int) sQualities[q]);
+			if (ok) {
+				n = resampler.process(tone, frames, out);
+				// odd piece sizes, straddling the internal chunks, must not change a thing
+				while (pos < frames) {
+					UInt32 count = (piece % 700) + 1;
+					if (count > frames - pos)
+						count = frames - pos;
+					nSplit += split.process(tone + pos, count, outSplit + nSplit);
+					pos += count;
+					piece = piece * 7 + 3;
+				}
+				ok = (n == nSplit) && !memcmp(out, outSplit, n * sizeof(Float32)) &&
+						(n <= resampler.maxOutputFrames(frames));
+				err = toneErrLSB(out, n, rc, passband, resampler.latency());
+			}
+			ns = nsPerSample([&]() {
+				resampler.reset();
+				resampler.process(tone, frames, out);
+			}, frames);
+			if (stopband && ok) {
+				resampler.reset();
+				n = resampler.process(alias, frames, out);
+				aliasErr = rmsLSB(out, n, rc.outRate / 100);
+			}
+			// the interpolator is exact for whole ratios but lets everything alias: the worse of the two counts;
+			// quality 0 is the same interpolation, so it only has to be as good
+			if (sQualities[q] == kPCMResamplerQualityLinear)
+				ok = ok && (err <= linearPass * 1.01 + 1) && (aliasErr <= linearAlias * 1.01 + 1);
+			else
+				ok = ok && (((err > aliasErr) ? err : aliasErr) <
+						((linearPass > linearAlias) ? linearPass : linearAlias));
+			report("resample", "PCMResampler", "vector", variant, format, 1, frames, 0, ns, err, ok);
+			if (stopband) {
+				snprintf(variant, sizeof(variant), "alias q%u", (unsigned int) sQualities[q]);
+				report("resample", "PCMResampler", "vector", variant, format, 1, frames, 0, 0, aliasErr, ok);
+			}
+
+			// stereo, for the cost per channel
+			ok = resampler.init(rc.inRate, rc.outRate, 2, sQualities[q]);
+			for (UInt32 i = 0; i < frames; i++)
+				tone[frames + i] = tone[i];
+			snprintf(variant, sizeof(variant), "q%u", (unsigned int) sQualities[q]);
+			ns = ok ? nsPerSample([&]() {
+				resampler.reset();
+				resampler.process(tone, frames, out);
+			}, frames * 2) : 0;
+			report("resample", "PCMResampler", "vector", variant, format, 2, frames * 2, 0, ns, 0, ok);
+			resampler.free();
+			split.free();
+		}
+	}
+
+	delete [] tone;
+	delete [] alias;
+	delete [] out;
+	delete [] outSplit;
+}
+
+#pragma mark -
+#pragma mark Software rate conversion
+
+typedef struct {
+	UInt32 engineRate, hwRate;
+	UInt32 engineUnit, hwUnit;		// the ratio in lowest terms
+} SRCCase;
+
+static const SRCCase sSRCCases[] = {
+	{ 44100, 48000, 147, 160 },
+	{ 88200, 96000, 147, 160 },
+	{ 176400, 48000, 147, 40 }
+};
+
+static const int sSRCFormats[] = { kS16LE, kS32LE };
+
+// what setupSRC does for the channel, with a buffer of 20 units
+static void setupChannelSRC(Channel &channel, const SRCCase &sc, UInt32 channels)
+{
+	channel.src.resampler.init(sc.engineRate, sc.hwRate, channels, kPCMResamplerQualityMedium);
+	channel.src.engineFrames = 20 * sc.engineUnit;
+	channel.src.hwFrames = 20 * sc.hwUnit;
+	channel.src.nextFrame = channel.src.engineFrames;
+	channel.src.writeFrame = 0;
+	channel.src.engineRate = sc.engineRate;
+}
+
+// clipOutputSamples at a rate the codec doesn't have: two laps of the engine buffer, clipped in odd pieces,
+// must leave in the DMA buffer what one resampler fed the same two laps in one go writes around the codec's
+// buffer from frame 0; eraseOutputSamples must clear the codec frames that go with the engine's
+static void runSRC(VoodooHDAEngine &engine, Channel &channel)
+{
+	for (unsigned int r = 0; r < NUM_ELEMENTS(sSRCCases); r++) {
+		const SRCCase &sc = sSRCCases[r];
+		for (UInt32 c = 2; c <= 8; c += 6) {
+			for (unsigned int fi = 0; fi < NUM_ELEMENTS(sSRCFormats); fi++) {
+				const Format &f = sFormats[sSRCFormats[fi]];
+				UInt32 engineFrames, hwFrames, pos, piece = 5, n, outFrames = 0;
+				IOAudioStreamFormat fmt;
+				Float32 *mix, *laps, *refFloats;
+				SInt32 *refInts;
+				UInt8 *dma;
+				PCMResampler reference = PCMResampler();
+				char format[48];
+				double err, ns;
+				bool ok = true;
+
+				if (sQuick && (c != 2))
+					continue;
+				setupChannelSRC(channel, sc, c);
+				engineFrames = channel.src.engineFrames;
+				hwFrames = channel.src.hwFrames;
+				setFormat(fmt, f, c);
+				mix = new Float32[engineFrames * c];
+				laps = new Float32[engineFrames * c * 2];
+				refFloats = new Float32[(engineFrames * 2 * sc.hwRate / sc.engineRate + 8) * c];
+				refInts = new SInt32[hwFrames * c];
+				dma = new UInt8[hwFrames * c * f.bytes + kGuard];
+				fillFloats(mix, engineFrames * c);
+				memcpy(laps, mix, engineFrames * c * sizeof(Float32));
+				memcpy(laps + engineFrames * c, mix, engineFrames * c * sizeof(Float32));
+				memset(dma, 0, hwFrames * c * f.bytes);
+				memset(dma + hwFrames * c * f.bytes, 0xA5, kGuard);
+
+				// pieces of 1 to 700 frames, split at the end of the buffer like the engine does
+				for (pos = 0; pos < engineFrames * 2; pos += n) {
+					UInt32 first = pos % engineFrames;
+					n = (piece % 700) + 1;
+					piece = piece * 7 + 3;
+					if (n > engineFrames - first)
+						n = engineFrames - first;
+					engine.clipOutputSamples(mix, dma, first, n, &fmt, NULL);
+				}
+
+				// the reference ring
+				reference.init(sc.engineRate, sc.hwRate, c, kPCMResamplerQualityMedium);
+				n = reference.process(laps, engineFrames * 2, refFloats);
+				memset(refInts, 0, hwFrames * c * sizeof(SInt32));
+				for (pos = 0; pos < n; pos++) {
+					SInt32 frame[8];
+					referenceFloatToInt(refFloats + pos * c, frame, f, c);
+					memcpy(refInts + (pos % hwFrames) * c, frame, c * sizeof(SInt32));
+				}
+				outFrames = n;
+				err = intErrLSB(dma, refInts, f, hwFrames * c);
+				ok = (outFrames >= hwFrames) && guardIntact(dma + hwFrames * c * f.bytes) &&
+						(err <= intTolerance(f, 0)) && (channel.src.nextFrame == 0) &&
+						(channel.src.writeFrame == outFrames % hwFrames);
+
+				ns = nsPerSample([&]() {
+					for (pos = 0; pos < engineFrames; pos += n) {
+						n = (engineFrames - pos < 512) ? engineFrames - pos : 512;
+						engine.clipOutputSamples(mix, dma, pos, n, &fmt, NULL);
+					}
+				}, engineFrames * c);
+				snprintf(format, sizeof(format), "%s %u>%u", f.name, (unsigned int) sc.engineRate,
+						(unsigned int) sc.hwRate);
+				report("src", "clipOutputSamples", "vector", "resampled", format, c, engineFrames * c, 0, ns,
+						err, ok);
+
+				// the first half of the engine buffer is the first half of the codec's
+				engine.eraseOutputSamples(mix, dma, 0, engineFrames / 2, &fmt, NULL);
+				ok = true;
+				for (pos = 0; pos < engineFrames / 2 * c; pos++)
+					ok = ok && (mix[pos] == 0.0f);
+				for (pos = 0; pos < hwFrames * c; pos++) {
+					bool cleared = (readSample(dma, f, pos) == 0);
+					if ((pos < hwFrames / 2 * c) && !cleared)
+						ok = false;
+				}
+				ok = ok && (readSample(dma, f, hwFrames / 2 * c) == refInts[hwFrames / 2 * c]);
+				report("src", "eraseOutputSamples", "scalar", "resampled", format, c, engineFrames * c, 0, 0, 0,
+						ok);
+
+				channel.src.resampler.free();
+				channel.src.engineRate = 0;
+				reference.free();
+				delete [] mix;
+				delete [] laps;
+				delete [] refFloats;
+				delete [] refInts;
+				delete [] dma;
+			}
+		}
+	}
+}
+
+#pragma mark -
+#pragma mark iSub
+
+#define kiSubRate		6000
+#define kiSubRingLen	300		// samples, so that the ring wraps a few times
+
+// what attachiSub and setupiSub do for the channel, on the engine's rate
+static bool setupChanneliSub(Channel &channel, iSubCrossoverCache &cache, SInt16 *ring, UInt32 rate,
+		UInt32 channels, UInt32 srcQuality)
+{
+	ChanneliSub *isub = &channel.isub;
+
+	memset(isub, 0, sizeof(*isub));
+	isub->low = new Float32[HDA_ISUB_CHUNK_FRAMES * kiSubMaxChannels];
+	isub->high = new Float32[HDA_ISUB_CHUNK_FRAMES * kiSubMaxChannels];
+	isub->buffer = ring;
+	isub->bufferLen = kiSubRingLen;
+	isub->format.numChannels = 1;
+	isub->format.bytesPerSample = 2;
+	isub->format.outputSampleRate = kiSubRate;
+	isub->coeffs = cache.lookup(rate, kiSubCrossoverFrequency4thOrder, 4, true);
+	if (!isub->crossover.init(isub->coeffs, channels))
+		return false;
+	if ((srcQuality != HDA_ISUB_SRC_INTERPOLATOR) &&
+			!isub->resampler.init(rate, kiSubRate, isub->format.numChannels, srcQuality))
+		return false;
+	isub->sampleRate = rate;
+	return true;
+}
+
+static void runiSub(VoodooHDAEngine &engine, Channel &channel)
+{
+	const UInt32 rate = 48000, frames = 4096;
+	static const int formats[] = { kS16LE, kS32LE };
+	static const UInt32 qualities[] = { HDA_ISUB_SRC_INTERPOLATOR, kPCMResamplerQualityMedium };
+	iSubCrossoverCache cache;
+
+	cache.invalidate();
+
+	for (UInt32 c = 2; c <= 6; c += 4) {
+		for (unsigned int fi = 0; fi < NUM_ELEMENTS(formats); fi++) {
+			for (unsigned int q = 0; q < NUM_ELEMENTS(qualities); q++) {
+				const Format &f = sFormats[formats[fi]];
+				UInt32 pos, piece = 5, n, outFrames, p, i;
+				IOAudioStreamFormat fmt;
+				PCMResampler reference = PCMResampler();
+				PreviousValues refState[kiSubMaxChannels / 2][kiSubNumStages];
+				Float32 *mix = new Float32[frames * c], *refLow = new Float32[frames * c];
+				Float32 *refHigh = new Float32[frames * c], *pairIn = new Float32[frames * 2];
+				Float32 *pairLow = new Float32[frames * 2], *pairHigh = new Float32[frames * 2];
+				Float32 *mono = new Float32[frames], *refOut = new Float32[frames + 64];
+				UInt8 *dma = new UInt8[frames * c * f.bytes + kGuard], *refDma = new UInt8[frames * c * f.bytes];
+				SInt16 ring[kiSubRingLen + 1], refRing[kiSubRingLen];
+				float phase = 0, state = 0;
+				double err = 0, ns;
+				bool ok;
+
+				memset(refState, 0, sizeof(refState));
+				memset(ring, 0, sizeof(ring));
+				ring[kiSubRingLen] = 0x5A5A;
+				memset(refRing, 0, sizeof(refRing));
+				setFormat(fmt, f, c);
+				fillFloats(mix, frames * c);
+				memset(dma, 0, frames * c * f.bytes);
+				memset(dma + frames * c * f.bytes, 0xA5, kGuard);
+				ok = setupChanneliSub(channel, cache, ring, rate, c, qualities[q]);
+
+				// pieces of 1 to 700 frames
+				for (pos = 0; ok && (pos < frames); pos += n) {
+					n = (piece % 700) + 1;
+					piece = piece * 7 + 3;
+					if (n > frames - pos)
+						n = frames - pos;
+					ok = (engine.clipOutputSamples(mix, dma, pos, n, &fmt, NULL) == kIOReturnSuccess);
+				}
+
+				// the reference: the scalar filters a pair at a time over the whole mix
+				for (p = 0; p < c / 2; p++) {
+					for (i = 0; i < frames; i++) {
+						pairIn[i * 2] = mix[i * c + p * 2];
+						pairIn[i * 2 + 1] = mix[i * c + p * 2 + 1];
+					}
+					StereoFilter4thOrderPhaseComp(pairIn, pairLow, pairHigh, frames, rate, &refState[p][0],
+							&refState[p][1], &refState[p][2]);
+					for (i = 0; i < frames; i++) {
+						refLow[i * c + p * 2] = pairLow[i * 2];
+						refLow[i * c + p * 2 + 1] = pairLow[i * 2 + 1];
+						refHigh[i * c + p * 2] = pairHigh[i * 2];
+						refHigh[i * c + p * 2 + 1] = pairHigh[i * 2 + 1];
+					}
+				}
+				engine.blitOutputSamples(refHigh, refDma, 0, frames, &fmt);
+				for (i = 0; i < frames; i++) {
+					Float32 sum = 0.0f;
+					for (p = 0; p < c; p++)
+						sum += refLow[i * c + p];
+					mono[i] = ((Float32) 1 / (Float32) c) * sum;
+				}
+				if (qualities[q] == HDA_ISUB_SRC_INTERPOLATOR)
+					outFrames = linearResample(mono, frames, refOut, (float) rate / (float) kiSubRate, &phase, &state);
+				else {
+					reference.init(rate, kiSubRate, 1, qualities[q]);
+					outFrames = reference.process(mono, frames, refOut);
+				}
+				for (i = 0; i < outFrames; i++) {
+					Float32 x = refOut[i];
+					if (x > 1.0)
+						x = 1.0;
+					else if (x < -1.0)
+						x = -1.0;
+					refRing[i % kiSubRingLen] = (x >= 0) ? (SInt16) (x * 32767.0) : (SInt16) (x * 32768.0);
+				}
+
+				for (i = 0; i < frames * c; i++) {
+					double e = fabs((double) readSample(dma, f, i) - (double) readSample(refDma, f, i));
+					if (e > err)
+						err = e;
+				}
+				for (i = 0; i < kiSubRingLen; i++)
+					if (ring[i] != refRing[i])
+						err = 1;
+				ok = ok && (err == 0) && guardIntact(dma + frames * c * f.bytes) && (ring[kiSubRingLen] == 0x5A5A) &&
+						(channel.isub.loopCount == (outFrames - 1) / kiSubRingLen) &&
+						((UInt32) channel.isub.offset == (outFrames - 1) % kiSubRingLen + 1);
+
+				ns = nsPerSample([&]() {
+					for (pos = 0; pos < frames; pos += 512)
+						engine.clipOutputSamples(mix, dma, pos, 512, &fmt, NULL);
+				}, frames * c);
+				report("isub", "clipOutputSamples", "vector", (qualities[q] == HDA_ISUB_SRC_INTERPOLATOR) ?
+						"interpolator" : "q16", f.name, c, frames * c, 0, ns, err, ok);
+
+				channel.isub.resampler.free();
+				reference.free();
+				delete [] channel.isub.low;
+				delete [] channel.isub.high;
+				memset(&channel.isub, 0, sizeof(channel.isub));
+				delete [] mix;
+				delete [] refLow;
+				delete [] refHigh;
+				delete [] pairIn;
+				delete [] pairLow;
+				delete [] pairHigh;
+				delete [] mono;
+				delete [] refOut;
+				delete [] dma;
+				delete [] refDma;
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	VoodooHDAEngine engine;
+	Channel channel;
+	int cpuTier, tier;
+
+	if ((argc > 1) && !strcmp(argv[1], "-q"))
+		sQuick = true;
+
+	cpuTier = PCMBlitterCPUTier();
+	tier = PCMBlitterInitDispatch(-1, false);
+	fprintf(stderr, "blitbench: CPU supports %s, dispatching to %s kernels\n", PCMBlitterTierName(cpuTier),
+			PCMBlitterTierName(tier));
+
+	memset(&channel, 0, sizeof(channel));
+	engine.mChannel = &channel;
+	engine.mDevice = NULL;
+	engine.Boost = 0;
+	engine.InputBoost = 0;
+
+	printf("suite,name,tier,variant,format,channels,samples,misalign,ns_per_sample,max_err_lsb,ok\n");
+	runKernels(cpuTier);
+	runClip(engine, channel);
+	runConvert(engine, channel);
+	runConvertMap(engine, channel);
+	runCrossoverCoeffs();
+	runCrossover();
+	runResample();
+	runSRC(engine, channel);
+	runiSub(engine, channel);
+
+	fprintf(stderr, "blitbench: %d failure%s\n", sFailures, (sFailures == 1) ? "" : "s");
+	return sFailures ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+/*
+	clockbench - simulated check of the engine timestamps of VoodooHDADevice.
+
+	Runs on any host, without hardware. It builds with the driver's WallClock.cpp, so the filter and the wrap
+	times are the driver's own; only the register reads of latchStreamInterrupt and wallClockSample are
+	modelled, with the host clock read around them as the driver does. The model's link wall clock runs off
+	by drift_ppm from its nominal 24 MHz, and clocks a stream whose ring wraps every ring_ms. The interrupt filter latches a wrap 2 to 10 us after it, and the
+	workloop gets to it 5 to 40 us after that, 1 in 16 of them up to 2 ms after, which is when the old
+	timestamps were taken. The host clock reads around a sample are 1.5 us apart, 1 in 32 of them 20 us,
+	as if interrupted. The timer samples the wall clock every 5 s as well, on the workloop, so its sample
+	may be fed before an older latched one.
+
+	For each case it compares the timestamps with the true wrap times after HDAC_WALCLK_SETTLE samples and
+	a settling time, as taken at interrupt time (old) and reconstructed from the wall clock (new), and the
+	filter's rate with the true one.
+
+	Results go to stdout as CSV, one row per case:
+		suite,drift_ppm,rate,ring_ms,wraps,old_rms_us,old_max_us,new_rms_us,new_max_us,rate_err_ppm,ok
+	ok is 0 if the new timestamps are off by more than a frame and 5 us, LPIB counting whole bytes, or are not
+	four times closer than the old ones.
+	The exit status is 1 if anything failed.
+
+	usage: clockbench
+*/
+
+#include <IOKit/IOTypes.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "WallClock.h"
+
+#define NUM_ELEMENTS(a)	(sizeof(a) / sizeof((a)[0]))
+
+static const double kSettleSeconds = 60.0;
+static const double kRunSeconds = 600.0;
+static const double kTimerSeconds = 5.0;
+
+static int sFailures;
+static UInt32 sRandom = 1;
+
+static UInt32 simRandom(UInt32 range)
+{
+	sRandom = sRandom * 1664525 + 1013904223;
+	return (sRandom >> 8) % range;
+}
+
+#pragma mark -
+#pragma mark Simulated clocks
+
+// the host clock is the reference; the wall clock started at host time 1 s
+class SimClocks {
+public:
+	double	drift;		// of the wall clock, ppm
+	WallClock mWallClock;
+
+	void	reset(double driftPpm) { memset(this, 0, sizeof (*this)); drift = driftPpm; }
+	double	wallHz() const { return HDAC_WALCLK_HZ * (1.0 + drift / 1e6); }
+	double	wallAt(double hostNs) const { return (hostNs - 1e9) * wallHz() / 1e9; }
+	double	hostAt(double wall) const { return 1e9 + wall * 1e9 / wallHz(); }
+
+	void	latchStreamInterrupt(double hostNs, double ringNs, UInt32 ringBytes, StreamIntLatch *latch);
+	void	wallClockSample(double hostNs);
+	bool	channelWrapTime(StreamIntLatch *latched, UInt32 ringBytes, UInt32 speed, UInt32 frameBytes,
+			UInt64 *timestamp);
+};
+
+static double simSpread() { return (simRandom(32) == 0) ? 20000.0 : 1500.0; }
+
+#pragma mark -
+#pragma mark Simulated reads
+
+// the register reads happen at hostNs, the host clock reads around them
+void SimClocks::latchStreamInterrupt(double hostNs, double ringNs, UInt32 ringBytes, StreamIntLatch *latch)
+{
+	UInt64 before, after;
+	double spreadNs = simSpread();
+
+	before = (UInt64) (hostNs - spreadNs / 2);
+	latch->wallClock = (UInt32) (UInt64) wallAt(hostNs);
+	latch->position = (UInt32) (fmod(hostNs - 1e9, ringNs) / ringNs * ringBytes);
+	after = (UInt64) (hostNs + spreadNs / 2);
+	latch->time = before + (after - before) / 2;
+	latch->spread = after - before;
+}
+
+void SimClocks::wallClockSample(double hostNs)
+{
+	UInt64 before, after;
+	UInt32 raw;
+	double spreadNs = simSpread();
+
+	before = (UInt64) (hostNs - spreadNs / 2);
+	raw = (UInt32) (UInt64) wallAt(hostNs);
+	after = (UInt64) (hostNs + spreadNs / 2);
+	wallClockUpdate(&mWallClock, raw, before + (after - before) / 2, after - before);
+}
+
+// the driver's channelWrapTime, host time being in ns
+bool SimClocks::channelWrapTime(StreamIntLatch *latched, UInt32 ringBytes, UInt32 speed, UInt32 frameBytes,
+		UInt64 *timestamp)
+{
+	wallClockUpdate(&mWallClock, latched->wallClock, latched->time, latched->spread);
+	return wallClockWrapNs(&mWallClock, latched->wallClock, latched->position, ringBytes, speed, frameBytes,
+			timestamp);
+}
+
+#pragma mark -
+#pragma mark Runs
+
+static void run(double driftPpm, UInt32 speed, UInt32 frameBytes, UInt32 ringBytes)
+{
+	static SimClocks clocks;
+	// the stream is clocked by the link: a ring takes ringBytes / frameBytes frames of the wall clock
+	double ringNs, nextTimer = 1e9 + kTimerSeconds * 1e9, oldSq = 0, newSq = 0, oldMax = 0, newMax = 0;
+	double rateErr;
+	UInt32 wraps = 0, counted = 0;
+	bool ok;
+
+	clocks.reset(driftPpm);
+	ringNs = (double) ringBytes / frameBytes / speed * HDAC_WALCLK_HZ / clocks.wallHz() * 1e9;
+
+	for (UInt32 n = 1; n * ringNs < kRunSeconds * 1e9; n++) {
+		double wrap = 1e9 + n * ringNs, filter, handler, oldErr, newErr;
+		StreamIntLatch latch;
+		UInt64 timestamp;
+
+		filter = wrap + 2000 + simRandom(8000);
+		clocks.latchStreamInterrupt(filter, ringNs, ringBytes, &latch);
+		handler = filter + 5000 + simRandom(35000);
+		if (simRandom(16) == 0)
+			handler += simRandom(2000000);
+		// the workloop runs one at a time, in order
+		while (nextTimer < handler) {
+			clocks.wallClockSample(nextTimer);
+			nextTimer += kTimerSeconds * 1e9;
+		}
+		wraps++;
+		if (!clocks.channelWrapTime(&latch, ringBytes, speed, frameBytes, &timestamp))
+			timestamp = (UInt64) handler;
+		if (wrap - 1e9 < kSettleSeconds * 1e9)
+			continue;
+		oldErr = handler - wrap;
+		newErr = (double) timestamp - wrap;
+		oldSq += oldErr * oldErr;
+		newSq += newErr * newErr;
+		if (fabs(oldErr) > oldMax)
+			oldMax = fabs(oldErr);
+		if (fabs(newErr) > newMax)
+			newMax = fabs(newErr);
+		counted++;
+	}
+
+	rateErr = ((double) clocks.mWallClock.rate / 4294967296.0 * clocks.wallHz() / 1e9 - 1.0) * 1e6;
+	oldSq = counted ? sqrt(oldSq / counted) : 0;
+	newSq = counted ? sqrt(newSq / counted) : 0;
+	ok = counted && (newMax <= 5000.0 + 1e9 / speed) && (newSq * 4 <= oldSq);
+	if (!ok)
+		sFailures++;
+	printf("clock,%.0f,%u,%.1f,%u,%.2f,%.2f,%.2f,%.2f,%.2f,%d\n", driftPpm, (unsigned int) speed,
+			ringNs / 1e6, (unsigned int) wraps,
+			oldSq / 1000, oldMax / 1000, newSq / 1000, newMax / 1000, rateErr, ok ? 1 : 0);
+}
+
+static const double sDrifts[] = { -300, -50, 0, 20, 100, 500 };
+
+static const struct {
+	UInt32 speed, frameBytes, ringBytes;
+} sStreams[] = {
+	{ 48000, 4, 262144 },	// the whole DMA buffer, stereo 16 bit
+	{ 44100, 4, 262144 },
+	{ 192000, 32, 262144 },
+	{ 48000, 4, 12288 },	// low latency, 64 ms
+};
+
+int main(int argc, char **argv)
+{
+	printf("suite,drift_ppm,rate,ring_ms,wraps,old_rms_us,old_max_us,new_rms_us,new_max_us,rate_err_ppm,ok\n");
+	for (unsigned int s = 0; s < NUM_ELEMENTS(sStreams); s++)
+		for (unsigned int d = 0; d < NUM_ELEMENTS(sDrifts); d++)
+			run(sDrifts[d], sStreams[s].speed, sStreams[s].frameBytes, sStreams[s].ringBytes);
+
+	fprintf(stderr, "clockbench: %d failures\n", sFailures);
+	return sFailures ? 1 : 0;
+}
@@ -0,0 +1,548 @@
+/*
+	cmdbench - the codec command transports of VoodooHDADevice on a model of the controller, for comparing
+	their costs.
+
+	This builds the driver's CommandTransport.cpp, which has sendCommandLists, sendCommandsImmediate,
+	sendCommandsCorb, rirbWait and rirbFlush, and defines its hooks against a model of the controller's
+	CORB/RIRB and immediate command registers and of the link to the codecs, on a simulated clock, on any
+	host. The VoodooHDADevice here stands in for the driver's: its interruptFilter is the codec part of
+	the driver's, and sendCommands is the driver's. Each register access, IODelay and interrupt costs
+	simulated time as set in sCosts. The link runs 48 kHz frames and carries one verb per frame, whatever
+	codec it is for; the codec answers in the next one, and the rirb interrupt comes after RINTCNT
+	responses or after a frame without one, as the driver programs it.
+
+	Results go to stdout as CSV, one row per measurement:
+		suite,transport,codecs,verbs,lists,ns_per_verb,us_total,reads_per_verb,writes_per_verb,ok
+	transport is one of
+		immediate	every list through the immediate interface
+		corb-poll	the corb, polling the rirb (no controller interrupt)
+		corb-irq	the corb, sleeping until the rirb interrupt
+		auto		the driver's default: lists up to HDAC_IMMEDIATE_MAX_DEFAULT immediate, the rest by corb
+	The "mixed" rows alternate lists of one verb and of verbs verbs, so that auto stops and starts the
+	corb; the "fallback" rows have a controller without the immediate interface, which auto has to give
+	up on. The "probe" rows go through the verb rounds of the codec probe for an analog codec and codecs-1
+	HDMI codecs, all codecs in each round at once as scanCodecs does; "probe-seq" does one codec after
+	the other, as it used to, power up delays included. ok is 0 if the transport got a response wrong,
+	missed it or gave it to the wrong codec. The exit status is 1 if anything failed. The transport's
+	warnings go to stderr.
+
+	usage: cmdbench
+*/
+
+#include <IOKit/IOTypes.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Registers.h"
+#include "Models.h"
+#include "CommandTransport.h"
+
+#define NUM_ELEMENTS(a)	(sizeof(a) / sizeof((a)[0]))
+
+#pragma mark -
+#pragma mark Simulated controller
+
+// simulated time, in ns
+typedef struct {
+	UInt64 read;		// uncached register read, a round trip over PCIe
+	UInt64 write;		// posted register write
+	UInt64 frame;		// link frame, 1 / 48 kHz
+	UInt64 fetch;		// corb DMA fetch after the write pointer moves
+	UInt64 interrupt;	// from the rirb interrupt to interruptFilter
+	UInt64 wakeup;		// from thread_wakeup to the sender running again
+} SimCosts;
+
+static const SimCosts sCosts = { 700, 150, 20833, 1000, 4000, 10000 };
+
+#define kCorbSize		256
+#define kRirbSize		256
+#define kRintCnt		(kRirbSize / 2)
+#define kMaxEvents		1024
+
+static UInt32 codecResponse(UInt32 verb)
+{
+	return (verb * 0x9e3779b1) & 0x7fffffff;
+}
+
+class SimController {
+public:
+	UInt64	now;
+	UInt64	reads, writes;
+	UInt32	corb[kCorbSize];	// what the driver sees as DMA memory
+	UInt32	rirb[kRirbSize][2];
+
+	void	reset(bool immediate);
+	UInt32	read(UInt32 reg);
+	void	write(UInt32 reg, UInt32 value);
+	void	delay(UInt32 us) { advance(now + us * 1000ULL); }
+	void	advance(UInt64 t);
+	// advances to when the rirb interrupt goes off, or to deadline; false if it didn't
+	bool	advanceToInterrupt(UInt64 deadline);
+
+private:
+	enum { kCorbRead, kRirbWrite, kRirbIdle, kImmediateDone };
+	typedef struct {
+		UInt64 time;
+		int type;
+		UInt32 value;
+		UInt32 ex;
+	} Event;
+
+	bool	mHasImmediate;
+	Event	mEvents[kMaxEvents];	// by time
+	int		mNumEvents;
+	UInt64	mLinkFree;				// first frame the link has no verb in
+	UInt64	mLastResponse;
+	UInt16	mIcis;
+	UInt32	mIcoi, mIcii;
+	UInt8	mCorbCtl, mRirbSts;
+	UInt32	mCorbWp, mCorbRp, mCorbQueued, mRirbWp, mRintCount, mGctl;
+
+	void	schedule(UInt64 time, int type, UInt32 value, UInt32 ex = 0);
+	UInt64	sendVerb(UInt64 earliest);
+	void	fire(const Event &event);
+	void	queueCorb();
+};
+
+void SimController::reset(bool immediate)
+{
+	memset(this, 0, sizeof (*this));
+	mHasImmediate = immediate;
+	mCorbCtl = HDAC_CORBCTL_CMEIE;
+}
+
+void SimController::schedule(UInt64 time, int type, UInt32 value, UInt32 ex)
+{
+	int i;
+
+	if (mNumEvents >= kMaxEvents)
+		return;
+	for (i = mNumEvents; (i > 0) && (mEvents[i - 1].time > time); i--)
+		mEvents[i] = mEvents[i - 1];
+	mEvents[i].time = time;
+	mEvents[i].type = type;
+	mEvents[i].value = value;
+	mEvents[i].ex = ex;
+	mNumEvents++;
+}
+
+// the frame a verb ready at earliest goes out in: the first free one that starts after it
+UInt64 SimController::sendVerb(UInt64 earliest)
+{
+	UInt64 frame = (earliest + sCosts.frame - 1) / sCosts.frame;
+
+	if (frame < mLinkFree)
+		frame = mLinkFree;
+	mLinkFree = frame + 1;
+	return frame;
+}
+
+void SimController::queueCorb()
+{
+	while ((mCorbCtl & HDAC_CORBCTL_CORBRUN) && (mCorbQueued != mCorbWp)) {
+		UInt32 verb;
+		UInt64 frame;
+		mCorbQueued = (mCorbQueued + 1) % kCorbSize;
+		verb = corb[mCorbQueued];
+		frame = sendVerb(now + sCosts.fetch);
+		schedule(frame * sCosts.frame, kCorbRead, 0);
+		schedule((frame + 2) * sCosts.frame, kRirbWrite, codecResponse(verb), verb >> 28);
+	}
+}
+
+void SimController::fire(const Event &event)
+{
+	switch (event.type) {
+	case kCorbRead:
+		mCorbRp = (mCorbRp + 1) % kCorbSize;
+		break;
+	case kRirbWrite:
+		mRirbWp = (mRirbWp + 1) % kRirbSize;
+		rirb[mRirbWp][0] = event.value;
+		rirb[mRirbWp][1] = event.ex;	// codec address, solicited
+		mLastResponse = event.time;
+		if (++mRintCount >= kRintCnt) {
+			mRirbSts |= HDAC_RIRBSTS_RINTFL;
+			mRintCount = 0;
+		} else
+			schedule(event.time + sCosts.frame, kRirbIdle, 0);
+		break;
+	case kRirbIdle:
+		if ((mLastResponse + sCosts.frame == event.time) && mRintCount) {
+			mRirbSts |= HDAC_RIRBSTS_RINTFL;
+			mRintCount = 0;
+		}
+		break;
+	case kImmediateDone:
+		mIcii = event.value;
+		mIcis = (mIcis & ~HDAC_ICIS_ICB) | HDAC_ICIS_IRV;
+		break;
+	}
+}
+
+void SimController::advance(UInt64 t)
+{
+	while (mNumEvents && (mEvents[0].time <= t)) {
+		Event event = mEvents[0];
+		memmove(&mEvents[0], &mEvents[1], --mNumEvents * sizeof (Event));
+		if (now < event.time)
+			now = event.time;
+		fire(event);
+	}
+	if (now < t)
+		now = t;
+}
+
+bool SimController::advanceToInterrupt(UInt64 deadline)
+{
+	while (!(mRirbSts & HDAC_RIRBSTS_RINTFL)) {
+		if (!mNumEvents || (mEvents[0].time > deadline)) {
+			advance(deadline);
+			return false;
+		}
+		advance(mEvents[0].time);
+	}
+	return true;
+}
+
+UInt32 SimController::read(UInt32 reg)
+{
+	advance(now + sCosts.read);
+	reads++;
+	switch (reg) {
+	case HDAC_INTSTS:
+		return (mRirbSts & HDAC_RIRBSTS_RINTFL) ? (HDAC_INTSTS_GIS | HDAC_INTSTS_CIS) : 0;
+	case HDAC_INTCTL:
+		return HDAC_INTCTL_CIE | HDAC_INTCTL_GIE;
+	case HDAC_GCTL:
+		return mGctl;
+	case HDAC_CORBRP:
+		return mCorbRp;
+	case HDAC_CORBCTL:
+		return mCorbCtl;
+	case HDAC_RIRBWP:
+		return mRirbWp;
+	case HDAC_RIRBSTS:
+		return mRirbSts;
+	case HDAC_ICIS:
+		return mHasImmediate ? mIcis : 0;
+	case HDAC_ICII:
+		return mHasImmediate ? mIcii : 0;
+	}
+	return 0;
+}
+
+void SimController::write(UInt32 reg, UInt32 value)
+{
+	advance(now + sCosts.write);
+	writes++;
+	switch (reg) {
+	case HDAC_GCTL:
+		mGctl = value;
+		break;
+	case HDAC_CORBWP:
+		mCorbWp = value % kCorbSize;
+		queueCorb();
+		break;
+	case HDAC_CORBCTL:
+		mCorbCtl = value;
+		queueCorb();
+		break;
+	case HDAC_RIRBSTS:
+		mRirbSts &= ~value;
+		break;
+	case HDAC_ICOI:
+		mIcoi = value;
+		break;
+	case HDAC_ICIS:
+		if (!mHasImmediate)
+			break;
+		if (value & HDAC_ICIS_IRV)
+			mIcis &= ~HDAC_ICIS_IRV;
+		if ((value & HDAC_ICIS_ICB) && !(mIcis & HDAC_ICIS_ICB)) {
+			mIcis |= HDAC_ICIS_ICB;
+			schedule((sendVerb(now) + 2) * sCosts.frame, kImmediateDone, codecResponse(mIcoi));
+		}
+		break;
+	}
+}
+
+#pragma mark -
+#pragma mark Driver
+
+// the parts of VoodooHDADevice around its CommandTransport, with the registers going to SimController
+class VoodooHDADevice {
+public:
+	SimController *hw;
+	CommandTransport mCommands;
+
+	void	start(SimController *controller, int immediateMax, bool interrupts);
+	void	sendCommands(CommandList *commands, int cad);
+	void	sendCommandLists(CommandList **lists) { mCommands.sendCommandLists(lists); }
+	void	interruptFilter();
+};
+
+void VoodooHDADevice::start(SimController *controller, int immediateMax, bool interrupts)
+{
+	hw = controller;
+	memset(&mCommands, 0, sizeof (mCommands));
+	mCommands.init(this, immediateMax);
+	mCommands.setCorb(hw->corb, kCorbSize);
+	mCommands.setRirb((RirbResponse *) hw->rirb, kRirbSize);
+	mCommands.setRirbInterrupts(interrupts);
+	mCommands.startCorb();
+	hw->reads = hw->writes = 0;
+}
+
+void VoodooHDADevice::sendCommands(CommandList *commands, int cad)
+{
+	CommandList *lists[HDAC_CODEC_MAX];
+
+	if (!commands || (commands->numCommands < 1))
+		return;
+
+	memset(lists, 0, sizeof (lists));
+	lists[cad] = commands;
+	sendCommandLists(lists);
+}
+
+void VoodooHDADevice::interruptFilter()
+{
+	UInt32 status = hw->read(HDAC_INTSTS);
+
+	if (!HDA_FLAG_MATCH(status, HDAC_INTSTS_GIS))
+		return;
+	hw->write(HDAC_INTSTS, status);
+	if (HDA_FLAG_MATCH(status, HDAC_INTSTS_CIS))
+		mCommands.rirbInterrupt();
+}
+
+/* The transport's hooks */
+
+UInt8 CommandTransport::readData8(UInt32 reg)
+{
+	return mDevice->hw->read(reg);
+}
+
+UInt16 CommandTransport::readData16(UInt32 reg)
+{
+	return mDevice->hw->read(reg);
+}
+
+UInt32 CommandTransport::readData32(UInt32 reg)
+{
+	return mDevice->hw->read(reg);
+}
+
+void CommandTransport::writeData8(UInt32 reg, UInt8 value)
+{
+	mDevice->hw->write(reg, value);
+}
+
+void CommandTransport::writeData16(UInt32 reg, UInt16 value)
+{
+	mDevice->hw->write(reg, value);
+}
+
+void CommandTransport::writeData32(UInt32 reg, UInt32 value)
+{
+	mDevice->hw->write(reg, value);
+}
+
+void CommandTransport::delay(UInt32 us)
+{
+	mDevice->hw->delay(us);
+}
+
+// the model's corb is coherent
+void CommandTransport::syncCorb(__unused bool written)
+{
+}
+
+// and nothing runs at the same time as the sender, the interrupt filter runs from rirbSleep()
+void CommandTransport::lockRirb()
+{
+}
+
+void CommandTransport::unlockRirb()
+{
+}
+
+UInt64 CommandTransport::rirbDeadline(UInt32 timeoutUs)
+{
+	return mDevice->hw->now + timeoutUs * 1000ULL;
+}
+
+bool CommandTransport::rirbSleep(UInt64 deadline)
+{
+	if (!mDevice->hw->advanceToInterrupt(deadline))
+		return false;
+	mDevice->hw->advance(mDevice->hw->now + sCosts.interrupt);
+	mDevice->interruptFilter();
+	mDevice->hw->advance(mDevice->hw->now + sCosts.wakeup);
+	return true;
+}
+
+// the model has no unsolicited responses
+void CommandTransport::queueUnsolicited(__unused int cad, __unused UInt32 response)
+{
+}
+
+void CommandTransport::unsolicitedQueued()
+{
+}
+
+void CommandTransport::errorMsg(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+#pragma mark -
+#pragma mark Runs
+
+static int sFailures = 0;
+
+static void report(const char *suite, const char *transport, int codecs, int verbs, int lists, UInt64 ns,
+		UInt64 reads, UInt64 writes, int total, bool ok)
+{
+	if (!ok)
+		sFailures++;
+	printf("%s,%s,%d,%d,%d,%.1f,%.1f,%.2f,%.2f,%d\n", suite, transport, codecs, verbs, lists, (double) ns / total,
+			(double) ns / 1000, (double) reads / total, (double) writes / total, ok ? 1 : 0);
+}
+
+typedef struct {
+	const char *name;
+	int immediateMax;
+	bool interrupts;
+} Transport;
+
+static const Transport sTransports[] = {
+	{ "immediate",	1 << 30,					true },
+	{ "corb-poll",	0,							false },
+	{ "corb-irq",	0,							true },
+	{ "auto",		HDAC_IMMEDIATE_MAX_DEFAULT,	true }
+};
+
+static const int sListSizes[] = { 1, 2, 4, 16, 64, 255 };
+
+#define kVerbsPerRun	2048
+
+// lists of verbs verbs, or alternating with lists of one if mixed; all responses checked
+static void run(const char *suite, const Transport &transport, int verbs, bool mixed, bool immediate)
+{
+	static SimController controller;
+	VoodooHDADevice driver;
+	UInt32 verbList[256], responses[256];
+	UInt64 start;
+	int lists = 0, total = 0;
+	bool ok = true;
+
+	controller.reset(immediate);
+	driver.start(&controller, transport.immediateMax, transport.interrupts);
+	start = controller.now;
+	while (total < kVerbsPerRun) {
+		CommandList commands;
+		int n = (mixed && (lists & 1)) ? 1 : verbs;
+		for (int i = 0; i < n; i++) {
+			verbList[i] = 0x000f0000 | ((UInt32) ((total + i) & 0x7f) << 20) | ((total + i) & 0xff);
+			responses[i] = HDAC_INVALID;
+		}
+		commands.numCommands = n;
+		commands.verbs = verbList;
+		commands.responses = responses;
+		driver.sendCommands(&commands, 0);
+		for (int i = 0; i < n; i++)
+			if (responses[i] != codecResponse(verbList[i]))
+				ok = false;
+		total += n;
+		lists++;
+	}
+	report(suite, transport.name, 1, verbs, lists, controller.now - start, controller.reads, controller.writes,
+			total, ok);
+}
+
+// the probe rounds, in verbs for a codec of widgets widgets, and the delay after each
+#define kProbeRounds	7
+
+static int probeRoundVerbs(int round, int widgets)
+{
+	static const int fixed[kProbeRounds] = { 3, 2, 1, 0, 5, 0, 0 };
+	static const int perWidget[kProbeRounds] = { 0, 0, 0, 1, 1, 2, 1 };
+
+	return fixed[round] + perWidget[round] * widgets;
+}
+
+static const UInt32 sProbeDelays[kProbeRounds] = { 0, 0, 100, 1000, 0, 0, 0 };
+
+// an analog codec at 0 and HDMI codecs after it; all of them in each round, or one codec after the other
+static void runProbe(const char *suite, const Transport &transport, int codecs, bool concurrent)
+{
+	static SimController controller;
+	static UInt32 verbList[HDAC_CODEC_MAX][128], responses[HDAC_CODEC_MAX][128];
+	VoodooHDADevice driver;
+	CommandList commands[HDAC_CODEC_MAX];
+	CommandList *lists[HDAC_CODEC_MAX];
+	UInt64 start;
+	int calls = 0, total = 0;
+	bool ok = true;
+
+	controller.reset(true);
+	driver.start(&controller, transport.immediateMax, transport.interrupts);
+	start = controller.now;
+	for (int pass = 0; pass < (concurrent ? 1 : codecs); pass++) {
+		for (int round = 0; round < kProbeRounds; round++) {
+			memset(lists, 0, sizeof (lists));
+			for (int cad = 0; cad < codecs; cad++) {
+				int n = probeRoundVerbs(round, (cad == 0) ? 37 : 12);
+				if (!concurrent && (cad != pass))
+					continue;
+				for (int i = 0; i < n; i++) {
+					verbList[cad][i] = ((UInt32) cad << 28) | ((UInt32) (i & 0x7f) << 20) | 0x000f0000 |
+							(round << 8) | i;
+					responses[cad][i] = HDAC_INVALID;
+				}
+				commands[cad].numCommands = n;
+				commands[cad].verbs = verbList[cad];
+				commands[cad].responses = responses[cad];
+				lists[cad] = &commands[cad];
+				total += n;
+			}
+			driver.sendCommandLists(lists);
+			calls++;
+			for (int cad = 0; cad < codecs; cad++)
+				if (lists[cad])
+					for (int i = 0; i < lists[cad]->numCommands; i++)
+						if (responses[cad][i] != codecResponse(verbList[cad][i]))
+							ok = false;
+			if (sProbeDelays[round])
+				controller.delay(sProbeDelays[round]);
+		}
+	}
+	report(suite, transport.name, codecs, total, calls, controller.now - start, controller.reads,
+			controller.writes, total, ok);
+}
+
+int main()
+{
+	printf("suite,transport,codecs,verbs,lists,ns_per_verb,us_total,reads_per_verb,writes_per_verb,ok\n");
+	for (unsigned int t = 0; t < NUM_ELEMENTS(sTransports); t++)
+		for (unsigned int s = 0; s < NUM_ELEMENTS(sListSizes); s++)
+			run("lists", sTransports[t], sListSizes[s], false, true);
+	for (unsigned int t = 0; t < NUM_ELEMENTS(sTransports); t++)
+		run("mixed", sTransports[t], 16, true, true);
+	run("fallback", sTransports[3], 1, false, false);
+	run("fallback", sTransports[3], 16, true, false);
+	for (int codecs = 1; codecs <= 4; codecs++) {
+		runProbe("probe-seq", sTransports[3], codecs, false);
+		runProbe("probe", sTransports[3], codecs, true);
+	}
+
+	fprintf(stderr, "cmdbench: %d failures\n", sFailures);
+	return sFailures ? 1 : 0;
+}
@@ -0,0 +1,12 @@
+// Host shim: IOKit/IOCommandGate.h
+#ifndef _IOKIT_IOCOMMANDGATE_H
+#define _IOKIT_IOCOMMANDGATE_H
+
+#include <IOKit/IOService.h>
+
+class IOCommandGate : public OSObject {
+public:
+	typedef IOReturn (*Action)(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+};
+
+#endif
@@ -0,0 +1,16 @@
+// Host shim: the allocation and logging subset of IOKit/IOLib.h
+#ifndef __IOKIT_IOLIB_H
+#define __IOKIT_IOLIB_H
+
+#include <IOKit/IOTypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+static inline void *IOMalloc(size_t size) { return malloc(size); }
+static inline void IOFree(void *address, size_t) { free(address); }
+static inline void IOSleep(unsigned int) { }
+
+#define IOLog	printf
+
+#endif
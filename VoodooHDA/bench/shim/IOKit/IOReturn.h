@@ -0,0 +1,2 @@
+// Host shim: IOKit/IOReturn.h
+#include <IOKit/IOTypes.h>
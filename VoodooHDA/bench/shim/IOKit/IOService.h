@@ -0,0 +1,42 @@
+// Host shim: just enough of the libkern/IOKit class hierarchy to declare the driver classes
+#ifndef _IOKIT_IOSERVICE_H
+#define _IOKIT_IOSERVICE_H
+
+#include <IOKit/IOLib.h>
+
+#define OSDeclareDefaultStructors(className)
+#define OSDefineMetaClassAndStructors(className, superclassName)
+
+class OSObject {
+public:
+	virtual ~OSObject() { }
+	virtual void free() { }
+};
+
+class OSString;
+class OSNumber;
+class OSBoolean;
+class OSArray;
+class OSDictionary;
+class IOWorkLoop;
+class IOMemoryMap;
+class IOMemoryDescriptor;
+class IOBufferMemoryDescriptor;
+class IODMACommand;
+class IOInterruptEventSource;
+class IOFilterInterruptEventSource;
+class IOTimerEventSource;
+class IOPCIDevice;
+
+typedef struct _IOLock IOLock;
+typedef struct _IOSimpleLock IOSimpleLock;
+typedef int IOInterruptState;
+
+class IOService : public OSObject {
+public:
+	virtual bool init(OSDictionary * = 0) { return true; }
+	virtual bool start(IOService *) { return true; }
+	virtual void stop(IOService *) { }
+};
+
+#endif
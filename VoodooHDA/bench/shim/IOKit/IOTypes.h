@@ -0,0 +1,19 @@
+// Host shim: IOKit/IOTypes.h
+#ifndef __IOKIT_IOTYPES_H
+#define __IOKIT_IOTYPES_H
+
+#include <libkern/OSTypes.h>
+#include <libkern/OSByteOrder.h>
+#include <string.h>
+
+typedef SInt32		IOReturn;
+typedef uintptr_t	IOVirtualAddress;
+typedef UInt64		IOPhysicalAddress;
+typedef UInt64		AbsoluteTime;
+
+#define kIOReturnSuccess		0
+#define kIOReturnError			((IOReturn) 0xe00002bc)
+#define kIOReturnBadArgument	((IOReturn) 0xe00002c2)
+#define kIOReturnUnsupported	((IOReturn) 0xe00002c7)
+
+#endif
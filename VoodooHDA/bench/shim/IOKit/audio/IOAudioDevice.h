@@ -0,0 +1,14 @@
+// Host shim: IOKit/audio/IOAudioDevice.h
+#ifndef _IOKIT_IOAUDIODEVICE_H
+#define _IOKIT_IOAUDIODEVICE_H
+
+#include <IOKit/IOService.h>
+#include <IOKit/audio/IOAudioTypes.h>
+
+class IOAudioEngine;
+class IOAudioControl;
+
+class IOAudioDevice : public IOService {
+};
+
+#endif
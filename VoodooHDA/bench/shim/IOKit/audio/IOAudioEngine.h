@@ -0,0 +1,35 @@
+// Host shim: IOKit/audio/IOAudioEngine.h, with the conversion and erase entry points the benchmark calls
+#ifndef _IOKIT_IOAUDIOENGINE_H
+#define _IOKIT_IOAUDIOENGINE_H
+
+#include <IOKit/IOService.h>
+#include <IOKit/audio/IOAudioTypes.h>
+#include <strings.h>
+
+class IOAudioStream;
+class IOAudioControl;
+class IOAudioPort;
+class IOAudioSelectorControl;
+class IOAudioLevelControl;
+class IOAudioToggleControl;
+
+class IOAudioEngine : public IOService {
+public:
+	virtual IOReturn clipOutputSamples(const void *, void *, UInt32, UInt32, const IOAudioStreamFormat *,
+			IOAudioStream *) { return kIOReturnSuccess; }
+	virtual IOReturn eraseOutputSamples(const void *mixBuf, void *sampleBuf, UInt32 firstSampleFrame,
+			UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat, IOAudioStream *)
+	{
+		if (mixBuf)
+			bzero((Float32 *) mixBuf + firstSampleFrame * streamFormat->fNumChannels,
+					numSampleFrames * streamFormat->fNumChannels * sizeof(Float32));
+		if (sampleBuf)
+			bzero((UInt8 *) sampleBuf + firstSampleFrame * streamFormat->fNumChannels * (streamFormat->fBitWidth / 8),
+					numSampleFrames * streamFormat->fNumChannels * (streamFormat->fBitWidth / 8));
+		return kIOReturnSuccess;
+	}
+	virtual IOReturn convertInputSamples(const void *, void *, UInt32, UInt32, const IOAudioStreamFormat *,
+			IOAudioStream *) { return kIOReturnSuccess; }
+};
+
+#endif
@@ -0,0 +1,38 @@
+// Host shim: the stream format description from IOKit/audio/IOAudioTypes.h
+#ifndef _IOKIT_IOAUDIOTYPES_H
+#define _IOKIT_IOAUDIOTYPES_H
+
+#include <IOKit/IOTypes.h>
+
+typedef struct _IOAudioStreamFormat {
+	UInt32	fNumChannels;
+	UInt32	fSampleFormat;
+	UInt32	fNumericRepresentation;
+	UInt8	fBitDepth;
+	UInt8	fBitWidth;
+	UInt8	fAlignment;
+	UInt8	fByteOrder;
+	UInt8	fIsMixable;
+	UInt32	fDriverTag;
+} IOAudioStreamFormat;
+
+typedef struct _IOAudioSampleRate {
+	UInt32	whole;
+	UInt32	fraction;
+} IOAudioSampleRate;
+
+typedef UInt32 IOAudioStreamDirection;
+typedef UInt32 IOAudioDevicePowerState;
+
+enum {
+	kIOAudioStreamDirectionOutput = 0,
+	kIOAudioStreamDirectionInput = 1
+};
+
+#define kIOAudioStreamSampleFormatLinearPCM				'lpcm'
+#define kIOAudioStreamNumericRepresentationSignedInt	'sint'
+#define kIOAudioStreamNumericRepresentationIEEE754Float	'flot'
+#define kIOAudioStreamByteOrderBigEndian				0
+#define kIOAudioStreamByteOrderLittleEndian				1
+
+#endif
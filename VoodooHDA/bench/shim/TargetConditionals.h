@@ -0,0 +1,13 @@
+/*
+	Host shim for the blitter benchmark (see bench/blitbench.cpp). Claims a little-endian x86 target
+	that is not Mac OS, so the *_Portable kernels are compiled alongside the SSE2 ones.
+*/
+#ifndef __TARGETCONDITIONALS__
+#define __TARGETCONDITIONALS__
+
+#define TARGET_OS_MAC			0
+#define TARGET_CPU_X86			1
+#define TARGET_RT_LITTLE_ENDIAN	1
+#define TARGET_RT_BIG_ENDIAN	0
+
+#endif
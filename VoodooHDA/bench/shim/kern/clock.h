@@ -0,0 +1,15 @@
+// Host shim: mach_absolute_time() in nanoseconds
+#ifndef _KERN_CLOCK_H_
+#define _KERN_CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t mach_absolute_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,39 @@
+// Host shim: the byte-swapping subset of libkern/OSByteOrder.h used by the blitters
+#ifndef _OS_OSBYTEORDER_H
+#define _OS_OSBYTEORDER_H
+
+#include <stdint.h>
+
+#define OSSwapInt16(x)	__builtin_bswap16(x)
+#define OSSwapInt32(x)	__builtin_bswap32(x)
+
+#define OSSwapHostToLittleInt16(x)	((uint16_t)(x))
+#define OSSwapLittleToHostInt16(x)	((uint16_t)(x))
+#define OSSwapHostToLittleInt32(x)	((uint32_t)(x))
+#define OSSwapLittleToHostInt32(x)	((uint32_t)(x))
+#define OSSwapHostToBigInt16(x)		__builtin_bswap16(x)
+#define OSSwapBigToHostInt16(x)		__builtin_bswap16(x)
+#define OSSwapHostToBigInt32(x)		__builtin_bswap32(x)
+#define OSSwapBigToHostInt32(x)		__builtin_bswap32(x)
+
+static inline uint16_t OSReadSwapInt16(const volatile void *base, uintptr_t offset)
+{
+	return __builtin_bswap16(*(const volatile uint16_t *)((const volatile char *)base + offset));
+}
+
+static inline uint32_t OSReadSwapInt32(const volatile void *base, uintptr_t offset)
+{
+	return __builtin_bswap32(*(const volatile uint32_t *)((const volatile char *)base + offset));
+}
+
+static inline void OSWriteSwapInt16(volatile void *base, uintptr_t offset, uint16_t data)
+{
+	*(volatile uint16_t *)((volatile char *)base + offset) = __builtin_bswap16(data);
+}
+
+static inline void OSWriteSwapInt32(volatile void *base, uintptr_t offset, uint32_t data)
+{
+	*(volatile uint32_t *)((volatile char *)base + offset) = __builtin_bswap32(data);
+}
+
+#endif
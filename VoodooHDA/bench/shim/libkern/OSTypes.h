@@ -0,0 +1,31 @@
+// Host shim: kernel integer types
+#ifndef _OS_OSTYPES_H
+#define _OS_OSTYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t		UInt8;
+typedef int8_t		SInt8;
+typedef uint16_t	UInt16;
+typedef int16_t		SInt16;
+typedef uint32_t	UInt32;
+typedef int32_t		SInt32;
+typedef uint64_t	UInt64;
+typedef int64_t		SInt64;
+typedef unsigned char	Boolean;
+typedef uint64_t	mach_vm_size_t;
+typedef uint64_t	mach_vm_address_t;
+typedef uintptr_t	vm_address_t;
+typedef uintptr_t	vm_size_t;
+
+#ifndef TRUE
+#define TRUE	1
+#define FALSE	0
+#endif
+
+#ifndef __unused
+#define __unused	__attribute__((unused))
+#endif
+
+#endif
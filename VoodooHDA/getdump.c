@@ -12,10 +12,10 @@ void printMsgBuffer(io_service_t service)
 	kern_return_t ret;
 	io_connect_t connect = 0;
 #if __LP64__
-	mach_vm_address_t address;
+	mach_vm_address_t address = 0;
 	mach_vm_size_t size;	
 #else	
-	vm_address_t address;
+	vm_address_t address = 0;
 	vm_size_t size;
 #endif	
 	
@@ -29,12 +29,78 @@ void printMsgBuffer(io_service_t service)
 			kIOMapAnywhere | kIOMapDefaultCache);
 	if (ret != kIOReturnSuccess) {
 		printf("error: IOConnectMapMemory returned 0x%08x\n", ret);
+		address = 0;
 		goto failure;
 	}
 
 	printf("%s\n", (char *) address);
 
 failure:
+	if (address) {
+		ret = IOConnectUnmapMemory(connect, kVoodooHDAMemoryMessageBuffer, mach_task_self(), address);
+		if (ret != kIOReturnSuccess)
+			printf("warning: IOConnectUnmapMemory returned 0x%08x\n", ret);
+	}
+	if (connect) {
+		ret = IOServiceClose(connect);
+		if (ret != KERN_SUCCESS)
+			printf("warning: IOServiceClose returned 0x%08x\n", ret);
+	}
+}
+
+void printStreamStats(io_service_t service)
+{
+	kern_return_t ret;
+	io_connect_t connect = 0;
+	StreamStatsBuffer *buffer;
+#if __LP64__
+	mach_vm_address_t address = 0;
+	mach_vm_size_t size;	
+#else	
+	vm_address_t address = 0;
+	vm_size_t size;
+#endif	
+
+	ret = IOServiceOpen(service, mach_task_self(), 0, &connect);
+	if (ret != KERN_SUCCESS) {
+		printf("error: IOServiceOpen returned 0x%08x\n", ret);
+		goto failure;
+	}
+
+	ret = IOConnectMapMemory(connect, kVoodooHDAMemoryStreamStats, mach_task_self(), &address, &size,
+			kIOMapAnywhere | kIOMapDefaultCache);
+	if (ret != kIOReturnSuccess) {
+		printf("error: IOConnectMapMemory returned 0x%08x\n", ret);
+		address = 0;
+		goto failure;
+	}
+	buffer = (StreamStatsBuffer *) address;
+	if ((size < sizeof (*buffer)) || (buffer->version != kVoodooHDAStreamStatsVersion)) {
+		printf("error: unknown stream statistics version\n");
+		goto failure;
+	}
+
+	printf("Stream interrupts (period histogram in quarters of the expected period, 0 to 2+):\n");
+	for (unsigned int i = 0; i < buffer->numStreams; i++) {
+		StreamStats *stats = &buffer->streams[i];
+		printf("  stream %2u %s: %llu interrupts, %llu late, %llu missed, %llu FIFO errors, "
+				"%llu descriptor errors\n", (unsigned int) stats->stream, stats->direction ? "rec " : "play",
+				(unsigned long long) stats->interrupts, (unsigned long long) stats->late,
+				(unsigned long long) stats->missed, (unsigned long long) stats->fifoErrors,
+				(unsigned long long) stats->descErrors);
+		printf("            period %llu us expected, %llu..%llu us seen:", (unsigned long long) stats->expectedNs / 1000,
+				(unsigned long long) stats->minNs / 1000, (unsigned long long) stats->maxNs / 1000);
+		for (int j = 0; j < kVoodooHDAStreamStatsBuckets; j++)
+			printf(" %u", (unsigned int) stats->histogram[j]);
+		printf("\n");
+	}
+
+failure:
+	if (address) {
+		ret = IOConnectUnmapMemory(connect, kVoodooHDAMemoryStreamStats, mach_task_self(), address);
+		if (ret != kIOReturnSuccess)
+			printf("warning: IOConnectUnmapMemory returned 0x%08x\n", ret);
+	}
 	if (connect) {
 		ret = IOServiceClose(connect);
 		if (ret != KERN_SUCCESS)
@@ -72,6 +138,7 @@ int main()
 	printf("Found a device of class "kVoodooHDAClassName": %s\n\n", path);
 
 	printMsgBuffer(service);
+	printStreamStats(service);
 
 failure:
 	if (service)
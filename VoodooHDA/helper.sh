@@ -10,7 +10,7 @@ TMPKEXT="$TMPDIR/VoodooHDA.kext"
 
 if [ "$ACTION" = "clean" ]; then
 	set -x
-	rm -rf release $RELFILE getdump build
+	rm -rf release $RELFILE getdump build blitbench cmdbench bdlbench clockbench
 	[ -e $TMPDIR ] && sudo rm -rf $TMPDIR
 elif [ "$ACTION" = "build" ]; then
 	set -x
@@ -55,6 +55,24 @@ elif [ "$ACTION" = "unload" ]; then
 	sudo kextunload $TMPKEXT
 	sudo kextunload $TMPKEXT
 	sudo rm -rf $TMPDIR
+elif [ "$ACTION" = "bench" ]; then
+	# host build of the blitters and clip paths, the codec command model, the stream DMA and clock simulations,
+	# against bench/shim; CSV on stdout, "-q" for a quick blitter run
+	set -x
+	g++ -O2 -msse2 -DVOODOOHDA_HOST_BENCH -Ibench/shim -iquote . -Wall -Wno-unknown-pragmas -Wno-multichar \
+		-Wno-register -Wno-attributes -o blitbench bench/blitbench.cpp PCMBlitterLib.cpp PCMBlitterLibX86.cpp \
+		PCMBlitterLibDispatch.cpp PCMBlitterLibSSSE3.cpp PCMBlitterLibAVX2.cpp AppleAudioClip.cpp \
+		iSubCrossover.cpp PCMResampler.cpp || exit 1
+	g++ -O2 -DVOODOOHDA_HOST_BENCH -Ibench/shim -iquote . -Wall -Wno-unknown-pragmas -o cmdbench \
+		bench/cmdbench.cpp CommandTransport.cpp || exit 1
+	g++ -O2 -DVOODOOHDA_HOST_BENCH -Ibench/shim -iquote . -Wall -Wno-unknown-pragmas -o bdlbench \
+		bench/bdlbench.cpp BdlLayout.cpp || exit 1
+	g++ -O2 -DVOODOOHDA_HOST_BENCH -Ibench/shim -iquote . -Wall -Wno-unknown-pragmas -o clockbench \
+		bench/clockbench.cpp WallClock.cpp || exit 1
+	./blitbench $2 || exit 1
+	./cmdbench || exit 1
+	./bdlbench || exit 1
+	./clockbench
 else
-	echo "usage: $0 [clean|build|release|load|unload]"
+	echo "usage: $0 [clean|build|release|load|unload|bench [-q]]"
 fi
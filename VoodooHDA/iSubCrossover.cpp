@@ -0,0 +1,333 @@
+#include "License.h"
+#ifndef TIGER
+#include <TargetConditionals.h>
+#endif
+
+#include "iSubCrossover.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#define _MM_MALLOC_H_INCLUDED 1	// we don't want this header
+#ifdef VOODOOHDA_HOST_BENCH
+#include <xmmintrin.h>
+#else
+#include "xmmintrin.h"
+#endif
+#define ISUB_SSE 1
+#endif
+
+#pragma mark -
+#pragma mark Coefficients
+
+// tan() for 0 <= x < pi/2, as there is no libm in the kernel; the series are good to double precision here
+static double CrossoverTan(double x)
+{
+	double x2 = x * x, sinTerm = x, cosTerm = 1.0, sinSum = x, cosSum = 1.0;
+
+	for (int n = 1; n <= 14; n++) {
+		sinTerm *= -x2 / ((2 * n) * (2 * n + 1));
+		cosTerm *= -x2 / ((2 * n - 1) * (2 * n));
+		sinSum += sinTerm;
+		cosSum += cosTerm;
+	}
+	return sinSum / cosSum;
+}
+
+bool iSubCrossoverCoeffsBilinear(iSubCrossoverCoeffs *coeffs, UInt32 sampleRate, UInt32 frequency,
+		UInt32 order, bool phaseComp)
+{
+	const double kPi = 3.14159265358979323846, kSqrt2 = 1.41421356237309504880;
+	double k, k2, norm, damping;
+	iSubBiquad *lp = &coeffs->lowpass, *ap = &coeffs->allpass;
+
+	if (!frequency || (2 * frequency >= sampleRate) || ((order != 2) && (order != 4)) ||
+			((order == 2) && phaseComp))
+		return false;
+
+	// prewarped, so that the -3 dB point of each section lands on the frequency; the 2nd order tables were
+	// made by CoeffsFilterOrder2() with an attenuation of 0.707 rather than 1/sqrt(2), so do the same
+	damping = (order == 2) ? 1.0 / 0.707 : kSqrt2;
+	k = CrossoverTan(kPi * frequency / sampleRate);
+	k2 = k * k;
+	norm = 1.0 + damping * k + k2;
+
+	coeffs->sampleRate = sampleRate;
+	coeffs->frequency = frequency;
+	coeffs->numSections = (order == 4) ? 2 : 1;
+	coeffs->phaseComp = phaseComp;
+	lp->b0 = k2 / norm;
+	lp->b1 = 2.0 * k2 / norm;
+	lp->b2 = k2 / norm;
+	lp->a1 = 2.0 * (k2 - 1.0) / norm;
+	lp->a2 = (1.0 - damping * k + k2) / norm;
+	// the Linkwitz-Riley lowpass and highpass add up to this allpass, so allpass - lowpass is the highpass
+	ap->b0 = lp->a2;
+	ap->b1 = lp->a1;
+	ap->b2 = 1.0;
+	ap->a1 = lp->a1;
+	ap->a2 = lp->a2;
+	return true;
+}
+
+bool iSubCrossoverCoeffsForFrequency(iSubCrossoverCoeffs *coeffs, UInt32 sampleRate, UInt32 frequency,
+		UInt32 order, bool phaseComp)
+{
+	if ((frequency == ((order == 2) ? kiSubCrossoverFrequency2ndOrder : kiSubCrossoverFrequency4thOrder)) &&
+			iSubCrossoverCoeffsForRate(coeffs, sampleRate, order, phaseComp))
+		return true;
+	return iSubCrossoverCoeffsBilinear(coeffs, sampleRate, frequency, order, phaseComp);
+}
+
+void iSubCrossoverCache::invalidate()
+{
+	mNumEntries = 0;
+}
+
+const iSubCrossoverCoeffs *iSubCrossoverCache::lookup(UInt32 sampleRate, UInt32 frequency, UInt32 order,
+		bool phaseComp)
+{
+	UInt32 numSections = (order == 4) ? 2 : 1;
+
+	for (UInt32 n = 0; n < mNumEntries; n++) {
+		const iSubCrossoverCoeffs *entry = &mEntries[n];
+		if ((entry->sampleRate == sampleRate) && (entry->frequency == frequency) &&
+				(entry->numSections == numSections) && (entry->phaseComp == phaseComp))
+			return entry;
+	}
+	if ((mNumEntries >= kiSubCrossoverCacheSize) ||
+			!iSubCrossoverCoeffsForFrequency(&mEntries[mNumEntries], sampleRate, frequency, order, phaseComp))
+		return NULL;
+	return &mEntries[mNumEntries++];
+}
+
+#pragma mark -
+#pragma mark Filter
+
+bool iSubCrossover::init(const iSubCrossoverCoeffs *coeffs, UInt32 numChannels)
+{
+	mCoeffs = NULL;
+	mNumChannels = 0;
+	if (!coeffs || !numChannels || (numChannels > kiSubMaxChannels) || !coeffs->numSections ||
+			(coeffs->numSections > 2))
+		return false;
+	mCoeffs = coeffs;
+	mNumChannels = numChannels;
+	reset();
+	return true;
+}
+
+void iSubCrossover::reset()
+{
+	for (UInt32 stage = 0; stage < kiSubNumStages; stage++)
+		for (UInt32 tap = 0; tap < kNumTaps; tap++)
+			for (UInt32 ch = 0; ch < kiSubMaxChannels; ch++)
+				mState[stage][tap][ch] = 0.0f;
+}
+
+void iSubCrossover::loadState(UInt32 stage, const PreviousValues *state)
+{
+	if ((stage >= kiSubNumStages) || !state)
+		return;
+	mState[stage][kX1][0] = state->xl_1;
+	mState[stage][kX1][1] = state->xr_1;
+	mState[stage][kX2][0] = state->xl_2;
+	mState[stage][kX2][1] = state->xr_2;
+	mState[stage][kY1][0] = state->yl_1;
+	mState[stage][kY1][1] = state->yr_1;
+	mState[stage][kY2][0] = state->yl_2;
+	mState[stage][kY2][1] = state->yr_2;
+}
+
+void iSubCrossover::saveState(UInt32 stage, PreviousValues *state) const
+{
+	if ((stage >= kiSubNumStages) || !state)
+		return;
+	state->xl_1 = mState[stage][kX1][0];
+	state->xr_1 = mState[stage][kX1][1];
+	state->xl_2 = mState[stage][kX2][0];
+	state->xr_2 = mState[stage][kX2][1];
+	state->yl_1 = mState[stage][kY1][0];
+	state->yr_1 = mState[stage][kY1][1];
+	state->yl_2 = mState[stage][kY2][0];
+	state->yr_2 = mState[stage][kY2][1];
+}
+
+void iSubCrossover::process(const Float32 *in, Float32 *low, Float32 *high, UInt32 frames)
+{
+	UInt32 ch;
+
+	if (!mCoeffs)
+		return;
+	for (ch = 0; ch < mNumChannels; ch += 4) {
+		switch (mNumChannels - ch) {
+		case 1:
+			processLanes<1>(in + ch, low + ch, high + ch, frames, ch);
+			break;
+		case 2:
+			processLanes<2>(in + ch, low + ch, high + ch, frames, ch);
+			break;
+		case 3:
+			processLanes<3>(in + ch, low + ch, high + ch, frames, ch);
+			break;
+		default:
+			processLanes<4>(in + ch, low + ch, high + ch, frames, ch);
+			break;
+		}
+	}
+}
+
+#if ISUB_SSE
+// ____________________________________________________________________________
+//
+// One channel per lane; lanes past kLanes read as 0 and are never written back to the buffers.
+
+template <int kLanes>
+static inline __m128 LoadLanes(const Float32 *p)
+{
+	switch (kLanes) {
+	case 1:
+		return _mm_load_ss(p);
+	case 2:
+		return _mm_loadl_pi(_mm_setzero_ps(), (const __m64 *) p);
+	case 3:
+		return _mm_movelh_ps(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *) p), _mm_load_ss(p + 2));
+	default:
+		return _mm_loadu_ps(p);
+	}
+}
+
+template <int kLanes>
+static inline void StoreLanes(Float32 *p, __m128 v)
+{
+	switch (kLanes) {
+	case 1:
+		_mm_store_ss(p, v);
+		break;
+	case 2:
+		_mm_storel_pi((__m64 *) p, v);
+		break;
+	case 3:
+		_mm_storel_pi((__m64 *) p, v);
+		_mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+		break;
+	default:
+		_mm_storeu_ps(p, v);
+		break;
+	}
+}
+
+// the same operations in the same order as the scalar filters
+static inline __m128 Biquad(__m128 x, __m128 &x1, __m128 &x2, __m128 &y1, __m128 &y2, const __m128 *c)
+{
+	__m128 y = _mm_mul_ps(c[0], x);
+	y = _mm_add_ps(y, _mm_mul_ps(c[1], x1));
+	y = _mm_add_ps(y, _mm_mul_ps(c[2], x2));
+	y = _mm_sub_ps(y, _mm_mul_ps(c[3], y1));
+	y = _mm_sub_ps(y, _mm_mul_ps(c[4], y2));
+	x2 = x1;
+	x1 = x;
+	y2 = y1;
+	y1 = y;
+	return y;
+}
+
+static inline void SplatBiquad(__m128 *c, const iSubBiquad *q)
+{
+	c[0] = _mm_set1_ps(q->b0);
+	c[1] = _mm_set1_ps(q->b1);
+	c[2] = _mm_set1_ps(q->b2);
+	c[3] = _mm_set1_ps(q->a1);
+	c[4] = _mm_set1_ps(q->a2);
+}
+
+template <int kLanes>
+void iSubCrossover::processLanes(const Float32 *in, Float32 *low, Float32 *high, UInt32 frames,
+		UInt32 firstChannel)
+{
+	const UInt32 stride = mNumChannels;
+	const bool twoSections = (mCoeffs->numSections > 1);
+	const bool phaseComp = mCoeffs->phaseComp;
+	__m128 lp[5], ap[5];
+	__m128 x1, x2, y1, y2, x1_2, x2_2, y1_2, y2_2, x1_p, x2_p, y1_p, y2_p;
+	__m128 x, y, h;
+
+	SplatBiquad(lp, &mCoeffs->lowpass);
+	SplatBiquad(ap, &mCoeffs->allpass);
+
+	// the state is kiSubMaxChannels wide, so four lanes from any group of four channels are in bounds
+	x1 = _mm_loadu_ps(&mState[kiSubSection1][kX1][firstChannel]);
+	x2 = _mm_loadu_ps(&mState[kiSubSection1][kX2][firstChannel]);
+	y1 = _mm_loadu_ps(&mState[kiSubSection1][kY1][firstChannel]);
+	y2 = _mm_loadu_ps(&mState[kiSubSection1][kY2][firstChannel]);
+	x1_2 = _mm_loadu_ps(&mState[kiSubSection2][kX1][firstChannel]);
+	x2_2 = _mm_loadu_ps(&mState[kiSubSection2][kX2][firstChannel]);
+	y1_2 = _mm_loadu_ps(&mState[kiSubSection2][kY1][firstChannel]);
+	y2_2 = _mm_loadu_ps(&mState[kiSubSection2][kY2][firstChannel]);
+	x1_p = _mm_loadu_ps(&mState[kiSubPhaseComp][kX1][firstChannel]);
+	x2_p = _mm_loadu_ps(&mState[kiSubPhaseComp][kX2][firstChannel]);
+	y1_p = _mm_loadu_ps(&mState[kiSubPhaseComp][kY1][firstChannel]);
+	y2_p = _mm_loadu_ps(&mState[kiSubPhaseComp][kY2][firstChannel]);
+
+	for (UInt32 i = 0; i < frames; i++) {
+		x = LoadLanes<kLanes>(in);
+		y = Biquad(x, x1, x2, y1, y2, lp);
+		if (twoSections)
+			y = Biquad(y, x1_2, x2_2, y1_2, y2_2, lp);
+		h = phaseComp ? Biquad(x, x1_p, x2_p, y1_p, y2_p, ap) : x;
+		StoreLanes<kLanes>(low, y);
+		StoreLanes<kLanes>(high, _mm_sub_ps(h, y));
+		in += stride;
+		low += stride;
+		high += stride;
+	}
+
+	// lanes past kLanes belong to channels that don't exist or are stored again by a later group
+	_mm_storeu_ps(&mState[kiSubSection1][kX1][firstChannel], x1);
+	_mm_storeu_ps(&mState[kiSubSection1][kX2][firstChannel], x2);
+	_mm_storeu_ps(&mState[kiSubSection1][kY1][firstChannel], y1);
+	_mm_storeu_ps(&mState[kiSubSection1][kY2][firstChannel], y2);
+	_mm_storeu_ps(&mState[kiSubSection2][kX1][firstChannel], x1_2);
+	_mm_storeu_ps(&mState[kiSubSection2][kX2][firstChannel], x2_2);
+	_mm_storeu_ps(&mState[kiSubSection2][kY1][firstChannel], y1_2);
+	_mm_storeu_ps(&mState[kiSubSection2][kY2][firstChannel], y2_2);
+	_mm_storeu_ps(&mState[kiSubPhaseComp][kX1][firstChannel], x1_p);
+	_mm_storeu_ps(&mState[kiSubPhaseComp][kX2][firstChannel], x2_p);
+	_mm_storeu_ps(&mState[kiSubPhaseComp][kY1][firstChannel], y1_p);
+	_mm_storeu_ps(&mState[kiSubPhaseComp][kY2][firstChannel], y2_p);
+}
+
+#else
+// ____________________________________________________________________________
+//
+// Scalar version of the above, one channel at a time, straight on the state.
+
+static inline Float32 Biquad(Float32 x, Float32 *s, const iSubBiquad *c)
+{
+	Float32 y = c->b0*x + c->b1*s[0] + c->b2*s[kiSubMaxChannels] - c->a1*s[2 * kiSubMaxChannels] -
+			c->a2*s[3 * kiSubMaxChannels];
+	s[kiSubMaxChannels] = s[0];
+	s[0] = x;
+	s[3 * kiSubMaxChannels] = s[2 * kiSubMaxChannels];
+	s[2 * kiSubMaxChannels] = y;
+	return y;
+}
+
+template <int kLanes>
+void iSubCrossover::processLanes(const Float32 *in, Float32 *low, Float32 *high, UInt32 frames,
+		UInt32 firstChannel)
+{
+	const UInt32 stride = mNumChannels;
+
+	for (UInt32 lane = 0; lane < kLanes; lane++) {
+		UInt32 ch = firstChannel + lane;
+		for (UInt32 i = 0; i < frames; i++) {
+			Float32 x = in[i * stride + lane], y, h;
+			y = Biquad(x, &mState[kiSubSection1][kX1][ch], &mCoeffs->lowpass);
+			if (mCoeffs->numSections > 1)
+				y = Biquad(y, &mState[kiSubSection2][kX1][ch], &mCoeffs->lowpass);
+			h = mCoeffs->phaseComp ? Biquad(x, &mState[kiSubPhaseComp][kX1][ch], &mCoeffs->allpass) : x;
+			low[i * stride + lane] = y;
+			high[i * stride + lane] = h - y;
+		}
+	}
+}
+#endif
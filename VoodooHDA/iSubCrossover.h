@@ -0,0 +1,107 @@
+#include "License.h"
+
+#ifndef __iSubCrossover_h__
+#define __iSubCrossover_h__
+
+#include <IOKit/IOTypes.h>
+#include <IOKit/audio/IOAudioTypes.h>
+
+#include "AppleAudioClip.h"
+
+/*
+	iSub crossover.
+
+	The lowpass (one or two identical second order sections) and the phase compensating allpass of
+	AppleAudioClip.cpp, with the filter state of every channel kept in the object and the channels of an
+	interleaved buffer run side by side in the lanes of an SSE register, four at a time.
+
+	Each lane does exactly the arithmetic of the scalar filters, in the same order
+		y = b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2
+	(the allpass has b2 = 1.0, and 1.0*x2 is exact), in single precision, so the low and high outputs are
+	bit for bit those of MonoFilter, StereoFilter, StereoFilter4thOrder and StereoFilter4thOrderPhaseComp
+	for the same coefficients and state. The kext and the host benchmark do all float math with SSE, so
+	there is no extended precision or contraction on either side; "helper.sh bench" checks it.
+*/
+
+#define kiSubMaxChannels	8
+
+// what the tables in AppleAudioClip.cpp were designed for: Butterworth sections at these frequencies, two of
+// them (Linkwitz-Riley) for the 4th order
+#define kiSubCrossoverFrequency2ndOrder	120
+#define kiSubCrossoverFrequency4thOrder	240
+
+#define kiSubCrossoverCacheSize	4
+
+enum {
+	kiSubSection1 = 0,
+	kiSubSection2,
+	kiSubPhaseComp,
+	kiSubNumStages
+};
+
+// y[n] = b0*x[n] + b1*x[n-1] + b2*x[n-2] - a1*y[n-1] - a2*y[n-2]
+typedef struct _iSubBiquad {
+	Float32	b0, b1, b2, a1, a2;
+} iSubBiquad;
+
+// everything that depends on the sample rate
+typedef struct _iSubCrossoverCoeffs {
+	UInt32		sampleRate;
+	UInt32		frequency;		// crossover frequency in Hz
+	UInt32		numSections;	// lowpass sections, all with the same coefficients: 1 = 2nd, 2 = 4th order
+	bool		phaseComp;		// high = allpass(in) - low instead of in - low
+	iSubBiquad	lowpass;
+	iSubBiquad	allpass;
+} iSubCrossoverCoeffs;
+
+// fills in the coefficients of the tables in AppleAudioClip.cpp; false if the rate isn't in them
+bool iSubCrossoverCoeffsForRate(iSubCrossoverCoeffs *coeffs, UInt32 sampleRate, UInt32 order, bool phaseComp);
+
+// Butterworth sections for any frequency below Nyquist from the bilinear transform, with the allpass of the
+// same poles for the 4th order (the 2nd order phase compensator only exists in the tables)
+bool iSubCrossoverCoeffsBilinear(iSubCrossoverCoeffs *coeffs, UInt32 sampleRate, UInt32 frequency,
+		UInt32 order, bool phaseComp);
+
+// the tables where they apply, so the output stays that of the scalar filters, the bilinear design otherwise
+bool iSubCrossoverCoeffsForFrequency(iSubCrossoverCoeffs *coeffs, UInt32 sampleRate, UInt32 frequency,
+		UInt32 order, bool phaseComp);
+
+// Coefficient sets built once per (rate, frequency, order) and handed out by pointer, which stays valid until
+// invalidate(). No allocation: once all the slots are taken lookup() fails for anything new.
+class iSubCrossoverCache {
+public:
+	void	invalidate();
+	const iSubCrossoverCoeffs	*lookup(UInt32 sampleRate, UInt32 frequency, UInt32 order, bool phaseComp);
+
+private:
+	iSubCrossoverCoeffs	mEntries[kiSubCrossoverCacheSize];
+	UInt32				mNumEntries;
+};
+
+class iSubCrossover {
+public:
+	// coeffs must stay valid as long as the crossover uses it; the state starts out cleared
+	bool	init(const iSubCrossoverCoeffs *coeffs, UInt32 numChannels);
+	void	reset();
+
+	// in, low and high are interleaved, numChannels samples per frame; in may not alias low or high
+	void	process(const Float32 *in, Float32 *low, Float32 *high, UInt32 frames);
+
+	// the state of channels 0 and 1 of one stage, in the layout of the scalar filters
+	void	loadState(UInt32 stage, const PreviousValues *state);
+	void	saveState(UInt32 stage, PreviousValues *state) const;
+
+	UInt32	numChannels() const { return mNumChannels; }
+
+private:
+	enum { kX1 = 0, kX2, kY1, kY2, kNumTaps };
+
+	template <int kLanes>
+	void	processLanes(const Float32 *in, Float32 *low, Float32 *high, UInt32 frames, UInt32 firstChannel);
+
+	const iSubCrossoverCoeffs	*mCoeffs;
+	UInt32						mNumChannels;
+	Float32						mState[kiSubNumStages][kNumTaps][kiSubMaxChannels];
+};
+
+#endif // __iSubCrossover_h__